@@ -2,6 +2,9 @@
 #include <stddef.h>
 #include <limits.h>
 
+#include "bitstream.h"
+#include "decode_counters.h"
+
 /* 6/2009 public domain 	wesley ebisuzaki
  *
  * code taken from wgrib 
@@ -35,6 +38,8 @@ int rd_bitstream(unsigned char *p, int offset, int *u, int n_bits, unsigned int
         return -2;
     }
 
+    COUNT_DECODE(bits_read, (unsigned long long) n_bits * n);
+
     if (n_bits == 0) {
         for (i = 0; i < n; i++) {
             u[i] = 0;
@@ -95,6 +100,8 @@ int rd_bitstream_flt(unsigned char *p, int offset, float *u, int n_bits, unsigne
         return -2;
     }
 
+    COUNT_DECODE(bits_read, (unsigned long long) n_bits * n);
+
     if (n_bits == 0) {
         for (i = 0; i < n; i++) {
             u[i] = 0.0;
@@ -146,29 +153,47 @@ int rd_bitstream_flt(unsigned char *p, int offset, float *u, int n_bits, unsigne
  * to close (zero fill):  finish_bitstream()
  */
 
-static unsigned char *bitstream;
-static int rbits, reg, n_bitstream;
+// The writer behind init_bitstream(), add_bitstream(), etc. It's shared, so those aren't reentrant; code that can run on more than one thread at
+//   once (like pk_complex()) uses its own struct bitstream_writer instead.
+static struct bitstream_writer shared_writer;
 
-int add_bitstream(int t, int n_bits) {
+void init_bitstream_writer(struct bitstream_writer *writer, unsigned char *new_bitstream) {
+    writer->bitstream = new_bitstream;
+    writer->n_bitstream = writer->reg = writer->rbits = 0;
+}
+
+int add_bitstream_writer(struct bitstream_writer *writer, int t, int n_bits) {
     unsigned int jmask;
 
     if (n_bits > 16) {
-        add_bitstream(t >> 16, n_bits - 16);
+        add_bitstream_writer(writer, t >> 16, n_bits - 16);
         n_bits = 16; 
     }   
     if (n_bits > 25) {
-        fprintf(stderr, "add_bitstream: n_bits = (%d)", n_bits);
+        fprintf(stderr, "add_bitstream: n_bits = (%d)\n", n_bits);
         return -1;
     }
     jmask = (1 << n_bits) - 1;
-    rbits += n_bits;
-    reg = (reg << n_bits) | (t & jmask);
-    while (rbits >= 8) {
-    *bitstream++ = (reg >> (rbits = rbits-8)) & 255;
-    n_bitstream++;
+    writer->rbits += n_bits;
+    writer->reg = (writer->reg << n_bits) | (t & jmask);
+    while (writer->rbits >= 8) {
+    *writer->bitstream++ = (writer->reg >> (writer->rbits = writer->rbits-8)) & 255;
+    writer->n_bitstream++;
     }   
     return 0;
 }
+
+void finish_bitstream_writer(struct bitstream_writer *writer) {
+    if (writer->rbits) {
+	writer->n_bitstream++;
+        *writer->bitstream++ = (writer->reg << (8-writer->rbits)) & 255;
+	writer->rbits = 0;
+    }
+}
+
+int add_bitstream(int t, int n_bits) {
+    return add_bitstream_writer(&shared_writer, t, n_bits);
+}
 int add_many_bitstream(int *t, unsigned int n, int n_bits) {
     unsigned int jmask, tt;
     unsigned int i;
@@ -181,13 +206,13 @@ int add_many_bitstream(int *t, unsigned int n, int n_bits) {
 
     for (i = 0; i < n; i++) {
 	tt = (unsigned int) *t++;
-        rbits += n_bits;
-        reg = (reg << n_bits) | (tt & jmask);
+        shared_writer.rbits += n_bits;
+        shared_writer.reg = (shared_writer.reg << n_bits) | (tt & jmask);
 
-        while (rbits >= 8) {
-	    rbits -= 8;
-	    *bitstream++ = (reg >> rbits) & 255;
-            n_bitstream++;
+        while (shared_writer.rbits >= 8) {
+	    shared_writer.rbits -= 8;
+	    *shared_writer.bitstream++ = (shared_writer.reg >> shared_writer.rbits) & 255;
+            shared_writer.n_bitstream++;
 	}
 
 /*
@@ -229,16 +254,9 @@ int add_many_bitstream(int *t, unsigned int n, int n_bits) {
     return 0;
 }
 void init_bitstream(unsigned char *new_bitstream) {
-    bitstream = new_bitstream;
-    n_bitstream = reg = rbits = 0;
-    return;
+    init_bitstream_writer(&shared_writer, new_bitstream);
 }
 
 void finish_bitstream(void) {
-    if (rbits) {
-	n_bitstream++;
-        *bitstream++ = (reg << (8-rbits)) & 255;
-	rbits = 0;
-    }
-    return;
-}
\ No newline at end of file
+    finish_bitstream_writer(&shared_writer);
+}
@@ -4,4 +4,14 @@ int rd_bitstream_flt(unsigned char *p, int offset, float *u, int n_bits, unsigne
 int add_bitstream(int t, int n_bits);
 int add_many_bitstream(int *t, unsigned int n, int n_bits);
 void init_bitstream(unsigned char *new_bitstream);
-void finish_bitstream(void);
\ No newline at end of file
+void finish_bitstream(void);
+
+// State for writing a bitstream. Each writer is independent, unlike init_bitstream()/add_bitstream()/finish_bitstream(), which all share one.
+struct bitstream_writer {
+    unsigned char *bitstream;
+    int rbits, reg, n_bitstream;
+};
+
+void init_bitstream_writer(struct bitstream_writer *writer, unsigned char *new_bitstream);
+int add_bitstream_writer(struct bitstream_writer *writer, int t, int n_bits);
+void finish_bitstream_writer(struct bitstream_writer *writer);
@@ -1,8 +1,8 @@
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 
-typedef unsigned long int size_t;
-
 int apply_bitmap(const char* input_bitmap, const float* input_data, float* output, const size_t output_size) {
     // Missing data are represented as a bitmap in GRIB, with a 0 meaning missing data. This function reconstructs the field with missing values, using NaN as the missing value.
     // input_bitmap is the bitmap
@@ -11,10 +11,11 @@ int apply_bitmap(const char* input_bitmap, const float* input_data, float* outpu
 
     size_t i_input = 0;
     for (size_t i = 0; i < output_size; i++) {
-        size_t i_byte = i / __CHAR_BIT__;
-        char bit = i % __CHAR_BIT__;
+        size_t i_byte = i / 8;
+        char bit = i % 8;
 
-        if ((input_bitmap[i_byte] >> bit) & 1) {
+        // The first point is in the most significant bit
+        if ((input_bitmap[i_byte] >> (7 - bit)) & 1) {
             output[i] = input_data[i_input];
             i_input++;
         }
@@ -24,4 +25,47 @@ int apply_bitmap(const char* input_bitmap, const float* input_data, float* outpu
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+int bitmap_packed_indices(const unsigned char *bitmap, unsigned int n_grid, const int *grid_indices, unsigned int n_indices, int *packed_indices) {
+    // Find where each grid point is in the packed data, which is the number of points before it that the bitmap says are present. Points the bitmap
+    //   says are missing get -1.
+
+    unsigned int n_bytes = (n_grid + 7) / 8;
+    unsigned int *byte_counts;
+    unsigned int i;
+
+    // byte_counts[i] is the number of points present in the first i bytes of the bitmap
+    byte_counts = (unsigned int *) malloc(sizeof(unsigned int) * (n_bytes + 1));
+    if (byte_counts == NULL) {
+        printf("bitmap_packed_indices: memory allocation\n");
+        return -1;
+    }
+
+    byte_counts[0] = 0;
+    for (i = 0; i < n_bytes; i++) {
+        byte_counts[i + 1] = byte_counts[i] + __builtin_popcount(bitmap[i]);
+    }
+
+    for (i = 0; i < n_indices; i++) {
+        int idx = grid_indices[i];
+        unsigned int bit;
+
+        if (idx < 0 || (unsigned int) idx >= n_grid) {
+            packed_indices[i] = -1;
+            continue;
+        }
+
+        bit = idx % 8;
+        if (!((bitmap[idx / 8] >> (7 - bit)) & 1)) {
+            packed_indices[i] = -1;
+            continue;
+        }
+
+        // Count the points present in the bits above this one in its byte (the first point is in the most significant bit)
+        packed_indices[i] = (int) (byte_counts[idx / 8] + __builtin_popcount(bitmap[idx / 8] >> (8 - bit)));
+    }
+
+    free(byte_counts);
+    return 0;
+}
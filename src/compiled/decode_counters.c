@@ -0,0 +1,24 @@
+#include "decode_counters.h"
+
+struct decode_counters decode_counters = {0, 0, 0, 0, 0};
+
+static void reset_decode_counters(void) {
+    decode_counters.groups_decoded = 0;
+    decode_counters.bits_read = 0;
+    decode_counters.values_decoded = 0;
+    decode_counters.allocations = 0;
+}
+
+void enable_decode_counters(int enabled) {
+    reset_decode_counters();
+    decode_counters.enabled = enabled;
+}
+
+void read_decode_counters(double *counts) {
+    // counts must hold N_DECODE_COUNTERS values. Doubles are used so the counts are easy to read from Javascript.
+    counts[0] = (double) decode_counters.groups_decoded;
+    counts[1] = (double) decode_counters.bits_read;
+    counts[2] = (double) decode_counters.values_decoded;
+    counts[3] = (double) decode_counters.allocations;
+    reset_decode_counters();
+}
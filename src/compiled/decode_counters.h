@@ -0,0 +1,26 @@
+/*
+ * Counters for instrumenting the decoders. Counting is off unless it's been turned on with enable_decode_counters(), and
+ *   read_decode_counters() returns the counts since the last read.
+ */
+
+struct decode_counters {
+    int enabled;
+    unsigned long long groups_decoded;
+    unsigned long long bits_read;
+    unsigned long long values_decoded;
+    unsigned long long allocations;
+};
+
+#define N_DECODE_COUNTERS 4
+
+extern struct decode_counters decode_counters;
+
+#define COUNT_DECODE(counter, n) do { \
+        if (decode_counters.enabled) { \
+            _Pragma("omp atomic") \
+            decode_counters.counter += (unsigned long long) (n); \
+        } \
+    } while (0)
+
+void enable_decode_counters(int enabled);
+void read_decode_counters(double *counts);
@@ -19,6 +19,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
+
+#include "decode_counters.h"
 
 static void openjpeg_warning(const char *msg, void *client_data)
 {
@@ -125,11 +128,11 @@ static void opj_memory_stream_do_nothing(void * p_user_data)
 }
 
 /* Create a stream to use memory as the input or output */
-static opj_stream_t* opj_stream_create_default_memory_stream(opj_memory_stream* memoryStream, OPJ_BOOL is_read_stream)
+static opj_stream_t* opj_stream_create_memory_stream(opj_memory_stream* memoryStream, OPJ_SIZE_T buffer_size, OPJ_BOOL is_read_stream)
 {
 	opj_stream_t* stream;
 
-	if (!(stream = opj_stream_default_create(is_read_stream)))
+	if (!(stream = opj_stream_create(buffer_size, is_read_stream)))
 		return (NULL);
     /* Set how to work with the frame buffer */
 	if (is_read_stream)
@@ -144,54 +147,31 @@ static opj_stream_t* opj_stream_create_default_memory_stream(opj_memory_stream*
 	return stream;
 }
 
-int decode_jpeg2000(char *injpc, int bufsize, int *outfld)
-/*$$$  SUBPROGRAM DOCUMENTATION BLOCK
-*                .      .    .                                       .
-* SUBPROGRAM:    dec_jpeg2000      Decodes JPEG2000 code stream
-*   PRGMMR: Jovic            ORG: W/NP11     DATE: 2020-06-08
-*
-* ABSTRACT: This Function decodes a JPEG2000 code stream specified in the
-*   JPEG2000 Part-1 standard (i.e., ISO/IEC 15444-1) using OpenJPEG
-*
-* PROGRAM HISTORY LOG:
-* 2002-12-02  Gilbert
-* 2016-06-08  Jovic
-*
-* USAGE:     int dec_jpeg2000_clone(char *injpc, int bufsize, int *outfld)
-*
-*   INPUT ARGUMENTS:
-*      injpc - Input JPEG2000 code stream.
-*    bufsize - Length (in bytes) of the input JPEG2000 code stream.
-*
-*   OUTPUT ARGUMENTS:
-*     outfld - Output matrix of grayscale image values.
-*
-*   RETURN VALUES :
-*          0 = Successful decode
-*         -3 = Error decode jpeg2000 code stream.
-*         -5 = decoded image had multiple color components.
-*              Only grayscale is expected.
-*
-* REMARKS:
-*
-*      Requires OpenJPEG Version 2
-*
-* ATTRIBUTES:
-*   LANGUAGE: C
-*   MACHINE:  Linux
-*
-*$$$*/
+/*
+ * Decode a JPEG2000 code stream into an output of a known size. Same as decode_jpeg2000(), except that n_outfld is the size
+ *   of outfld, and images bigger than that return -4. The stream buffer is sized to the code stream (instead of the 1 MB
+ *   default, which is much bigger than most GRIB2 code streams). OpenJPEG can't reset a codec or stream for another code
+ *   stream, so nothing is kept from one message to the next.
+ */
+int decode_jpeg2000_sized(char *injpc, int bufsize, int *outfld, unsigned int n_outfld)
 {
     int iret = 0;
-    unsigned int i;
+    unsigned int i, n_values;
     OPJ_INT32 mask;
+    OPJ_SIZE_T stream_buffer_size;
 
     opj_stream_t *stream = NULL;
     opj_image_t *image = NULL;
     opj_codec_t *codec = NULL;
+    opj_memory_stream mstream;
+    opj_dparameters_t parameters = {0,};	/* decompression parameters */
+
+    if (bufsize <= 0) {
+        fprintf(stderr,"openjpeg: empty code stream");
+        return -3;
+    }
 
     /* set decoding parameters to default values */
-    opj_dparameters_t parameters = {0,};	/* decompression parameters */
     opj_set_default_decoder_parameters(&parameters);
     parameters.decod_format = 1; /* JP2_FMT */
 
@@ -204,12 +184,16 @@ int decode_jpeg2000(char *injpc, int bufsize, int *outfld)
     opj_set_error_handler(codec, openjpeg_error,NULL);
 
     /* initialize our memory stream */
-    opj_memory_stream mstream;
     mstream.pData = (OPJ_UINT8 *)injpc;
     mstream.dataSize = (OPJ_SIZE_T)bufsize;
     mstream.offset = 0;
-    /* open a byte stream from memory stream */
-    stream = opj_stream_create_default_memory_stream( &mstream, OPJ_STREAM_READ);
+
+    /* open a byte stream from memory stream, with a buffer no bigger than the code stream */
+    stream_buffer_size = mstream.dataSize < OPJ_J2K_STREAM_CHUNK_SIZE ? mstream.dataSize : OPJ_J2K_STREAM_CHUNK_SIZE;
+    if (!(stream = opj_stream_create_memory_stream(&mstream, stream_buffer_size, OPJ_STREAM_READ))) {
+        iret = -3;
+        goto cleanup;
+    }
 
     /* setup the decoder decoding parameters using user parameters */
     if (!opj_setup_decoder(codec, &parameters)) {
@@ -233,14 +217,25 @@ int decode_jpeg2000(char *injpc, int bufsize, int *outfld)
         goto cleanup;
     }
 
+    n_values = image->comps[0].w * image->comps[0].h;
+    if (n_values > n_outfld) {
+        fprintf(stderr,"openjpeg: image is bigger than the output");
+        iret = -4;
+        goto cleanup;
+    }
+
     assert(image->comps[0].sgnd == 0);
     assert(image->comps[0].prec < sizeof(mask)*8-1);
 
     mask = (1 << image->comps[0].prec) - 1;
 
-    for (i = 0; i < image->comps[0].w * image->comps[0].h ; i++)
+    for (i = 0; i < n_values; i++)
         outfld[i] = (int) (image->comps[0].data[i] & mask);
 
+    // codec, stream, and image
+    COUNT_DECODE(allocations, 3);
+    COUNT_DECODE(values_decoded, n_values);
+
     if (!opj_end_decompress(codec, stream)) {
         fprintf(stderr,"openjpeg: failed in opj_end_decompress");
         iret = -3;
@@ -253,4 +248,45 @@ cleanup:
     if (image)  opj_image_destroy(image);
 
     return iret;
-}
\ No newline at end of file
+}
+
+int decode_jpeg2000(char *injpc, int bufsize, int *outfld)
+/*$$$  SUBPROGRAM DOCUMENTATION BLOCK
+*                .      .    .                                       .
+* SUBPROGRAM:    dec_jpeg2000      Decodes JPEG2000 code stream
+*   PRGMMR: Jovic            ORG: W/NP11     DATE: 2020-06-08
+*
+* ABSTRACT: This Function decodes a JPEG2000 code stream specified in the
+*   JPEG2000 Part-1 standard (i.e., ISO/IEC 15444-1) using OpenJPEG
+*
+* PROGRAM HISTORY LOG:
+* 2002-12-02  Gilbert
+* 2016-06-08  Jovic
+*
+* USAGE:     int dec_jpeg2000_clone(char *injpc, int bufsize, int *outfld)
+*
+*   INPUT ARGUMENTS:
+*      injpc - Input JPEG2000 code stream.
+*    bufsize - Length (in bytes) of the input JPEG2000 code stream.
+*
+*   OUTPUT ARGUMENTS:
+*     outfld - Output matrix of grayscale image values.
+*
+*   RETURN VALUES :
+*          0 = Successful decode
+*         -3 = Error decode jpeg2000 code stream.
+*         -5 = decoded image had multiple color components.
+*              Only grayscale is expected.
+*
+* REMARKS:
+*
+*      Requires OpenJPEG Version 2
+*
+* ATTRIBUTES:
+*   LANGUAGE: C
+*   MACHINE:  Linux
+*
+*$$$*/
+{
+    return decode_jpeg2000_sized(injpc, bufsize, outfld, UINT_MAX);
+}
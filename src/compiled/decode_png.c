@@ -17,22 +17,36 @@
  *        if differs, then delayed error
  *	  changed char *cout to unsigned char *cout to be consistent with wgrib2
  *        Now handles bit_depth of 1, 2 and 4 as well as 8, 16, 24 and 32.
+ *
+ * png_session: keeps the row pointers and scratch image between messages, and has libpng write the rows straight into
+ *        the output instead of into its own row buffers. libpng can't reuse a read struct for another image, so those
+ *        are still made for each message.
  * 
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <png.h>
 
 #include "bitstream.h"
+#include "decode_counters.h"
 
 struct png_stream {
-   unsigned char *stream_ptr;     /*  location to write PNG stream  */
-   int stream_len;               /*  number of bytes written       */
+   const unsigned char *stream_ptr;   /*  location of the PNG stream    */
+   size_t stream_len;                 /*  number of bytes read          */
+   size_t stream_size;                /*  size of the PNG stream        */
 };
 typedef struct png_stream png_stream;
 
+struct png_session {
+    png_bytep *row_pointers;
+    unsigned int n_rows;            /* number of row pointers allocated */
+    unsigned char *scratch;         /* the image, for bit depths that aren't a whole number of bytes */
+    size_t scratch_size;
+};
+
 void user_read_data_clone(png_structp , png_bytep , png_size_t );
 
 void user_read_data_clone(png_structp png_ptr,png_bytep data, png_size_t length)
@@ -41,34 +55,62 @@ void user_read_data_clone(png_structp png_ptr,png_bytep data, png_size_t length)
         from memory instead of a file on disk.
 */
 {
-     char *ptr;
-     int offset;
      png_stream *mem;
 
      mem=(png_stream *)png_get_io_ptr(png_ptr);
-     ptr=(void *)mem->stream_ptr;
-     offset=mem->stream_len;
-     memcpy(data,ptr+offset,length);
+     if (length > mem->stream_size - mem->stream_len)
+        png_error(png_ptr, "read past the end of the PNG stream");
+
+     memcpy(data,mem->stream_ptr+mem->stream_len,length);
      mem->stream_len += length;
 }
 
+struct png_session *png_session_new(void) {
+    struct png_session *session = (struct png_session *)calloc(1, sizeof(struct png_session));
+    if (session == NULL) {
+        printf("png_session_new: couldn't allocate the session\n");
+    }
+    return session;
+}
 
+void png_session_free(struct png_session *session) {
+    if (session == NULL) return;
 
-int decode_png(unsigned char *pngbuf,int *width,int *height, unsigned char *cout, int *grib2_bit_depth, unsigned int ndata)
-{
+    free(session->row_pointers);
+    free(session->scratch);
+    free(session);
+}
+
+/*
+ * Decode a PNG stream. The rows are read straight into cout (or into the session's scratch image for bit depths that aren't a whole
+ *   number of bytes, which then get packed into cout).
+ *
+ * pngbuf_size - the length of the PNG stream
+ * cout_size - the size of cout in bytes
+ *
+ * Returns 0 on success, -1 or -2 if the libpng structs couldn't be made, -3 for a bad PNG stream, -4 if the image doesn't fit in the
+ *   output, -5 if packing the output failed, and -6 if the session's buffers couldn't be grown.
+ */
+int png_session_decode(struct png_session *session, const unsigned char *pngbuf, unsigned int pngbuf_size, int *width, int *height,
+                       unsigned char *cout, unsigned int cout_size, int *grib2_bit_depth, unsigned int ndata) {
     int interlace,color,compres,filter,bit_depth;
-    int j,k, rowlen, tmp;
+    int k, tmp, n_bits;
+    png_uint_32 j;
+    size_t rowlen;
     long int rowlen_bits;
     int add_status;
+    /* These change after the setjmp() below, so they have to be volatile to be read reliably after a longjmp() back to it */
+    volatile int iret = 0;
+    volatile int n_allocations = 0;
     png_structp png_ptr;
     png_infop info_ptr,end_info;
-    png_bytepp row_pointers;
     png_stream read_io_ptr;
     png_uint_32 h32, w32;
+    unsigned char *image;
 
 /*  check if stream is a valid PNG format   */
 
-    if ( png_sig_cmp(pngbuf,0,8) != 0) 
+    if (pngbuf_size < 8 || png_sig_cmp((png_const_bytep)pngbuf,0,8) != 0)
        return (-3);
 
 /* create and initialize png_structs  */
@@ -102,33 +144,26 @@ int decode_png(unsigned char *pngbuf,int *width,int *height, unsigned char *cout
 
 /*    Initialize info for reading PNG stream from memory   */
 
-    read_io_ptr.stream_ptr=(png_voidp)pngbuf;
+    read_io_ptr.stream_ptr=pngbuf;
     read_io_ptr.stream_len=0;
+    read_io_ptr.stream_size=pngbuf_size;
 
 /*    Set new custom read function    */
 
     png_set_read_fn(png_ptr,(png_voidp)&read_io_ptr,(png_rw_ptr)user_read_data_clone);
-/*     png_init_io(png_ptr, fptr);   */
-
-/*     Read and decode PNG stream   */
-
-    png_read_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
-
-/*     Get pointer to each row of image data   */
-
-    row_pointers = png_get_rows(png_ptr, info_ptr);
 
 /*     Get image info, such as size, depth, colortype, etc...   */
 
-    // (void)png_get_IHDR(png_ptr, info_ptr, (png_uint_32 *)width, (png_uint_32 *)height,
+    png_read_info(png_ptr, info_ptr);
     (void)png_get_IHDR(png_ptr, info_ptr, &w32, &h32,
                &bit_depth, &color, &interlace, &compres, &filter);
 
     *height = h32;
     *width = w32;
-    if ((unsigned int) h32 * (unsigned int) w32 > ndata) {
+    if ((unsigned long long) h32 * (unsigned long long) w32 > ndata) {
         fprintf(stderr, "error: png decode: size of png grid too large\n");
-        return (-4);
+        iret = -4;
+        goto cleanup;
     }
 
     if ( color == PNG_COLOR_TYPE_RGB ) {
@@ -144,31 +179,73 @@ int decode_png(unsigned char *pngbuf,int *width,int *height, unsigned char *cout
         *grib2_bit_depth = bit_depth;
     }
 
-/*     Copy image data to output string   */
+    (void)png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
 
     /* get number of bytes per row used to store packed numbers */
-    rowlen =  png_get_rowbytes(png_ptr, info_ptr);
+    rowlen = png_get_rowbytes(png_ptr, info_ptr);
+    rowlen_bits = (long int) w32 * bit_depth;
+
+    if (((unsigned long long) rowlen_bits * h32 + 7) / 8 > cout_size) {
+        fprintf(stderr, "error: png decode: image doesn't fit in the output\n");
+        iret = -4;
+        goto cleanup;
+    }
 
-    rowlen_bits = w32 * bit_depth;
+/*     Point the rows at the output, or at the scratch image if the rows need to be packed   */
+
+    if (h32 > session->n_rows) {
+        png_bytep *row_pointers = (png_bytep *)realloc(session->row_pointers, h32 * sizeof(png_bytep));
+        if (row_pointers == NULL) {
+            iret = -6;
+            goto cleanup;
+        }
+        session->row_pointers = row_pointers;
+        session->n_rows = h32;
+        n_allocations++;
+    }
 
     if (rowlen_bits % 8 == 0) {
-#pragma omp parallel for private(j,k) schedule(static)
-        for (j = 0; j < h32; j++) {
-            for (k = 0; k < rowlen; k++) {
-                cout[j*rowlen+k]=*(row_pointers[j]+k);
+        image = cout;
+    }
+    else {
+        if (rowlen * h32 > session->scratch_size) {
+            unsigned char *scratch = (unsigned char *)realloc(session->scratch, rowlen * h32);
+            if (scratch == NULL) {
+                iret = -6;
+                goto cleanup;
             }
+            session->scratch = scratch;
+            session->scratch_size = rowlen * h32;
+            n_allocations++;
         }
+        image = session->scratch;
     }
-    else {
+
+    for (j = 0; j < h32; j++) {
+        session->row_pointers[j] = image + j * rowlen;
+    }
+
+/*     Read and decode PNG stream   */
+
+    png_read_image(png_ptr, session->row_pointers);
+    png_read_end(png_ptr, end_info);
+
+    if (rowlen_bits % 8 != 0) {
         /* bitstream is set to *cout */
         init_bitstream(cout);
         for (j = 0; j < h32; j++) {
-            rowlen_bits = w32 * bit_depth;
+            rowlen_bits = (long int) w32 * bit_depth;
             k = 0;
             while (rowlen_bits > 0) {
-                tmp = (int) *(row_pointers[j] + k++);
-                add_status = add_bitstream(tmp, rowlen_bits > 8 ? 8: rowlen_bits);
-                if (add_status != 0) return (-5);
+                /* the last byte in a row is padded at the low end */
+                n_bits = rowlen_bits > 8 ? 8 : rowlen_bits;
+                tmp = (int) *(session->row_pointers[j] + k++);
+                add_status = add_bitstream(tmp >> (8 - n_bits), n_bits);
+                if (add_status != 0) {
+                    iret = -5;
+                    goto cleanup;
+                }
 
                 rowlen_bits -= 8;
             }
@@ -176,9 +253,26 @@ int decode_png(unsigned char *pngbuf,int *width,int *height, unsigned char *cout
         finish_bitstream();
     }
 
-/*      Clean up   */
+    COUNT_DECODE(values_decoded, (unsigned long long) w32 * h32);
 
+cleanup:
     png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-    return 0;
 
-}
\ No newline at end of file
+    // read, info, and end info structs, plus any growth of the session's buffers
+    COUNT_DECODE(allocations, 3 + n_allocations);
+    return iret;
+}
+
+int decode_png(unsigned char *pngbuf,int *width,int *height, unsigned char *cout, int *grib2_bit_depth, unsigned int ndata)
+{
+    struct png_session session = {NULL, 0, NULL, 0};
+    unsigned long long cout_size = ((unsigned long long) ndata * *grib2_bit_depth + 7) / 8;
+    int iret;
+
+    iret = png_session_decode(&session, pngbuf, UINT_MAX, width, height, cout, cout_size > UINT_MAX ? UINT_MAX : (unsigned int) cout_size,
+                              grib2_bit_depth, ndata);
+
+    free(session.row_pointers);
+    free(session.scratch);
+    return iret;
+}
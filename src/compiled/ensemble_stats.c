@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ensemble_stats.h"
+#include "decode_counters.h"
+
+// Running statistics across ensemble members, so members can be added one at a time and only the accumulators stay in memory. At each point, the sums
+//   are of the member values minus the first valid member's value (which keeps the sum of squares from cancelling catastrophically when computing the
+//   variance), and both sums use Kahan compensation, so adding many members in single precision doesn't lose accuracy. Missing (NaN) values are left
+//   out of everything. This file shouldn't be compiled with -ffast-math, which would optimize the compensation away.
+
+struct ensemble_stats {
+    unsigned int n_points;
+    int n_thresholds;
+    float *thresholds;
+
+    int *count;
+    float *shift;
+    float *sum, *sum_comp;
+    float *sumsq, *sumsq_comp;
+    int *n_exceed;          // n_thresholds x n_points, one threshold after the other
+};
+
+struct ensemble_stats *ensemble_stats_new(unsigned int n_points, const float *thresholds, int n_thresholds) {
+    struct ensemble_stats *stats;
+
+    if (n_thresholds < 0) {
+        printf("ensemble_stats_new: bad number of thresholds %d\n", n_thresholds);
+        return NULL;
+    }
+
+    stats = (struct ensemble_stats *) malloc(sizeof(struct ensemble_stats));
+    if (stats == NULL) {
+        printf("ensemble_stats_new: memory allocation\n");
+        return NULL;
+    }
+
+    stats->n_points = n_points;
+    stats->n_thresholds = n_thresholds;
+    stats->thresholds = (float *) malloc(sizeof(float) * (n_thresholds > 0 ? n_thresholds : 1));
+    stats->count = (int *) calloc(n_points, sizeof(int));
+    stats->shift = (float *) calloc(n_points, sizeof(float));
+    stats->sum = (float *) calloc(n_points, sizeof(float));
+    stats->sum_comp = (float *) calloc(n_points, sizeof(float));
+    stats->sumsq = (float *) calloc(n_points, sizeof(float));
+    stats->sumsq_comp = (float *) calloc(n_points, sizeof(float));
+    stats->n_exceed = (int *) calloc((size_t) n_points * (n_thresholds > 0 ? n_thresholds : 1), sizeof(int));
+
+    if (stats->thresholds == NULL || stats->count == NULL || stats->shift == NULL || stats->sum == NULL || stats->sum_comp == NULL
+        || stats->sumsq == NULL || stats->sumsq_comp == NULL || stats->n_exceed == NULL) {
+        printf("ensemble_stats_new: memory allocation\n");
+        ensemble_stats_free(stats);
+        return NULL;
+    }
+
+    if (n_thresholds > 0) {
+        memcpy(stats->thresholds, thresholds, sizeof(float) * n_thresholds);
+    }
+
+    COUNT_DECODE(allocations, 1);
+    return stats;
+}
+
+int ensemble_stats_add(struct ensemble_stats *stats, const float *member) {
+    // Add one member, which has n_points values (NaN for missing)
+
+    const unsigned int n_points = stats->n_points;
+    int *count = stats->count;
+    float *shift = stats->shift;
+    float *sum = stats->sum, *sum_comp = stats->sum_comp;
+    float *sumsq = stats->sumsq, *sumsq_comp = stats->sumsq_comp;
+    long i;
+    int k;
+
+    // Written without branches so it vectorizes
+#pragma omp parallel for simd schedule(static)
+    for (i = 0; i < (long) n_points; i++) {
+        float val = member[i];
+        int valid = !isnan(val);
+        float point_shift = count[i] == 0 ? val : shift[i];
+        float dev = valid ? val - point_shift : 0.f;
+        float y, t;
+
+        shift[i] = point_shift;
+
+        y = dev - sum_comp[i];
+        t = sum[i] + y;
+        sum_comp[i] = (t - sum[i]) - y;
+        sum[i] = t;
+
+        y = dev * dev - sumsq_comp[i];
+        t = sumsq[i] + y;
+        sumsq_comp[i] = (t - sumsq[i]) - y;
+        sumsq[i] = t;
+
+        count[i] += valid;
+    }
+
+    for (k = 0; k < stats->n_thresholds; k++) {
+        const float threshold = stats->thresholds[k];
+        int *n_exceed = stats->n_exceed + (size_t) k * n_points;
+
+        // NaN is never greater than the threshold, so missing values don't count
+#pragma omp parallel for simd schedule(static)
+        for (i = 0; i < (long) n_points; i++) {
+            n_exceed[i] += member[i] > threshold;
+        }
+    }
+
+    COUNT_DECODE(values_decoded, n_points);
+    return 0;
+}
+
+int ensemble_stats_result(const struct ensemble_stats *stats, int ddof, float *mean, float *stdev, float *prob, int *count) {
+    // ddof is subtracted from the number of members in the denominator of the variance (0 for the population standard deviation, 1 for the sample)
+    // Any of the outputs can be NULL to skip it. mean and stdev get n_points values, prob gets n_thresholds x n_points, and count gets the number of
+    //   valid members at each point. Points with no valid members are NaN (as is the standard deviation where there aren't more than ddof members).
+
+    const unsigned int n_points = stats->n_points;
+    long i;
+    int k;
+
+    if (ddof < 0) {
+        printf("ensemble_stats_result: bad ddof %d\n", ddof);
+        return -1;
+    }
+
+#pragma omp parallel for schedule(static)
+    for (i = 0; i < (long) n_points; i++) {
+        const int n = stats->count[i];
+        const float sum = stats->sum[i] - stats->sum_comp[i];
+        const float sumsq = stats->sumsq[i] - stats->sumsq_comp[i];
+
+        if (mean != NULL) {
+            mean[i] = n > 0 ? stats->shift[i] + sum / n : NAN;
+        }
+
+        if (stdev != NULL) {
+            if (n > ddof) {
+                float var = (sumsq - sum * sum / n) / (n - ddof);
+                stdev[i] = var > 0.f ? sqrtf(var) : 0.f;
+            }
+            else {
+                stdev[i] = NAN;
+            }
+        }
+
+        if (count != NULL) {
+            count[i] = n;
+        }
+    }
+
+    if (prob != NULL) {
+        for (k = 0; k < stats->n_thresholds; k++) {
+            const int *n_exceed = stats->n_exceed + (size_t) k * n_points;
+            float *prob_k = prob + (size_t) k * n_points;
+
+#pragma omp parallel for schedule(static)
+            for (i = 0; i < (long) n_points; i++) {
+                const int n = stats->count[i];
+                prob_k[i] = n > 0 ? (float) n_exceed[i] / n : NAN;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void ensemble_stats_free(struct ensemble_stats *stats) {
+    if (stats == NULL) return;
+
+    free(stats->thresholds);
+    free(stats->count);
+    free(stats->shift);
+    free(stats->sum);
+    free(stats->sum_comp);
+    free(stats->sumsq);
+    free(stats->sumsq_comp);
+    free(stats->n_exceed);
+    free(stats);
+}
@@ -0,0 +1,6 @@
+struct ensemble_stats;
+
+struct ensemble_stats *ensemble_stats_new(unsigned int n_points, const float *thresholds, int n_thresholds);
+int ensemble_stats_add(struct ensemble_stats *stats, const float *member);
+int ensemble_stats_result(const struct ensemble_stats *stats, int ddof, float *mean, float *stdev, float *prob, int *count);
+void ensemble_stats_free(struct ensemble_stats *stats);
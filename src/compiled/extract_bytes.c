@@ -1,3 +1,5 @@
+#include <string.h>
+
 
 unsigned int uint2(unsigned char const *p) {
     return (p[0] << 8) + p[1];
@@ -44,4 +46,27 @@ float ieee2flt(unsigned char *ieee) {
     // Assumes little-endian
     unsigned int val = ieee[0] + (ieee[1] << 8) + (ieee[2] << 16) + (ieee[3] << 24);
     return (float)val;
-}
\ No newline at end of file
+}
+void uint_n_char(unsigned int i, unsigned char *p, int n) {
+    while (n-- > 0) {
+        p[n] = i & 255;
+        i >>= 8;
+    }
+}
+
+void int_n_char(int i, unsigned char *p, int n) {
+    // Grib stores negatives as a sign bit and a magnitude
+    if (i < 0) {
+        uint_n_char((unsigned int) -i, p, n);
+        p[0] |= 0x80;
+    }
+    else {
+        uint_n_char((unsigned int) i, p, n);
+    }
+}
+
+void flt2ieee(float x, unsigned char *ieee) {
+    unsigned int val;
+    memcpy(&val, &x, sizeof(val));
+    uint_n_char(val, ieee, 4);
+}
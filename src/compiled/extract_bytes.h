@@ -4,4 +4,7 @@ unsigned int uint4(unsigned const char *p);
 int int2(unsigned const char *p);
 int int_n(unsigned const char *p, int n);
 unsigned int uint_n(unsigned const char *p, int n);
-float ieee2flt(unsigned char *ieee);
\ No newline at end of file
+float ieee2flt(unsigned char *ieee);
+void uint_n_char(unsigned int i, unsigned char *p, int n);
+void int_n_char(int i, unsigned char *p, int n);
+void flt2ieee(float x, unsigned char *ieee);
\ No newline at end of file
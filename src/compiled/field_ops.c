@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "field_ops.h"
+#include "unpack_scaling.h"
+#include "decode_counters.h"
+
+// Point-by-point arithmetic on decoded fields
+
+// Expressions are evaluated on blocks of this many points, so all the intermediate values for a block stay in cache
+#define EXPRESSION_BLOCK_SIZE 256
+
+int field_difference(const float *later, float later_weight, const float *earlier, float earlier_weight, unsigned int n_points, float min_value,
+                     float *output) {
+    // output = later_weight * later - earlier_weight * earlier, e.g., to get the 3-6 hour precip from the 0-6 and 0-3 hour buckets (both weights 1), or
+    //   the 3-6 hour average from the 0-6 and 0-3 hour averages (weights 6/3 and 3/3)
+    // Differences less than min_value are set to min_value (pass -INFINITY to leave them alone), which is mostly for taking out small negative
+    //   amounts from packing error. NaN in either input gives NaN in the output.
+    // output can be the same array as later or earlier
+
+    long i;
+
+#pragma omp parallel for simd schedule(static)
+    for (i = 0; i < (long) n_points; i++) {
+        float diff = later_weight * later[i] - earlier_weight * earlier[i];
+        output[i] = diff < min_value ? min_value : diff;
+    }
+
+    COUNT_DECODE(values_decoded, n_points);
+    return 0;
+}
+
+static int check_program(const int *program, int program_length, int n_constants, int n_inputs) {
+    // Make sure the program only reads inputs and constants that exist and keeps the stack in bounds, so evaluating it doesn't need any checks
+    int ip, depth = 0;
+
+    for (ip = 0; ip < program_length; ip++) {
+        switch (program[ip]) {
+            case FIELD_OP_INPUT:
+            case FIELD_OP_CONST:
+                if (ip + 1 >= program_length || program[ip + 1] < 0 || program[ip + 1] >= (program[ip] == FIELD_OP_INPUT ? n_inputs : n_constants)) {
+                    printf("field_expression: bad operand at %d\n", ip);
+                    return -1;
+                }
+                ip++;
+                depth++;
+                break;
+            case FIELD_OP_NEG: case FIELD_OP_ABS: case FIELD_OP_SQRT: case FIELD_OP_EXP: case FIELD_OP_LOG:
+                if (depth < 1) {
+                    printf("field_expression: stack underflow at %d\n", ip);
+                    return -1;
+                }
+                break;
+            case FIELD_OP_ADD: case FIELD_OP_SUB: case FIELD_OP_MUL: case FIELD_OP_DIV: case FIELD_OP_MIN: case FIELD_OP_MAX: case FIELD_OP_POW:
+            case FIELD_OP_HYPOT: case FIELD_OP_ATAN2: case FIELD_OP_MOD:
+                if (depth < 2) {
+                    printf("field_expression: stack underflow at %d\n", ip);
+                    return -1;
+                }
+                depth--;
+                break;
+            default:
+                printf("field_expression: unknown opcode %d at %d\n", program[ip], ip);
+                return -1;
+        }
+
+        if (depth > FIELD_EXPRESSION_MAX_STACK) {
+            printf("field_expression: expression is too deep\n");
+            return -1;
+        }
+    }
+
+    if (depth != 1) {
+        printf("field_expression: program leaves %d values on the stack\n", depth);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void eval_block(const int *program, int program_length, const float *constants, const float **inputs, size_t offset, int n,
+                       float (*stack)[EXPRESSION_BLOCK_SIZE], float *output) {
+    // Run the program on points offset through offset + n - 1. Each operation is a simple loop over the block, which the compiler can vectorize.
+    int ip, top = -1, i;
+
+    for (ip = 0; ip < program_length; ip++) {
+        float *a = top >= 1 ? stack[top - 1] : NULL;
+        float *b = top >= 0 ? stack[top] : NULL;
+
+        switch (program[ip]) {
+            case FIELD_OP_INPUT: {
+                const float *input = inputs[program[++ip]] + offset;
+                top++;
+                for (i = 0; i < n; i++) stack[top][i] = input[i];
+                break;
+            }
+            case FIELD_OP_CONST: {
+                const float val = constants[program[++ip]];
+                top++;
+                for (i = 0; i < n; i++) stack[top][i] = val;
+                break;
+            }
+            case FIELD_OP_NEG: for (i = 0; i < n; i++) b[i] = -b[i]; break;
+            case FIELD_OP_ABS: for (i = 0; i < n; i++) b[i] = fabsf(b[i]); break;
+            case FIELD_OP_SQRT: for (i = 0; i < n; i++) b[i] = sqrtf(b[i]); break;
+            case FIELD_OP_EXP: for (i = 0; i < n; i++) b[i] = expf(b[i]); break;
+            case FIELD_OP_LOG: for (i = 0; i < n; i++) b[i] = logf(b[i]); break;
+            case FIELD_OP_ADD: for (i = 0; i < n; i++) a[i] = a[i] + b[i]; top--; break;
+            case FIELD_OP_SUB: for (i = 0; i < n; i++) a[i] = a[i] - b[i]; top--; break;
+            case FIELD_OP_MUL: for (i = 0; i < n; i++) a[i] = a[i] * b[i]; top--; break;
+            case FIELD_OP_DIV: for (i = 0; i < n; i++) a[i] = a[i] / b[i]; top--; break;
+            // NaN in either argument gives NaN, unlike fminf() and fmaxf()
+            case FIELD_OP_MIN: for (i = 0; i < n; i++) a[i] = a[i] != a[i] || b[i] != b[i] ? NAN : (a[i] < b[i] ? a[i] : b[i]); top--; break;
+            case FIELD_OP_MAX: for (i = 0; i < n; i++) a[i] = a[i] != a[i] || b[i] != b[i] ? NAN : (a[i] > b[i] ? a[i] : b[i]); top--; break;
+            case FIELD_OP_POW: for (i = 0; i < n; i++) a[i] = powf(a[i], b[i]); top--; break;
+            case FIELD_OP_HYPOT: for (i = 0; i < n; i++) a[i] = sqrtf(a[i] * a[i] + b[i] * b[i]); top--; break;
+            case FIELD_OP_ATAN2: for (i = 0; i < n; i++) a[i] = atan2f(a[i], b[i]); top--; break;
+            // Modulo with the sign of the divisor, so e.g. directions wrap into [0, 360)
+            case FIELD_OP_MOD: for (i = 0; i < n; i++) a[i] = a[i] - b[i] * floorf(a[i] / b[i]); top--; break;
+        }
+    }
+
+    for (i = 0; i < n; i++) output[offset + i] = stack[0][i];
+}
+
+int field_expression(const int *program, int program_length, const float *constants, int n_constants, const float **inputs, int n_inputs,
+                     unsigned int n_points, float *output) {
+    // Evaluate an expression at every point in one pass. The program is in postfix order (e.g., INPUT 0, INPUT 0, MUL, INPUT 1, INPUT 1, MUL, ADD,
+    //   SQRT for the magnitude of a vector), and each input has n_points values. NaN (missing) inputs give NaN outputs for all the operations.
+    // output can be the same array as one of the inputs
+
+    long n_blocks = ((long) n_points + EXPRESSION_BLOCK_SIZE - 1) / EXPRESSION_BLOCK_SIZE;
+    long iblock;
+
+    if (check_program(program, program_length, n_constants, n_inputs) < 0) {
+        return -1;
+    }
+
+#pragma omp parallel for schedule(static)
+    for (iblock = 0; iblock < n_blocks; iblock++) {
+        float stack[FIELD_EXPRESSION_MAX_STACK][EXPRESSION_BLOCK_SIZE];
+        size_t offset = (size_t) iblock * EXPRESSION_BLOCK_SIZE;
+        int n = n_points - offset < EXPRESSION_BLOCK_SIZE ? (int) (n_points - offset) : EXPRESSION_BLOCK_SIZE;
+
+        eval_block(program, program_length, constants, inputs, offset, n, stack, output);
+    }
+
+    COUNT_DECODE(values_decoded, n_points);
+    return 0;
+}
+
+int field_to_packed16(const float *input, unsigned int n_points, float reference_value, int binary_scale_factor, int decimal_scale_factor,
+                      unsigned short *output) {
+    // Turn a decoded field back into the message's packed integers (as 16-bit ints, with PACKED16_MISSING for NaN), e.g., for storing it in half the
+    //   space without losing anything. The scaling is the one from section 5, which the values were decoded with.
+    // Returns 1 if some value isn't exactly what one of the packed integers scales to or the packed integers don't fit in 16 bits (e.g., the packing
+    //   used more than 16 bits, or the field was changed after decoding), in which case the output is incomplete and the field should be kept as is.
+
+    double ref = reference_value;
+    double bin_exp = pow(2., binary_scale_factor), dec_exp = pow(10., -decimal_scale_factor);
+    long i;
+    int n_bad = 0;
+
+#pragma omp parallel for schedule(static) reduction(+:n_bad)
+    for (i = 0; i < (long) n_points; i++) {
+        double guess;
+        int val, ival;
+
+        if (isnan(input[i])) {
+            output[i] = PACKED16_MISSING;
+            continue;
+        }
+
+        // The division can round either way, so check the neighbors of the closest integer, too
+        guess = round((input[i] / dec_exp - ref) / bin_exp);
+        if (!(guess >= -1. && guess <= PACKED16_MISSING)) {
+            n_bad++;
+            continue;
+        }
+
+        val = -1;
+        for (ival = (int) guess - 1; ival <= (int) guess + 1; ival++) {
+            if (ival >= 0 && ival < PACKED16_MISSING && scale_packed(ref, ival, bin_exp, dec_exp) == input[i]) {
+                val = ival;
+                break;
+            }
+        }
+
+        if (val < 0) {
+            n_bad++;
+            continue;
+        }
+
+        output[i] = (unsigned short) val;
+    }
+
+    COUNT_DECODE(values_decoded, n_points);
+    return n_bad > 0 ? 1 : 0;
+}
+
+int field_from_packed16(const unsigned short *input, unsigned int n_points, float reference_value, int binary_scale_factor, int decimal_scale_factor,
+                        float *output) {
+    // Scale packed integers from field_to_packed16() back to the field
+
+    double ref = reference_value;
+    double bin_exp = pow(2., binary_scale_factor), dec_exp = pow(10., -decimal_scale_factor);
+    long i;
+
+#pragma omp parallel for schedule(static)
+    for (i = 0; i < (long) n_points; i++) {
+        output[i] = input[i] == PACKED16_MISSING ? NAN : scale_packed(ref, input[i], bin_exp, dec_exp);
+    }
+
+    COUNT_DECODE(values_decoded, n_points);
+    return 0;
+}
@@ -0,0 +1,29 @@
+// Opcodes for field_expression() programs. FIELD_OP_INPUT and FIELD_OP_CONST are followed by the index of the input or constant.
+#define FIELD_OP_INPUT 0
+#define FIELD_OP_CONST 1
+#define FIELD_OP_ADD 2
+#define FIELD_OP_SUB 3
+#define FIELD_OP_MUL 4
+#define FIELD_OP_DIV 5
+#define FIELD_OP_NEG 6
+#define FIELD_OP_ABS 7
+#define FIELD_OP_SQRT 8
+#define FIELD_OP_EXP 9
+#define FIELD_OP_LOG 10
+#define FIELD_OP_MIN 11
+#define FIELD_OP_MAX 12
+#define FIELD_OP_POW 13
+#define FIELD_OP_HYPOT 14
+#define FIELD_OP_ATAN2 15
+#define FIELD_OP_MOD 16
+
+#define FIELD_EXPRESSION_MAX_STACK 16
+
+int field_difference(const float *later, float later_weight, const float *earlier, float earlier_weight, unsigned int n_points, float min_value,
+                     float *output);
+int field_expression(const int *program, int program_length, const float *constants, int n_constants, const float **inputs, int n_inputs,
+                     unsigned int n_points, float *output);
+int field_to_packed16(const float *input, unsigned int n_points, float reference_value, int binary_scale_factor, int decimal_scale_factor,
+                      unsigned short *output);
+int field_from_packed16(const unsigned short *input, unsigned int n_points, float reference_value, int binary_scale_factor, int decimal_scale_factor,
+                        float *output);
@@ -0,0 +1,56 @@
+/*
+ * Public interface to the grib_compression library. The same functions are exported from the web assembly module
+ *   (see EXPORTED_FUNCTIONS in the Makefile) and from the native shared library built with `make native`.
+ */
+
+#ifndef GRIB_COMPRESSION_H
+#define GRIB_COMPRESSION_H
+
+#include <stddef.h>
+
+int decode_png(unsigned char *pngbuf, int *width, int *height, unsigned char *cout, int *grib2_bit_depth, unsigned int ndata);
+int decode_jpeg2000(char *injpc, int bufsize, int *outfld);
+int decode_jpeg2000_sized(char *injpc, int bufsize, int *outfld, unsigned int n_outfld);
+
+/* Decoder state that's kept between messages */
+struct png_session;
+struct png_session *png_session_new(void);
+int png_session_decode(struct png_session *session, const unsigned char *pngbuf, unsigned int pngbuf_size, int *width, int *height,
+                       unsigned char *cout, unsigned int cout_size, int *grib2_bit_depth, unsigned int ndata);
+void png_session_free(struct png_session *session);
+
+int unpk_simple(unsigned int npnts, int nbits, unsigned int sec7_size, unsigned char *data_in, int *data_out);
+int extract_simple(unsigned int npnts, int nbits, unsigned int sec7_size, unsigned char *data_in, const int *indices, unsigned int n_indices,
+    int *data_out);
+
+int unpk_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
+    unsigned char group_split_method, unsigned char missing_val_method, unsigned char ref_group_width, unsigned char nbit_group_width,
+    unsigned int ref_group_length, unsigned char group_length_factor, unsigned int len_last,
+    unsigned char nbits_group_len, unsigned int sec7_size, unsigned char *data_in, int *data_out);
+int extract_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
+    unsigned char group_split_method, unsigned char missing_val_method, unsigned char ref_group_width, unsigned char nbit_group_width,
+    unsigned int ref_group_length, unsigned char group_length_factor, unsigned int len_last,
+    unsigned char nbits_group_len, unsigned int sec7_size, unsigned char *data_in, const int *indices, unsigned int n_indices, int *data_out);
+int unpk_sd_complex(unsigned int npnts, unsigned char nbits, unsigned int n_groups,
+    unsigned char group_split_method, unsigned char missing_val_method, unsigned char ref_group_width, unsigned char nbit_group_width,
+    unsigned int ref_group_length, unsigned char group_length_factor, unsigned int len_last,
+    unsigned char nbits_group_len, unsigned int sec7_size, unsigned char sd_order, unsigned char extra_octets, unsigned char *data_in, int *data_out);
+
+int pk_complex(const float *data, unsigned int npnts, int decimal_scale_factor, int binary_scale_factor, int sd_order,
+    unsigned char *sec5, unsigned int *sec5_size, unsigned char **sec7, unsigned int *sec7_size);
+
+int apply_bitmap(const char* input_bitmap, const float* input_data, float* output, const size_t output_size);
+int bitmap_packed_indices(const unsigned char *bitmap, unsigned int n_grid, const int *grid_indices, unsigned int n_indices, int *packed_indices);
+
+#include "unpack_scaling.h"
+#include "grid_projection.h"
+#include "regrid.h"
+#include "pyramid.h"
+#include "inflate_stream.h"
+#include "ensemble_stats.h"
+#include "field_ops.h"
+
+void enable_decode_counters(int enabled);
+void read_decode_counters(double *counts);
+
+#endif
@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <math.h>
+
+#include "grid_projection.h"
+
+// Transforms between latitude/longitude and fractional grid indices. Lambert conformal uses the ellipsoidal formulas from Snyder (1987),
+//   "Map Projections -- A Working Manual", pp. 104-110, which reduce to the spherical ones when the earth is a sphere.
+
+#define LAMBERT_INVERSE_ITERATIONS 6    // iterations for the latitude in the inverse ellipsoidal Lambert projection; converges to < 1e-12 rad
+
+#define DEG2RAD (M_PI / 180.)
+
+static double wrap_lon(double dlon) {
+    // Wrap a longitude difference into [-180, 180)
+    dlon = fmod(dlon + 180., 360.);
+    if (dlon < 0) dlon += 360.;
+    return dlon - 180.;
+}
+
+static double lambert_t(double phi, double e) {
+    double esin = e * sin(phi);
+    return tan(M_PI / 4. - phi / 2.) / pow((1. - esin) / (1. + esin), e / 2.);
+}
+
+static double lambert_m(double phi, double e) {
+    double esin = e * sin(phi);
+    return cos(phi) / sqrt(1. - esin * esin);
+}
+
+static void lambert_xy(const struct grid_projection *proj, double lat, double lon, double *x, double *y) {
+    double rho, theta;
+
+    if (fabs(lat) >= 90.) {
+        // The pole on the same side as the projection maps to the origin; the other pole is infinitely far away
+        rho = (lat > 0) == (proj->n > 0) ? 0. : INFINITY;
+    }
+    else {
+        rho = proj->a_f * pow(lambert_t(lat * DEG2RAD, proj->e), proj->n);
+    }
+
+    theta = proj->n * wrap_lon(lon - proj->lov) * DEG2RAD;
+    *x = rho * sin(theta);
+    *y = -rho * cos(theta);
+}
+
+static void lambert_latlon(const struct grid_projection *proj, double x, double y, double *lat, double *lon) {
+    // Inverse of lambert_xy()
+    double sign_n = proj->n > 0 ? 1. : -1.;
+    double rho = sign_n * sqrt(x * x + y * y);
+    double theta = atan2(sign_n * x, -sign_n * y);
+    double t, phi;
+    int iter;
+
+    if (rho == 0) {
+        *lat = sign_n * 90.;
+        *lon = proj->lov;
+        return;
+    }
+
+    t = pow(rho / proj->a_f, 1. / proj->n);
+    phi = M_PI / 2. - 2. * atan(t);
+    if (proj->e > 0) {
+        // Fixed number of iterations, so there are no data-dependent branches in the coordinate loop
+        for (iter = 0; iter < LAMBERT_INVERSE_ITERATIONS; iter++) {
+            double esin = proj->e * sin(phi);
+            phi = M_PI / 2. - 2. * atan(t * pow((1. - esin) / (1. + esin), proj->e / 2.));
+        }
+    }
+
+    *lat = phi / DEG2RAD;
+    *lon = theta / proj->n / DEG2RAD + proj->lov;
+}
+
+static void rotate_latlon(const struct grid_projection *proj, double lat, double lon, double *lat_rot, double *lon_rot) {
+    // Geographic to rotated coordinates: rotate by the south pole longitude about the earth's axis, then by 90 + the south pole latitude
+    //   about the new y axis.
+    double lat_r = lat * DEG2RAD, lon_r = (lon - proj->south_pole_lon) * DEG2RAD;
+    double x = cos(lat_r) * cos(lon_r), y = cos(lat_r) * sin(lon_r), z = sin(lat_r);
+    double x_rot = proj->cos_theta * x + proj->sin_theta * z;
+    double z_rot = -proj->sin_theta * x + proj->cos_theta * z;
+
+    if (z_rot > 1.) z_rot = 1.;
+    if (z_rot < -1.) z_rot = -1.;
+
+    *lat_rot = asin(z_rot) / DEG2RAD;
+    *lon_rot = atan2(y, x_rot) / DEG2RAD - proj->rotation;
+}
+
+static void unrotate_latlon(const struct grid_projection *proj, double lat_rot, double lon_rot, double *lat, double *lon) {
+    // Inverse of rotate_latlon()
+    double lat_r = lat_rot * DEG2RAD, lon_r = (lon_rot + proj->rotation) * DEG2RAD;
+    double x_rot = cos(lat_r) * cos(lon_r), y = cos(lat_r) * sin(lon_r), z_rot = sin(lat_r);
+    double x = proj->cos_theta * x_rot - proj->sin_theta * z_rot;
+    double z = proj->sin_theta * x_rot + proj->cos_theta * z_rot;
+
+    if (z > 1.) z = 1.;
+    if (z < -1.) z = -1.;
+
+    *lat = asin(z) / DEG2RAD;
+    *lon = atan2(y, x) / DEG2RAD + proj->south_pole_lon;
+}
+
+int init_grid_projection(const double *params, struct grid_projection *proj) {
+    int scan_mode = (int) params[GRID_PARAM_SCAN_MODE];
+
+    proj->template_number = (int) params[GRID_PARAM_TEMPLATE];
+    proj->ni = (unsigned int) params[GRID_PARAM_NI];
+    proj->nj = (unsigned int) params[GRID_PARAM_NJ];
+    proj->column_major = (scan_mode & 0x20) != 0;
+    proj->lat_first = params[GRID_PARAM_LAT_FIRST];
+    proj->lon_first = params[GRID_PARAM_LON_FIRST];
+
+    // Scan mode bit 0x80 means points scan in the -i direction, and bit 0x40 means they scan in the +j direction
+    proj->di = (scan_mode & 0x80) ? -fabs(params[GRID_PARAM_DI]) : fabs(params[GRID_PARAM_DI]);
+    proj->dj = (scan_mode & 0x40) ? fabs(params[GRID_PARAM_DJ]) : -fabs(params[GRID_PARAM_DJ]);
+
+    if (proj->ni == 0 || proj->nj == 0 || proj->di == 0 || proj->dj == 0) {
+        printf("init_grid_projection: bad grid dimensions or spacing\n");
+        return -2;
+    }
+
+    proj->i_periodic = 0;
+
+    switch (proj->template_number) {
+        case GRID_TEMPLATE_ROTATED_LATLON:
+            {
+                double theta = (90. + params[GRID_PARAM_SOUTH_POLE_LAT]) * DEG2RAD;
+                proj->south_pole_lon = params[GRID_PARAM_SOUTH_POLE_LON];
+                proj->sin_theta = sin(theta);
+                proj->cos_theta = cos(theta);
+                proj->rotation = params[GRID_PARAM_ROTATION];
+            }
+            // fall through
+        case GRID_TEMPLATE_LATLON:
+            proj->i_periodic = fabs(fabs(proj->di) * proj->ni - 360.) < 0.5 * fabs(proj->di);
+            return 0;
+
+        case GRID_TEMPLATE_LAMBERT:
+            {
+                double a = params[GRID_PARAM_SEMIMAJOR], b = params[GRID_PARAM_SEMIMINOR];
+                double phi1 = params[GRID_PARAM_LATIN1] * DEG2RAD, phi2 = params[GRID_PARAM_LATIN2] * DEG2RAD;
+                double e = a > b ? sqrt(1. - (b * b) / (a * a)) : 0.;
+                double m1 = lambert_m(phi1, e), t1 = lambert_t(phi1, e);
+
+                if (fabs(phi1 - phi2) < 1e-10) {
+                    proj->n = sin(phi1);
+                }
+                else {
+                    proj->n = (log(m1) - log(lambert_m(phi2, e))) / (log(t1) - log(lambert_t(phi2, e)));
+                }
+
+                if (proj->n == 0) {
+                    printf("init_grid_projection: Lambert conformal standard latitudes can't be on the equator\n");
+                    return -2;
+                }
+
+                proj->a = a;
+                proj->e = e;
+                proj->a_f = a * m1 / (proj->n * pow(t1, proj->n));
+                proj->lov = params[GRID_PARAM_LOV];
+                proj->rho0 = proj->a_f * pow(lambert_t(params[GRID_PARAM_LAD] * DEG2RAD, e), proj->n);
+                lambert_xy(proj, proj->lat_first, proj->lon_first, &proj->x_first, &proj->y_first);
+            }
+            return 0;
+
+        default:
+            printf("init_grid_projection: grid definition template %d is not supported\n", proj->template_number);
+            return -1;
+    }
+}
+
+void latlon_to_grid(const struct grid_projection *proj, double lat, double lon, double *fi, double *fj) {
+    // Fractional grid indices for the point at (lat, lon) in degrees. Points off the grid get indices outside [0, ni - 1] and [0, nj - 1].
+    double x, y;
+
+    switch (proj->template_number) {
+        case GRID_TEMPLATE_ROTATED_LATLON:
+            rotate_latlon(proj, lat, lon, &lat, &lon);
+            // fall through
+        case GRID_TEMPLATE_LATLON:
+            {
+                // Measure the longitude from the first point in the direction the grid scans, so grids that cross the prime meridian work
+                double dlon = fmod(lon - proj->lon_first, 360.);
+                if (proj->di > 0 && dlon < 0) dlon += 360.;
+                if (proj->di < 0 && dlon > 0) dlon -= 360.;
+
+                *fi = dlon / proj->di;
+                if (!proj->i_periodic && *fi > proj->ni - 0.5) {
+                    // Past the end of a regional grid, so see if the point is closer before the start
+                    double fi_before = (dlon - (proj->di > 0 ? 360. : -360.)) / proj->di;
+                    if (-fi_before < *fi - (proj->ni - 1)) *fi = fi_before;
+                }
+                *fj = (lat - proj->lat_first) / proj->dj;
+            }
+            break;
+
+        case GRID_TEMPLATE_LAMBERT:
+            lambert_xy(proj, lat, lon, &x, &y);
+            *fi = (x - proj->x_first) / proj->di;
+            *fj = (y - proj->y_first) / proj->dj;
+            break;
+
+        default:
+            *fi = NAN;
+            *fj = NAN;
+    }
+}
+
+void grid_to_latlon(const struct grid_projection *proj, double fi, double fj, double *lat, double *lon) {
+    // Latitude and longitude in degrees of the point at fractional grid indices (fi, fj). Longitudes are in [-180, 180).
+    switch (proj->template_number) {
+        case GRID_TEMPLATE_LATLON:
+            *lat = proj->lat_first + fj * proj->dj;
+            *lon = proj->lon_first + fi * proj->di;
+            break;
+
+        case GRID_TEMPLATE_ROTATED_LATLON:
+            unrotate_latlon(proj, proj->lat_first + fj * proj->dj, proj->lon_first + fi * proj->di, lat, lon);
+            break;
+
+        case GRID_TEMPLATE_LAMBERT:
+            lambert_latlon(proj, proj->x_first + fi * proj->di, proj->y_first + fj * proj->dj, lat, lon);
+            break;
+
+        default:
+            *lat = NAN;
+            *lon = NAN;
+            return;
+    }
+
+    *lon = wrap_lon(*lon);
+}
+
+int grid_coordinates(const double *params, int coordinate_type, float *coord1, float *coord2) {
+    // Coordinates of every point in the grid described by params, in the same order as the decoded data
+    // coordinate_type is GRID_COORDS_LATLON, in which case coord1 gets the latitudes and coord2 the longitudes, GRID_COORDS_PROJECTED, in which case
+    //   coord1 gets x (or longitude) and coord2 y (or latitude), or GRID_COORDS_WIND_ROTATION, in which case coord1 gets sin(a) and coord2 cos(a), where
+    //   a is the angle from the grid's y axis to north. Earth-relative components are then u = cos(a) * u_grid + sin(a) * v_grid and
+    //   v = cos(a) * v_grid - sin(a) * u_grid.
+    // coord1 and coord2 must each hold ni * nj values.
+
+    struct grid_projection proj;
+    long j;
+    int ierr;
+
+    if (coordinate_type != GRID_COORDS_LATLON && coordinate_type != GRID_COORDS_PROJECTED && coordinate_type != GRID_COORDS_WIND_ROTATION) {
+        printf("grid_coordinates: unknown coordinate type %d\n", coordinate_type);
+        return -1;
+    }
+
+    ierr = init_grid_projection(params, &proj);
+    if (ierr != 0) return ierr;
+
+    if (coordinate_type == GRID_COORDS_WIND_ROTATION && proj.template_number == GRID_TEMPLATE_ROTATED_LATLON) {
+        printf("grid_coordinates: wind rotation isn't supported for rotated lat/lon grids\n");
+        return -3;
+    }
+
+#pragma omp parallel for schedule(static)
+    for (j = 0; j < (long) proj.nj; j++) {
+        unsigned int i;
+
+        if (coordinate_type == GRID_COORDS_WIND_ROTATION) {
+            // The grid's axes line up with north and east on a lat/lon grid. On a Lambert conformal grid, north is turned from the y axis by the cone
+            //   factor times the longitude from the orientation longitude.
+            for (i = 0; i < proj.ni; i++) {
+                size_t offset = GRID_OFFSET(&proj, i, j);
+                double lat, lon, angle = 0.;
+                if (proj.template_number == GRID_TEMPLATE_LAMBERT) {
+                    grid_to_latlon(&proj, i, j, &lat, &lon);
+                    angle = proj.n * wrap_lon(lon - proj.lov) * DEG2RAD;
+                }
+                coord1[offset] = (float) sin(angle);
+                coord2[offset] = (float) cos(angle);
+            }
+        }
+        else if (coordinate_type == GRID_COORDS_PROJECTED) {
+            // These are all linear in the grid indices
+            double c1_first, c2_row, dc1;
+            if (proj.template_number == GRID_TEMPLATE_LAMBERT) {
+                c1_first = proj.x_first;
+                c2_row = proj.y_first + j * proj.dj + proj.rho0;
+            }
+            else {
+                c1_first = proj.lon_first;
+                c2_row = proj.lat_first + j * proj.dj;
+            }
+            dc1 = proj.di;
+
+            for (i = 0; i < proj.ni; i++) {
+                size_t offset = GRID_OFFSET(&proj, i, j);
+                coord1[offset] = (float) (c1_first + i * dc1);
+                coord2[offset] = (float) c2_row;
+            }
+        }
+        else if (proj.template_number == GRID_TEMPLATE_LATLON) {
+            // Latitude is constant along a row
+            float lat_row = (float) (proj.lat_first + j * proj.dj);
+            for (i = 0; i < proj.ni; i++) {
+                size_t offset = GRID_OFFSET(&proj, i, j);
+                coord1[offset] = lat_row;
+                coord2[offset] = (float) wrap_lon(proj.lon_first + i * proj.di);
+            }
+        }
+        else {
+            for (i = 0; i < proj.ni; i++) {
+                size_t offset = GRID_OFFSET(&proj, i, j);
+                double lat, lon;
+                grid_to_latlon(&proj, i, j, &lat, &lon);
+                coord1[offset] = (float) lat;
+                coord2[offset] = (float) lon;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * Map projections for the grid definition templates we support (3.0, 3.1, and 3.30). Grids are described to the native code by an array of
+ *   N_GRID_PARAMS doubles, laid out as below; the Javascript side builds it from section 3.
+ */
+
+#ifndef GRID_PROJECTION_H
+#define GRID_PROJECTION_H
+
+#define GRID_PARAM_TEMPLATE 0           // grid definition template number
+#define GRID_PARAM_NI 1
+#define GRID_PARAM_NJ 2
+#define GRID_PARAM_SCAN_MODE 3          // scanning mode flags, as in the template
+#define GRID_PARAM_SEMIMAJOR 4          // earth semimajor axis (m)
+#define GRID_PARAM_SEMIMINOR 5          // earth semiminor axis (m)
+#define GRID_PARAM_LAT_FIRST 6          // latitude of the first grid point (degrees, in rotated coordinates for 3.1)
+#define GRID_PARAM_LON_FIRST 7          // longitude of the first grid point (degrees, in rotated coordinates for 3.1)
+#define GRID_PARAM_DI 8                 // grid spacing in i (degrees for 3.0 and 3.1, m for 3.30)
+#define GRID_PARAM_DJ 9                 // grid spacing in j (degrees for 3.0 and 3.1, m for 3.30)
+#define GRID_PARAM_SOUTH_POLE_LAT 10    // 3.1 only: latitude of the south pole of the rotated grid (degrees)
+#define GRID_PARAM_SOUTH_POLE_LON 11    // 3.1 only: longitude of the south pole of the rotated grid (degrees)
+#define GRID_PARAM_ROTATION 12          // 3.1 only: angle of rotation about the new polar axis (degrees)
+#define GRID_PARAM_LAD 13               // 3.30 only: latitude where dx and dy are specified (degrees)
+#define GRID_PARAM_LOV 14               // 3.30 only: orientation longitude (degrees)
+#define GRID_PARAM_LATIN1 15            // 3.30 only: first standard latitude (degrees)
+#define GRID_PARAM_LATIN2 16            // 3.30 only: second standard latitude (degrees)
+#define N_GRID_PARAMS 17
+
+#define GRID_TEMPLATE_LATLON 0
+#define GRID_TEMPLATE_ROTATED_LATLON 1
+#define GRID_TEMPLATE_LAMBERT 30
+
+#define GRID_COORDS_LATLON 0            // latitude and longitude (degrees, with longitudes in [-180, 180))
+#define GRID_COORDS_PROJECTED 1         // coordinates on the grid's own projection: x and y (m) for 3.30, and longitude and latitude for 3.0 and 3.1
+#define GRID_COORDS_WIND_ROTATION 2     // sine and cosine of the angle that turns grid-relative vector components into earth-relative ones (3.0 and 3.30)
+
+struct grid_projection {
+    int template_number;
+    unsigned int ni, nj;
+    int column_major;
+
+    // Signed grid spacing, so the fractional index is (coordinate - coordinate of first point) / spacing
+    double di, dj;
+    double lat_first, lon_first;
+    int i_periodic;                 // lat/lon grids that wrap all the way around the earth
+
+    // Rotated lat/lon
+    double south_pole_lon, sin_theta, cos_theta, rotation;
+
+    // Lambert conformal (x and y are relative to the pole of the projection; rho0 is the distance from the pole to LaD)
+    double a, e, n, a_f, lov, rho0, x_first, y_first;
+};
+
+int init_grid_projection(const double *params, struct grid_projection *proj);
+void latlon_to_grid(const struct grid_projection *proj, double lat, double lon, double *fi, double *fj);
+void grid_to_latlon(const struct grid_projection *proj, double fi, double fj, double *lat, double *lon);
+int grid_coordinates(const double *params, int coordinate_type, float *coord1, float *coord2);
+
+// Index of grid point (i, j) in the decoded data
+#define GRID_OFFSET(proj, i, j) ((proj)->column_major ? (size_t) (i) * (proj)->nj + (j) : (size_t) (j) * (proj)->ni + (i))
+
+#endif
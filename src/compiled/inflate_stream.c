@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "inflate_stream.h"
+#include "decode_counters.h"
+
+// Incremental gzip/zlib decompression, so compressed files (e.g., MRMS .grib2.gz) can be inflated as they download instead of all at once. The
+//   compressed data is fed in whatever size chunks it arrives in, and the output is drained into a fixed-size buffer that the caller copies out.
+
+#define INFLATE_WINDOW_BITS (15 + 32)   // the largest window, and detect gzip or zlib headers automatically
+
+struct inflate_stream {
+    z_stream zs;
+    int finished;
+};
+
+struct inflate_stream *inflate_stream_new(void) {
+    struct inflate_stream *stream = (struct inflate_stream *) malloc(sizeof(struct inflate_stream));
+    if (stream == NULL) {
+        printf("inflate_stream_new: memory allocation\n");
+        return NULL;
+    }
+
+    memset(stream, 0, sizeof(struct inflate_stream));
+    if (inflateInit2(&stream->zs, INFLATE_WINDOW_BITS) != Z_OK) {
+        printf("inflate_stream_new: %s\n", stream->zs.msg == NULL ? "couldn't initialize zlib" : stream->zs.msg);
+        free(stream);
+        return NULL;
+    }
+
+    COUNT_DECODE(allocations, 1);
+    return stream;
+}
+
+int inflate_stream_feed(struct inflate_stream *stream, const unsigned char *input, unsigned int input_size, unsigned char *output, unsigned int output_size,
+                        unsigned int *input_used, unsigned int *output_used) {
+    // Inflate as much of input as fits in output. Call this again with the rest of the input (input + *input_used) until it's all used, and then
+    //   keep calling it with no input until it doesn't fill the output, to drain what zlib is holding on to.
+    // Returns INFLATE_STREAM_MORE or INFLATE_STREAM_END, or a negative number on an error.
+
+    int ierr;
+
+    stream->zs.next_in = (unsigned char *) input;
+    stream->zs.avail_in = input_size;
+    stream->zs.next_out = output;
+    stream->zs.avail_out = output_size;
+
+    while (stream->zs.avail_out > 0) {
+        if (stream->finished) {
+            // gzip files can be several gzip streams one after the other (e.g., from cat a.gz b.gz), so start over if there's more input
+            if (stream->zs.avail_in == 0) break;
+
+            ierr = inflateReset(&stream->zs);
+            if (ierr != Z_OK) {
+                printf("inflate_stream_feed: couldn't reset zlib\n");
+                return -1;
+            }
+            stream->finished = 0;
+        }
+
+        ierr = inflate(&stream->zs, Z_NO_FLUSH);
+
+        if (ierr == Z_STREAM_END) {
+            stream->finished = 1;
+        }
+        else if (ierr == Z_BUF_ERROR) {
+            // Out of input or output; either way, nothing more can be done in this call
+            break;
+        }
+        else if (ierr != Z_OK) {
+            printf("inflate_stream_feed: %s\n", stream->zs.msg == NULL ? "corrupt compressed data" : stream->zs.msg);
+            return -2;
+        }
+    }
+
+    *input_used = input_size - stream->zs.avail_in;
+    *output_used = output_size - stream->zs.avail_out;
+    COUNT_DECODE(bits_read, (unsigned long long) *input_used * 8);
+
+    return stream->finished && stream->zs.avail_in == 0 ? INFLATE_STREAM_END : INFLATE_STREAM_MORE;
+}
+
+void inflate_stream_free(struct inflate_stream *stream) {
+    if (stream == NULL) return;
+
+    inflateEnd(&stream->zs);
+    free(stream);
+}
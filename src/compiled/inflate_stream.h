@@ -0,0 +1,9 @@
+#define INFLATE_STREAM_MORE 0           // needs more input (or more room for output)
+#define INFLATE_STREAM_END 1            // got to the end of the compressed data
+
+struct inflate_stream;
+
+struct inflate_stream *inflate_stream_new(void);
+int inflate_stream_feed(struct inflate_stream *stream, const unsigned char *input, unsigned int input_size, unsigned char *output, unsigned int output_size,
+                        unsigned int *input_used, unsigned int *output_used);
+void inflate_stream_free(struct inflate_stream *stream);
@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "bitstream.h"
+#include "extract_bytes.h"
+
+#ifdef USE_OPENMP
+#include <omp.h>
+#endif
+
+// Complex packing and complex packing with spatial differencing (DRT 5.2 and 5.3). This is the inverse of unpk_complex() and
+//   unpk_sd_complex(), and the output is laid out so that those routines can read it back.
+//
+// note: the scaled integers are limited to 30 bits, so that they stay below INT_MAX (which the decoder uses to mark missing values)
+//       and within the limits of the bitstream routines.
+
+#define PK_GROUP_MIN 8              // points used to set the width of a new group
+#define PK_GROUP_MAX 65535          // longest group allowed
+#define PK_SEGMENT_SIZE 65536       // points per independently-grouped segment
+#define PK_ESTIMATE_BLOCK 64        // block size for estimating the packed size of a differencing order
+#define PK_MAX_BITS 30
+
+struct pk_group {
+    unsigned int start;
+    unsigned int len;
+    int ref;                        // INT_MAX for a group that is entirely missing
+    int width;
+};
+
+static int bits_needed(unsigned int x) {
+    int n = 0;
+    while (x) {
+        n++;
+        x >>= 1;
+    }
+    return n;
+}
+
+// Width of the next PK_GROUP_MIN points starting at start, or INT_MAX if they're all missing
+static int block_width(const int *vals, unsigned int start, unsigned int end, int reserve_missing) {
+    unsigned int k;
+    int vmin = INT_MAX, vmax = INT_MIN;
+
+    for (k = start; k < end && k - start < PK_GROUP_MIN; k++) {
+        if (vals[k] == INT_MAX) continue;
+        if (vals[k] < vmin) vmin = vals[k];
+        if (vals[k] > vmax) vmax = vals[k];
+    }
+
+    return vmin == INT_MAX ? INT_MAX : bits_needed((unsigned int) (vmax - vmin) + reserve_missing);
+}
+
+// Split vals[start, end) into groups. Each group's width is set by its first PK_GROUP_MIN points, and the group is then extended
+//   for as long as the next point fits in that width and the next block wouldn't pack much narrower on its own. With reserve_missing set, the all-ones value in each group is left free to
+//   mark missing values.
+static unsigned int pick_groups(const int *vals, unsigned int start, unsigned int end, int reserve_missing, struct pk_group *groups) {
+    unsigned int i, k, ngroups;
+    int vmin, vmax, width, new_min, new_max;
+
+    ngroups = 0;
+    i = start;
+    while (i < end) {
+        vmin = INT_MAX;
+        vmax = INT_MIN;
+
+        for (k = i; k < end && k - i < PK_GROUP_MIN; k++) {
+            if (vals[k] == INT_MAX) continue;
+            if (vals[k] < vmin) vmin = vals[k];
+            if (vals[k] > vmax) vmax = vals[k];
+        }
+
+        width = (vmin == INT_MAX) ? 0 : bits_needed((unsigned int) (vmax - vmin) + reserve_missing);
+
+        for (; k < end && k - i < PK_GROUP_MAX; k++) {
+            if ((k - i) % PK_GROUP_MIN == 0 && width > 2 && block_width(vals, k, end, reserve_missing) < width - 2) {
+                // The next block packs narrower by enough to pay for a new group's descriptors
+                break;
+            }
+
+            if (vals[k] == INT_MAX) continue;
+
+            // Don't mix values into an all-missing group
+            if (vmin == INT_MAX) break;
+
+            new_min = vals[k] < vmin ? vals[k] : vmin;
+            new_max = vals[k] > vmax ? vals[k] : vmax;
+            if (bits_needed((unsigned int) (new_max - new_min) + reserve_missing) > width) break;
+
+            vmin = new_min;
+            vmax = new_max;
+        }
+
+        groups[ngroups].start = i;
+        groups[ngroups].len = k - i;
+        groups[ngroups].ref = vmin;
+        groups[ngroups].width = width;
+        ngroups++;
+
+        i = k;
+    }
+
+    return ngroups;
+}
+
+// Compute the spatial differences of order sd_order over the non-missing points. The first sd_order non-missing values are returned
+//   in first_vals (they're stored in the extra descriptors instead of the data), and their slots are set to zero.
+static int spatial_difference(const int *vals, unsigned int npnts, int sd_order, int *diffs, int *first_vals, int *min_val) {
+    unsigned int i;
+    int n_valid;
+    long long last, penultimate, diff, dmin;
+
+    n_valid = 0;
+    last = penultimate = 0;
+    dmin = LLONG_MAX;
+
+    for (i = 0; i < npnts; i++) {
+        if (vals[i] == INT_MAX) {
+            diffs[i] = INT_MAX;
+            continue;
+        }
+
+        if (n_valid < sd_order) {
+            first_vals[n_valid] = vals[i];
+            diffs[i] = 0;
+        }
+        else {
+            diff = sd_order == 1 ? vals[i] - last : vals[i] - 2 * last + penultimate;
+            if (diff < dmin) dmin = diff;
+            if (diff > INT_MAX / 2 || diff < -(INT_MAX / 2)) return -1;
+            diffs[i] = (int) diff;
+        }
+
+        penultimate = last;
+        last = vals[i];
+        n_valid++;
+    }
+
+    if (dmin == LLONG_MAX) dmin = 0;
+
+    // The decoder adds the minimum back in, so remove it here, leaving the ignored slots at zero.
+    n_valid = 0;
+    for (i = 0; i < npnts; i++) {
+        if (diffs[i] == INT_MAX) continue;
+        if (n_valid >= sd_order) diffs[i] -= (int) dmin;
+        n_valid++;
+    }
+
+    *min_val = (int) dmin;
+    return 0;
+}
+
+// Rough estimate of the number of bits needed to pack vals, used to choose the differencing order
+static double estimate_packed_bits(const int *vals, unsigned int npnts) {
+    long long i;
+    double total = 0.;
+
+#pragma omp parallel for reduction(+:total) schedule(static)
+    for (i = 0; i < (long long) npnts; i += PK_ESTIMATE_BLOCK) {
+        unsigned int k, end;
+        int vmin = INT_MAX, vmax = INT_MIN;
+
+        end = (unsigned int) i + PK_ESTIMATE_BLOCK;
+        if (end > npnts) end = npnts;
+
+        for (k = (unsigned int) i; k < end; k++) {
+            if (vals[k] == INT_MAX) continue;
+            if (vals[k] < vmin) vmin = vals[k];
+            if (vals[k] > vmax) vmax = vals[k];
+        }
+
+        if (vmin != INT_MAX) {
+            total += (double) (end - i) * bits_needed((unsigned int) (vmax - vmin)) + 16.;
+        }
+    }
+
+    return total;
+}
+
+int pk_complex(const float *data, unsigned int npnts, int decimal_scale_factor, int binary_scale_factor, int sd_order,
+    unsigned char *sec5, unsigned int *sec5_size, unsigned char **sec7, unsigned int *sec7_size) {
+    // Pack data with complex packing (sd_order == 0), or complex packing with spatial differencing (sd_order == 1 or 2). If sd_order is -1,
+    //   the order (including no differencing) that gives the smallest estimated output is used.
+    // data is the field to pack. NaNs are treated as missing values and packed with missing value management 1.
+    // sec5 must hold at least 49 bytes and receives the complete data representation section.
+    // *sec7 is allocated to hold the complete data section, and should be freed by the caller.
+
+    unsigned int i, j, ngroups, nsegments, iseg, n_valid;
+    int *vals, *diffs, *packed;
+    int first_vals[2], min_val, extra_octets, missing_val_method, drt;
+    int nbits, max_ref, ref_width, max_width, nbit_group_width, ref_len, max_len, nbits_group_len;
+    int status;
+    double dec_exp, bin_exp, scaled, ref_value, vmax;
+    float ref_value_flt;
+    unsigned int *seg_ngroups;
+    struct pk_group *groups;
+    unsigned long long n_packed_bits;
+    unsigned int sec5_len, sec7_len, payload_len;
+    unsigned char *out, *ptr;
+    struct bitstream_writer writer;
+
+    if (sd_order < -1 || sd_order > 2) {
+        printf("pk_complex: unsupported spatial differencing order %d\n", sd_order);
+        return -1;
+    }
+
+    vals = (int *) malloc(sizeof(int) * (size_t) npnts);
+    diffs = (int *) malloc(sizeof(int) * (size_t) npnts);
+    if (vals == NULL || diffs == NULL) {
+        printf("pk_complex: memory allocation\n");
+        free(vals);
+        free(diffs);
+        return -1;
+    }
+
+    // Scale the data to integers: Y * 10^D = R + X * 2^E
+    dec_exp = pow(10., decimal_scale_factor);
+    bin_exp = pow(2., -binary_scale_factor);
+
+    ref_value = INFINITY;
+    vmax = -INFINITY;
+    n_valid = 0;
+
+#pragma omp parallel for reduction(min:ref_value) reduction(max:vmax) reduction(+:n_valid) schedule(static)
+    for (i = 0; i < npnts; i++) {
+        if (!isnan(data[i])) {
+            double val = data[i] * dec_exp;
+            if (val < ref_value) ref_value = val;
+            if (val > vmax) vmax = val;
+            n_valid++;
+        }
+    }
+
+    if (n_valid == 0) {
+        ref_value = vmax = 0.;
+    }
+
+    ref_value_flt = (float) ref_value;
+    if (ref_value_flt > ref_value) ref_value_flt = nextafterf(ref_value_flt, -INFINITY);
+
+    if ((vmax - ref_value_flt) * bin_exp >= (double) (1 << PK_MAX_BITS)) {
+        printf("pk_complex: range of scaled data exceeds %d bits; use a smaller decimal or larger binary scale factor\n", PK_MAX_BITS);
+        free(vals);
+        free(diffs);
+        return -2;
+    }
+
+#pragma omp parallel for private(scaled) schedule(static)
+    for (i = 0; i < npnts; i++) {
+        if (isnan(data[i])) {
+            vals[i] = INT_MAX;
+        }
+        else {
+            scaled = floor(((double) data[i] * dec_exp - ref_value_flt) * bin_exp + 0.5);
+            vals[i] = scaled < 0 ? 0 : (int) scaled;
+        }
+    }
+
+    missing_val_method = n_valid < npnts ? 1 : 0;
+
+    // Choose the differencing order
+    if (sd_order == -1) {
+        double bits, best_bits;
+        int order;
+
+        sd_order = 0;
+        best_bits = estimate_packed_bits(vals, npnts);
+
+        for (order = 1; order <= 2; order++) {
+            if (spatial_difference(vals, npnts, order, diffs, first_vals, &min_val) != 0) continue;
+            bits = estimate_packed_bits(diffs, npnts);
+            if (bits < best_bits) {
+                best_bits = bits;
+                sd_order = order;
+            }
+        }
+    }
+
+    first_vals[0] = first_vals[1] = 0;
+    min_val = 0;
+    extra_octets = 0;
+
+    if (sd_order > 0) {
+        if (spatial_difference(vals, npnts, sd_order, diffs, first_vals, &min_val) != 0) {
+            printf("pk_complex: spatial differences exceed the packing limits\n");
+            free(vals);
+            free(diffs);
+            return -2;
+        }
+        packed = diffs;
+
+        // Enough octets to hold the first values and the signed minimum
+        for (extra_octets = 1; extra_octets < 4; extra_octets++) {
+            unsigned int limit = 1u << (8 * extra_octets);
+            if ((unsigned int) first_vals[0] < limit && (unsigned int) first_vals[1] < limit &&
+                (unsigned int) abs(min_val) < (limit >> 1)) break;
+        }
+    }
+    else {
+        packed = vals;
+    }
+
+    // Pick the groups. Segments are grouped independently, so the output doesn't depend on the number of threads.
+    nsegments = (npnts + PK_SEGMENT_SIZE - 1) / PK_SEGMENT_SIZE;
+    if (nsegments == 0) nsegments = 1;
+
+    groups = (struct pk_group *) malloc(sizeof(struct pk_group) * ((size_t) npnts / PK_GROUP_MIN + nsegments + 1));
+    seg_ngroups = (unsigned int *) malloc(sizeof(unsigned int) * (size_t) nsegments);
+    if (groups == NULL || seg_ngroups == NULL) {
+        printf("pk_complex: memory allocation\n");
+        free(vals);
+        free(diffs);
+        free(groups);
+        free(seg_ngroups);
+        return -1;
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for (iseg = 0; iseg < nsegments; iseg++) {
+        unsigned int seg_start = iseg * PK_SEGMENT_SIZE;
+        unsigned int seg_end = seg_start + PK_SEGMENT_SIZE > npnts ? npnts : seg_start + PK_SEGMENT_SIZE;
+        size_t group_offset = (size_t) iseg * (PK_SEGMENT_SIZE / PK_GROUP_MIN + 1);
+
+        seg_ngroups[iseg] = pick_groups(packed, seg_start, seg_end, missing_val_method, groups + group_offset);
+    }
+
+    // Compact the per-segment group lists
+    ngroups = 0;
+    for (iseg = 0; iseg < nsegments; iseg++) {
+        size_t group_offset = (size_t) iseg * (PK_SEGMENT_SIZE / PK_GROUP_MIN + 1);
+        memmove(groups + ngroups, groups + group_offset, sizeof(struct pk_group) * seg_ngroups[iseg]);
+        ngroups += seg_ngroups[iseg];
+    }
+    free(seg_ngroups);
+
+    if (ngroups == 0) {
+        // Empty field; write a single empty group so the sections are still valid
+        groups[0].start = 0;
+        groups[0].len = 0;
+        groups[0].ref = 0;
+        groups[0].width = 0;
+        ngroups = 1;
+    }
+
+    // Work out the bit widths for the group descriptors
+    max_ref = 0;
+    ref_width = INT_MAX;
+    max_width = 0;
+    ref_len = INT_MAX;
+    max_len = 0;
+    n_packed_bits = 0;
+
+    for (j = 0; j < ngroups; j++) {
+        if (groups[j].ref != INT_MAX && groups[j].ref > max_ref) max_ref = groups[j].ref;
+        if (groups[j].width < ref_width) ref_width = groups[j].width;
+        if (groups[j].width > max_width) max_width = groups[j].width;
+        if (j < ngroups - 1) {
+            if ((int) groups[j].len < ref_len) ref_len = groups[j].len;
+            if ((int) groups[j].len > max_len) max_len = groups[j].len;
+        }
+        n_packed_bits += (unsigned long long) groups[j].len * groups[j].width;
+    }
+
+    if (ref_len == INT_MAX) ref_len = max_len = 0;
+
+    // With missing values, the all-ones reference is reserved for groups that are entirely missing
+    nbits = bits_needed((unsigned int) max_ref + (missing_val_method == 1 ? 1 : 0));
+    nbit_group_width = bits_needed((unsigned int) (max_width - ref_width));
+    nbits_group_len = bits_needed((unsigned int) (max_len - ref_len));
+
+    if (nbits > PK_MAX_BITS) {
+        printf("pk_complex: group references exceed %d bits\n", PK_MAX_BITS);
+        free(vals);
+        free(diffs);
+        free(groups);
+        return -2;
+    }
+
+    payload_len = (sd_order > 0 ? (sd_order + 1) * extra_octets : 0) +
+                  ((unsigned long long) ngroups * nbits + 7) / 8 +
+                  ((unsigned long long) ngroups * nbit_group_width + 7) / 8 +
+                  ((unsigned long long) ngroups * nbits_group_len + 7) / 8 +
+                  (n_packed_bits + 7) / 8;
+    sec7_len = 5 + payload_len;
+
+    out = (unsigned char *) malloc(sec7_len);
+    if (out == NULL) {
+        printf("pk_complex: memory allocation\n");
+        free(vals);
+        free(diffs);
+        free(groups);
+        return -1;
+    }
+
+    // Section 7
+    uint_n_char(sec7_len, out, 4);
+    out[4] = 7;
+    ptr = out + 5;
+
+    if (sd_order > 0) {
+        uint_n_char((unsigned int) first_vals[0], ptr, extra_octets);
+        ptr += extra_octets;
+        if (sd_order == 2) {
+            uint_n_char((unsigned int) first_vals[1], ptr, extra_octets);
+            ptr += extra_octets;
+        }
+        int_n_char(min_val, ptr, extra_octets);
+        ptr += extra_octets;
+    }
+
+    // pk_complex() can run on several threads at once in the native library, so it has its own writer
+    status = 0;
+    init_bitstream_writer(&writer, ptr);
+
+    // group references
+    for (j = 0; j < ngroups; j++) {
+        int ref = groups[j].ref == INT_MAX ? (1 << nbits) - 1 : groups[j].ref;
+        if (nbits > 0) status |= add_bitstream_writer(&writer, ref, nbits);
+    }
+    finish_bitstream_writer(&writer);
+
+    // group widths
+    for (j = 0; j < ngroups; j++) {
+        if (nbit_group_width > 0) status |= add_bitstream_writer(&writer, groups[j].width - ref_width, nbit_group_width);
+    }
+    finish_bitstream_writer(&writer);
+
+    // group lengths (the true length of the last group is in section 5)
+    for (j = 0; j < ngroups; j++) {
+        int scaled_len = j < ngroups - 1 ? (int) groups[j].len - ref_len : 0;
+        if (nbits_group_len > 0) status |= add_bitstream_writer(&writer, scaled_len, nbits_group_len);
+    }
+    finish_bitstream_writer(&writer);
+
+    // packed values
+    for (j = 0; j < ngroups; j++) {
+        int width = groups[j].width;
+        int all_ones = (1 << width) - 1;
+
+        if (width == 0) continue;
+
+        for (i = groups[j].start; i < groups[j].start + groups[j].len; i++) {
+            status |= add_bitstream_writer(&writer, packed[i] == INT_MAX ? all_ones : packed[i] - groups[j].ref, width);
+        }
+    }
+    finish_bitstream_writer(&writer);
+
+    if (status != 0) {
+        printf("pk_complex: bitstream error\n");
+        free(vals);
+        free(diffs);
+        free(groups);
+        free(out);
+        return -3;
+    }
+
+    // Section 5
+    drt = sd_order > 0 ? 3 : 2;
+    sec5_len = drt == 3 ? 49 : 47;
+
+    memset(sec5, 0, sec5_len);
+    uint_n_char(sec5_len, sec5, 4);
+    sec5[4] = 5;
+    uint_n_char(npnts, sec5 + 5, 4);
+    uint_n_char(drt, sec5 + 9, 2);
+    flt2ieee(ref_value_flt, sec5 + 11);
+    int_n_char(binary_scale_factor, sec5 + 15, 2);
+    int_n_char(decimal_scale_factor, sec5 + 17, 2);
+    sec5[19] = nbits;
+    sec5[20] = 0;                                   // original data were floats
+    sec5[21] = 1;                                   // general group splitting
+    sec5[22] = missing_val_method;
+    flt2ieee(9.999e20, sec5 + 23);                  // primary missing value substitute
+    uint_n_char(0xffffffff, sec5 + 27, 4);          // no secondary missing value
+    uint_n_char(ngroups, sec5 + 31, 4);
+    sec5[35] = ref_width;
+    sec5[36] = nbit_group_width;
+    uint_n_char(ref_len, sec5 + 37, 4);
+    sec5[41] = 1;                                   // length increment
+    uint_n_char(groups[ngroups - 1].len, sec5 + 42, 4);
+    sec5[46] = nbits_group_len;
+    if (drt == 3) {
+        sec5[47] = sd_order;
+        sec5[48] = extra_octets;
+    }
+
+    *sec5_size = sec5_len;
+    *sec7 = out;
+    *sec7_size = sec7_len;
+
+    free(vals);
+    free(diffs);
+    free(groups);
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "pyramid.h"
+
+// Multi-resolution pyramids for map tiles. Each level is the level below it reduced in 2x2 blocks, so level l has ceil(ni / 2^l) x ceil(nj / 2^l)
+//   points. Blocks at the right and top edges of odd-sized grids only have the points that exist. Missing (NaN) points are left out of every
+//   reducer, so a point on a coarser level is only missing if every point under it is.
+
+static unsigned int level_dim(unsigned int n, int level) {
+    return (unsigned int) (((unsigned long long) n + (1ull << level) - 1) >> level);
+}
+
+unsigned int pyramid_size(unsigned int ni, unsigned int nj, int n_levels) {
+    // The number of points in levels 1 through n_levels - 1 (level 0 is the input)
+    unsigned int size = 0;
+    int level;
+
+    for (level = 1; level < n_levels; level++) {
+        size += level_dim(ni, level) * level_dim(nj, level);
+    }
+    return size;
+}
+
+static void reduce_row(const float *src, const float *src_counts, unsigned int src_ni, unsigned int src_nj, unsigned int j, unsigned int dst_ni, int reducer,
+                       float *dst, float *dst_counts) {
+    // Reduce the 2x2 blocks in row j of the destination level. For the mean, src_counts and dst_counts are the number of valid level-0 points under each
+    //   point, so each level is the mean of the points in level 0, not a mean of means.
+    const float *row0 = src + (size_t) (2 * j) * src_ni;
+    const float *row1 = 2 * j + 1 < src_nj ? row0 + src_ni : NULL;
+    unsigned int i;
+
+    for (i = 0; i < dst_ni; i++) {
+        unsigned int i0 = 2 * i, i1 = 2 * i + 1 < src_ni ? 2 * i + 1 : 2 * i;
+        const float *block[4];
+        unsigned int block_offsets[4];
+        int n_block = 0, k;
+
+        block[n_block] = row0; block_offsets[n_block++] = i0;
+        if (i1 != i0) { block[n_block] = row0; block_offsets[n_block++] = i1; }
+        if (row1 != NULL) {
+            block[n_block] = row1; block_offsets[n_block++] = i0;
+            if (i1 != i0) { block[n_block] = row1; block_offsets[n_block++] = i1; }
+        }
+
+        switch (reducer) {
+            case PYRAMID_MEAN: {
+                float sum = 0.f, count = 0.f;
+                for (k = 0; k < n_block; k++) {
+                    float val = block[k][block_offsets[k]];
+                    float weight = src_counts == NULL ? 1.f : src_counts[(block[k] - src) + block_offsets[k]];
+                    if (isnan(val) || weight == 0.f) continue;
+
+                    sum += weight * val;
+                    count += weight;
+                }
+                dst[i] = count > 0.f ? sum / count : NAN;
+                dst_counts[i] = count;
+                break;
+            }
+            case PYRAMID_MAX: {
+                float max = NAN;
+                for (k = 0; k < n_block; k++) {
+                    float val = block[k][block_offsets[k]];
+                    if (!isnan(val) && (isnan(max) || val > max)) max = val;
+                }
+                dst[i] = max;
+                break;
+            }
+            case PYRAMID_NEAREST: {
+                // The first point in the block, or the next one that isn't missing
+                float val = NAN;
+                for (k = 0; k < n_block && isnan(val); k++) {
+                    val = block[k][block_offsets[k]];
+                }
+                dst[i] = val;
+                break;
+            }
+        }
+    }
+}
+
+int build_pyramid(const float *level0, unsigned int ni, unsigned int nj, int n_levels, int reducer, float *output) {
+    // level0 is the full-resolution field, ni x nj points with i varying fastest
+    // n_levels is the number of levels including level 0
+    // reducer is one of the PYRAMID_* values
+    // output must hold pyramid_size(ni, nj, n_levels) values, and gets levels 1 through n_levels - 1 one after the other
+
+    float *counts = NULL, *src_counts, *dst_counts;
+    const float *src;
+    float *dst;
+    unsigned int src_ni = ni, src_nj = nj;
+    int level;
+
+    if (reducer < PYRAMID_MEAN || reducer > PYRAMID_NEAREST) {
+        printf("build_pyramid: unknown reducer %d\n", reducer);
+        return -1;
+    }
+
+    if (n_levels < 1 || n_levels > 32) {
+        printf("build_pyramid: bad number of levels %d\n", n_levels);
+        return -1;
+    }
+
+    if (reducer == PYRAMID_MEAN && n_levels > 1) {
+        // Counts for two levels at a time; level 1 is the biggest
+        size_t level1_size = (size_t) level_dim(ni, 1) * level_dim(nj, 1);
+        counts = (float *) malloc(sizeof(float) * 2 * level1_size);
+        if (counts == NULL) {
+            printf("build_pyramid: memory allocation\n");
+            return -1;
+        }
+
+        src_counts = NULL;
+        dst_counts = counts;
+    }
+    else {
+        src_counts = dst_counts = NULL;
+    }
+
+    src = level0;
+    dst = output;
+
+    for (level = 1; level < n_levels; level++) {
+        unsigned int dst_ni = level_dim(ni, level), dst_nj = level_dim(nj, level);
+        long j;
+
+#pragma omp parallel for schedule(static)
+        for (j = 0; j < (long) dst_nj; j++) {
+            reduce_row(src, src_counts, src_ni, src_nj, (unsigned int) j, dst_ni, reducer, dst + (size_t) j * dst_ni,
+                       dst_counts == NULL ? NULL : dst_counts + (size_t) j * dst_ni);
+        }
+
+        if (counts != NULL) {
+            // The counts just written are the source for the next level, and the other half of the buffer is free
+            float *next_counts = dst_counts == counts ? counts + (size_t) level_dim(ni, 1) * level_dim(nj, 1) : counts;
+            src_counts = dst_counts;
+            dst_counts = next_counts;
+        }
+
+        src = dst;
+        dst += (size_t) dst_ni * dst_nj;
+        src_ni = dst_ni;
+        src_nj = dst_nj;
+    }
+
+    free(counts);
+    return 0;
+}
+
+int cut_tiles(const float *level, unsigned int ni, unsigned int nj, unsigned int tile_size, float *tiles) {
+    // Cut a level into tile_size x tile_size tiles. The tiles are in row-major order (i varying fastest), and each tile is tile_size x tile_size
+    //   values with i varying fastest. Tiles that hang off the right or top edge are padded with NaN.
+    // tiles must hold ceil(ni / tile_size) * ceil(nj / tile_size) * tile_size * tile_size values
+
+    unsigned int n_tiles_i, n_tiles_j;
+    long itile;
+
+    if (tile_size == 0) {
+        printf("cut_tiles: tile size must be positive\n");
+        return -1;
+    }
+
+    n_tiles_i = (ni + tile_size - 1) / tile_size;
+    n_tiles_j = (nj + tile_size - 1) / tile_size;
+
+#pragma omp parallel for schedule(static)
+    for (itile = 0; itile < (long) n_tiles_i * n_tiles_j; itile++) {
+        unsigned int tile_i = (unsigned int) (itile % n_tiles_i), tile_j = (unsigned int) (itile / n_tiles_i);
+        float *tile = tiles + (size_t) itile * tile_size * tile_size;
+        unsigned int i, j;
+
+        for (j = 0; j < tile_size; j++) {
+            unsigned int src_j = tile_j * tile_size + j;
+            float *tile_row = tile + (size_t) j * tile_size;
+
+            for (i = 0; i < tile_size; i++) {
+                unsigned int src_i = tile_i * tile_size + i;
+                tile_row[i] = src_i < ni && src_j < nj ? level[(size_t) src_j * ni + src_i] : NAN;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,7 @@
+#define PYRAMID_MEAN 0
+#define PYRAMID_MAX 1
+#define PYRAMID_NEAREST 2
+
+unsigned int pyramid_size(unsigned int ni, unsigned int nj, int n_levels);
+int build_pyramid(const float *level0, unsigned int ni, unsigned int nj, int n_levels, int reducer, float *output);
+int cut_tiles(const float *level, unsigned int ni, unsigned int nj, unsigned int tile_size, float *tiles);
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <math.h>
+
+#include "grid_projection.h"
+#include "regrid.h"
+
+// Interpolation from a source grid to arbitrary target points. Computing the weights (which needs the map projection) is separated from applying
+//   them, so the weights can be computed once for a pair of grids and then applied to every field on the source grid. Applying the weights is a
+//   gather of n_weights source points per target point, with -1 marking points that aren't used.
+
+#define GRID_EDGE_TOLERANCE 1e-6    // in grid points, so target points right on the edge of the source grid aren't lost to roundoff
+
+int regrid_weights(const double *src_params, const float *lats, const float *lons, unsigned int n_target, int method, int *indices, float *weights) {
+    // src_params describes the source grid (see grid_projection.h)
+    // lats and lons are the n_target target points in degrees
+    // method is REGRID_NEAREST or REGRID_BILINEAR
+    // indices and weights must hold n_target * REGRID_*_WEIGHTS values for the method
+
+    struct grid_projection proj;
+    int n_weights, ierr;
+    long itarget;
+
+    if (method != REGRID_NEAREST && method != REGRID_BILINEAR) {
+        printf("regrid_weights: unknown interpolation method %d\n", method);
+        return -1;
+    }
+
+    ierr = init_grid_projection(src_params, &proj);
+    if (ierr != 0) return ierr;
+
+    n_weights = method == REGRID_BILINEAR ? REGRID_BILINEAR_WEIGHTS : REGRID_NEAREST_WEIGHTS;
+
+#pragma omp parallel for schedule(static)
+    for (itarget = 0; itarget < (long) n_target; itarget++) {
+        int *pt_indices = indices + itarget * n_weights;
+        float *pt_weights = weights + itarget * n_weights;
+        double fi, fj;
+        int k, on_grid;
+
+        latlon_to_grid(&proj, lats[itarget], lons[itarget], &fi, &fj);
+
+        if (proj.i_periodic) {
+            fi = fmod(fi, (double) proj.ni);
+            if (fi < 0) fi += proj.ni;
+        }
+
+        on_grid = fj >= -GRID_EDGE_TOLERANCE && fj <= proj.nj - 1 + GRID_EDGE_TOLERANCE &&
+                  (proj.i_periodic || (fi >= -GRID_EDGE_TOLERANCE && fi <= proj.ni - 1 + GRID_EDGE_TOLERANCE));
+
+        if (!on_grid) {
+            for (k = 0; k < n_weights; k++) {
+                pt_indices[k] = -1;
+                pt_weights[k] = 0.f;
+            }
+            continue;
+        }
+
+        if (method == REGRID_NEAREST) {
+            unsigned int i = (unsigned int) floor(fi + 0.5), j = (unsigned int) floor(fj + 0.5);
+            if (i >= proj.ni) i = proj.i_periodic ? 0 : proj.ni - 1;
+            if (j >= proj.nj) j = proj.nj - 1;
+
+            pt_indices[0] = (int) GRID_OFFSET(&proj, i, j);
+            pt_weights[0] = 1.f;
+        }
+        else {
+            // Clamp to the last cell on non-periodic edges, so a point on the edge gets a weight of 1 on the edge points
+            unsigned int i0, j0, i1, j1;
+            double wi, wj;
+
+            i0 = fi < 0 ? 0 : (unsigned int) fi;
+            j0 = fj < 0 ? 0 : (unsigned int) fj;
+            if (!proj.i_periodic && i0 >= proj.ni - 1) i0 = proj.ni > 1 ? proj.ni - 2 : 0;
+            if (j0 >= proj.nj - 1) j0 = proj.nj > 1 ? proj.nj - 2 : 0;
+
+            i1 = proj.ni > 1 ? (i0 + 1) % proj.ni : i0;
+            j1 = proj.nj > 1 ? j0 + 1 : j0;
+
+            wi = fi - i0;
+            wj = fj - j0;
+            if (wi < 0) wi = 0;
+            if (wi > 1) wi = 1;
+            if (wj < 0) wj = 0;
+            if (wj > 1) wj = 1;
+
+            pt_indices[0] = (int) GRID_OFFSET(&proj, i0, j0);
+            pt_indices[1] = (int) GRID_OFFSET(&proj, i1, j0);
+            pt_indices[2] = (int) GRID_OFFSET(&proj, i0, j1);
+            pt_indices[3] = (int) GRID_OFFSET(&proj, i1, j1);
+            pt_weights[0] = (float) ((1 - wi) * (1 - wj));
+            pt_weights[1] = (float) (wi * (1 - wj));
+            pt_weights[2] = (float) ((1 - wi) * wj);
+            pt_weights[3] = (float) (wi * wj);
+        }
+    }
+
+    return 0;
+}
+
+int regrid_apply(const float *src, unsigned int n_src, const int *indices, const float *weights, unsigned int n_target, int n_weights, float *output) {
+    // src is the field on the source grid, with n_src points
+    // indices and weights are from regrid_weights(), with n_weights per target point
+    // output must hold n_target values. Target points off the source grid are NaN. Missing (NaN) source points are left out and the rest of the
+    //   weights renormalized, so a target point is only missing if all the source points around it are.
+
+    long itarget;
+
+#pragma omp parallel for schedule(static)
+    for (itarget = 0; itarget < (long) n_target; itarget++) {
+        const int *pt_indices = indices + itarget * n_weights;
+        const float *pt_weights = weights + itarget * n_weights;
+        float sum = 0.f, weight_sum = 0.f;
+        int k;
+
+        for (k = 0; k < n_weights; k++) {
+            float val;
+            if (pt_indices[k] < 0 || (unsigned int) pt_indices[k] >= n_src || pt_weights[k] == 0.f) continue;
+
+            val = src[pt_indices[k]];
+            if (isnan(val)) continue;
+
+            sum += pt_weights[k] * val;
+            weight_sum += pt_weights[k];
+        }
+
+        output[itarget] = weight_sum > 0.f ? sum / weight_sum : NAN;
+    }
+
+    return 0;
+}
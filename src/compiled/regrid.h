@@ -0,0 +1,8 @@
+#define REGRID_NEAREST 0
+#define REGRID_BILINEAR 1
+
+#define REGRID_NEAREST_WEIGHTS 1
+#define REGRID_BILINEAR_WEIGHTS 4
+
+int regrid_weights(const double *src_params, const float *lats, const float *lons, unsigned int n_target, int method, int *indices, float *weights);
+int regrid_apply(const float *src, unsigned int n_src, const int *indices, const float *weights, unsigned int n_target, int n_weights, float *output);
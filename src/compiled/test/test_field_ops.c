@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../grib_compression.h"
+
+// Tests for field_to_packed16() and field_from_packed16(): fields decoded from packed integers should pack back to the same integers and come back
+//   exactly, including fields with values far outside the range of half-precision floats (e.g., pressure in Pa), and anything that can't be packed
+//   exactly should be reported so the caller can keep the field as is.
+
+static int n_failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            n_failures++; \
+        } \
+    } while (0)
+
+static void decode(const unsigned int *packed, unsigned int n_points, float reference_value, int binary_scale_factor, int decimal_scale_factor,
+                   float *output) {
+    // Scale packed integers the way the decoders do (with 0xffffffff for missing)
+    int *ints = (int *) malloc(sizeof(int) * n_points);
+    unsigned int i;
+
+    for (i = 0; i < n_points; i++) {
+        ints[i] = packed[i] == 0xffffffff ? 0x7fffffff : (int) packed[i];
+    }
+
+    unpack_scaling(ints, n_points, NULL, n_points, reference_value, binary_scale_factor, decimal_scale_factor, OUTPUT_FLOAT32, output, NULL);
+    free(ints);
+}
+
+static void check_round_trip(const char *name, unsigned int max_packed, float reference_value, int binary_scale_factor, int decimal_scale_factor) {
+    const unsigned int n_points = 50000;
+    unsigned int *packed = (unsigned int *) malloc(sizeof(unsigned int) * n_points);
+    float *field = (float *) malloc(sizeof(float) * n_points);
+    float *restored = (float *) malloc(sizeof(float) * n_points);
+    unsigned short *packed16 = (unsigned short *) malloc(sizeof(unsigned short) * n_points);
+    unsigned int i, n_wrong = 0;
+    int status;
+
+    for (i = 0; i < n_points; i++) {
+        // Every packed value at the ends, and some missing points
+        packed[i] = i % 101 == 0 ? 0xffffffff : i < 2 ? i * max_packed : (unsigned int) rand() % (max_packed + 1);
+    }
+
+    decode(packed, n_points, reference_value, binary_scale_factor, decimal_scale_factor, field);
+
+    status = field_to_packed16(field, n_points, reference_value, binary_scale_factor, decimal_scale_factor, packed16);
+    CHECK(status == 0, "%s: field_to_packed16 returned %d", name, status);
+
+    status = field_from_packed16(packed16, n_points, reference_value, binary_scale_factor, decimal_scale_factor, restored);
+    CHECK(status == 0, "%s: field_from_packed16 returned %d", name, status);
+
+    for (i = 0; i < n_points; i++) {
+        int same = isnan(field[i]) ? isnan(restored[i]) && packed16[i] == PACKED16_MISSING : restored[i] == field[i] && packed16[i] == packed[i];
+        if (!same) {
+            if (n_wrong < 5) {
+                printf("%s: point %u was %.9g (packed %u) and came back %.9g (packed %u)\n", name, i, field[i], packed[i], restored[i], packed16[i]);
+            }
+            n_wrong++;
+        }
+    }
+
+    CHECK(n_wrong == 0, "%s: %u points didn't round-trip", name, n_wrong);
+
+    free(packed);
+    free(field);
+    free(restored);
+    free(packed16);
+}
+
+static void check_not_packable(const char *name, float value, unsigned int max_packed, float reference_value, int binary_scale_factor,
+                               int decimal_scale_factor) {
+    // A field that's packable except for one point
+    const unsigned int n_points = 1000;
+    unsigned int packed[1000];
+    float field[1000];
+    unsigned short packed16[1000];
+    unsigned int i;
+    int status;
+
+    for (i = 0; i < n_points; i++) {
+        packed[i] = i % (max_packed + 1);
+    }
+
+    decode(packed, n_points, reference_value, binary_scale_factor, decimal_scale_factor, field);
+    field[n_points / 2] = value;
+
+    status = field_to_packed16(field, n_points, reference_value, binary_scale_factor, decimal_scale_factor, packed16);
+    CHECK(status == 1, "%s: field_to_packed16 returned %d, expected 1", name, status);
+}
+
+int main(void) {
+    srand(12345);
+
+    // Surface pressure in Pa (above the largest half-precision float, 65504)
+    check_round_trip("pressure", 8191, 85000.f, 0, 0);
+    check_round_trip("pressure, decimal", 16383, 850000.f, 1, 1);
+
+    // Geopotential height in gpm, and temperature in K at 0.01 K
+    check_round_trip("height", 65534, 0.f, -1, 0);
+    check_round_trip("temperature", 4095, 21215.f, 0, 2);
+
+    // Small values with a negative reference value
+    check_round_trip("vorticity", 32767, -3.2e-3f, -20, 0);
+
+    // Values that can't be packed exactly
+    check_not_packable("geopotential", 1e10f, 8191, 85000.f, 0, 0);
+    check_not_packable("infinity", INFINITY, 8191, 85000.f, 0, 0);
+    check_not_packable("between packed values", 85000.5f, 8191, 85000.f, 0, 0);
+    check_not_packable("below the reference value", 84000.f, 8191, 85000.f, 0, 0);
+    check_not_packable("more than 16 bits", 85000.f + 70000.f, 8191, 85000.f, 0, 0);
+
+    if (n_failures > 0) {
+        printf("test_field_ops: %d failures\n", n_failures);
+        return 1;
+    }
+
+    printf("test_field_ops: all passed\n");
+    return 0;
+}
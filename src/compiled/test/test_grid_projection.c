@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../grid_projection.h"
+
+// Tests for the wind rotation from grid_coordinates(): on a Lambert conformal grid, the rotation should turn the grid's y axis into the direction of
+//   north, which is checked against a small step north mapped onto the grid with latlon_to_grid().
+
+static int n_failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            n_failures++; \
+        } \
+    } while (0)
+
+static void check_lambert(const char *name, double *params) {
+    struct grid_projection proj;
+    unsigned int ni = (unsigned int) params[GRID_PARAM_NI], nj = (unsigned int) params[GRID_PARAM_NJ];
+    float *sin_angle = (float *) malloc(sizeof(float) * ni * nj);
+    float *cos_angle = (float *) malloc(sizeof(float) * ni * nj);
+    unsigned int i, j;
+    int status;
+
+    status = grid_coordinates(params, GRID_COORDS_WIND_ROTATION, sin_angle, cos_angle);
+    CHECK(status == 0, "%s: grid_coordinates returned %d", name, status);
+    CHECK(init_grid_projection(params, &proj) == 0, "%s: init_grid_projection failed", name);
+
+    for (j = 0; j < nj && status == 0; j += nj / 7) {
+        for (i = 0; i < ni; i += ni / 9) {
+            size_t offset = GRID_OFFSET(&proj, i, j);
+            double lat, lon, fi, fj, dx, dy, angle;
+
+            // Direction of north on the grid, measured from the y axis toward -x
+            grid_to_latlon(&proj, i, j, &lat, &lon);
+            latlon_to_grid(&proj, lat + 0.01, lon, &fi, &fj);
+            dx = (fi - i) * proj.di;
+            dy = (fj - j) * proj.dj;
+            angle = atan2(-dx, dy);
+
+            CHECK(fabs(sin_angle[offset] - sin(angle)) < 1e-4 && fabs(cos_angle[offset] - cos(angle)) < 1e-4,
+                  "%s: (%u, %u) at %.2f, %.2f: rotation is (%f, %f), expected (%f, %f)", name, i, j, lat, lon, sin_angle[offset], cos_angle[offset],
+                  sin(angle), cos(angle));
+        }
+    }
+
+    // Along the orientation longitude, the y axis points north
+    {
+        double fi, fj;
+        latlon_to_grid(&proj, 40., params[GRID_PARAM_LOV], &fi, &fj);
+        i = (unsigned int) round(fi);
+        j = (unsigned int) round(fj);
+        if (i < ni && j < nj) {
+            size_t offset = GRID_OFFSET(&proj, i, j);
+            CHECK(fabs(sin_angle[offset]) < 1e-3 && fabs(cos_angle[offset] - 1.f) < 1e-6, "%s: rotation at the orientation longitude is (%f, %f)",
+                  name, sin_angle[offset], cos_angle[offset]);
+        }
+    }
+
+    free(sin_angle);
+    free(cos_angle);
+}
+
+int main(void) {
+    double hrrr[N_GRID_PARAMS] = {0}, southern[N_GRID_PARAMS] = {0}, latlon[N_GRID_PARAMS] = {0}, rotated[N_GRID_PARAMS] = {0};
+    float sin_angle[4 * 3], cos_angle[4 * 3];
+    unsigned int i;
+    int status;
+
+    // HRRR's CONUS grid
+    hrrr[GRID_PARAM_TEMPLATE] = GRID_TEMPLATE_LAMBERT;
+    hrrr[GRID_PARAM_NI] = 1799;
+    hrrr[GRID_PARAM_NJ] = 1059;
+    hrrr[GRID_PARAM_SCAN_MODE] = 0x40;
+    hrrr[GRID_PARAM_SEMIMAJOR] = 6371229.;
+    hrrr[GRID_PARAM_SEMIMINOR] = 6371229.;
+    hrrr[GRID_PARAM_LAT_FIRST] = 21.138123;
+    hrrr[GRID_PARAM_LON_FIRST] = 237.280472;
+    hrrr[GRID_PARAM_DI] = 3000.;
+    hrrr[GRID_PARAM_DJ] = 3000.;
+    hrrr[GRID_PARAM_LAD] = 38.5;
+    hrrr[GRID_PARAM_LOV] = 262.5;
+    hrrr[GRID_PARAM_LATIN1] = 38.5;
+    hrrr[GRID_PARAM_LATIN2] = 38.5;
+    check_lambert("hrrr", hrrr);
+
+    // A southern hemisphere grid on an ellipsoid, with two standard latitudes
+    southern[GRID_PARAM_TEMPLATE] = GRID_TEMPLATE_LAMBERT;
+    southern[GRID_PARAM_NI] = 400;
+    southern[GRID_PARAM_NJ] = 300;
+    southern[GRID_PARAM_SCAN_MODE] = 0x40;
+    southern[GRID_PARAM_SEMIMAJOR] = 6378137.;
+    southern[GRID_PARAM_SEMIMINOR] = 6356752.314;
+    southern[GRID_PARAM_LAT_FIRST] = -50.;
+    southern[GRID_PARAM_LON_FIRST] = 110.;
+    southern[GRID_PARAM_DI] = 12000.;
+    southern[GRID_PARAM_DJ] = 12000.;
+    southern[GRID_PARAM_LAD] = -30.;
+    southern[GRID_PARAM_LOV] = 135.;
+    southern[GRID_PARAM_LATIN1] = -20.;
+    southern[GRID_PARAM_LATIN2] = -40.;
+    check_lambert("southern", southern);
+
+    // Grid-relative and earth-relative are the same on a lat/lon grid
+    latlon[GRID_PARAM_TEMPLATE] = GRID_TEMPLATE_LATLON;
+    latlon[GRID_PARAM_NI] = 4;
+    latlon[GRID_PARAM_NJ] = 3;
+    latlon[GRID_PARAM_LAT_FIRST] = 50.;
+    latlon[GRID_PARAM_LON_FIRST] = 250.;
+    latlon[GRID_PARAM_DI] = 1.;
+    latlon[GRID_PARAM_DJ] = 1.;
+    status = grid_coordinates(latlon, GRID_COORDS_WIND_ROTATION, sin_angle, cos_angle);
+    CHECK(status == 0, "latlon: grid_coordinates returned %d", status);
+    for (i = 0; i < 4 * 3; i++) {
+        CHECK(sin_angle[i] == 0.f && cos_angle[i] == 1.f, "latlon: rotation at %u is (%f, %f)", i, sin_angle[i], cos_angle[i]);
+    }
+
+    // Not supported on rotated lat/lon grids
+    rotated[GRID_PARAM_TEMPLATE] = GRID_TEMPLATE_ROTATED_LATLON;
+    rotated[GRID_PARAM_NI] = 4;
+    rotated[GRID_PARAM_NJ] = 3;
+    rotated[GRID_PARAM_DI] = 1.;
+    rotated[GRID_PARAM_DJ] = 1.;
+    rotated[GRID_PARAM_SOUTH_POLE_LAT] = -40.;
+    rotated[GRID_PARAM_SOUTH_POLE_LON] = 10.;
+    status = grid_coordinates(rotated, GRID_COORDS_WIND_ROTATION, sin_angle, cos_angle);
+    CHECK(status != 0, "rotated: grid_coordinates should have failed");
+
+    if (n_failures > 0) {
+        printf("test_grid_projection: %d failures\n", n_failures);
+        return 1;
+    }
+
+    printf("test_grid_projection: all passed\n");
+    return 0;
+}
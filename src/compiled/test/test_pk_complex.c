@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "../grib_compression.h"
+#include "../extract_bytes.h"
+
+// Round-trip tests for pk_complex(): pack a field, unpack it with unpk_complex() or unpk_sd_complex() the way the decoders do, and check that every
+//   point comes back within the packing precision (and missing points come back missing).
+
+#define N_THREAD_COPIES 8
+
+static int n_failures = 0;
+
+#define CHECK(cond, ...) do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            n_failures++; \
+        } \
+    } while (0)
+
+static float reference_value(const unsigned char *sec5) {
+    // The reference value is a big-endian IEEE float, like the decoders read it
+    unsigned int bits = uint4(sec5 + 11);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static int unpack(const unsigned char *sec5, unsigned char *sec7, unsigned int sec7_size, unsigned int npnts, float *output) {
+    // Decode a packed field, reading the template 5.2/5.3 parameters out of section 5
+    int *packed, status;
+    unsigned int drt = uint2(sec5 + 9);
+    unsigned int ngroups = uint4(sec5 + 31);
+
+    packed = (int *) malloc(sizeof(int) * (npnts > 0 ? npnts : 1));
+    if (drt == 3) {
+        status = unpk_sd_complex(npnts, sec5[19], ngroups, sec5[21], sec5[22], sec5[35], sec5[36], uint4(sec5 + 37), sec5[41], uint4(sec5 + 42),
+                                 sec5[46], sec7_size - 5, sec5[47], sec5[48], sec7 + 5, packed);
+    }
+    else {
+        status = unpk_complex(npnts, sec5[19], ngroups, sec5[21], sec5[22], sec5[35], sec5[36], uint4(sec5 + 37), sec5[41], uint4(sec5 + 42),
+                              sec5[46], sec7_size - 5, sec7 + 5, packed);
+    }
+
+    if (status == 0) {
+        status = unpack_scaling(packed, npnts, NULL, npnts, reference_value(sec5), int2(sec5 + 15), int2(sec5 + 17), OUTPUT_FLOAT32, output, NULL);
+    }
+
+    free(packed);
+    return status;
+}
+
+static void check_round_trip(const char *name, const float *data, unsigned int npnts, int decimal_scale_factor, int sd_order) {
+    unsigned char sec5[49];
+    unsigned char *sec7 = NULL;
+    unsigned int sec5_size, sec7_size, i, n_bad = 0;
+    float *output;
+    double tolerance = 0.5 * pow(10., -decimal_scale_factor);
+    int status;
+
+    status = pk_complex(data, npnts, decimal_scale_factor, 0, sd_order, sec5, &sec5_size, &sec7, &sec7_size);
+    CHECK(status == 0, "%s (order %d): pk_complex returned %d", name, sd_order, status);
+    if (status != 0) return;
+
+    CHECK(uint4(sec5) == sec5_size && sec5[4] == 5, "%s (order %d): bad section 5 header", name, sd_order);
+    CHECK(uint4(sec7) == sec7_size && sec7[4] == 7, "%s (order %d): bad section 7 header", name, sd_order);
+    CHECK(sd_order < 0 || uint2(sec5 + 9) == (sd_order > 0 ? 3 : 2), "%s (order %d): wrong template %u", name, sd_order, uint2(sec5 + 9));
+
+    output = (float *) malloc(sizeof(float) * (npnts > 0 ? npnts : 1));
+    status = unpack(sec5, sec7, sec7_size, npnts, output);
+    CHECK(status == 0, "%s (order %d): unpacking returned %d", name, sd_order, status);
+
+    if (status == 0) {
+        for (i = 0; i < npnts; i++) {
+            int ok = isnan(data[i]) ? isnan(output[i]) : fabs(output[i] - data[i]) <= tolerance + 1e-6 * fabs(data[i]);
+            if (!ok && n_bad++ == 0) {
+                CHECK(ok, "%s (order %d): point %u was %g, came back %g", name, sd_order, i, data[i], output[i]);
+            }
+        }
+        CHECK(n_bad == 0, "%s (order %d): %u points didn't round-trip", name, sd_order, n_bad);
+    }
+
+    free(output);
+    free(sec7);
+}
+
+static void check_threads(const float *data, unsigned int npnts) {
+    // Encoding the same field on several threads at once should give the same output as encoding it on one
+    unsigned char sec5[49], thread_sec5[N_THREAD_COPIES][49];
+    unsigned char *sec7, *thread_sec7[N_THREAD_COPIES];
+    unsigned int sec5_size, sec7_size, thread_sec7_size[N_THREAD_COPIES];
+    int status, thread_status[N_THREAD_COPIES], i;
+
+    status = pk_complex(data, npnts, 2, 0, 2, sec5, &sec5_size, &sec7, &sec7_size);
+    CHECK(status == 0, "threads: pk_complex returned %d", status);
+    if (status != 0) return;
+
+#pragma omp parallel for schedule(static, 1) num_threads(N_THREAD_COPIES)
+    for (i = 0; i < N_THREAD_COPIES; i++) {
+        unsigned int thread_sec5_size;
+        thread_status[i] = pk_complex(data, npnts, 2, 0, 2, thread_sec5[i], &thread_sec5_size, &thread_sec7[i], &thread_sec7_size[i]);
+    }
+
+    for (i = 0; i < N_THREAD_COPIES; i++) {
+        CHECK(thread_status[i] == 0, "threads: copy %d returned %d", i, thread_status[i]);
+        if (thread_status[i] != 0) continue;
+
+        CHECK(memcmp(thread_sec5[i], sec5, sec5_size) == 0, "threads: copy %d has a different section 5", i);
+        CHECK(thread_sec7_size[i] == sec7_size && memcmp(thread_sec7[i], sec7, sec7_size) == 0, "threads: copy %d has a different section 7", i);
+        free(thread_sec7[i]);
+    }
+
+    free(sec7);
+}
+
+int main(void) {
+    const unsigned int nx = 300, ny = 200, npnts = nx * ny;
+    const int sd_orders[] = {-1, 0, 1, 2};
+    float *smooth, *with_nan, *constant, *all_missing, *noisy;
+    float one_point = 273.15f;
+    unsigned int i, iorder;
+
+    smooth = (float *) malloc(sizeof(float) * npnts);
+    with_nan = (float *) malloc(sizeof(float) * npnts);
+    constant = (float *) malloc(sizeof(float) * npnts);
+    all_missing = (float *) malloc(sizeof(float) * npnts);
+    noisy = (float *) malloc(sizeof(float) * npnts);
+
+    srand(12345);
+    for (i = 0; i < npnts; i++) {
+        float x = (float) (i % nx) / nx, y = (float) (i / nx) / ny;
+        smooth[i] = 250.f + 40.f * sinf(6.f * x) * cosf(4.f * y);
+        // Missing values in runs (like a bitmap over water) and scattered single points
+        with_nan[i] = (x > 0.3f && x < 0.5f) || i % 97 == 0 ? NAN : smooth[i];
+        constant[i] = 101325.f;
+        all_missing[i] = NAN;
+        noisy[i] = (float) rand() / RAND_MAX * 2000.f - 1000.f;
+    }
+
+    for (iorder = 0; iorder < sizeof(sd_orders) / sizeof(sd_orders[0]); iorder++) {
+        int sd_order = sd_orders[iorder];
+        check_round_trip("smooth", smooth, npnts, 2, sd_order);
+        check_round_trip("nan", with_nan, npnts, 2, sd_order);
+        check_round_trip("constant", constant, npnts, 0, sd_order);
+        check_round_trip("all missing", all_missing, npnts, 1, sd_order);
+        check_round_trip("noisy", noisy, npnts, 3, sd_order);
+        check_round_trip("one point", &one_point, 1, 2, sd_order);
+    }
+
+    check_threads(noisy, npnts);
+
+    free(smooth);
+    free(with_nan);
+    free(constant);
+    free(all_missing);
+    free(noisy);
+
+    if (n_failures > 0) {
+        printf("test_pk_complex: %d failures\n", n_failures);
+        return 1;
+    }
+
+    printf("test_pk_complex: all passed\n");
+    return 0;
+}
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "unpack_scaling.h"
+#include "decode_counters.h"
+
+// Final step of decoding: take the packed integers from a decoder, expand them with the bitmap (if any), and scale them to the
+//   requested output format, all in one pass. Missing values come from zeros in the bitmap or from INT_MAX in the packed data
+//   (which is how unpk_complex() marks them).
+
+#define SCALING_CHUNK 4096          // points per chunk when expanding a bitmap in parallel; must be a multiple of 8
+
+// Statistics on the packed integers for one chunk. These get converted to physical values at the end, which works because the scaling is linear
+//   and increasing.
+struct packed_stats {
+    int min, max;
+    unsigned int n_valid;
+    double sum, sumsq;
+};
+
+static const unsigned char bitmap_mask[8] = {128, 64, 32, 16, 8, 4, 2, 1};
+
+unsigned short flt2half(float x) {
+    // IEEE single to half precision, rounding to nearest even
+    unsigned int f, sign, exp, mant;
+    int half_exp;
+
+    memcpy(&f, &x, sizeof(f));
+    sign = (f >> 16) & 0x8000;
+    exp = (f >> 23) & 0xff;
+    mant = f & 0x7fffff;
+
+    if (exp == 0xff) {
+        // Inf or NaN
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    }
+
+    half_exp = (int) exp - 127 + 15;
+    if (half_exp >= 31) {
+        // Overflows to infinity
+        return sign | 0x7c00;
+    }
+
+    if (half_exp <= 0) {
+        // Subnormal or zero
+        unsigned int shift, half_mant, rem, halfway;
+        if (half_exp < -10) return sign;
+
+        mant |= 0x800000;
+        shift = 14 - half_exp;
+        half_mant = mant >> shift;
+        rem = mant & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (half_mant & 1))) half_mant++;
+        return sign | half_mant;
+    }
+
+    {
+        unsigned int half = sign | ((unsigned int) half_exp << 10) | (mant >> 13);
+        unsigned int rem = mant & 0x1fff;
+        // A carry out of the mantissa correctly bumps the exponent (and rounds to infinity at the top)
+        if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;
+        return half;
+    }
+}
+
+static void scale_range(const int *packed, unsigned int i_input, const unsigned char *bitmap, unsigned int start, unsigned int end,
+                        double ref, double bin_exp, double dec_exp, int output_format, void *output) {
+    unsigned int i;
+    int is_missing, val;
+    float fval;
+
+    for (i = start; i < end; i++) {
+        if (bitmap != NULL && !(bitmap[i >> 3] & bitmap_mask[i & 7])) {
+            is_missing = 1;
+            val = 0;
+        }
+        else {
+            val = packed[i_input++];
+            is_missing = val == INT_MAX;
+        }
+
+        switch (output_format) {
+            case OUTPUT_FLOAT32:
+                ((float *) output)[i] = is_missing ? NAN : scale_packed(ref, val, bin_exp, dec_exp);
+                break;
+            case OUTPUT_FLOAT16:
+                fval = is_missing ? NAN : scale_packed(ref, val, bin_exp, dec_exp);
+                ((unsigned short *) output)[i] = flt2half(fval);
+                break;
+            case OUTPUT_PACKED16:
+                ((unsigned short *) output)[i] = is_missing ? PACKED16_MISSING : (unsigned short) val;
+                break;
+            case OUTPUT_PACKED32:
+                ((unsigned int *) output)[i] = is_missing ? PACKED32_MISSING : (unsigned int) val;
+                break;
+        }
+    }
+}
+
+static void packed_range_stats(const int *packed, unsigned int n, struct packed_stats *stats) {
+    // The simd pragma tells the compiler it's OK to reorder the sums, so this loop can be vectorized (needs -fopenmp or -fopenmp-simd)
+    int min = INT_MAX, max = INT_MIN;
+    unsigned int i, n_valid = 0;
+    double sum = 0., sumsq = 0.;
+
+#pragma omp simd reduction(min:min) reduction(max:max) reduction(+:n_valid, sum, sumsq)
+    for (i = 0; i < n; i++) {
+        // Missing values are INT_MAX, so they can't lower the minimum, and they're swapped for INT_MIN for the maximum
+        int val = packed[i];
+        int is_valid = val != INT_MAX;
+        int val_max = is_valid ? val : INT_MIN;
+        double dval = (double) (is_valid ? val : 0);
+
+        min = val < min ? val : min;
+        max = val_max > max ? val_max : max;
+        n_valid += is_valid;
+        sum += dval;
+        sumsq += dval * dval;
+    }
+
+    stats->min = min;
+    stats->max = max;
+    stats->n_valid = n_valid;
+    stats->sum = sum;
+    stats->sumsq = sumsq;
+}
+
+static void physical_stats(const struct packed_stats *chunk_stats, unsigned int nchunks, unsigned int n_out, double ref, double bin_exp, double dec_exp,
+                           double *stats) {
+    // Combine the chunks (in order, so the result doesn't depend on the number of threads) and convert to physical values. With v = a + b * p,
+    //   sum(v) = n * a + b * sum(p) and sum(v^2) = n * a^2 + 2 * a * b * sum(p) + b^2 * sum(p^2).
+    unsigned int ichunk;
+    int min = INT_MAX, max = INT_MIN;
+    double n = 0., sum = 0., sumsq = 0.;
+    double a = ref * dec_exp, b = bin_exp * dec_exp;
+
+    for (ichunk = 0; ichunk < nchunks; ichunk++) {
+        if (chunk_stats[ichunk].n_valid == 0) continue;
+        if (chunk_stats[ichunk].min < min) min = chunk_stats[ichunk].min;
+        if (chunk_stats[ichunk].max > max) max = chunk_stats[ichunk].max;
+        n += chunk_stats[ichunk].n_valid;
+        sum += chunk_stats[ichunk].sum;
+        sumsq += chunk_stats[ichunk].sumsq;
+    }
+
+    stats[FIELD_STATS_MIN] = n > 0 ? a + b * min : NAN;
+    stats[FIELD_STATS_MAX] = n > 0 ? a + b * max : NAN;
+    stats[FIELD_STATS_SUM] = n * a + b * sum;
+    stats[FIELD_STATS_SUMSQ] = n * a * a + 2. * a * b * sum + b * b * sumsq;
+    stats[FIELD_STATS_MISSING] = n_out - n;
+}
+
+static unsigned int count_bits(const unsigned char *bitmap, unsigned int start, unsigned int end) {
+    unsigned int i, n = 0;
+    for (i = start; i < end; i++) {
+        if (bitmap[i >> 3] & bitmap_mask[i & 7]) n++;
+    }
+    return n;
+}
+
+int unpack_scaling(const int *packed, unsigned int n_packed, const unsigned char *bitmap, unsigned int n_out,
+                   float reference_value, int binary_scale_factor, int decimal_scale_factor, int output_format, void *output, double *stats) {
+    // packed is the output of the decoder, with n_packed values
+    // bitmap is the bitmap from section 6, or NULL if there's no bitmap. With no bitmap, n_packed should equal n_out.
+    // n_out is the size of the full grid
+    // output_format is one of the OUTPUT_* values, and output must hold n_out values of that type.
+    // stats is NULL, or N_FIELD_STATS values to fill with the min, max, sum, sum of squares, and number of missing points in physical units. These are
+    //   computed chunk by chunk right after each chunk is scaled, while its packed values are still in cache, rather than in a separate pass over the grid.
+
+    unsigned int nchunks, ichunk;
+    unsigned int *chunk_offsets;
+    struct packed_stats *chunk_stats = NULL;
+    double bin_exp, dec_exp;
+
+    if (output_format < OUTPUT_FLOAT32 || output_format > OUTPUT_PACKED32) {
+        printf("unpack_scaling: unknown output format %d\n", output_format);
+        return -1;
+    }
+
+    if (bitmap == NULL && n_packed < n_out) {
+        printf("unpack_scaling: expected %u values, got %u\n", n_out, n_packed);
+        return -2;
+    }
+
+    bin_exp = pow(2., binary_scale_factor);
+    dec_exp = pow(10., -decimal_scale_factor);
+
+    nchunks = (n_out + SCALING_CHUNK - 1) / SCALING_CHUNK;
+    chunk_offsets = (unsigned int *) malloc(sizeof(unsigned int) * ((size_t) nchunks + 1));
+    if (chunk_offsets == NULL) {
+        printf("unpack_scaling: memory allocation\n");
+        return -1;
+    }
+
+    if (stats != NULL) {
+        chunk_stats = (struct packed_stats *) malloc(sizeof(struct packed_stats) * ((size_t) nchunks + 1));
+        if (chunk_stats == NULL) {
+            printf("unpack_scaling: memory allocation\n");
+            free(chunk_offsets);
+            return -1;
+        }
+    }
+
+    // Find where each chunk starts in the packed data, so the chunks can be done independently
+    chunk_offsets[0] = 0;
+    if (bitmap != NULL) {
+#pragma omp parallel for schedule(static)
+        for (ichunk = 0; ichunk < nchunks; ichunk++) {
+            unsigned int end = (ichunk + 1) * SCALING_CHUNK > n_out ? n_out : (ichunk + 1) * SCALING_CHUNK;
+            chunk_offsets[ichunk + 1] = count_bits(bitmap, ichunk * SCALING_CHUNK, end);
+        }
+
+        for (ichunk = 0; ichunk < nchunks; ichunk++) {
+            chunk_offsets[ichunk + 1] += chunk_offsets[ichunk];
+        }
+
+        if (chunk_offsets[nchunks] > n_packed) {
+            printf("unpack_scaling: bitmap has %u points, but there are only %u values\n", chunk_offsets[nchunks], n_packed);
+            free(chunk_offsets);
+            free(chunk_stats);
+            return -2;
+        }
+    }
+    else {
+        for (ichunk = 0; ichunk < nchunks; ichunk++) {
+            chunk_offsets[ichunk + 1] = (ichunk + 1) * SCALING_CHUNK > n_out ? n_out : (ichunk + 1) * SCALING_CHUNK;
+        }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (ichunk = 0; ichunk < nchunks; ichunk++) {
+        unsigned int end = (ichunk + 1) * SCALING_CHUNK > n_out ? n_out : (ichunk + 1) * SCALING_CHUNK;
+        scale_range(packed, chunk_offsets[ichunk], bitmap, ichunk * SCALING_CHUNK, end,
+                    reference_value, bin_exp, dec_exp, output_format, output);
+
+        if (chunk_stats != NULL) {
+            // The chunk's packed values are still in cache from the scaling
+            packed_range_stats(packed + chunk_offsets[ichunk], chunk_offsets[ichunk + 1] - chunk_offsets[ichunk], &chunk_stats[ichunk]);
+        }
+    }
+
+    if (chunk_stats != NULL) {
+        physical_stats(chunk_stats, nchunks, n_out, reference_value, bin_exp, dec_exp, stats);
+        free(chunk_stats);
+        COUNT_DECODE(allocations, 1);
+    }
+
+    free(chunk_offsets);
+
+    COUNT_DECODE(allocations, 1);
+    return 0;
+}
@@ -0,0 +1,24 @@
+#define OUTPUT_FLOAT32 0
+#define OUTPUT_FLOAT16 1
+#define OUTPUT_PACKED16 2
+#define OUTPUT_PACKED32 3
+
+#define PACKED16_MISSING 0xffff
+#define PACKED32_MISSING 0xffffffff
+
+#define N_FIELD_STATS 5
+#define FIELD_STATS_MIN 0
+#define FIELD_STATS_MAX 1
+#define FIELD_STATS_SUM 2
+#define FIELD_STATS_SUMSQ 3
+#define FIELD_STATS_MISSING 4
+
+// Physical value of a packed integer. Everything that scales packed integers uses this, so the values can be packed again exactly (see
+//   field_to_packed16()).
+static inline float scale_packed(double ref, int val, double bin_exp, double dec_exp) {
+    return (float) ((ref + val * bin_exp) * dec_exp);
+}
+
+unsigned short flt2half(float x);
+int unpack_scaling(const int *packed, unsigned int n_packed, const unsigned char *bitmap, unsigned int n_out,
+                   float reference_value, int binary_scale_factor, int decimal_scale_factor, int output_format, void *output, double *stats);
@@ -5,6 +5,7 @@
 
 #include "bitstream.h"
 #include "extract_bytes.h"
+#include "decode_counters.h"
 
 #ifdef USE_OPENMP
 #include <omp.h>
@@ -21,7 +22,7 @@
 
 int unpk_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
     unsigned char group_split_method, unsigned char missing_val_method, unsigned char ref_group_width, unsigned char nbit_group_width,
-    unsigned int ref_group_length, unsigned char group_length_factor, unsigned char len_last,
+    unsigned int ref_group_length, unsigned char group_length_factor, unsigned int len_last,
     unsigned char nbits_group_len, unsigned int sec7_size, unsigned char *data_in, int *data_out) {
 
     unsigned int i, ii, j, n_bytes, n_bits;
@@ -36,7 +37,7 @@ int unpk_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
     int bitmap_flag;
     int nthreads, thread_id;
     unsigned int di;
-    int bitstream_stat;
+    int bitstream_err;
 
     data_ptr = data_in;
     nbits = nbits;
@@ -55,8 +56,12 @@ int unpk_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
             return -1;
     }
 
+    COUNT_DECODE(allocations, 6);
+    COUNT_DECODE(groups_decoded, ngroups);
+
     // do a check for number of grid points and size
     clocation = offset = n_bytes = n_bits = j = 0;
+    bitstream_err = 0;
 
 #pragma omp parallel private (i, ii, k, di, thread_id, nthreads)
     {
@@ -77,13 +82,11 @@ int unpk_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
             if (k > di) k = di;
 
             // read the group reference values
-            bitstream_stat = rd_bitstream(data_ptr + (i/8)*nbits, 0, group_refs+i, nbits, k);
-            if (bitstream_stat != 0) return -2;
+            if (rd_bitstream(data_ptr + (i/8)*nbits, 0, group_refs+i, nbits, k) != 0) bitstream_err = 1;
 
             // read the group widths
-            bitstream_stat = rd_bitstream(data_ptr+(nbits*ngroups+7)/8+(i/8)*nbit_group_width, 0,
-                                          group_widths+i,nbit_group_width,k);
-            if (bitstream_stat != 0) return -2;
+            if (rd_bitstream(data_ptr+(nbits*ngroups+7)/8+(i/8)*nbit_group_width, 0,
+                             group_widths+i,nbit_group_width,k) != 0) bitstream_err = 1;
 
             for (ii = 0; ii < k; ii++) group_widths[i+ii] += ref_group_width;
         }
@@ -102,9 +105,8 @@ int unpk_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
             if (i < ngroups - 1) {
                 k  = ngroups - 1 - i;
                 if (k > di) k = di;
-                bitstream_stat = rd_bitstream(data_ptr+(nbits*ngroups+7)/8+(ngroups*nbit_group_width+7)/8 + 
-                                              (i/8)*nbits_group_len, 0,group_lengths + i, nbits_group_len, k);
-                if (bitstream_stat != 0) return -2;
+                if (rd_bitstream(data_ptr+(nbits*ngroups+7)/8+(ngroups*nbit_group_width+7)/8 + 
+                                 (i/8)*nbits_group_len, 0,group_lengths + i, nbits_group_len, k) != 0) bitstream_err = 1;
 
                 for (ii = 0; ii < k; ii++) group_lengths[i+ii] = 
                     group_lengths[i+ii] * group_length_factor + ref_group_length;
@@ -165,6 +167,12 @@ int unpk_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
         }
     }
 
+    // can't return from inside the parallel region, so check for bitstream errors here
+    if (bitstream_err) {
+        printf("unpk_complex: error reading group descriptors\n");
+        return -2;
+    }
+
     if (j != npnts) {
         printf("bad complex packing: n points %u\n", j);
         return -2;
@@ -186,9 +194,13 @@ int unpk_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
         group_clocation[i] += (group_offset[i] / 8);
         group_offset[i] = (group_offset[i] % 8);
 
-        bitstream_stat = rd_bitstream(data_ptr + group_clocation[i], group_offset[i], data_out+group_location[i], 
-                                      group_widths[i], group_lengths[i]);
-        if (bitstream_stat != 0) return -2;
+        if (rd_bitstream(data_ptr + group_clocation[i], group_offset[i], data_out+group_location[i], 
+                         group_widths[i], group_lengths[i]) != 0) bitstream_err = 1;
+    }
+
+    if (bitstream_err) {
+        printf("unpk_complex: error reading packed data\n");
+        return -2;
     }
 
     // handle substitute, missing values and reference value
@@ -258,12 +270,164 @@ int unpk_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
 	free(group_clocation);
 	free(group_offset);
 
+    COUNT_DECODE(values_decoded, npnts);
+
     return 0;
 }
 
+int extract_complex(unsigned int npnts, unsigned char nbits, unsigned int ngroups,
+    unsigned char group_split_method, unsigned char missing_val_method, unsigned char ref_group_width, unsigned char nbit_group_width,
+    unsigned int ref_group_length, unsigned char group_length_factor, unsigned int len_last,
+    unsigned char nbits_group_len, unsigned int sec7_size, unsigned char *data_in, const int *indices, unsigned int n_indices, int *data_out) {
+
+    // Like unpk_complex(), but only unpacks the values at the given indices (in the packed data). An index of -1 gives a missing value (INT_MAX).
+    // The group descriptors still have to be read, but only the groups containing the requested points get unpacked.
+
+    unsigned int i, n_groups_read, last_group;
+    int *group_refs, *group_widths, *group_lengths;
+    unsigned int *group_location;
+    unsigned long long *group_bit, n_data_bits;
+    unsigned char *data_ptr;
+
+    group_refs = (int *) malloc(sizeof (int) * (size_t) ngroups);
+    group_widths = (int *) malloc(sizeof (int) * (size_t) ngroups);
+    group_lengths = (int *) malloc(sizeof (int) * (size_t) ngroups);
+    group_location = (unsigned int *) malloc(sizeof (unsigned int) * ((size_t) ngroups + 1));
+    group_bit = (unsigned long long *) malloc(sizeof (unsigned long long) * (size_t) ngroups);
+
+    if (group_refs == NULL || group_widths == NULL || group_lengths == NULL || group_location == NULL || group_bit == NULL) {
+        printf("extract_complex: memory allocation\n");
+        free(group_refs);
+        free(group_widths);
+        free(group_lengths);
+        free(group_location);
+        free(group_bit);
+        return -1;
+    }
+
+    COUNT_DECODE(allocations, 5);
+
+    // read the group reference values, widths, and lengths
+    data_ptr = data_in;
+    if (rd_bitstream(data_ptr, 0, group_refs, nbits, ngroups) != 0) goto descriptor_err;
+    data_ptr += (nbits * ngroups + 7) / 8;
+
+    if (rd_bitstream(data_ptr, 0, group_widths, nbit_group_width, ngroups) != 0) goto descriptor_err;
+    for (i = 0; i < ngroups; i++) group_widths[i] += ref_group_width;
+    data_ptr += (ngroups * nbit_group_width + 7) / 8;
+
+    if (group_split_method == 1 && ngroups > 0) {
+        if (rd_bitstream(data_ptr, 0, group_lengths, nbits_group_len, ngroups - 1) != 0) goto descriptor_err;
+        for (i = 0; i < ngroups - 1; i++) group_lengths[i] = group_lengths[i] * group_length_factor + ref_group_length;
+        group_lengths[ngroups - 1] = len_last;
+    }
+    data_ptr += (ngroups * nbits_group_len + 7) / 8;
+
+    // where each group starts in the grid and in the packed data
+    group_location[0] = 0;
+    n_data_bits = 0;
+    for (i = 0; i < ngroups; i++) {
+        group_location[i + 1] = group_location[i] + group_lengths[i];
+        group_bit[i] = n_data_bits;
+        n_data_bits += (unsigned long long) group_lengths[i] * group_widths[i];
+    }
+
+    if (group_location[ngroups] != npnts) {
+        printf("bad complex packing: n points %u\n", group_location[ngroups]);
+        goto size_err;
+    }
+
+    if (data_ptr + (n_data_bits + 7) / 8 - data_in != sec7_size) {
+        printf("complex unpacking size mismatch\n");
+        goto size_err;
+    }
+
+    n_groups_read = 0;
+    last_group = ngroups;
+
+    for (i = 0; i < n_indices; i++) {
+        unsigned int lo, hi, g, idx;
+        unsigned long long bit;
+        int val, m1, m2;
+
+        if (indices[i] < 0) {
+            data_out[i] = INT_MAX;
+            continue;
+        }
+
+        idx = (unsigned int) indices[i];
+        if (idx >= npnts) {
+            printf("extract_complex: index %u is out of range for %u points\n", idx, npnts);
+            goto size_err;
+        }
+
+        // find the last group starting at or before this point (which skips any empty groups)
+        lo = 0;
+        hi = ngroups;
+        while (hi - lo > 1) {
+            unsigned int mid = lo + (hi - lo) / 2;
+            if (group_location[mid] <= idx) lo = mid;
+            else hi = mid;
+        }
+        g = lo;
+
+        if (g != last_group) n_groups_read++;
+        last_group = g;
+
+        if (group_widths[g] == 0) {
+            val = 0;
+            m1 = (1 << nbits) - 1;
+            if ((missing_val_method == 1 && group_refs[g] == m1) || (missing_val_method == 2 && (group_refs[g] == m1 || group_refs[g] == m1 - 1))) {
+                data_out[i] = INT_MAX;
+                continue;
+            }
+        }
+        else {
+            bit = group_bit[g] + (unsigned long long) (idx - group_location[g]) * group_widths[g];
+            if (rd_bitstream(data_ptr + bit / 8, (int) (bit % 8), &val, group_widths[g], 1) != 0) goto descriptor_err;
+
+            m1 = (1 << group_widths[g]) - 1;
+            m2 = m1 - 1;
+            if ((missing_val_method == 1 && val == m1) || (missing_val_method == 2 && (val == m1 || val == m2))) {
+                data_out[i] = INT_MAX;
+                continue;
+            }
+        }
+
+        data_out[i] = val + group_refs[g];
+    }
+
+    COUNT_DECODE(groups_decoded, n_groups_read);
+    COUNT_DECODE(values_decoded, n_indices);
+
+    free(group_refs);
+    free(group_widths);
+    free(group_lengths);
+    free(group_location);
+    free(group_bit);
+    return 0;
+
+descriptor_err:
+    printf("extract_complex: error reading packed data\n");
+    free(group_refs);
+    free(group_widths);
+    free(group_lengths);
+    free(group_location);
+    free(group_bit);
+    return -2;
+
+size_err:
+    free(group_refs);
+    free(group_widths);
+    free(group_lengths);
+    free(group_location);
+    free(group_bit);
+    return -3;
+}
+
 int unpk_sd_complex(unsigned int npnts, unsigned char nbits, unsigned int n_groups,
     unsigned char group_split_method, unsigned char missing_val_method, unsigned char ref_group_width, unsigned char nbit_group_width,
-    unsigned int ref_group_length, unsigned char group_length_factor, unsigned char len_last,
+    unsigned int ref_group_length, unsigned char group_length_factor, unsigned int len_last,
     unsigned char nbits_group_len, unsigned int sec7_size, unsigned char sd_order, unsigned char extra_octets, unsigned char *data_in, int *data_out) {
 
     unsigned int i;
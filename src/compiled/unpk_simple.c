@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <limits.h>
+
+#include "bitstream.h"
+#include "decode_counters.h"
+
+// Simple packing (data representation template 5.0): every value is packed in nbits bits, one after the other, so value i starts at bit i * nbits.
+
+int unpk_simple(unsigned int npnts, int nbits, unsigned int sec7_size, unsigned char *data_in, int *data_out) {
+    if ((unsigned long long) npnts * nbits > (unsigned long long) sec7_size * 8) {
+        printf("unpk_simple: %u points of %d bits don't fit in %u bytes\n", npnts, nbits, sec7_size);
+        return -3;
+    }
+
+    if (rd_bitstream(data_in, 0, data_out, nbits, npnts) != 0) {
+        printf("unpk_simple: error reading packed data\n");
+        return -2;
+    }
+
+    COUNT_DECODE(values_decoded, npnts);
+    return 0;
+}
+
+int extract_simple(unsigned int npnts, int nbits, unsigned int sec7_size, unsigned char *data_in, const int *indices, unsigned int n_indices,
+                   int *data_out) {
+    // Unpack only the values at the given indices (in the packed data). An index of -1 gives a missing value (INT_MAX).
+    unsigned int i;
+
+    if ((unsigned long long) npnts * nbits > (unsigned long long) sec7_size * 8) {
+        printf("extract_simple: %u points of %d bits don't fit in %u bytes\n", npnts, nbits, sec7_size);
+        return -3;
+    }
+
+    for (i = 0; i < n_indices; i++) {
+        unsigned long long bit;
+
+        if (indices[i] < 0) {
+            data_out[i] = INT_MAX;
+            continue;
+        }
+
+        if ((unsigned int) indices[i] >= npnts) {
+            printf("extract_simple: index %d is out of range for %u points\n", indices[i], npnts);
+            return -2;
+        }
+
+        bit = (unsigned long long) indices[i] * nbits;
+        if (rd_bitstream(data_in + bit / 8, (int) (bit % 8), data_out + i, nbits, 1) != 0) {
+            printf("extract_simple: error reading packed data\n");
+            return -2;
+        }
+    }
+
+    COUNT_DECODE(values_decoded, n_indices);
+    return 0;
+}
@@ -0,0 +1,242 @@
+import { Grib2Metrics, startStage } from "./grib2metrics";
+import type { Grib2HeaderTable } from "./grib2index";
+import { getCompressionModule, runNative } from "./unpack";
+
+interface Grib2IntervalOptions {
+    /** Set differences less than this to this (e.g., 0 for precipitation, to take out small negative amounts from packing error). Off by default. */
+    min_value?: number;
+    /** Collect timings into this object */
+    metrics?: Grib2Metrics;
+}
+
+/**
+ * The amount (or average) over one interval. Times are in seconds after the reference time.
+ */
+interface Grib2Interval {
+    start: number;
+    end: number;
+    /** The messages the interval came from: just the one message if it was already this interval, or the later and earlier buckets if they were differenced */
+    messages: number[];
+    data: Float32Array;
+}
+
+/**
+ * The intervals for one field, in order of time
+ */
+interface Grib2IntervalSeries {
+    /** The field's inventory string, without the message number, offset, or forecast time */
+    field: string;
+    /** How the field is aggregated ('acc', 'ave', etc.) */
+    agg_type: string;
+    intervals: Grib2Interval[];
+}
+
+// Accumulations difference directly, and averages have to be weighted by their window lengths first
+const difference_kinds: Record<string, 'sum' | 'mean'> = {
+    'acc': 'sum',
+    'summation': 'sum',
+    'last-first': 'sum',
+    'ave': 'mean',
+};
+
+interface Grib2Window {
+    start: number;
+    end: number;
+    index: number;
+}
+
+interface Grib2IntervalPlan {
+    start: number;
+    end: number;
+    later: number;
+    earlier: number | null;
+    later_weight: number;
+    earlier_weight: number;
+}
+
+/**
+ * Work out how to get consecutive intervals from a set of windows that all start at the reference time or at earlier windows' ends (e.g., GFS's
+ *  alternating 0-3 and 0-6 hour buckets, or HRRR's 0-1, 0-2, ... hour buckets). Each interval runs from the previous window end to the next one. It's
+ *  taken straight from a window if there is one that covers exactly that interval, and otherwise it's the difference of two windows with the same start.
+ *  Intervals that can't be made either way are left out.
+ */
+function planIntervals(windows: Grib2Window[], kind: 'sum' | 'mean') {
+    const by_window: Record<string, number> = {};
+    windows.forEach(window => {
+        const key = `${window.start}:${window.end}`;
+        if (!(key in by_window)) by_window[key] = window.index;
+    });
+
+    const ends = windows.map(window => window.end).sort((a, b) => a - b).filter((end, i, ends) => i == 0 || end != ends[i - 1]);
+    const plans: Grib2IntervalPlan[] = [];
+
+    ends.forEach((end, iend) => {
+        // Shortest window first
+        const ending_here = windows.filter(window => window.end == end).sort((a, b) => b.start - a.start);
+
+        if (iend == 0) {
+            const window = ending_here[0];
+            plans.push({start: window.start, end: end, later: window.index, earlier: null, later_weight: 1, earlier_weight: 0});
+            return;
+        }
+
+        const start = ends[iend - 1];
+        const direct = `${start}:${end}`;
+        if (direct in by_window) {
+            plans.push({start: start, end: end, later: by_window[direct], earlier: null, later_weight: 1, earlier_weight: 0});
+            return;
+        }
+
+        const later = ending_here.filter(window => window.start < start && `${window.start}:${start}` in by_window)[0];
+        if (later !== undefined) {
+            const earlier = by_window[`${later.start}:${start}`];
+            const later_weight = kind == 'sum' ? 1 : (end - later.start) / (end - start);
+            const earlier_weight = kind == 'sum' ? 1 : (start - later.start) / (end - start);
+            plans.push({start: start, end: end, later: later.index, earlier: earlier, later_weight: later_weight, earlier_weight: earlier_weight});
+            return;
+        }
+
+        // There's a gap, so the best that can be done is the shortest window that doesn't overlap the previous interval
+        if (ending_here[0].start > start) {
+            const window = ending_here[0];
+            plans.push({start: window.start, end: end, later: window.index, earlier: null, later_weight: 1, earlier_weight: 0});
+        }
+    });
+
+    return plans;
+}
+
+/**
+ * Compute `later_weight * later - earlier_weight * earlier` natively
+ */
+async function differenceFields(later: Float32Array, later_weight: number, earlier: Float32Array, earlier_weight: number, opts?: Grib2IntervalOptions) {
+    opts = opts === undefined ? {} : opts;
+    const min_value = opts.min_value === undefined ? -Infinity : opts.min_value;
+    const metrics = opts.metrics;
+
+    if (later.length != earlier.length) {
+        throw `Can't difference fields with ${later.length} and ${earlier.length} points`;
+    }
+
+    const n_points = later.length;
+    const compression = await getCompressionModule(metrics);
+    const later_ = compression._malloc(Math.max(n_points, 1) * 4);
+    const earlier_ = compression._malloc(Math.max(n_points, 1) * 4);
+
+    const stop_input_copy = startStage(metrics, 'input_copy');
+    new Float32Array(compression.HEAPU8.buffer, later_, n_points).set(later);
+    new Float32Array(compression.HEAPU8.buffer, earlier_, n_points).set(earlier);
+    stop_input_copy({bytes: later.byteLength + earlier.byteLength});
+
+    // The difference goes back into the later field's buffer
+    const status = runNative(compression, 'difference', n_points, () => compression.ccall('field_difference', 'number',
+                             ['number', 'number', 'number', 'number', 'number', 'number', 'number'],
+                             [later_, later_weight, earlier_, earlier_weight, n_points, min_value, later_]) as number, metrics);
+
+    let output: Float32Array | null = null;
+    if (status == 0) {
+        const stop_output_copy = startStage(metrics, 'output_copy');
+        output = new Float32Array(compression.HEAPU8.buffer, later_, n_points).slice();
+        stop_output_copy({bytes: output.byteLength, points: n_points});
+    }
+
+    compression._free(later_);
+    compression._free(earlier_);
+
+    if (status != 0) {
+        throw `Differencing fields encountered an error: ${status}`;
+    }
+
+    return output;
+}
+
+/**
+ * Turn overlapping time-aggregated buckets into consecutive intervals. Messages are grouped by field (parameter, level, reference time, ensemble member,
+ *  and grid) and aggregation type, and each group's windows are ordered by time. Each message is decoded at most once, even if it's used for more than
+ *  one interval, and let go as soon as nothing else needs it.
+ * @param table - The header table for the messages
+ * @param decode - Decodes a message by index
+ * @param opts - Use `min_value` to clamp differences and `metrics` to collect timings
+ * @returns The intervals for each field. Fields with aggregations that can't be differenced (e.g., max and min) are left out.
+ */
+async function differenceAccumulations(table: Grib2HeaderTable, decode: (index: number) => Promise<Float32Array>, opts?: Grib2IntervalOptions) {
+    const groups: Record<string, {field: string, agg_type: string, windows: Grib2Window[]}> = {};
+    const group_keys: string[] = [];
+
+    const {agg_duration, forecast_time, grid_id} = table.columns;
+
+    for (let imsg = 0; imsg < table.n_messages; imsg++) {
+        if (agg_duration[imsg] <= 0 || isNaN(forecast_time[imsg])) continue;
+
+        // The inventory is "d=<reference time>:<parameter>:<surfaces>:<forecast time>:<ensemble>", and aggregated forecast times are
+        //  "<start>-<end> <unit> <aggregation> fcst"
+        const parts = table.getInventory(imsg).split(':');
+        const agg_match = parts.length < 4 ? null : parts[3].match(/^\S+ \S+ (.+) fcst$/);
+        if (agg_match === null || !(agg_match[1] in difference_kinds)) continue;
+
+        const agg_type = agg_match[1];
+        const field = parts.slice(0, 3).concat(parts.slice(4)).join(':');
+        const key = `${field}:${agg_type}:${grid_id[imsg]}`;
+
+        if (!(key in groups)) {
+            groups[key] = {field: field, agg_type: agg_type, windows: []};
+            group_keys.push(key);
+        }
+
+        groups[key].windows.push({start: forecast_time[imsg] - agg_duration[imsg], end: forecast_time[imsg], index: imsg});
+    }
+
+    const plans = group_keys.map(key => planIntervals(groups[key].windows, difference_kinds[groups[key].agg_type]));
+
+    // Count how many times each message is used, so it can be let go after the last one
+    const n_uses: Record<number, number> = {};
+    const use = (index: number) => { n_uses[index] = (index in n_uses ? n_uses[index] : 0) + 1; };
+    plans.forEach(group_plans => group_plans.forEach(plan => {
+        use(plan.later);
+        if (plan.earlier !== null) use(plan.earlier);
+    }));
+
+    const decoded: Record<number, Promise<Float32Array>> = {};
+    const get = (index: number) => {
+        if (!(index in decoded)) decoded[index] = decode(index);
+        return decoded[index];
+    };
+    const release = (index: number) => {
+        n_uses[index]--;
+        if (n_uses[index] == 0) delete decoded[index];
+    };
+
+    const series: Grib2IntervalSeries[] = [];
+
+    for (let igroup = 0; igroup < group_keys.length; igroup++) {
+        const {field, agg_type} = groups[group_keys[igroup]];
+        const intervals: Grib2Interval[] = [];
+
+        for (let iplan = 0; iplan < plans[igroup].length; iplan++) {
+            const plan = plans[igroup][iplan];
+            const later = await get(plan.later);
+            let data: Float32Array;
+
+            if (plan.earlier === null) {
+                // Copy it if another interval still needs the message
+                data = n_uses[plan.later] > 1 ? later.slice() : later;
+            }
+            else {
+                const earlier = await get(plan.earlier);
+                data = await differenceFields(later, plan.later_weight, earlier, plan.earlier_weight, opts);
+                release(plan.earlier);
+            }
+            release(plan.later);
+
+            const messages = plan.earlier === null ? [plan.later] : [plan.later, plan.earlier];
+            intervals.push({start: plan.start, end: plan.end, messages: messages, data: data});
+        }
+
+        series.push({field: field, agg_type: agg_type, intervals: intervals});
+    }
+
+    return series;
+}
+
+export {differenceAccumulations, differenceFields};
+export type {Grib2IntervalOptions, Grib2Interval, Grib2IntervalSeries};
@@ -0,0 +1,150 @@
+import { Grib2Metrics } from "./grib2metrics";
+import type { Grib2GridDefinitionSection } from "./grib2section";
+import { n_native_grid_params } from "./grib2griddefs";
+import { getCompressionModule, runNative } from "./unpack";
+
+type Grib2CoordinateType = 'latlon' | 'projected';
+// The rotation for grid-relative vector components is computed (and cached) the same way as the coordinates
+type NativeCoordinateType = Grib2CoordinateType | 'wind_rotation';
+
+/**
+ * Latitudes and longitudes (in degrees) of every grid point, in the same order as the decoded data. Longitudes are in [-180, 180).
+ */
+interface Grib2LatLonCoordinates {
+    lats: Float32Array;
+    lons: Float32Array;
+}
+
+/**
+ * Coordinates of every grid point on the grid's own projection, in the same order as the decoded data. For Lambert conformal grids, x and y are in meters,
+ *  with the origin at the standard longitude and the latitude where dx and dy are given. For lat/lon grids (including rotated ones), x is the longitude
+ *  and y the latitude on the grid.
+ */
+interface Grib2ProjectedCoordinates {
+    x: Float32Array;
+    y: Float32Array;
+}
+
+const coordinate_type_codes = {
+    latlon: 0,
+    projected: 1,
+    wind_rotation: 2,
+}
+
+async function computeGridCoordinates(grid_params: Float64Array, grid_size: number, coordinate_type: NativeCoordinateType, metrics?: Grib2Metrics) {
+    const compression = await getCompressionModule(metrics);
+    const grid_coordinates = compression.cwrap('grid_coordinates', 'number', ['number', 'number', 'number', 'number']);
+
+    const params_ = compression._malloc(n_native_grid_params * 8);
+    const coord1_ = compression._malloc(grid_size * 4);
+    const coord2_ = compression._malloc(grid_size * 4);
+
+    new Float64Array(compression.HEAPU8.buffer, params_, n_native_grid_params).set(grid_params);
+
+    const status = runNative(compression, 'coordinates', grid_size, () => grid_coordinates(params_, coordinate_type_codes[coordinate_type], coord1_, coord2_), metrics);
+
+    let coord1: Float32Array;
+    let coord2: Float32Array;
+
+    if (status == 0) {
+        coord1 = new Float32Array(compression.HEAPU8.buffer, coord1_, grid_size).slice();
+        coord2 = new Float32Array(compression.HEAPU8.buffer, coord2_, grid_size).slice();
+    }
+
+    compression._free(params_);
+    compression._free(coord1_);
+    compression._free(coord2_);
+
+    if (status != 0) {
+        throw `Computing grid coordinates encountered an error: ${status}`;
+    }
+
+    return [coord1, coord2];
+}
+
+// Coordinates for a large grid are big (a HRRR grid is about 15 MB for each coordinate type), so only keep the most recently used ones
+const max_cached_coordinates = 8;
+const coordinates_cache: Record<string, Promise<Float32Array[]>> = {};
+// Keys in the cache, least recently used first
+const coordinates_lru: string[] = [];
+
+function forgetCoordinates(key: string) {
+    const idx = coordinates_lru.indexOf(key);
+    if (idx >= 0) {
+        coordinates_lru.splice(idx, 1);
+    }
+
+    delete coordinates_cache[key];
+}
+
+function getCachedCoordinates(sec3: Grib2GridDefinitionSection, coordinate_type: NativeCoordinateType, metrics?: Grib2Metrics) {
+    const key = `${sec3.getGridKey()}|${coordinate_type}`;
+
+    if (Object.prototype.hasOwnProperty.call(coordinates_cache, key)) {
+        coordinates_lru.splice(coordinates_lru.indexOf(key), 1);
+    }
+    else {
+        const coords = computeGridCoordinates(sec3.contents.grid_definition_template.getNativeGridParameters(), sec3.contents.grid_size, coordinate_type, metrics);
+        coordinates_cache[key] = coords;
+
+        // Don't keep failures around (unless the entry has already been evicted and replaced)
+        coords.catch(() => {
+            if (coordinates_cache[key] === coords) {
+                forgetCoordinates(key);
+            }
+        });
+    }
+
+    coordinates_lru.push(key);
+    const coords = coordinates_cache[key];
+
+    while (coordinates_lru.length > max_cached_coordinates) {
+        forgetCoordinates(coordinates_lru[0]);
+    }
+
+    return coords;
+}
+
+/**
+ * Get the coordinates of every point in a grid. These are cached by the contents of section 3, so all messages on the same grid share them (and the
+ *  arrays shouldn't be modified). Only the coordinates for the 8 most recently used grids and coordinate types are kept.
+ * @param sec3 - The grid definition section
+ * @param coordinate_type - 'latlon' (the default) for latitude and longitude, or 'projected' for coordinates on the grid's projection
+ * @param metrics - Collect timings into this object
+ * @returns The coordinates
+ */
+async function getGridCoordinates(sec3: Grib2GridDefinitionSection, coordinate_type?: 'latlon', metrics?: Grib2Metrics) : Promise<Grib2LatLonCoordinates>;
+async function getGridCoordinates(sec3: Grib2GridDefinitionSection, coordinate_type: 'projected', metrics?: Grib2Metrics) : Promise<Grib2ProjectedCoordinates>;
+async function getGridCoordinates(sec3: Grib2GridDefinitionSection, coordinate_type?: Grib2CoordinateType, metrics?: Grib2Metrics) : Promise<Grib2LatLonCoordinates | Grib2ProjectedCoordinates> {
+    coordinate_type = coordinate_type === undefined ? 'latlon' : coordinate_type;
+    const [coord1, coord2] = await getCachedCoordinates(sec3, coordinate_type, metrics);
+    return coordinate_type == 'latlon' ? {lats: coord1, lons: coord2} : {x: coord1, y: coord2};
+}
+
+/**
+ * Get the rotation that turns grid-relative vector components on a grid into earth-relative ones, as the sine and cosine of the angle from the grid's
+ *  y axis to north at every point: u = cos * u_grid + sin * v_grid and v = cos * v_grid - sin * u_grid. These are cached along with the coordinates.
+ *  Only lat/lon and Lambert conformal grids are supported.
+ * @param sec3 - The grid definition section
+ * @param metrics - Collect timings into this object
+ * @returns The sine and cosine of the rotation angle
+ */
+async function getWindRotation(sec3: Grib2GridDefinitionSection, metrics?: Grib2Metrics) {
+    if (sec3.getGridParameters().projection == 'RotatedPlateCarree') {
+        throw `Rotating grid-relative winds to earth-relative isn't supported on rotated lat/lon grids`;
+    }
+
+    const [sin, cos] = await getCachedCoordinates(sec3, 'wind_rotation', metrics);
+    return {sin: sin, cos: cos};
+}
+
+/**
+ * Drop all the cached grid coordinates
+ */
+function clearCoordinateCache() {
+    Object.keys(coordinates_cache).forEach(key => { delete coordinates_cache[key]; });
+    coordinates_lru.length = 0;
+}
+
+export {getGridCoordinates, getWindRotation, clearCoordinateCache};
+export type {Grib2CoordinateType, Grib2LatLonCoordinates, Grib2ProjectedCoordinates};
@@ -0,0 +1,220 @@
+import { Grib2Metrics, startStage } from "./grib2metrics";
+import { getCompressionModule, runNative } from "./unpack";
+import { Grib2CompressionModule } from "../compiled/grib_compression";
+
+interface Grib2EnsembleOptions {
+    /** Compute the probability of exceeding each of these thresholds (none by default) */
+    thresholds?: number[];
+    /** Subtracted from the number of members in the denominator of the variance: 0 (the default) for the population standard deviation, 1 for the sample */
+    ddof?: number;
+    /** Decode a member yourself (e.g., on a worker pool) instead of on this thread. Called with the member's index in the file, one or two at a time. */
+    decode?: (index: number) => Promise<Float32Array>;
+    /** Collect timings into this object */
+    metrics?: Grib2Metrics;
+}
+
+/**
+ * Statistics across ensemble members at each point. Missing values are left out, so each point's statistics are over the members that aren't missing
+ *  there (`count`), and points where every member is missing are NaN.
+ */
+interface Grib2EnsembleStats {
+    mean: Float32Array;
+    std: Float32Array;
+    /** The fraction of members greater than each threshold, one array for each threshold */
+    probability: Float32Array[];
+    /** The number of members that aren't missing at each point */
+    count: Int32Array;
+    /** The number of members added */
+    n_members: number;
+}
+
+/**
+ * Running mean, standard deviation, and threshold probabilities across ensemble members, so members can be decoded and added one at a time without
+ *  holding onto all of them. The accumulators live on the WASM heap (a few grids' worth, no matter how many members), so call free() when done.
+ */
+class Grib2EnsembleReducer {
+    private compression: Grib2CompressionModule;
+    private stats_: number;
+    private member_: number;
+    private metrics: Grib2Metrics | undefined;
+
+    readonly n_points: number;
+    readonly thresholds: number[];
+    n_members: number;
+
+    private constructor(compression: Grib2CompressionModule, stats_: number, n_points: number, thresholds: number[], metrics?: Grib2Metrics) {
+        this.compression = compression;
+        this.stats_ = stats_;
+        this.member_ = compression._malloc(Math.max(n_points, 1) * 4);
+        this.n_points = n_points;
+        this.thresholds = thresholds;
+        this.n_members = 0;
+        this.metrics = metrics;
+    }
+
+    /**
+     * @param n_points - The number of points in each member
+     * @param opts - Use `thresholds` for the probabilities to compute, and `metrics` to collect timings
+     */
+    static async create(n_points: number, opts?: Grib2EnsembleOptions) {
+        opts = opts === undefined ? {} : opts;
+        const thresholds = opts.thresholds === undefined ? [] : opts.thresholds;
+
+        const compression = await getCompressionModule(opts.metrics);
+        const thresholds_ = compression._malloc(Math.max(thresholds.length, 1) * 4);
+        new Float32Array(compression.HEAPU8.buffer, thresholds_, thresholds.length).set(thresholds);
+
+        const stats_ = compression.ccall('ensemble_stats_new', 'number', ['number', 'number', 'number'], [n_points, thresholds_, thresholds.length]) as number;
+        compression._free(thresholds_);
+
+        if (stats_ === 0) {
+            throw `Couldn't allocate the ensemble accumulators`;
+        }
+
+        return new Grib2EnsembleReducer(compression, stats_, n_points, thresholds, opts.metrics);
+    }
+
+    /**
+     * Add a member
+     * @param member - The member's data, with NaN for missing values
+     */
+    add(member: Float32Array) {
+        if (this.stats_ === 0) {
+            throw `This ensemble reducer has been freed`;
+        }
+
+        if (member.length != this.n_points) {
+            throw `Ensemble member has ${member.length} points, but the other members have ${this.n_points}`;
+        }
+
+        const compression = this.compression;
+
+        const stop_input_copy = startStage(this.metrics, 'input_copy');
+        new Float32Array(compression.HEAPU8.buffer, this.member_, this.n_points).set(member);
+        stop_input_copy({bytes: member.byteLength});
+
+        const status = runNative(compression, 'ensemble', this.n_points, () => compression.ccall('ensemble_stats_add', 'number', ['number', 'number'], [this.stats_, this.member_]) as number, this.metrics);
+        if (status != 0) {
+            throw `Adding an ensemble member encountered an error: ${status}`;
+        }
+
+        this.n_members++;
+    }
+
+    /**
+     * Get the statistics for the members added so far (more members can still be added after this)
+     * @param ddof - 0 (the default) for the population standard deviation, 1 for the sample standard deviation
+     * @returns The statistics
+     */
+    getStats(ddof?: number) : Grib2EnsembleStats {
+        ddof = ddof === undefined ? 0 : ddof;
+
+        if (this.stats_ === 0) {
+            throw `This ensemble reducer has been freed`;
+        }
+
+        const compression = this.compression;
+        const n_points = this.n_points;
+        const n_thresholds = this.thresholds.length;
+
+        const mean_ = compression._malloc(Math.max(n_points, 1) * 4);
+        const std_ = compression._malloc(Math.max(n_points, 1) * 4);
+        const prob_ = compression._malloc(Math.max(n_points * n_thresholds, 1) * 4);
+        const count_ = compression._malloc(Math.max(n_points, 1) * 4);
+
+        const status = runNative(compression, 'ensemble', n_points, () => compression.ccall('ensemble_stats_result', 'number', ['number', 'number', 'number', 'number', 'number', 'number'],
+                                 [this.stats_, ddof, mean_, std_, prob_, count_]) as number, this.metrics);
+
+        let stats: Grib2EnsembleStats | null = null;
+        if (status == 0) {
+            const stop_output_copy = startStage(this.metrics, 'output_copy');
+            const buffer = compression.HEAPU8.buffer;
+
+            const probability: Float32Array[] = [];
+            for (let k = 0; k < n_thresholds; k++) {
+                probability.push(new Float32Array(buffer, prob_ + k * n_points * 4, n_points).slice());
+            }
+
+            stats = {
+                mean: new Float32Array(buffer, mean_, n_points).slice(),
+                std: new Float32Array(buffer, std_, n_points).slice(),
+                probability: probability,
+                count: new Int32Array(buffer, count_, n_points).slice(),
+                n_members: this.n_members,
+            };
+            stop_output_copy({bytes: n_points * 4 * (3 + n_thresholds), points: n_points});
+        }
+
+        compression._free(mean_);
+        compression._free(std_);
+        compression._free(prob_);
+        compression._free(count_);
+
+        if (status != 0) {
+            throw `Computing ensemble statistics encountered an error: ${status}`;
+        }
+
+        return stats;
+    }
+
+    /**
+     * Free the accumulators
+     */
+    free() {
+        if (this.stats_ === 0) return;
+
+        this.compression.ccall('ensemble_stats_free', null, ['number'], [this.stats_]);
+        this.compression._free(this.member_);
+        this.stats_ = 0;
+    }
+}
+
+/**
+ * Compute statistics across ensemble members, decoding them one at a time. The next member is decoded while the current one is added, so at most two
+ *  members are in memory at once.
+ * @param n_members - The number of members
+ * @param loadMember - Decodes a member. This is passed the array that held the member two before it (or undefined), which can be decoded into.
+ * @param opts - The thresholds, ddof, and metrics
+ * @returns The statistics
+ */
+async function reduceEnsemble(n_members: number, loadMember: (imem: number, destination: Float32Array | undefined) => Promise<Float32Array>,
+                              opts?: Grib2EnsembleOptions) {
+    opts = opts === undefined ? {} : opts;
+
+    if (n_members == 0) {
+        throw `No ensemble members to reduce`;
+    }
+
+    const scratch: (Float32Array | undefined)[] = [undefined, undefined];
+    const load = (imem: number) => loadMember(imem, scratch[imem % 2]).then(member => { scratch[imem % 2] = member; return member; });
+
+    let reducer: Grib2EnsembleReducer | null = null;
+    let next = load(0);
+
+    try {
+        for (let imem = 0; imem < n_members; imem++) {
+            const member = await next;
+            if (imem + 1 < n_members) {
+                next = load(imem + 1);
+            }
+
+            if (reducer === null) {
+                reducer = await Grib2EnsembleReducer.create(member.length, opts);
+            }
+            reducer.add(member);
+        }
+
+        return reducer.getStats(opts.ddof);
+    }
+    finally {
+        // Don't leave a failed read-ahead unhandled
+        next.catch(() => {});
+
+        if (reducer !== null) {
+            reducer.free();
+        }
+    }
+}
+
+export {Grib2EnsembleReducer, reduceEnsemble};
+export type {Grib2EnsembleOptions, Grib2EnsembleStats};
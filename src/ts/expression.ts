@@ -0,0 +1,298 @@
+import { Grib2Metrics, startStage } from "./grib2metrics";
+import { getCompressionModule, runNative } from "./unpack";
+
+interface Grib2ExpressionOptions {
+    /** Put the output in this array instead of a new one */
+    destination?: Float32Array;
+    /** Collect timings into this object */
+    metrics?: Grib2Metrics;
+}
+
+// Opcodes from field_ops.h
+const field_ops = {
+    input: 0, const: 1, add: 2, sub: 3, mul: 4, div: 5, neg: 6, abs: 7, sqrt: 8, exp: 9, log: 10, min: 11, max: 12, pow: 13, hypot: 14, atan2: 15, mod: 16,
+};
+
+const max_stack_depth = 16;
+
+const expression_functions: Record<string, {op: number, n_args: number}> = {
+    abs: {op: field_ops.abs, n_args: 1},
+    sqrt: {op: field_ops.sqrt, n_args: 1},
+    exp: {op: field_ops.exp, n_args: 1},
+    log: {op: field_ops.log, n_args: 1},
+    min: {op: field_ops.min, n_args: 2},
+    max: {op: field_ops.max, n_args: 2},
+    pow: {op: field_ops.pow, n_args: 2},
+    hypot: {op: field_ops.hypot, n_args: 2},
+    atan2: {op: field_ops.atan2, n_args: 2},
+    mod: {op: field_ops.mod, n_args: 2},
+};
+
+const binary_ops: Record<string, number> = {'+': field_ops.add, '-': field_ops.sub, '*': field_ops.mul, '/': field_ops.div};
+
+/**
+ * Expressions for common derived fields. Wind direction is the meteorological direction (where the wind is coming from) in degrees, which is only the
+ *  direction on the earth for earth-relative winds. Grib2File.deriveField() rotates grid-relative winds (e.g., from HRRR and NAM) first, but evaluating
+ *  this directly on grid-relative winds gives the direction relative to the grid.
+ */
+const derived_expressions = {
+    wind_speed: 'hypot(u, v)',
+    wind_direction: 'mod(270 - atan2(v, u) * 57.29577951308232, 360)',
+    dewpoint_depression: 't - td',
+    k_to_c: 't - 273.15',
+    k_to_f: '(t - 273.15) * 1.8 + 32',
+    pa_to_hpa: 'p / 100',
+    ms_to_kt: 'ws * 1.9438444924406',
+    kgm2_to_in: 'precip / 25.4',
+};
+
+/**
+ * Compile an infix expression to a postfix program. The grammar is the usual one: numbers, variables, + - * / (with the usual precedence), unary minus,
+ *  parentheses, and function calls.
+ */
+function compileExpression(expression: string) {
+    const tokens = expression.match(/\d+\.?\d*(?:[eE][+-]?\d+)?|\.\d+(?:[eE][+-]?\d+)?|[A-Za-z_]\w*|[-+*/(),]|\S/g);
+    if (tokens === null) {
+        throw `Empty expression`;
+    }
+
+    const program: number[] = [];
+    const constants: number[] = [];
+    const variables: string[] = [];
+    let pos = 0;
+
+    const peek = () => pos < tokens.length ? tokens[pos] : null;
+    const expect = (token: string) => {
+        if (peek() !== token) {
+            throw `Expected '${token}' in expression '${expression}', got ${peek() === null ? 'the end' : `'${peek()}'`}`;
+        }
+        pos++;
+    };
+
+    // additive := term (('+' | '-') term)*, term := unary (('*' | '/') unary)*, unary := '-' unary | primary
+    const additive = () : void => {
+        term();
+        while (peek() == '+' || peek() == '-') {
+            const op = binary_ops[tokens[pos++]];
+            term();
+            program.push(op);
+        }
+    };
+
+    const term = () : void => {
+        unary();
+        while (peek() == '*' || peek() == '/') {
+            const op = binary_ops[tokens[pos++]];
+            unary();
+            program.push(op);
+        }
+    };
+
+    const unary = () : void => {
+        if (peek() == '-') {
+            pos++;
+            unary();
+            program.push(field_ops.neg);
+        }
+        else {
+            primary();
+        }
+    };
+
+    const primary = () : void => {
+        const token = peek();
+        if (token === null) {
+            throw `Unexpected end of expression '${expression}'`;
+        }
+        pos++;
+
+        if (token == '(') {
+            additive();
+            expect(')');
+        }
+        else if (/^[\d.]/.test(token)) {
+            program.push(field_ops.const, constants.length);
+            constants.push(parseFloat(token));
+        }
+        else if (/^[A-Za-z_]/.test(token) && peek() == '(') {
+            if (!(token in expression_functions)) {
+                throw `Unknown function '${token}' in expression '${expression}'`;
+            }
+
+            const func = expression_functions[token];
+            pos++;
+            for (let iarg = 0; iarg < func.n_args; iarg++) {
+                if (iarg > 0) expect(',');
+                additive();
+            }
+            expect(')');
+            program.push(func.op);
+        }
+        else if (/^[A-Za-z_]/.test(token)) {
+            let ivar = variables.indexOf(token);
+            if (ivar < 0) {
+                ivar = variables.length;
+                variables.push(token);
+            }
+            program.push(field_ops.input, ivar);
+        }
+        else {
+            throw `Unexpected '${token}' in expression '${expression}'`;
+        }
+    };
+
+    additive();
+    if (pos < tokens.length) {
+        throw `Unexpected '${tokens[pos]}' in expression '${expression}'`;
+    }
+
+    // Check the stack depth here, so the error is clearer than the one from the native code
+    let depth = 0, max_depth = 0;
+    for (let ip = 0; ip < program.length; ip++) {
+        const op = program[ip];
+        if (op == field_ops.input || op == field_ops.const) {
+            depth++;
+            ip++;
+        }
+        else if (op != field_ops.neg && !(op >= field_ops.abs && op <= field_ops.log)) {
+            depth--;
+        }
+        max_depth = Math.max(max_depth, depth);
+    }
+
+    if (max_depth > max_stack_depth) {
+        throw `Expression '${expression}' is nested too deeply`;
+    }
+
+    return {program: new Int32Array(program), constants: new Float32Array(constants), variables: variables};
+}
+
+// Compiled expressions, by expression string. The expressions come from users, so only keep the most recently used ones.
+const max_cached_expressions = 64;
+const expression_cache: Record<string, Grib2Expression> = {};
+// Keys in the cache, least recently used first
+const expression_lru: string[] = [];
+
+/**
+ * An arithmetic expression over decoded fields, evaluated natively at every point in one pass (in cache-sized blocks, so there's no full-grid temporary
+ *  for each operation). Expressions can use numbers, + - * /, parentheses, and the functions abs, sqrt, exp, log, min, max, pow, hypot, atan2, and mod
+ *  (which wraps negative values, like for angles). Any other name is a variable, i.e., an input field. Missing (NaN) inputs give NaN.
+ */
+class Grib2Expression {
+    readonly expression: string;
+    /** The input names, in the order they first appear */
+    readonly variables: string[];
+    private program: Int32Array;
+    private constants: Float32Array;
+
+    private constructor(expression: string) {
+        const {program, constants, variables} = compileExpression(expression);
+        this.expression = expression;
+        this.program = program;
+        this.constants = constants;
+        this.variables = variables;
+    }
+
+    /**
+     * Compile an expression (or get it from the cache if it's been compiled before)
+     * @param expression - The expression, e.g., 'hypot(u, v)'
+     * @returns The compiled expression
+     */
+    static compile(expression: string) {
+        if (Object.prototype.hasOwnProperty.call(expression_cache, expression)) {
+            expression_lru.splice(expression_lru.indexOf(expression), 1);
+        }
+        else {
+            expression_cache[expression] = new Grib2Expression(expression);
+        }
+
+        expression_lru.push(expression);
+
+        while (expression_lru.length > max_cached_expressions) {
+            delete expression_cache[expression_lru.shift()];
+        }
+
+        return expression_cache[expression];
+    }
+
+    /**
+     * Evaluate the expression
+     * @param inputs - The fields for each variable, all with the same number of points
+     * @param opts - Use `destination` to write the output into an existing array and `metrics` to collect timings
+     * @returns The value of the expression at each point
+     * @example
+     * const wind_dir = grib.Grib2Expression.compile('mod(270 - atan2(v, u) * 57.29577951308232, 360)');
+     * const dir = await wind_dir.evaluate({u: msg_u.data, v: msg_v.data});
+     */
+    async evaluate(inputs: Record<string, Float32Array>, opts?: Grib2ExpressionOptions) {
+        opts = opts === undefined ? {} : opts;
+        const metrics = opts.metrics;
+
+        const fields = this.variables.map(name => {
+            if (!(name in inputs)) {
+                throw `No input given for '${name}' in expression '${this.expression}'`;
+            }
+            return inputs[name];
+        });
+
+        const n_points = fields.length > 0 ? fields[0].length : opts.destination !== undefined ? opts.destination.length : 1;
+        fields.forEach((field, ifield) => {
+            if (field.length != n_points) {
+                throw `Input '${this.variables[ifield]}' has ${field.length} points, but '${this.variables[0]}' has ${n_points}`;
+            }
+        });
+
+        if (opts.destination !== undefined && opts.destination.length < n_points) {
+            throw `Destination array has ${opts.destination.length} elements, but the inputs have ${n_points} points`;
+        }
+
+        const compression = await getCompressionModule(metrics);
+
+        const program_ = compression._malloc(this.program.byteLength);
+        const constants_ = compression._malloc(Math.max(this.constants.byteLength, 4));
+        const inputs_ = compression._malloc(Math.max(fields.length, 1) * 4);
+        const fields_ = fields.map(() => compression._malloc(Math.max(n_points, 1) * 4));
+        const output_ = compression._malloc(Math.max(n_points, 1) * 4);
+
+        const stop_input_copy = startStage(metrics, 'input_copy');
+        const buffer = compression.HEAPU8.buffer;
+        new Int32Array(buffer, program_, this.program.length).set(this.program);
+        new Float32Array(buffer, constants_, this.constants.length).set(this.constants);
+        new Int32Array(buffer, inputs_, fields.length).set(fields_);
+        fields.forEach((field, ifield) => new Float32Array(buffer, fields_[ifield], n_points).set(field));
+        stop_input_copy({bytes: fields.length * n_points * 4});
+
+        const status = runNative(compression, 'expression', n_points, () => compression.ccall('field_expression', 'number',
+                                 ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number'],
+                                 [program_, this.program.length, constants_, this.constants.length, inputs_, fields.length, n_points, output_]) as number, metrics);
+
+        let output: Float32Array | null = null;
+        if (status == 0) {
+            const stop_output_copy = startStage(metrics, 'output_copy');
+            const result = new Float32Array(compression.HEAPU8.buffer, output_, n_points);
+            if (opts.destination !== undefined) {
+                output = opts.destination.length == n_points ? opts.destination : opts.destination.subarray(0, n_points);
+                output.set(result);
+            }
+            else {
+                output = result.slice();
+            }
+            stop_output_copy({bytes: n_points * 4, points: n_points});
+        }
+
+        compression._free(program_);
+        compression._free(constants_);
+        compression._free(inputs_);
+        fields_.forEach(field_ => compression._free(field_));
+        compression._free(output_);
+
+        if (status != 0) {
+            throw `Evaluating expression '${this.expression}' encountered an error: ${status}`;
+        }
+
+        return output;
+    }
+}
+
+export {Grib2Expression, derived_expressions};
+export type {Grib2ExpressionOptions};
@@ -0,0 +1,192 @@
+import { Grib2Metrics } from "./grib2metrics";
+import type { Grib2GridDefinitionSection } from "./grib2section";
+import type { Grib2MessageHeaders } from "./index";
+import { Grib2RegridMethod, Grib2RegridTarget, computeRegridWeights, getRegridWeights } from "./regrid";
+
+/**
+ * The points to extract. Give either `indices` (into the decoded data), `lats` and `lons` in degrees, or a `target` (whose weights are cached like for
+ *  regridding). Points given by location are interpolated with `method`, which is 'nearest' by default.
+ */
+interface Grib2Points {
+    indices?: ArrayLike<number>;
+    lats?: ArrayLike<number>;
+    lons?: ArrayLike<number>;
+    target?: Grib2RegridTarget;
+    method?: Grib2RegridMethod;
+}
+
+interface Grib2ExtractOptions {
+    /** Collect timings and counters into this object */
+    metrics?: Grib2Metrics;
+}
+
+/**
+ * Values at a set of points from a set of messages. The value for point `ipt` in message `imsg` is `values[imsg * n_points + ipt]`, and missing values and
+ *  points off the grid are NaN.
+ */
+interface Grib2PointExtraction {
+    values: Float32Array;
+    n_messages: number;
+    n_points: number;
+}
+
+/**
+ * Gets a message to extract from: its headers and the buffer containing it
+ */
+type Grib2MessageLoader = (imsg: number) => Promise<{header: Grib2MessageHeaders, buffer: DataView}>;
+
+/**
+ * The points to extract, resolved to grid indices for one grid. Each point has `n_weights` grid indices and weights. Each grid point only needs to be
+ *  decoded once, so the unique grid indices are kept separately, and `slots` says which unique index each of the point's indices is.
+ */
+interface Grib2PointLocations {
+    n_points: number;
+    n_weights: number;
+    weights: Float32Array | null;
+    unique_indices: Int32Array;
+    slots: Int32Array;
+}
+
+function uniqueIndices(indices: Int32Array) {
+    const sorted = indices.filter(idx => idx >= 0).sort();
+    const unique: number[] = [];
+
+    sorted.forEach((idx, i) => {
+        if (i == 0 || idx != sorted[i - 1]) unique.push(idx);
+    });
+
+    return new Int32Array(unique);
+}
+
+function findSlot(unique_indices: Int32Array, idx: number) {
+    if (idx < 0) return -1;
+
+    let lower = 0;
+    let upper = unique_indices.length - 1;
+    while (lower < upper) {
+        const mid = Math.floor((lower + upper) / 2);
+        if (unique_indices[mid] < idx) {
+            lower = mid + 1;
+        }
+        else {
+            upper = mid;
+        }
+    }
+
+    return unique_indices[lower] == idx ? lower : -1;
+}
+
+async function resolvePoints(sec3: Grib2GridDefinitionSection, points: Grib2Points, metrics?: Grib2Metrics) : Promise<Grib2PointLocations> {
+    const grid_size = sec3.contents.grid_size;
+    let indices: Int32Array;
+    let weights: Float32Array | null = null;
+    let n_weights = 1;
+
+    if (points.indices !== undefined) {
+        indices = new Int32Array(points.indices.length);
+        for (let i = 0; i < points.indices.length; i++) {
+            const idx = points.indices[i];
+            indices[i] = idx >= 0 && idx < grid_size ? idx : -1;
+        }
+    }
+    else {
+        const method = points.method === undefined ? 'nearest' : points.method;
+        let regrid_weights;
+
+        if (points.target !== undefined) {
+            regrid_weights = await getRegridWeights(sec3, points.target, method, metrics);
+            ({indices, weights} = await regrid_weights.getIndicesAndWeights());
+        }
+        else if (points.lats !== undefined && points.lons !== undefined) {
+            // These points aren't reused, so don't cache the weights
+            const target = new Grib2RegridTarget(new Float32Array(points.lats), new Float32Array(points.lons), 'points');
+            regrid_weights = await computeRegridWeights(sec3.contents.grid_definition_template.getNativeGridParameters(), grid_size, target, method, metrics);
+            ({indices, weights} = await regrid_weights.getIndicesAndWeights());
+            await regrid_weights.free();
+        }
+        else {
+            throw `Points to extract need either indices, lats and lons, or a target`;
+        }
+
+        n_weights = regrid_weights.n_weights;
+    }
+
+    const unique_indices = uniqueIndices(indices);
+    const slots = indices.map(idx => findSlot(unique_indices, idx));
+
+    return {n_points: indices.length / n_weights, n_weights: n_weights, weights: weights, unique_indices: unique_indices, slots: slots};
+}
+
+function combinePoints(locations: Grib2PointLocations, unique_values: Float32Array, output: Float32Array) {
+    // Same as regrid_apply(): leave out missing source points and renormalize the rest of the weights
+    const {n_points, n_weights, weights, slots} = locations;
+
+    for (let ipt = 0; ipt < n_points; ipt++) {
+        let sum = 0;
+        let weight_sum = 0;
+
+        for (let k = 0; k < n_weights; k++) {
+            const slot = slots[ipt * n_weights + k];
+            const weight = weights === null ? 1 : weights[ipt * n_weights + k];
+            if (slot < 0 || weight == 0 || isNaN(unique_values[slot])) continue;
+
+            sum += weight * unique_values[slot];
+            weight_sum += weight;
+        }
+
+        output[ipt] = weight_sum > 0 ? sum / weight_sum : NaN;
+    }
+}
+
+/**
+ * Get the values at a set of points from a set of messages, only decoding the parts of each message needed for those points (for simple and complex
+ *  packing; other packings get fully decoded). The points are resolved to grid indices once for each unique grid.
+ * @param n_messages - The number of messages
+ * @param loadMessage - Gets each message, in order (so messages that are read as they're needed can be read one at a time)
+ * @param points - The points to extract
+ * @param opts - Use the `metrics` option to collect timings
+ * @returns The values at each point in each message
+ */
+async function extractPoints(n_messages: number, loadMessage: Grib2MessageLoader, points: Grib2Points, opts?: Grib2ExtractOptions) : Promise<Grib2PointExtraction> {
+    opts = opts === undefined ? {} : opts;
+    const locations_by_grid: Record<string, Promise<Grib2PointLocations>> = {};
+
+    let n_points: number | null = null;
+    let values: Float32Array | null = null;
+
+    for (let imsg = 0; imsg < n_messages; imsg++) {
+        const {header, buffer} = await loadMessage(imsg);
+        const grid_key = header.sec3.getGridKey();
+
+        if (!(grid_key in locations_by_grid)) {
+            locations_by_grid[grid_key] = resolvePoints(header.sec3, points, opts.metrics);
+        }
+
+        const locations = await locations_by_grid[grid_key];
+
+        if (values === null) {
+            n_points = locations.n_points;
+            values = new Float32Array(n_messages * n_points);
+        }
+
+        const output = values.subarray(imsg * n_points, (imsg + 1) * n_points);
+
+        if (locations.unique_indices.length == 0) {
+            output.fill(NaN);
+            continue;
+        }
+
+        const unique_values = await header.sec7.extractPoints(buffer, header.sec3, header.sec5, header.sec6, locations.unique_indices, opts);
+        combinePoints(locations, unique_values, output);
+    }
+
+    if (values === null) {
+        values = new Float32Array(0);
+        n_points = 0;
+    }
+
+    return {values: values, n_messages: n_messages, n_points: n_points};
+}
+
+export {extractPoints};
+export type {Grib2Points, Grib2ExtractOptions, Grib2PointExtraction};
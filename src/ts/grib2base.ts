@@ -105,7 +105,7 @@ function unpackStruct<T, U>(buf: DataView, struct: Grib2ContentSpecTemplate<U>,
 }
 
 function unpackUTF8String(buf: DataView, offset: number, length: number) {
-    return String.fromCharCode.apply(null, new Uint8Array(buf.buffer.slice(offset, offset + length)));
+    return String.fromCharCode.apply(null, new Uint8Array(buf.buffer, buf.byteOffset + offset, length));
 }
 
 interface Unpackable<T> {
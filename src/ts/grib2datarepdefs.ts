@@ -1,24 +1,31 @@
 
 import { G2Int2, G2UInt1, G2UInt2, G2UInt4, Grib2Struct, Grib2TemplateEnumeration, InternalTypeMapper, unpackerFactory } from "./grib2base"
-import { complexSDPackingDecoder, jpegDecoder, pngDecoder } from "./unpack";
+import { Grib2DecodeOptions, Grib2PackedData, complexPackingDecoder, complexPackingExtractor, complexSDPackingDecoder, jpegDecoder, pngDecoder,
+         simplePackingDecoder, simplePackingExtractor } from "./unpack";
+import { heapBytes } from "./heap";
 
 interface DataRepresentationDefinition {
-    unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number): Promise<Float32Array>;
-}
+    unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number, opts?: Grib2DecodeOptions): Promise<Grib2PackedData>;
 
-type TypedArray = Uint8Array | Uint16Array | Uint32Array;
+    /**
+     * Unpack only the values at some indices in the packed data (-1 for a missing value). Templates that can't find a value without unpacking everything
+     *  before it (e.g., spatial differencing, PNG, JPEG2000) don't implement this.
+     */
+    extractPoints?(buffer: DataView, offset: number, packed_length: number, expected_size: number, packed_indices: Int32Array, opts?: Grib2DecodeOptions): Promise<Grib2PackedData>;
+}
 
-function unpackScaling<T extends TypedArray>(packed: T, reference_value: number, binary_scale_factor: number, decimal_scale_factor: number, original_data_type: number) {
+function packedData(packed_: number, n_packed: number, reference_value: number, binary_scale_factor: number, decimal_scale_factor: number, original_data_type: number) : Grib2PackedData {
     if (original_data_type == 1) {
         console.warn("The original data type is integers, but I'm just blindly making floats");
     }
 
-    const binary_exp = Math.pow(2, binary_scale_factor);
-    const decimal_exp = Math.pow(10, -decimal_scale_factor);
+    // The scaling itself is done along with the bitmap in unpackScaling()
+    return {packed_: packed_, n_packed: n_packed, reference_value: reference_value, binary_scale_factor: binary_scale_factor, decimal_scale_factor: decimal_scale_factor};
+}
 
-    const output = new Float32Array(packed.length);
-    packed.forEach((val, i) => output[i] = (reference_value + val * binary_exp) * decimal_exp);
-    return output;
+function packedSection(buffer: DataView, offset: number, packed_length: number) {
+    // This is a view on the buffer; the decoders copy it onto the WASM heap themselves (or use it in place if the file is already on the heap)
+    return heapBytes(buffer, offset, packed_length);
 }
 
 function maybeRecastReferenceValue(raw_reference_value: number, data_type: number) {
@@ -44,8 +51,18 @@ class Grib2SimplePacking extends Grib2Struct<Grib2SimplePackingContents> impleme
         super(contents, offset);
     }
 
-    async unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number) : Promise<Float32Array> {
-        throw "Simple (un)packing not implemented yet";
+    async unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number, opts?: Grib2DecodeOptions) : Promise<Grib2PackedData> {
+        const metrics = opts === undefined ? undefined : opts.metrics;
+        const data = packedSection(buffer, offset, packed_length);
+        const output = await simplePackingDecoder(data, expected_size, this.contents.number_of_bits, packed_length, metrics);
+        return packedData(output, expected_size, this.contents.reference_value, this.contents.binary_scale_factor, this.contents.decimal_scale_factor, this.contents.original_data_type);
+    }
+
+    async extractPoints(buffer: DataView, offset: number, packed_length: number, expected_size: number, packed_indices: Int32Array, opts?: Grib2DecodeOptions) : Promise<Grib2PackedData> {
+        const metrics = opts === undefined ? undefined : opts.metrics;
+        const data = packedSection(buffer, offset, packed_length);
+        const output = await simplePackingExtractor(data, expected_size, this.contents.number_of_bits, packed_length, packed_indices, metrics);
+        return packedData(output, packed_indices.length, this.contents.reference_value, this.contents.binary_scale_factor, this.contents.decimal_scale_factor, this.contents.original_data_type);
     }
 }
 
@@ -78,8 +95,49 @@ class Grib2ComplexPacking extends Grib2Struct<Grib2ComplexPackingContents> imple
         super(contents, offset);
     }
 
-    async unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number) : Promise<Float32Array> {
-        throw "Complex (un)packing not implemented yet";
+    async unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number, opts?: Grib2DecodeOptions) : Promise<Grib2PackedData> {
+        const metrics = opts === undefined ? undefined : opts.metrics;
+        const data = packedSection(buffer, offset, packed_length);
+        const output = await complexPackingDecoder(data, 
+            expected_size,
+            this.contents.number_of_bits,
+            this.contents.number_of_groups,
+            this.contents.group_splitting_method,
+            this.contents.missing_value_method,
+            this.contents.group_width_reference,
+            this.contents.group_width_bits,
+            this.contents.group_length_reference,
+            this.contents.group_length_increment,
+            this.contents.last_group_length,
+            this.contents.group_length_bits,
+            packed_length,
+            metrics
+        );
+
+        return packedData(output, expected_size, this.contents.reference_value, this.contents.binary_scale_factor, this.contents.decimal_scale_factor, this.contents.original_data_type);
+    }
+
+    async extractPoints(buffer: DataView, offset: number, packed_length: number, expected_size: number, packed_indices: Int32Array, opts?: Grib2DecodeOptions) : Promise<Grib2PackedData> {
+        const metrics = opts === undefined ? undefined : opts.metrics;
+        const data = packedSection(buffer, offset, packed_length);
+        const output = await complexPackingExtractor(data, 
+            expected_size,
+            this.contents.number_of_bits,
+            this.contents.number_of_groups,
+            this.contents.group_splitting_method,
+            this.contents.missing_value_method,
+            this.contents.group_width_reference,
+            this.contents.group_width_bits,
+            this.contents.group_length_reference,
+            this.contents.group_length_increment,
+            this.contents.last_group_length,
+            this.contents.group_length_bits,
+            packed_length,
+            packed_indices,
+            metrics
+        );
+
+        return packedData(output, packed_indices.length, this.contents.reference_value, this.contents.binary_scale_factor, this.contents.decimal_scale_factor, this.contents.original_data_type);
     }
 }
 
@@ -114,8 +172,9 @@ class Grib2ComplexPackingDifferencing extends Grib2Struct<Grib2ComplexPackingDif
         super(contents, offset);
     }
 
-    async unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number) : Promise<Float32Array> {
-        const data = new Uint8Array(buffer.buffer.slice(offset, offset + packed_length))
+    async unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number, opts?: Grib2DecodeOptions) : Promise<Grib2PackedData> {
+        const metrics = opts === undefined ? undefined : opts.metrics;
+        const data = packedSection(buffer, offset, packed_length);
         const output = await complexSDPackingDecoder(data, 
             expected_size,
             this.contents.number_of_bits,
@@ -130,10 +189,11 @@ class Grib2ComplexPackingDifferencing extends Grib2Struct<Grib2ComplexPackingDif
             this.contents.group_length_bits,
             packed_length,
             this.contents.spatial_difference_order,
-            this.contents.descriptor_bytes
+            this.contents.descriptor_bytes,
+            metrics
         );
         
-        return unpackScaling(output, this.contents.reference_value, this.contents.binary_scale_factor, this.contents.decimal_scale_factor, this.contents.original_data_type);
+        return packedData(output, expected_size, this.contents.reference_value, this.contents.binary_scale_factor, this.contents.decimal_scale_factor, this.contents.original_data_type);
     }
 }
 
@@ -155,26 +215,17 @@ class Grib2PNGPacking extends Grib2Struct<Grib2PNGPackingContents> implements Da
         super(contents, offset);
     }
 
-    async unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number) {
-        const data = new Uint8Array(buffer.buffer.slice(offset, offset + packed_length));
+    async unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number, opts?: Grib2DecodeOptions) : Promise<Grib2PackedData> {
+        const metrics = opts === undefined ? undefined : opts.metrics;
+        const data = packedSection(buffer, offset, packed_length);
         
-        let output: TypedArray;
-
-        // This is dumb. Surely there's a better way to do this.
-        if (this.contents.bit_depth === 8) {
-            output = await pngDecoder(data, this.contents.bit_depth, expected_size);
-        }
-        else if (this.contents.bit_depth === 16) {
-            output = await pngDecoder(data, this.contents.bit_depth, expected_size);
-        }
-        else if (this.contents.bit_depth === 32) {
-            output = await pngDecoder(data, this.contents.bit_depth, expected_size);
-        }
-        else {
-            throw `PNG packing bit depth ${this.contents.bit_depth} is not supported`;
+        const bit_depth = this.contents.bit_depth;
+        if (bit_depth !== 8 && bit_depth !== 16 && bit_depth !== 32) {
+            throw `PNG packing bit depth ${bit_depth} is not supported`;
         }
 
-        return unpackScaling(output, this.contents.reference_value, this.contents.binary_scale_factor, this.contents.decimal_scale_factor, this.contents.original_data_type);
+        const output = await pngDecoder(data, bit_depth, expected_size, metrics);
+        return packedData(output, expected_size, this.contents.reference_value, this.contents.binary_scale_factor, this.contents.decimal_scale_factor, this.contents.original_data_type);
     }
 };
 
@@ -197,10 +248,11 @@ class Grib2JPEGPacking extends Grib2Struct<Grib2JPEGPackingContents> implements
         super(contents, offset);
     }
 
-    async unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number) : Promise<Float32Array> {
-        const data = new Uint8Array(buffer.buffer.slice(offset, offset + packed_length));
-        const output = await jpegDecoder(data, expected_size);
-        return unpackScaling(output, this.contents.reference_value, this.contents.binary_scale_factor, this.contents.decimal_scale_factor, this.contents.original_data_type);
+    async unpackData(buffer: DataView, offset: number, packed_length: number, expected_size: number, opts?: Grib2DecodeOptions) : Promise<Grib2PackedData> {
+        const metrics = opts === undefined ? undefined : opts.metrics;
+        const data = packedSection(buffer, offset, packed_length);
+        const output = await jpegDecoder(data, expected_size, metrics);
+        return packedData(output, expected_size, this.contents.reference_value, this.contents.binary_scale_factor, this.contents.decimal_scale_factor, this.contents.original_data_type);
     }
 };
 
@@ -36,6 +36,37 @@ type GridParameters = PlateCarreeGridParameters | RotatedPlateCarreeGridParamete
 
 interface GridDefinition {
     getGridParameters: () => GridParameters;
+    getNativeGridParameters: () => Float64Array;
+}
+
+// Layout of the grid description passed to the native code (see grid_projection.h)
+const native_grid_param_indices = {
+    template_number: 0,
+    ngrid_i: 1,
+    ngrid_j: 2,
+    scanning_mode_flags: 3,
+    semimajor: 4,
+    semiminor: 5,
+    lat_first: 6,
+    lon_first: 7,
+    di: 8,
+    dj: 9,
+    south_pole_lat: 10,
+    south_pole_lon: 11,
+    rotation_angle: 12,
+    lad: 13,
+    lov: 14,
+    standard_lat_1: 15,
+    standard_lat_2: 16,
+};
+const n_native_grid_params = 17;
+
+function nativeGridParameters(params: Partial<Record<keyof typeof native_grid_param_indices, number>>) {
+    const native_params = new Float64Array(n_native_grid_params);
+    (Object.keys(params) as (keyof typeof native_grid_param_indices)[]).forEach(key => {
+        native_params[native_grid_param_indices[key]] = params[key];
+    });
+    return native_params;
 }
 
 class GridDefinitionBase<T> extends Grib2Struct<T> {}
@@ -72,6 +103,23 @@ function hasScanModeFlags(obj: any) : obj is InstanceType<typeof GridWithScanMod
     return 'getScanModeFlags' in obj;
 }
 
+type ConstructorWithComponentFlags = Constructor<Grib2Struct<{resolution_component_flags: number}>>;
+function componentFlags<T extends ConstructorWithComponentFlags>(base: T) {
+    return class extends base {
+        /**
+         * @returns Whether vector quantities (e.g., u and v winds) are resolved relative to the grid's x and y directions instead of east and north
+         */
+        hasGridRelativeComponents() {
+            return (this.contents.resolution_component_flags & 0x08) > 0;
+        }
+    }
+}
+
+const GridWithComponentFlags = componentFlags(GridDefinitionBase);
+function hasComponentFlags(obj: any) : obj is InstanceType<typeof GridWithComponentFlags> {
+    return 'hasGridRelativeComponents' in obj;
+}
+
 type ConstructorWithNiNj = Constructor<Grib2Struct<{ngrid_i: number, ngrid_j: number}>>;
 function ninj<T extends ConstructorWithNiNj>(base: T) {
     return class extends base {
@@ -170,12 +218,56 @@ const g2_plate_carree_types = {
     scanning_mode_flags: G2UInt1,
 };
 
-class Grib2PlateCarreeGridDefinition extends scanModeFlags(earthShape(ninj(GridDefinitionBase<InternalTypeMapper<typeof g2_plate_carree_types>>))) implements GridDefinition {
+type LatLonGridContents = InternalTypeMapper<typeof g2_plate_carree_types>;
+
+function latLonAngleUnit(contents: LatLonGridContents) {
+    // Angles are in millionths of a degree unless the basic angle and subdivisions say otherwise
+    const missing = 0xffffffff;
+    if (contents.basic_angle == 0 || contents.basic_angle == missing || contents.subdivisions_to_basic_angle == 0 || contents.subdivisions_to_basic_angle == missing) {
+        return 1e-6;
+    }
+    return contents.basic_angle / contents.subdivisions_to_basic_angle;
+}
+
+function latLonIncrements(contents: LatLonGridContents) {
+    // Use the increments if they're given, otherwise work them out from the first and last points
+    const angle_unit = latLonAngleUnit(contents);
+    const missing = 0xffffffff;
+    const scans_negative_i = (contents.scanning_mode_flags & 0x80) > 0;
+
+    let di = contents.i_direction_increment * angle_unit;
+    if (!(contents.resolution_component_flags & 0x20) || contents.i_direction_increment == missing) {
+        const lon_span = scans_negative_i ? contents.lon_first - contents.lon_last : contents.lon_last - contents.lon_first;
+        di = ((lon_span * angle_unit) % 360 + 360) % 360 / Math.max(contents.ngrid_i - 1, 1);
+    }
+
+    let dj = contents.j_direction_increment * angle_unit;
+    if (!(contents.resolution_component_flags & 0x10) || contents.j_direction_increment == missing) {
+        dj = Math.abs(contents.lat_last - contents.lat_first) * angle_unit / Math.max(contents.ngrid_j - 1, 1);
+    }
+
+    return {di: di, dj: dj};
+}
+
+class Grib2PlateCarreeGridDefinition extends componentFlags(scanModeFlags(earthShape(ninj(GridDefinitionBase<InternalTypeMapper<typeof g2_plate_carree_types>>)))) implements GridDefinition {
     getGridParameters() : PlateCarreeGridParameters {
         const angle_unit = 1e-6;
         return {projection: 'PlateCarree', lat_first: this.contents.lat_first * angle_unit, lon_first: this.contents.lon_first * angle_unit,
                 lat_last: this.contents.lat_last * angle_unit, lon_last: this.contents.lon_last * angle_unit};
     }
+
+    /**
+     * @returns The grid description for the native regridding and coordinate code
+     */
+    getNativeGridParameters() {
+        const angle_unit = latLonAngleUnit(this.contents);
+        const {di, dj} = latLonIncrements(this.contents);
+        const earth_shape = this.getEarthShape();
+
+        return nativeGridParameters({template_number: 0, ngrid_i: this.contents.ngrid_i, ngrid_j: this.contents.ngrid_j, scanning_mode_flags: this.contents.scanning_mode_flags,
+                                     semimajor: earth_shape.semimajor, semiminor: earth_shape.semiminor,
+                                     lat_first: this.contents.lat_first * angle_unit, lon_first: this.contents.lon_first * angle_unit, di: di, dj: dj});
+    }
 }
 
 const g2_plate_carree_grid_unpacker = unpackerFactory(g2_plate_carree_types, Grib2PlateCarreeGridDefinition);
@@ -205,7 +297,7 @@ const g2_plate_carree_rot_types = {
     projection_rotation_angle: G2Int4
 };
 
-class Grib2PlateCarreeRotatedGridDefinition extends scanModeFlags(earthShape(ninj(GridDefinitionBase<InternalTypeMapper<typeof g2_plate_carree_rot_types>>))) implements GridDefinition {
+class Grib2PlateCarreeRotatedGridDefinition extends componentFlags(scanModeFlags(earthShape(ninj(GridDefinitionBase<InternalTypeMapper<typeof g2_plate_carree_rot_types>>)))) implements GridDefinition {
     getGridParameters() : RotatedPlateCarreeGridParameters {
         const angle_unit = 1e-6;
         return {projection: 'RotatedPlateCarree', lat_first: this.contents.lat_first * angle_unit, lon_first: this.contents.lon_first * angle_unit,
@@ -213,6 +305,21 @@ class Grib2PlateCarreeRotatedGridDefinition extends scanModeFlags(earthShape(nin
                 south_pole_lat: this.contents.south_pole_latitude * angle_unit, south_pole_lon: this.contents.south_pole_longitude * angle_unit, 
                 rotation_angle: this.contents.projection_rotation_angle * angle_unit};
     }
+
+    /**
+     * @returns The grid description for the native regridding and coordinate code
+     */
+    getNativeGridParameters() {
+        const angle_unit = latLonAngleUnit(this.contents);
+        const {di, dj} = latLonIncrements(this.contents);
+        const earth_shape = this.getEarthShape();
+
+        return nativeGridParameters({template_number: 1, ngrid_i: this.contents.ngrid_i, ngrid_j: this.contents.ngrid_j, scanning_mode_flags: this.contents.scanning_mode_flags,
+                                     semimajor: earth_shape.semimajor, semiminor: earth_shape.semiminor,
+                                     lat_first: this.contents.lat_first * angle_unit, lon_first: this.contents.lon_first * angle_unit, di: di, dj: dj,
+                                     south_pole_lat: this.contents.south_pole_latitude * angle_unit, south_pole_lon: this.contents.south_pole_longitude * angle_unit,
+                                     rotation_angle: this.contents.projection_rotation_angle * angle_unit});
+    }
 }
 const g2_plate_carree_rot_grid_unpacker = unpackerFactory(g2_plate_carree_rot_types, Grib2PlateCarreeRotatedGridDefinition);
 
@@ -241,7 +348,7 @@ const g2_lambert_conformal_types = {
     south_pole_longitude: G2Int4
 }
 
-class Grib2LambertConformalGridDefinition extends scanModeFlags(earthShape(ninj(GridDefinitionBase<InternalTypeMapper<typeof g2_lambert_conformal_types>>))) implements GridDefinition {
+class Grib2LambertConformalGridDefinition extends componentFlags(scanModeFlags(earthShape(ninj(GridDefinitionBase<InternalTypeMapper<typeof g2_lambert_conformal_types>>)))) implements GridDefinition {
     getGridParameters() : LambertConformalGridParameters {
         const angle_unit = 1e-6;
         const spacing_unit = 1e-3;
@@ -250,6 +357,22 @@ class Grib2LambertConformalGridDefinition extends scanModeFlags(earthShape(ninj(
                 dx: this.contents.grid_dx * spacing_unit, dy: this.contents.grid_dy * spacing_unit, 
                 standard_lat_1: this.contents.standard_latitude_1 * angle_unit, standard_lat_2: this.contents.standard_latitude_2 * angle_unit};
     }
+
+    /**
+     * @returns The grid description for the native regridding and coordinate code
+     */
+    getNativeGridParameters() {
+        const angle_unit = 1e-6;
+        const spacing_unit = 1e-3;
+        const earth_shape = this.getEarthShape();
+
+        return nativeGridParameters({template_number: 30, ngrid_i: this.contents.ngrid_i, ngrid_j: this.contents.ngrid_j, scanning_mode_flags: this.contents.scanning_mode_flags,
+                                     semimajor: earth_shape.semimajor, semiminor: earth_shape.semiminor,
+                                     lat_first: this.contents.lat_first * angle_unit, lon_first: this.contents.lon_first * angle_unit,
+                                     di: this.contents.grid_dx * spacing_unit, dj: this.contents.grid_dy * spacing_unit,
+                                     lad: this.contents.center_latitude * angle_unit, lov: this.contents.standard_longitude * angle_unit,
+                                     standard_lat_1: this.contents.standard_latitude_1 * angle_unit, standard_lat_2: this.contents.standard_latitude_2 * angle_unit});
+    }
 }
 const g2_lambert_conformal_grid_unpacker = unpackerFactory(g2_lambert_conformal_types, Grib2LambertConformalGridDefinition);
 
@@ -259,5 +382,5 @@ const section3_template_unpackers = new Grib2TemplateEnumeration<GridDefinition>
     30: g2_lambert_conformal_grid_unpacker,
 });
 
-export {section3_template_unpackers, hasScanModeFlags, hasNiNj, hasEarthShape};
+export {section3_template_unpackers, hasScanModeFlags, hasNiNj, hasEarthShape, hasComponentFlags, n_native_grid_params};
 export type {GridDefinition, ScanModeFlags, GridParameters, PlateCarreeGridParameters, RotatedPlateCarreeGridParameters, LambertConformalGridParameters};
\ No newline at end of file
@@ -0,0 +1,386 @@
+import type { Grib2MessageHeaders } from "./index";
+import type { ProductDefinition } from "./grib2productdefs";
+
+/**
+ * The location and key fields of one message, for reopening a file without scanning it. Times are in UTC.
+ */
+interface Grib2IndexEntry {
+    /** Byte offset of the message in the file */
+    offset: number;
+    /** Length of the message in bytes */
+    length: number;
+    discipline: number;
+    parameter_category: number;
+    parameter_number: number;
+    product_template: number;
+    /** First fixed surface type (255 if there isn't one) and value (scaled, NaN if there isn't one) */
+    surface1_type: number;
+    surface1_value: number;
+    /** Second fixed surface type (255 if there isn't one) and value (scaled, NaN if there isn't one) */
+    surface2_type: number;
+    surface2_value: number;
+    /** Reference time in milliseconds since 1970-01-01 */
+    reference_time: number;
+    /** Forecast time in seconds (for aggregated products, the end of the aggregation window), or NaN if there isn't one */
+    forecast_time: number;
+    /** Length of the aggregation window in seconds, or 0 if the product isn't aggregated */
+    agg_duration: number;
+    /** Ensemble member type (255 if it isn't an ensemble product) and perturbation number */
+    ensemble_type: number;
+    ensemble_perturbation: number;
+    grid_template: number;
+    /** A hash of the grid definition, which is the same for messages on the same grid */
+    grid_id: number;
+    data_representation_template: number;
+    /** The inventory string, without the message number and offset */
+    inventory: string;
+}
+
+const index_magic = 'G2IX';
+const index_version = 1;
+const index_header_length = 16;
+const index_record_length = 80;
+
+// Template numbers are 2 bytes after the fixed part of each section. They're not kept in the section contents, so get them from the message.
+const sec3_template_offset = 12;
+const sec4_template_offset = 7;
+const sec5_template_offset = 9;
+
+function hashString(str: string) {
+    // 32-bit FNV-1a
+    let hash = 0x811c9dc5;
+    for (let i = 0; i < str.length; i++) {
+        hash ^= str.charCodeAt(i);
+        // Multiply by the FNV prime (2^24 + 403) mod 2^32
+        hash = (hash + (hash << 1) + (hash << 4) + (hash << 7) + (hash << 8) + (hash << 24)) >>> 0;
+    }
+    return hash;
+}
+
+function surfaceValue(surface_type: number, scale_factor: number, value: number) {
+    return surface_type == 255 ? NaN : Math.pow(10, -scale_factor) * value;
+}
+
+/**
+ * Make the index entry for a message
+ * @param header - The message headers
+ * @param buffer - The buffer containing the message
+ * @param index - The message number in the file, for the inventory string
+ * @returns The index entry
+ */
+function makeIndexEntry(header: Grib2MessageHeaders, buffer: DataView, index: number) : Grib2IndexEntry {
+    const pdt = header.sec4.contents.product_definition_template as ProductDefinition & {contents: Record<string, number>};
+    const contents = pdt.contents;
+
+    const has_surfaces = 'fixed_surface_1_type' in contents;
+    const surface1_type = has_surfaces ? contents.fixed_surface_1_type : 255;
+    const surface2_type = has_surfaces ? contents.fixed_surface_2_type : 255;
+
+    const forecast_time = header.sec4.getForecastTime();
+    const time_agg = header.sec4.getTimeAgg();
+    const ensemble = header.sec4.getEnsemble();
+
+    // Strip off the message number and offset
+    const inventory = header.getInventoryString(index).replace(/^\d+:\d+:/, '');
+
+    return {
+        offset: header.offset,
+        length: header.message_length,
+        discipline: header.sec0.contents.grib_discipline,
+        parameter_category: header.sec4.contents.product_definition_template.parameter_category,
+        parameter_number: header.sec4.contents.product_definition_template.parameter_number,
+        product_template: buffer.getUint16(header.sec4.offset + sec4_template_offset),
+        surface1_type: surface1_type,
+        surface1_value: has_surfaces ? surfaceValue(surface1_type, contents.fixed_surface_1_scale_factor, contents.fixed_surface_1_value) : NaN,
+        surface2_type: surface2_type,
+        surface2_value: has_surfaces ? surfaceValue(surface2_type, contents.fixed_surface_2_scale_factor, contents.fixed_surface_2_value) : NaN,
+        reference_time: header.getReferenceTime().toMillis(),
+        forecast_time: forecast_time.isValid ? forecast_time.as('seconds') : NaN,
+        agg_duration: time_agg === null ? 0 : time_agg.agg_dur.as('seconds'),
+        ensemble_type: ensemble === null ? 255 : contents.ensemble_type,
+        ensemble_perturbation: ensemble === null ? 0 : ensemble.perturbation_number,
+        grid_template: buffer.getUint16(header.sec3.offset + sec3_template_offset),
+        grid_id: hashString(header.sec3.getGridKey()),
+        data_representation_template: buffer.getUint16(header.sec5.offset + sec5_template_offset),
+        inventory: inventory,
+    };
+}
+
+type Grib2IndexColumn = Exclude<keyof Grib2IndexEntry, 'inventory'>;
+type Grib2ColumnArray = Float64Array | Uint32Array | Uint16Array | Uint8Array;
+
+// Times, offsets, and surface values need doubles (offsets can be past 4 GB); everything else fits in the size it is in the grib message
+const column_types: Record<Grib2IndexColumn, new(length: number) => Grib2ColumnArray> = {
+    offset: Float64Array,
+    length: Float64Array,
+    discipline: Uint8Array,
+    parameter_category: Uint8Array,
+    parameter_number: Uint8Array,
+    product_template: Uint16Array,
+    surface1_type: Uint8Array,
+    surface1_value: Float64Array,
+    surface2_type: Uint8Array,
+    surface2_value: Float64Array,
+    reference_time: Float64Array,
+    forecast_time: Float64Array,
+    agg_duration: Float64Array,
+    ensemble_type: Uint8Array,
+    ensemble_perturbation: Uint16Array,
+    grid_template: Uint16Array,
+    grid_id: Uint32Array,
+    data_representation_template: Uint16Array,
+};
+
+const column_names = Object.keys(column_types) as Grib2IndexColumn[];
+
+/**
+ * The index entries for a file stored as columns, one typed array per field, with all the inventory strings in one string. This takes about a hundred
+ *  bytes per message, which for files with thousands of messages is much less than keeping a Grib2MessageHeaders object (with all its sections and
+ *  templates) for each one.
+ */
+class Grib2HeaderTable {
+    readonly n_messages: number;
+    /** The value of each index entry field for every message, e.g., `columns.forecast_time[i]` for message i */
+    readonly columns: Record<Grib2IndexColumn, Grib2ColumnArray>;
+
+    private inventory_text: string;
+    private inventory_offsets: Uint32Array;
+
+    /**
+     * @param n_messages - The number of messages
+     * @param inventories - The inventory string for each message
+     */
+    constructor(n_messages: number, inventories: string[]) {
+        if (inventories.length != n_messages) {
+            throw `Header table has ${n_messages} messages, but ${inventories.length} inventory strings`;
+        }
+
+        const columns: Partial<Record<Grib2IndexColumn, Grib2ColumnArray>> = {};
+        column_names.forEach(name => { columns[name] = new column_types[name](n_messages); });
+
+        this.n_messages = n_messages;
+        this.columns = columns as Record<Grib2IndexColumn, Grib2ColumnArray>;
+        this.inventory_text = inventories.join('');
+        this.inventory_offsets = new Uint32Array(n_messages + 1);
+
+        for (let i = 0; i < n_messages; i++) {
+            this.inventory_offsets[i + 1] = this.inventory_offsets[i] + inventories[i].length;
+        }
+    }
+
+    /**
+     * Make a table from index entries
+     * @param entries - The index entries
+     * @returns The table
+     */
+    static fromEntries(entries: Grib2IndexEntry[]) {
+        const table = new Grib2HeaderTable(entries.length, entries.map(entry => entry.inventory));
+
+        column_names.forEach(name => {
+            const column = table.columns[name];
+            entries.forEach((entry, ientry) => { column[ientry] = entry[name]; });
+        });
+
+        return table;
+    }
+
+    /**
+     * @param index - The message index
+     * @returns The inventory string for the message, without the message number and offset
+     */
+    getInventory(index: number) {
+        return this.inventory_text.substring(this.inventory_offsets[index], this.inventory_offsets[index + 1]);
+    }
+
+    /**
+     * @param index - The message index
+     * @returns The index entry for the message as an object
+     */
+    getEntry(index: number) {
+        const entry: Partial<Grib2IndexEntry> = {inventory: this.getInventory(index)};
+        column_names.forEach(name => { entry[name] = this.columns[name][index]; });
+        return entry as Grib2IndexEntry;
+    }
+
+    /**
+     * Grib2 messages don't have checksums, so this is a hash of the message's index entry (everything but where the message is), which can be checked
+     *  without reading the message
+     * @param index - The message index
+     * @returns The checksum
+     */
+    getChecksum(index: number) {
+        const fields = column_names.filter(name => name != 'offset').map(name => this.columns[name][index]);
+        return hashString(`${fields.join(',')}:${this.getInventory(index)}`);
+    }
+
+    /**
+     * @returns The index entries for all the messages as objects
+     */
+    getEntries() {
+        const entries: Grib2IndexEntry[] = [];
+        for (let i = 0; i < this.n_messages; i++) {
+            entries.push(this.getEntry(i));
+        }
+        return entries;
+    }
+
+    /**
+     * Make a table with some of the messages in this one
+     * @param indices - The messages to keep, in the order to keep them
+     * @returns The new table
+     */
+    subset(indices: number[]) {
+        const table = new Grib2HeaderTable(indices.length, indices.map(i => this.getInventory(i)));
+
+        column_names.forEach(name => {
+            const src = this.columns[name];
+            const dst = table.columns[name];
+            indices.forEach((i, isub) => { dst[isub] = src[i]; });
+        });
+
+        return table;
+    }
+}
+
+/**
+ * Pack a header table into a compact binary index. The layout is a 16-byte header (magic, version, number of messages, and length of the string table),
+ *  then a fixed-size record for each message, then the inventory strings. Numbers are big-endian, like grib.
+ * @param table - The header table
+ * @returns The binary index
+ */
+function packIndex(table: Grib2HeaderTable) {
+    const n_messages = table.n_messages;
+    const inventories: string[] = [];
+    for (let i = 0; i < n_messages; i++) {
+        inventories.push(table.getInventory(i));
+    }
+
+    const strings_length = inventories.map(inv => inv.length).reduce((a, b) => a + b, 0);
+    const buffer = new ArrayBuffer(index_header_length + n_messages * index_record_length + strings_length);
+    const view = new DataView(buffer);
+    const bytes = new Uint8Array(buffer);
+    const cols = table.columns;
+
+    for (let i = 0; i < index_magic.length; i++) {
+        view.setUint8(i, index_magic.charCodeAt(i));
+    }
+    view.setUint16(4, index_version);
+    view.setUint32(8, n_messages);
+    view.setUint32(12, strings_length);
+
+    let string_offset = 0;
+    for (let imsg = 0; imsg < n_messages; imsg++) {
+        const rec = index_header_length + imsg * index_record_length;
+        const inventory = inventories[imsg];
+
+        if (inventory.length > 0xffff) {
+            throw `Inventory string for message ${imsg + 1} is too long for the index`;
+        }
+
+        view.setFloat64(rec, cols.offset[imsg]);
+        view.setFloat64(rec + 8, cols.length[imsg]);
+        view.setFloat64(rec + 16, cols.reference_time[imsg]);
+        view.setFloat64(rec + 24, cols.forecast_time[imsg]);
+        view.setFloat64(rec + 32, cols.agg_duration[imsg]);
+        view.setFloat64(rec + 40, cols.surface1_value[imsg]);
+        view.setFloat64(rec + 48, cols.surface2_value[imsg]);
+        view.setUint32(rec + 56, cols.grid_id[imsg]);
+        view.setUint32(rec + 60, string_offset);
+        view.setUint16(rec + 64, inventory.length);
+        view.setUint16(rec + 66, cols.grid_template[imsg]);
+        view.setUint16(rec + 68, cols.data_representation_template[imsg]);
+        view.setUint16(rec + 70, cols.ensemble_perturbation[imsg]);
+        view.setUint8(rec + 72, cols.discipline[imsg]);
+        view.setUint8(rec + 73, cols.parameter_category[imsg]);
+        view.setUint8(rec + 74, cols.parameter_number[imsg]);
+        view.setUint8(rec + 75, cols.surface1_type[imsg]);
+        view.setUint8(rec + 76, cols.surface2_type[imsg]);
+        view.setUint8(rec + 77, cols.ensemble_type[imsg]);
+        view.setUint16(rec + 78, cols.product_template[imsg]);
+
+        // The inventory strings are all ASCII
+        const string_start = index_header_length + n_messages * index_record_length + string_offset;
+        for (let i = 0; i < inventory.length; i++) {
+            bytes[string_start + i] = inventory.charCodeAt(i) & 0xff;
+        }
+        string_offset += inventory.length;
+    }
+
+    return buffer;
+}
+
+/**
+ * Unpack a binary index made by packIndex()
+ * @param buffer - The binary index
+ * @returns The header table
+ */
+function unpackIndex(buffer: ArrayBuffer) {
+    const view = new DataView(buffer);
+    const bytes = new Uint8Array(buffer);
+
+    if (buffer.byteLength < index_header_length || String.fromCharCode(bytes[0], bytes[1], bytes[2], bytes[3]) != index_magic) {
+        throw `Not a grib2 message index`;
+    }
+
+    const version = view.getUint16(4);
+    if (version != index_version) {
+        throw `Unsupported grib2 message index version ${version}`;
+    }
+
+    const n_messages = view.getUint32(8);
+    const strings_start = index_header_length + n_messages * index_record_length;
+    if (strings_start + view.getUint32(12) > buffer.byteLength) {
+        throw `Grib2 message index is truncated`;
+    }
+
+    const inventories: string[] = [];
+    for (let imsg = 0; imsg < n_messages; imsg++) {
+        const rec = index_header_length + imsg * index_record_length;
+        const string_offset = strings_start + view.getUint32(rec + 60);
+        inventories.push(String.fromCharCode.apply(null, bytes.subarray(string_offset, string_offset + view.getUint16(rec + 64))));
+    }
+
+    const table = new Grib2HeaderTable(n_messages, inventories);
+    const cols = table.columns;
+
+    for (let imsg = 0; imsg < n_messages; imsg++) {
+        const rec = index_header_length + imsg * index_record_length;
+
+        cols.offset[imsg] = view.getFloat64(rec);
+        cols.length[imsg] = view.getFloat64(rec + 8);
+        cols.reference_time[imsg] = view.getFloat64(rec + 16);
+        cols.forecast_time[imsg] = view.getFloat64(rec + 24);
+        cols.agg_duration[imsg] = view.getFloat64(rec + 32);
+        cols.surface1_value[imsg] = view.getFloat64(rec + 40);
+        cols.surface2_value[imsg] = view.getFloat64(rec + 48);
+        cols.grid_id[imsg] = view.getUint32(rec + 56);
+        cols.grid_template[imsg] = view.getUint16(rec + 66);
+        cols.data_representation_template[imsg] = view.getUint16(rec + 68);
+        cols.ensemble_perturbation[imsg] = view.getUint16(rec + 70);
+        cols.discipline[imsg] = view.getUint8(rec + 72);
+        cols.parameter_category[imsg] = view.getUint8(rec + 73);
+        cols.parameter_number[imsg] = view.getUint8(rec + 74);
+        cols.surface1_type[imsg] = view.getUint8(rec + 75);
+        cols.surface2_type[imsg] = view.getUint8(rec + 76);
+        cols.ensemble_type[imsg] = view.getUint8(rec + 77);
+        cols.product_template[imsg] = view.getUint16(rec + 78);
+    }
+
+    return table;
+}
+
+/**
+ * Write a header table as a wgrib2-style inventory (.idx file)
+ * @param table - The header table
+ * @returns The inventory, one line per message
+ */
+function formatInventory(table: Grib2HeaderTable) {
+    const lines: string[] = [];
+    for (let i = 0; i < table.n_messages; i++) {
+        lines.push(`${i + 1}:${table.columns.offset[i]}:${table.getInventory(i)}`);
+    }
+    return lines.join("\n") + "\n";
+}
+
+export {Grib2HeaderTable, makeIndexEntry, packIndex, unpackIndex, formatInventory, hashString};
+export type {Grib2IndexEntry, Grib2IndexColumn, Grib2ColumnArray};
@@ -0,0 +1,194 @@
+/**
+ * The stages of getting data out of a grib file, plus the post-processing stages. 'scaling' includes applying the bitmap, as the two are done in the same pass.
+ */
+type Grib2Stage = 'fetch' | 'inflate' | 'scan' | 'module_init' | 'input_copy' | 'decompress' | 'scaling' | 'scan_mode' | 'output_copy' | 'coordinates' | 'regrid_weights' | 'regrid' | 'pyramid' | 'ensemble' | 'difference' | 'expression' | 'cache_read' | 'cache_write' | 'quantize';
+
+interface Grib2StageMetrics {
+    /** Number of times the stage ran */
+    calls: number;
+    /** Total wall-clock time spent in the stage in milliseconds */
+    time_ms: number;
+    /** Number of bytes the stage processed */
+    bytes: number;
+    /** Number of grid points the stage processed */
+    points: number;
+}
+
+interface Grib2StageCounts {
+    bytes?: number;
+    points?: number;
+}
+
+/**
+ * Counters from the native decoders. The names match the fields in decode_counters.h.
+ */
+interface Grib2NativeCounters {
+    groups_decoded: number;
+    bits_read: number;
+    values_decoded: number;
+    allocations: number;
+}
+
+const native_counter_names: (keyof Grib2NativeCounters)[] = ['groups_decoded', 'bits_read', 'values_decoded', 'allocations'];
+
+/**
+ * An error that didn't fail the operation it happened in (e.g., a persistent cache store that couldn't be read, so the message was decoded instead)
+ */
+interface Grib2HandledError {
+    /** The stage the error happened in */
+    stage: Grib2Stage;
+    /** The error message */
+    message: string;
+}
+
+// Keep only the most recent handled errors, so a store that's failing on every message doesn't grow the metrics without bound
+const max_handled_errors = 100;
+
+function now() {
+    return typeof performance !== 'undefined' ? performance.now() : Date.now();
+}
+
+/**
+ * Timings and counters for fetching, scanning, and decoding grib data. Pass one of these in the options to collect metrics (it's off otherwise).
+ *  Metrics from different operations can be accumulated in one object, and toJSON() gives a plain object suitable for logging.
+ */
+class Grib2Metrics {
+    readonly stages: Partial<Record<Grib2Stage, Grib2StageMetrics>>;
+    readonly counters: Grib2NativeCounters;
+    readonly errors: Grib2HandledError[];
+
+    constructor() {
+        this.stages = {};
+        this.counters = {groups_decoded: 0, bits_read: 0, values_decoded: 0, allocations: 0};
+        this.errors = [];
+    }
+
+    /**
+     * Start timing a stage
+     * @param stage - The stage to time
+     * @returns A function to call when the stage is done, with the number of bytes and/or grid points the stage processed
+     */
+    start(stage: Grib2Stage) {
+        const start_time = now();
+        return (counts?: Grib2StageCounts) => this.record(stage, now() - start_time, counts);
+    }
+
+    /**
+     * Record a run of a stage
+     * @param stage - The stage that ran
+     * @param time_ms - How long the stage took in milliseconds
+     * @param counts - The number of bytes and/or grid points the stage processed
+     */
+    record(stage: Grib2Stage, time_ms: number, counts?: Grib2StageCounts) {
+        counts = counts === undefined ? {} : counts;
+
+        if (this.stages[stage] === undefined) {
+            this.stages[stage] = {calls: 0, time_ms: 0, bytes: 0, points: 0};
+        }
+
+        const stage_metrics = this.stages[stage];
+        stage_metrics.calls += 1;
+        stage_metrics.time_ms += time_ms;
+        stage_metrics.bytes += counts.bytes === undefined ? 0 : counts.bytes;
+        stage_metrics.points += counts.points === undefined ? 0 : counts.points;
+    }
+
+    /**
+     * Record an error that was handled without failing the operation
+     * @param stage - The stage the error happened in
+     * @param err - The error
+     */
+    recordError(stage: Grib2Stage, err: unknown) {
+        this.errors.push({stage: stage, message: `${err}`});
+        if (this.errors.length > max_handled_errors) {
+            this.errors.splice(0, this.errors.length - max_handled_errors);
+        }
+    }
+
+    /**
+     * Add counts from the native decoders
+     * @param counts - The counts, in the order given by native_counter_names
+     */
+    addNativeCounters(counts: ArrayLike<number>) {
+        native_counter_names.forEach((name, i) => {
+            this.counters[name] += counts[i];
+        });
+    }
+
+    /**
+     * Add all the metrics from another Grib2Metrics object to this one
+     * @param other - The metrics to add
+     */
+    merge(other: Grib2Metrics) {
+        (Object.keys(other.stages) as Grib2Stage[]).forEach(stage => {
+            const {calls, time_ms, bytes, points} = other.stages[stage];
+
+            if (this.stages[stage] === undefined) {
+                this.stages[stage] = {calls: 0, time_ms: 0, bytes: 0, points: 0};
+            }
+
+            const stage_metrics = this.stages[stage];
+            stage_metrics.calls += calls;
+            stage_metrics.time_ms += time_ms;
+            stage_metrics.bytes += bytes;
+            stage_metrics.points += points;
+        });
+
+        native_counter_names.forEach(name => {
+            this.counters[name] += other.counters[name];
+        });
+
+        other.errors.forEach(error => this.recordError(error.stage, error.message));
+    }
+
+    /**
+     * @returns The total time in milliseconds across all stages
+     */
+    getTotalTime() {
+        return (Object.keys(this.stages) as Grib2Stage[]).map(stage => this.stages[stage].time_ms).reduce((a, b) => a + b, 0);
+    }
+
+    /**
+     * @returns A plain object with copies of the stage metrics, counters, and handled errors
+     */
+    toJSON() {
+        const stages: Partial<Record<Grib2Stage, Grib2StageMetrics>> = {};
+        (Object.keys(this.stages) as Grib2Stage[]).forEach(stage => {
+            stages[stage] = {...this.stages[stage]};
+        });
+
+        return {stages: stages, counters: {...this.counters}, errors: this.errors.map(error => ({...error})), total_time_ms: this.getTotalTime()};
+    }
+}
+
+/**
+ * Start timing a stage if metrics are being collected
+ * @param metrics - The metrics to record into, or undefined/null if metrics aren't being collected
+ * @param stage - The stage to time
+ * @returns A function to call when the stage is done (which does nothing if metrics aren't being collected)
+ */
+function startStage(metrics: Grib2Metrics | null | undefined, stage: Grib2Stage) : (counts?: Grib2StageCounts) => void {
+    if (metrics === undefined || metrics === null) {
+        return () => {};
+    }
+
+    return metrics.start(stage);
+}
+
+/**
+ * Report an error that was handled without failing the operation, into the metrics if they're being collected, or as a console warning otherwise
+ * @param metrics - The metrics to record into, or undefined/null if metrics aren't being collected
+ * @param stage - The stage the error happened in
+ * @param err - The error
+ */
+function reportError(metrics: Grib2Metrics | null | undefined, stage: Grib2Stage, err: unknown) {
+    if (metrics === undefined || metrics === null) {
+        console.warn(`grib2 ${stage}: ${err}`);
+        return;
+    }
+
+    metrics.recordError(stage, err);
+}
+
+export {Grib2Metrics, startStage, reportError, native_counter_names};
+export type {Grib2Stage, Grib2StageMetrics, Grib2StageCounts, Grib2NativeCounters, Grib2HandledError};
@@ -2,10 +2,12 @@
 import { DateTime, Duration } from "luxon";
 import { Grib2Struct, unpackStruct, unpackUTF8String, unpackerFactory, G2UInt1, G2UInt2, G2UInt4, G2UInt8, InternalTypeMapper, Constructor } from "./grib2base";
 import { DataRepresentationDefinition, g2_section5_template_unpackers } from "./grib2datarepdefs";
-import { GridDefinition, ScanModeFlags, hasNiNj, hasScanModeFlags, section3_template_unpackers } from "./grib2griddefs";
+import { GridDefinition, ScanModeFlags, hasComponentFlags, hasNiNj, hasScanModeFlags, section3_template_unpackers } from "./grib2griddefs";
 import { EnsembleSpec, ProductDefinition, SurfaceSpec, TimeAggSpec, g2_section4_template_unpackers, isAnalysisOrForecastProduct, isEnsembleProduct, isHorizontalLayerProduct, isTimeAggProduct } from "./grib2productdefs";
 import { lookupGrib2Parameter } from "./grib2producttables";
-import { applyBitmap } from "./unpack";
+import { Grib2DecodeOptions, Grib2OutputArray, Grib2PackedData, Grib2ScalingParameters, bitmapPackedIndices, pickPackedValues, unpackScaling } from "./unpack";
+import { Grib2Metrics, startStage } from "./grib2metrics";
+import { heapBytes } from "./heap";
 
 type ConstructorWithSectionNumber = Constructor<Grib2Struct<{section_number: number}>>;
 
@@ -133,7 +135,42 @@ class Grib2GridDefinitionSection extends sectionNumberCheck(Grib2Struct<Grib2Sec
         return this.contents.grid_definition_template.getGridParameters();
     }
 
-    applyScanModeFlags(data: Float32Array) {
+    /**
+     * @returns Whether vector quantities (e.g., u and v winds) on this grid are relative to the grid's x and y directions instead of east and north
+     */
+    hasGridRelativeComponents() {
+        return hasComponentFlags(this.contents.grid_definition_template) && this.contents.grid_definition_template.hasGridRelativeComponents();
+    }
+
+    /**
+     * @returns A string that's the same for any two sections that describe the same grid, for caching things computed from the grid
+     */
+    getGridKey() {
+        const template = this.contents.grid_definition_template as GridDefinition & {contents: Record<string, number>};
+        return `${this.getGridParameters().projection}:${this.contents.grid_size}:${JSON.stringify(template.contents)}`;
+    }
+
+    /**
+     * Map indices in the decoded data (after applyScanModeFlags()) to where those points are stored in the message
+     * @param indices - Indices in the decoded data
+     * @returns Indices in the order the points are stored in the message
+     */
+    getStorageIndices(indices: Int32Array) {
+        if (!hasScanModeFlags(this.contents.grid_definition_template) || !this.contents.grid_definition_template.getScanModeFlags().do_adjacent_rows_alternate) {
+            return indices;
+        }
+
+        // Odd rows are stored backwards
+        const {ngrid_i} = this.getGridDims();
+        return indices.map(idx => {
+            if (idx < 0) return idx;
+
+            const j = Math.floor(idx / ngrid_i);
+            return j % 2 == 1 ? j * ngrid_i + ngrid_i - 1 - (idx - j * ngrid_i) : idx;
+        });
+    }
+
+    applyScanModeFlags(data: Grib2OutputArray) {
         if (!hasScanModeFlags(this.contents.grid_definition_template)) {
             return;
         }
@@ -236,10 +273,32 @@ class Grib2DataRepresentationSection extends sectionNumberCheck(Grib2Struct<Grib
         this.checkSectionNumber();
     }
 
-    async unpackData(buffer: DataView, offset: number, packed_len: number, sec3: Grib2GridDefinitionSection) {
-        const data_unpacked = await this.contents.data_representation_template.unpackData(buffer, offset, packed_len, this.contents.number_of_data_points);
-        sec3.applyScanModeFlags(data_unpacked);
-        return data_unpacked;
+    /**
+     * @returns The scaling the packed integers are decoded with, or null if the template doesn't have one
+     */
+    getScaling() : Grib2ScalingParameters | null {
+        const template = this.contents.data_representation_template as DataRepresentationDefinition & {contents: Record<string, number>};
+        const {reference_value, binary_scale_factor, decimal_scale_factor} = template.contents;
+        if (reference_value === undefined || binary_scale_factor === undefined || decimal_scale_factor === undefined) {
+            return null;
+        }
+
+        return {reference_value: reference_value, binary_scale_factor: binary_scale_factor, decimal_scale_factor: decimal_scale_factor};
+    }
+
+    async unpackData(buffer: DataView, offset: number, packed_len: number, opts?: Grib2DecodeOptions) {
+        return await this.contents.data_representation_template.unpackData(buffer, offset, packed_len, this.contents.number_of_data_points, opts);
+    }
+
+    async extractPoints(buffer: DataView, offset: number, packed_len: number, packed_indices: Int32Array, opts?: Grib2DecodeOptions) : Promise<Grib2PackedData> {
+        const template = this.contents.data_representation_template;
+        if (template.extractPoints !== undefined) {
+            return await template.extractPoints(buffer, offset, packed_len, this.contents.number_of_data_points, packed_indices, opts);
+        }
+
+        // This template can't unpack individual values, so unpack everything and pick out the points
+        const packed_data = await template.unpackData(buffer, offset, packed_len, this.contents.number_of_data_points, opts);
+        return await pickPackedValues(packed_data, packed_indices, opts === undefined ? undefined : opts.metrics);
     }
 }
 
@@ -261,12 +320,30 @@ class Grib2BitmapSection extends sectionNumberCheck(Grib2Struct<Grib2Section6Con
         this.checkSectionNumber();
     }
 
-    async unpackData(buffer: DataView, decoded_data: Float32Array, expected_size: number) {
+    getBitmap(buffer: DataView) {
         const header_length = 6;
-        if (this.contents.section_length == header_length) return decoded_data; // No bitmap, so just return the input data
+        if (this.contents.section_length == header_length) return null;
+
+        return heapBytes(buffer, this.offset + header_length, this.contents.section_length - header_length);
+    }
+
+    async unpackData(buffer: DataView, packed_data: Grib2PackedData, expected_size: number, opts?: Grib2DecodeOptions) {
+        return unpackScaling(packed_data, this.getBitmap(buffer), expected_size, opts);
+    }
 
-        const bitmap = new Uint8Array(buffer.buffer.slice(this.offset + header_length, this.offset + this.contents.section_length - header_length));
-        return applyBitmap(bitmap, decoded_data, expected_size);
+    /**
+     * Find where grid points are in the packed data
+     * @param buffer - The buffer containing the message
+     * @param grid_indices - Indices of points in the grid, in the order they're stored in the message
+     * @param grid_size - The number of points in the grid
+     * @param metrics - Collect timings into this object
+     * @returns Indices into the packed data, with -1 for missing points
+     */
+    async getPackedIndices(buffer: DataView, grid_indices: Int32Array, grid_size: number, metrics?: Grib2Metrics) {
+        const bitmap = this.getBitmap(buffer);
+        if (bitmap === null) return grid_indices;
+
+        return await bitmapPackedIndices(bitmap, grid_size, grid_indices, metrics);
     }
 }
 
@@ -287,10 +364,35 @@ class Grib2DataSection extends sectionNumberCheck(Grib2Struct<Grib2Section7Conte
         this.checkSectionNumber();
     }
 
-    async unpackData(buffer: DataView, sec3: Grib2GridDefinitionSection, sec5: Grib2DataRepresentationSection, sec6: Grib2BitmapSection) {
+    async unpackData(buffer: DataView, sec3: Grib2GridDefinitionSection, sec5: Grib2DataRepresentationSection, sec6: Grib2BitmapSection, opts?: Grib2DecodeOptions) {
         const header_length = 5;
-        const data_unpacked = await sec5.unpackData(buffer, this.offset + header_length, this.contents.section_length - header_length, sec3);
-        return sec6.unpackData(buffer, data_unpacked, sec3.contents.grid_size);
+        const data_packed = await sec5.unpackData(buffer, this.offset + header_length, this.contents.section_length - header_length, opts);
+        const data_unpacked = await sec6.unpackData(buffer, data_packed, sec3.contents.grid_size, opts);
+
+        const stop_scan_mode = startStage(opts === undefined ? undefined : opts.metrics, 'scan_mode');
+        sec3.applyScanModeFlags(data_unpacked.data);
+        stop_scan_mode({points: data_unpacked.data.length});
+        return data_unpacked;
+    }
+
+    /**
+     * Decode only some of the grid points. For data representation templates that support it, this only unpacks the requested points; otherwise the
+     *  whole field is unpacked, but only the requested points are scaled and returned.
+     * @param indices - Indices of points in the decoded grid (i.e., after the scan mode has been applied), with -1 for no point
+     * @returns The values at the points as 32-bit floats, with NaN for missing values
+     */
+    async extractPoints(buffer: DataView, sec3: Grib2GridDefinitionSection, sec5: Grib2DataRepresentationSection, sec6: Grib2BitmapSection, indices: Int32Array,
+                        opts?: Grib2DecodeOptions) {
+        opts = opts === undefined ? {} : opts;
+        const header_length = 5;
+
+        const grid_indices = sec3.getStorageIndices(indices);
+        const packed_indices = await sec6.getPackedIndices(buffer, grid_indices, sec3.contents.grid_size, opts.metrics);
+        const data_packed = await sec5.extractPoints(buffer, this.offset + header_length, this.contents.section_length - header_length, packed_indices, opts);
+
+        // The missing points are already marked in the extracted values, so there's no bitmap to apply
+        const {data} = await unpackScaling(data_packed, null, indices.length, {metrics: opts.metrics});
+        return data as Float32Array;
     }
 }
 
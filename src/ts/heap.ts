@@ -0,0 +1,123 @@
+import { Grib2CompressionModule } from "../compiled/grib_compression";
+
+// Views handed out by a Grib2HeapBuffer remember where they came from, since they stop working (detach) if the heap grows
+interface Grib2HeapView extends DataView {
+    heap_buffer?: Grib2HeapBuffer;
+}
+
+interface Grib2HeapBytes extends Uint8Array {
+    heap_ptr?: number;
+}
+
+/**
+ * A block of the WASM heap holding grib data, so the decoders can read the packed data where it is instead of copying it onto the heap for every
+ *  decode. The heap can grow while decoding (which detaches any views on it), so get a fresh view from `view` instead of holding onto one. The memory
+ *  isn't garbage-collected, so call free() when done with it.
+ */
+class Grib2HeapBuffer {
+    private module: Grib2CompressionModule;
+    private data_: number;
+    private view_: Grib2HeapView | null;
+
+    readonly length: number;
+
+    private constructor(module: Grib2CompressionModule, data_: number, length: number) {
+        this.module = module;
+        this.data_ = data_;
+        this.view_ = null;
+        this.length = length;
+    }
+
+    /**
+     * Allocate a block on the heap
+     * @param module - The WASM module
+     * @param length - The size of the block in bytes
+     */
+    static allocate(module: Grib2CompressionModule, length: number) {
+        const data_ = module._malloc(Math.max(length, 1));
+        if (data_ === 0) {
+            throw `Couldn't allocate ${length} bytes on the WASM heap`;
+        }
+
+        return new Grib2HeapBuffer(module, data_, length);
+    }
+
+    /**
+     * The address of the block on the heap
+     */
+    get pointer() {
+        if (this.data_ === 0) {
+            throw `This heap buffer has been freed`;
+        }
+
+        return this.data_;
+    }
+
+    /**
+     * A view on the data. This is a new view if the heap has grown since the last one.
+     */
+    get view() : DataView {
+        const heap = this.module.HEAPU8.buffer;
+        if (this.view_ === null || this.view_.buffer !== heap) {
+            this.view_ = new DataView(heap, this.pointer, this.length);
+            this.view_.heap_buffer = this;
+        }
+
+        return this.view_;
+    }
+
+    /**
+     * Copy data into the block
+     * @param data - The data
+     * @param offset - Where to put it, in bytes from the start of the block
+     */
+    set(data: Uint8Array, offset: number) {
+        if (offset + data.length > this.length) {
+            throw `Writing ${data.length} bytes at ${offset} goes past the end of a ${this.length}-byte heap buffer`;
+        }
+
+        this.module.HEAPU8.set(data, this.pointer + offset);
+    }
+
+    /**
+     * Free the block. Any files using it can't be decoded after this.
+     */
+    free() {
+        if (this.data_ === 0) return;
+
+        this.module._free(this.data_);
+        this.data_ = 0;
+        this.view_ = null;
+    }
+}
+
+/**
+ * Get bytes from a buffer. If the buffer is a view from a Grib2HeapBuffer, the bytes remember their address on the heap (see heapPointer()), and a
+ *  view that's been detached by the heap growing is replaced with a fresh one.
+ * @param buffer - The buffer
+ * @param offset - Where the bytes start in the buffer
+ * @param length - The number of bytes
+ * @returns A view on the bytes
+ */
+function heapBytes(buffer: DataView, offset: number, length: number) : Uint8Array {
+    const heap_buffer = (buffer as Grib2HeapView).heap_buffer;
+    if (heap_buffer === undefined) {
+        return new Uint8Array(buffer.buffer, buffer.byteOffset + offset, length);
+    }
+
+    const view = heap_buffer.view;
+    const bytes: Grib2HeapBytes = new Uint8Array(view.buffer, view.byteOffset + offset, length);
+    bytes.heap_ptr = heap_buffer.pointer + offset;
+    return bytes;
+}
+
+/**
+ * @param data - Bytes from heapBytes()
+ * @returns The address of the bytes on the WASM heap (which stays good even if the heap grows), or null if they aren't on the heap
+ */
+function heapPointer(data: Uint8Array) {
+    const heap_ptr = (data as Grib2HeapBytes).heap_ptr;
+    return heap_ptr === undefined ? null : heap_ptr;
+}
+
+export {Grib2HeapBuffer, heapBytes, heapPointer};
@@ -5,70 +5,683 @@ import {Grib2BitmapSection, Grib2DataRepresentationSection, Grib2DataSection, Gr
         g2_section5_unpacker, g2_section6_unpacker, g2_section7_unpacker} from './grib2section';
 import { addGrib2ParameterListing } from './grib2producttables';
 import { DurationObjectUnits } from 'luxon';
+import { Grib2DecodeOptions, Grib2FieldStats, Grib2OutputArray, Grib2OutputFormat, Grib2PackingParameters, complexPackingEncoder, freeDecoderSession, getCompressionModule } from './unpack';
+import { Grib2HandledError, Grib2Metrics, Grib2NativeCounters, Grib2Stage, Grib2StageMetrics, reportError, startStage } from './grib2metrics';
+import { Grib2CoordinateType, Grib2LatLonCoordinates, Grib2ProjectedCoordinates, clearCoordinateCache, getGridCoordinates, getWindRotation } from './coordinates';
+import { Grib2RegridMethod, Grib2RegridOptions, Grib2RegridTarget, Grib2RegridWeights, clearRegridCache, getRegridWeights, regridCached } from './regrid';
+import { Grib2ExtractOptions, Grib2PointExtraction, Grib2Points, extractPoints } from './extract';
+import { Grib2PyramidLevel, Grib2PyramidOptions, Grib2PyramidReducer, buildPyramid } from './pyramid';
+import { Grib2Compression, Grib2StreamOptions, readGribStream } from './stream';
+import { Grib2ColumnArray, Grib2HeaderTable, Grib2IndexColumn, Grib2IndexEntry, formatInventory, makeIndexEntry, packIndex, unpackIndex } from './grib2index';
+import { Grib2EnsembleOptions, Grib2EnsembleReducer, Grib2EnsembleStats, reduceEnsemble } from './ensemble';
+import { Grib2Interval, Grib2IntervalOptions, Grib2IntervalSeries, differenceAccumulations } from './accumulation';
+import { Grib2Expression, Grib2ExpressionOptions, derived_expressions } from './expression';
+import { Grib2BlobSource, Grib2ByteRange, Grib2ByteSource, Grib2FileHandle, Grib2FileHandleSource, Grib2MessageCache, Grib2MessageCacheOptions, Grib2RangeSource, Grib2SourceRange,
+         fetchSourceVersion, remoteOffset, responseVersion } from './source';
+import { Grib2HeapBuffer, heapBytes } from './heap';
+import { Grib2PrefetchOptions, Grib2Scheduler, Grib2SchedulerOptions, Grib2Task, Grib2TaskKind, Grib2TaskOptions, Grib2TaskState, cancelled_message } from './scheduler';
+import { Grib2CachedField, Grib2DirectoryFS, Grib2DirectoryStore, Grib2IndexedDBStore, Grib2PersistentCache, Grib2PersistentCacheOptions, Grib2PersistentStore,
+         Grib2StoredEntry, copyFieldData } from './persistent';
 
 /**
- * Grib2 files contain one or more grib2 messages in sequence, and each message is independent of all the others. This class keeps the headers
- * for all messages in memory and doesn't unpack the actual data until getMessage() is called.
+ * Grib2 files contain one or more grib2 messages in sequence, and each message is independent of all the others. This class keeps a compact table of
+ * the key fields for all messages (see Grib2HeaderTable) and doesn't unpack the full headers for a message until they're needed, or the actual data
+ * until getMessage() is called. A file opened with fromSource() isn't kept in memory at all; each message is read when it's decoded. A file on the
+ * WASM heap (see toHeap()) is decoded without copying the packed data. With a persistent cache (see usePersistentCache()), decoded messages are kept
+ * between page loads or restarts.
  */
 class Grib2File {
-    readonly headers: Grib2MessageHeaders[];
-    readonly buffer: DataView;
+    private headers_: Grib2MessageHeaders[];
+    private index_: Grib2HeaderTable | null;
+    private cache: Grib2MessageCache | null;
+    private heap: Grib2HeapBuffer | null;
+    private buffer_: DataView | null;
+    private persistent: Grib2PersistentCache | null;
+    private source_url: string | null;
+    private source_version: string | null;
+    private source_ranges: Grib2SourceRange[] | null;
+
+    /** Timings and counters for fetching, scanning, and decoding messages from this file, or null if metrics aren't being collected */
+    readonly metrics: Grib2Metrics | null;
+
+    /** Schedules reads and decodes for getMessage() by priority, or null to run them right away. Files from Grib2Inventory.downloadData() get the scheduler
+     *  that downloaded them, and searches keep it. */
+    scheduler: Grib2Scheduler | null;
 
-    constructor(headers: Grib2MessageHeaders[], buffer: DataView) {
-        this.headers = headers;
-        this.buffer = buffer;
+    /**
+     * @param headers - The headers for each message, or null to unpack them from the index as they're needed
+     * @param data - The data (in memory or on the WASM heap), or a cache to read messages from a source as they're needed (which requires an index)
+     * @param metrics - Metrics to collect
+     * @param index - A header table or index entries for the messages (required if headers is null)
+     */
+    constructor(headers: Grib2MessageHeaders[] | null, data: DataView | Grib2HeapBuffer | Grib2MessageCache, metrics?: Grib2Metrics | null, index?: Grib2HeaderTable | Grib2IndexEntry[] | null) {
+        if ((headers === null || data instanceof Grib2MessageCache) && (index === undefined || index === null)) {
+            throw `Grib2File needs either headers or an index`;
+        }
+
+        this.index_ = index === undefined || index === null ? null : index instanceof Grib2HeaderTable ? index : Grib2HeaderTable.fromEntries(index);
+        this.headers_ = headers === null ? new Array(this.index_.n_messages) : headers;
+        this.buffer_ = data instanceof DataView ? data : null;
+        this.heap = data instanceof Grib2HeapBuffer ? data : null;
+        this.cache = data instanceof Grib2MessageCache ? data : null;
+        this.metrics = metrics === undefined ? null : metrics;
+        this.scheduler = null;
+        this.persistent = null;
+        this.source_url = null;
+        this.source_version = null;
+        this.source_ranges = null;
+    }
+
+    /**
+     * The data, or null for a file opened with fromSource(). For a file on the WASM heap, this is a view on the heap, which stops working if the heap
+     *  grows, so don't hold onto it.
+     */
+    get buffer() {
+        return this.heap !== null ? this.heap.view : this.buffer_;
+    }
+
+    /**
+     * The number of messages in the file
+     */
+    get n_messages() {
+        return this.index_ === null ? this.headers_.length : this.index_.n_messages;
+    }
+
+    /**
+     * The headers for all the messages. This unpacks any headers that haven't been unpacked yet, so for files with many messages, it's better to use
+     *  getHeaders() for the ones that are needed, or the columns in getHeaderTable().
+     */
+    get headers() {
+        for (let i = 0; i < this.n_messages; i++) {
+            this.getHeaders(i);
+        }
+        return this.headers_;
+    }
+
+    /**
+     * Get the headers for one message, unpacking them if they haven't been unpacked yet. For a file opened with fromSource(), use loadHeaders() instead,
+     *  since the message may need to be read first.
+     * @param index - The index of the message
+     * @returns The message headers
+     */
+    getHeaders(index: number) {
+        if (index < 0 || index >= this.n_messages) {
+            throw `Message index ${index} is out of range for a file with ${this.n_messages} messages`;
+        }
+
+        if (this.headers_[index] === undefined) {
+            if (this.buffer === null) {
+                throw `The headers for message ${index + 1} haven't been read yet; use loadHeaders() to read them`;
+            }
+
+            const offset = this.index_.columns.offset[index];
+            if (offset + this.index_.columns.length[index] > this.buffer.byteLength) {
+                throw `Message ${index + 1} goes past the end of the data; does the index go with this file?`;
+            }
+
+            this.headers_[index] = Grib2MessageHeaders.unpack(this.buffer, offset);
+        }
+
+        return this.headers_[index];
+    }
+
+    /**
+     * Get the headers for one message, reading the message first if the file was opened with fromSource()
+     * @param index - The index of the message
+     * @returns The message headers
+     */
+    async loadHeaders(index: number) {
+        return (await this.loadMessage(index)).header;
+    }
+
+    /**
+     * Get the compact table of the key fields (offset, length, parameter, level, times, grid, etc.) for all the messages in the file
+     * @returns The header table
+     */
+    getHeaderTable() {
+        if (this.index_ === null) {
+            this.index_ = Grib2HeaderTable.fromEntries(this.headers_.map((header, ihdr) => makeIndexEntry(header, this.buffer, ihdr)));
+        }
+
+        return this.index_;
+    }
+
+    /**
+     * Get the index entries for the messages in the file as objects. For files with many messages, getHeaderTable() has the same fields in less memory.
+     * @returns The index entry for each message
+     */
+    getIndex() {
+        return this.getHeaderTable().getEntries();
+    }
+
+    /**
+     * Make a compact binary index of the messages in the file, which can be saved and passed to fromIndex() to reopen the file without scanning it
+     * @returns The binary index
+     */
+    exportIndex() {
+        return packIndex(this.getHeaderTable());
+    }
+
+    /**
+     * Make a wgrib2-style inventory (.idx file) for the file
+     * @returns The inventory text
+     */
+    exportInventory() {
+        return formatInventory(this.getHeaderTable());
+    }
+
+    /**
+     * Open a grib file using an index made by exportIndex(). This doesn't look at the data until a message is decoded.
+     * @param buffer - The data
+     * @param index - The binary index, or the index entries
+     * @param opts - Use the `metrics` option to collect timings for decoding messages from the file
+     * @returns A Grib2File with all the messages
+     * @example
+     * const index = g2_file.exportIndex();  // Save this alongside the file
+     * // Later on ...
+     * const g2_file = grib.Grib2File.fromIndex(buffer, index);
+     * const msg = await g2_file.search(':TMP:2 m above ground:').getMessage(0);
+     */
+    static fromIndex(buffer: DataView, index: ArrayBuffer | Grib2HeaderTable | Grib2IndexEntry[], opts?: {metrics?: Grib2Metrics}) {
+        opts = opts === undefined ? {} : opts;
+        const table = index instanceof ArrayBuffer ? unpackIndex(index) : index;
+        return new Grib2File(null, buffer, opts.metrics, table);
+    }
+
+    /**
+     * Get the inventory string for a message
+     * @param index - The index of the message
+     * @returns The inventory string
+     */
+    getInventoryString(index: number) {
+        if (this.index_ !== null) {
+            return `${index + 1}:${this.index_.columns.offset[index]}:${this.index_.getInventory(index)}`;
+        }
+
+        return this.headers_[index].getInventoryString(index);
     }
 
     /**
      * Get a grib2 message from the file by index.
      * @param index - The index of the message
+     * @param opts - Options for decoding the data. Use `output_format` to get half-precision floats or the raw packed integers instead of 32-bit floats,
+     *  and `destination` to decode into an existing array. With a scheduler (the file's, or one passed as `scheduler`), the read and the decode are queued
+     *  with the given `priority` and `group`, and `signal` cancels them if they haven't run yet.
      * @returns The message at the index `index`
+     * @example
+     * // Decode into an existing Uint16Array as half-precision floats, e.g., for uploading to a 16-bit float texture
+     * const msg = await g2_file.getMessage(0, {output_format: 'float16', destination: texture_data});
+     */
+    async getMessage(index: number, opts?: Grib2DecodeOptions & Grib2TaskOptions & {scheduler?: Grib2Scheduler}) {
+        opts = opts === undefined ? {} : opts;
+        const scheduler = opts.scheduler === undefined ? this.scheduler : opts.scheduler;
+        const task_opts: Grib2TaskOptions = {priority: opts.priority, signal: opts.signal, group: opts.group};
+
+        if (opts.metrics === undefined && this.metrics !== null) {
+            opts = {...opts, metrics: this.metrics};
+        }
+
+        if (this.persistent !== null) {
+            const cached = await this.readPersistent(index, opts);
+            if (cached !== null) {
+                if (opts.signal !== undefined && opts.signal.aborted) {
+                    throw cancelled_message;
+                }
+
+                return cached;
+            }
+        }
+
+        let header: Grib2MessageHeaders, buffer: DataView, msg: Grib2Message;
+
+        if (scheduler === null) {
+            ({header, buffer} = await this.loadMessage(index));
+            if (opts.signal !== undefined && opts.signal.aborted) {
+                throw cancelled_message;
+            }
+
+            msg = await header.getMessage(buffer, opts);
+        }
+        else {
+            // Reads from a source go through the fetch queue; messages that are already in memory go straight to the decode queue
+            ({header, buffer} = this.cache === null ? await this.loadMessage(index) : await scheduler.schedule('fetch', () => this.loadMessage(index), task_opts).promise);
+            msg = await scheduler.schedule('decode', () => header.getMessage(buffer, opts), task_opts).promise;
+        }
+
+        if (this.persistent !== null) {
+            this.writePersistent(index, header, buffer, msg, opts.metrics);
+        }
+
+        return msg;
+    }
+
+    /**
+     * Keep the messages decoded from this file in a persistent cache, so they don't have to be read or decoded again after a page reload or restart.
+     *  Searches of the file use the same cache.
+     * @param cache - The cache, or null to stop using one
+     * @param url - Where the file is (a URL or path), which goes in the cache keys along with each message's byte range and checksum
+     * @param version - Which version of the file is at `url`, from the file's own metadata (e.g., its ETag, or its modification time and size), which
+     *  also goes in the cache keys, so messages cached from a file that's since been replaced aren't used
+     * @param ranges - For a file made of byte ranges from the file at `url` (like the ones from Grib2Inventory.downloadData(), which sets this up
+     *  itself), where the ranges are in each
+     * @example
+     * // Node
+     * const cache = new grib.Grib2PersistentCache(await grib.Grib2DirectoryStore.open(fs.promises, '/var/cache/gribjs'));
+     * const g2_file = await grib.Grib2File.fromSource(await grib.Grib2FileHandleSource.open(fs.promises, path), {index: saved_index});
+     * const {mtimeMs, size} = await fs.promises.stat(path);
+     * g2_file.usePersistentCache(cache, path, `${mtimeMs}:${size}`);
+     */
+    usePersistentCache(cache: Grib2PersistentCache | null, url?: string, version?: string, ranges?: Grib2SourceRange[]) {
+        if (cache !== null && (url === undefined || version === undefined)) {
+            throw `A persistent cache needs the file's url and version`;
+        }
+
+        this.persistent = cache;
+        this.source_url = cache === null ? null : url;
+        this.source_version = cache === null ? null : version;
+        this.source_ranges = cache === null || ranges === undefined ? null : ranges;
+    }
+
+    /**
+     * The persistent cache key for a message, which has where the message is in the original file
      */
-    async getMessage(index: number) {
-        const header = this.headers[index];
-        return await header.getMessage(this.buffer);
+    private persistentKey(index: number, output_format: Grib2OutputFormat) {
+        const table = this.getHeaderTable();
+        const offset = table.columns.offset[index];
+        const source_offset = this.source_ranges === null ? offset : remoteOffset(this.source_ranges, offset);
+        return this.persistent.messageKey(this.source_url, this.source_version, source_offset, table.columns.length[index], table.getChecksum(index), output_format);
+    }
+
+    /**
+     * Get a message from the persistent cache, or null if it isn't there or its headers don't match this file's index. The destination array (if any)
+     *  is only written once the cached message has been checked.
+     */
+    private async readPersistent(index: number, opts: Grib2DecodeOptions) {
+        if (index < 0 || index >= this.n_messages) return null;
+
+        const output_format = opts.output_format === undefined ? 'float32' : opts.output_format;
+        const key = this.persistentKey(index, output_format);
+        const metrics = opts.metrics === undefined ? null : new Grib2Metrics();
+
+        let field: Grib2CachedField | null;
+        try {
+            field = await this.persistent.getField(key, metrics === null ? undefined : metrics);
+        }
+        catch (err) {
+            // The store isn't working (e.g., it's out of space or was deleted), so decode the message instead
+            reportError(opts.metrics, 'cache_read', err);
+            return null;
+        }
+
+        if (field === null || (opts.stats && field.stats === null)) return null;
+
+        // The key has the file's version, so this is just a check that the entry is the message it's supposed to be
+        const {offset, length, discipline, reference_time} = this.getHeaderTable().columns;
+        let header: Grib2MessageHeaders | null = null;
+        try {
+            header = Grib2MessageHeaders.unpack(new DataView(field.headers.buffer, field.headers.byteOffset, field.headers.byteLength), 0,
+                                                {file_offset: offset[index], headers_only: true});
+        }
+        catch {}
+
+        if (header === null || header.sec0.contents.grib_edition != 2 || header.message_length != length[index]
+            || header.sec0.contents.grib_discipline != discipline[index] || header.getReferenceTime().toMillis() != reference_time[index]) {
+            this.persistent.delete(key).catch(err => reportError(opts.metrics, 'cache_write', err));
+            return null;
+        }
+
+        let data = field.data;
+        if (opts.destination !== undefined) {
+            try {
+                data = copyFieldData(field.data, opts.destination);
+            }
+            catch {
+                // Decoding the message instead will report the bad destination
+                return null;
+            }
+        }
+
+        if (metrics !== null) {
+            opts.metrics.merge(metrics);
+        }
+
+        return new Grib2Message(header.offset, header, data, output_format, field.packing, metrics, opts.stats ? field.stats : null);
+    }
+
+    /**
+     * Put a decoded message in the persistent cache. What's needed is copied right away (in case the data are in a destination array that gets reused),
+     *  and the write happens in the background; if it fails, the error goes in the metrics, and the message just gets decoded again next time.
+     */
+    private writePersistent(index: number, header: Grib2MessageHeaders, buffer: DataView, msg: Grib2Message, metrics?: Grib2Metrics) {
+        // Keep the message through section 7's 5-byte header, which is enough to unpack the headers from
+        const start = header.sec0.offset;
+        const headers = heapBytes(buffer, start, header.sec7.offset + 5 - start).slice();
+
+        const field: Grib2CachedField = {headers: headers, data: msg.data.slice(), output_format: msg.output_format, packing: msg.packing, stats: msg.stats,
+                                         scaling: header.sec5.getScaling()};
+        this.persistent.putField(this.persistentKey(index, msg.output_format), field, metrics).catch(err => reportError(metrics, 'cache_write', err));
+    }
+
+    /**
+     * Get a message's headers and the buffer that goes with them, reading the message from the source if the file was opened with fromSource()
+     */
+    private async loadMessage(index: number) {
+        if (this.cache === null) {
+            return {header: this.getHeaders(index), buffer: this.buffer};
+        }
+
+        if (index < 0 || index >= this.n_messages) {
+            throw `Message index ${index} is out of range for a file with ${this.n_messages} messages`;
+        }
+
+        const {offset, length} = this.index_.columns;
+        const range = (i: number) : Grib2ByteRange => ({offset: offset[i], length: length[i]});
+
+        // Read ahead to the messages after this one, since they're likely to be decoded next
+        const max_read_ahead_messages = 64;
+        const next: Grib2ByteRange[] = [];
+        for (let i = index + 1; i < Math.min(index + 1 + max_read_ahead_messages, this.n_messages); i++) {
+            next.push(range(i));
+        }
+
+        const stop_fetch = startStage(this.metrics, 'fetch');
+        const data = await this.cache.get(range(index), next);
+        stop_fetch({bytes: data.byteLength});
+
+        // Messages read from a source each have their own buffer, so the section offsets in their headers are relative to the start of the message
+        const buffer = new DataView(data.buffer, data.byteOffset, data.byteLength);
+        if (this.headers_[index] === undefined) {
+            this.headers_[index] = Grib2MessageHeaders.unpack(buffer, 0, {file_offset: offset[index]});
+        }
+
+        return {header: this.headers_[index], buffer: buffer};
+    }
+
+    /**
+     * Get the values at a set of points from many messages at once (e.g., for a time series), without decoding the full fields. For simple and complex
+     *  packing, only the parts of the packed data needed for the points are unpacked.
+     * @param points - `{indices}` for indices into the decoded data, or `{lats, lons}` for locations (which use nearest-neighbor by default; pass
+     *  `method: 'bilinear'` to interpolate)
+     * @param opts - Use `messages` to pick which messages (by index) to extract from (all of them by default), and `metrics` to collect timings
+     * @returns The values, with the value for point `ipt` in message `imsg` at `values[imsg * n_points + ipt]`
+     * @example
+     * // Get 2 m temperature at a few stations from every forecast hour in a run
+     * const t2m_file = g2_file.search(':TMP:2 m above ground:');
+     * const {values, n_points} = await t2m_file.extractPoints({lats: station_lats, lons: station_lons});
+     */
+    async extractPoints(points: Grib2Points, opts?: Grib2ExtractOptions & {messages?: number[]}) : Promise<Grib2PointExtraction> {
+        opts = opts === undefined ? {} : opts;
+        const metrics = opts.metrics === undefined && this.metrics !== null ? this.metrics : opts.metrics;
+
+        const messages: number[] = [];
+        if (opts.messages === undefined) {
+            for (let i = 0; i < this.n_messages; i++) messages.push(i);
+        }
+        else {
+            messages.push(...opts.messages);
+        }
+
+        return await extractPoints(messages.length, imsg => this.loadMessage(messages[imsg]), points, {metrics: metrics});
+    }
+
+    /**
+     * Compute the ensemble mean, standard deviation, and probabilities of exceeding thresholds across all the messages in the file, which should be the
+     *  members of one ensemble field (e.g., from a search). The members are decoded one at a time and added to running native accumulators, so memory use
+     *  doesn't grow with the number of members.
+     * @param opts - Use `thresholds` to compute probabilities, `ddof: 1` for the sample standard deviation, `decode` to decode members yourself (e.g., on a
+     *  worker pool), and `metrics` to collect timings
+     * @returns The statistics at each point
+     * @example
+     * // Probability of more than 25.4 mm of precipitation across the GEFS members
+     * const apcp = g2_file.search(':APCP:surface:0-24 hour acc fcst:');
+     * const {mean, probability} = await apcp.reduceEnsemble({thresholds: [25.4]});
+     */
+    async reduceEnsemble(opts?: Grib2EnsembleOptions) : Promise<Grib2EnsembleStats> {
+        opts = opts === undefined ? {} : opts;
+        const metrics = opts.metrics === undefined && this.metrics !== null ? this.metrics : opts.metrics;
+
+        // Check the members from the header table, so nothing gets decoded if they don't go together
+        const table = this.getHeaderTable();
+        const field = (index: number) => table.getInventory(index).replace(/ENS=[^:]*/, '');
+
+        for (let i = 0; i < table.n_messages; i++) {
+            if (table.columns.ensemble_type[i] == 255) {
+                throw `Message ${i + 1} isn't an ensemble member`;
+            }
+            if (table.columns.grid_id[i] != table.columns.grid_id[0]) {
+                throw `Message ${i + 1} isn't on the same grid as message 1`;
+            }
+            if (field(i) != field(0)) {
+                throw `Message ${i + 1} isn't the same field as message 1 (${field(i)} vs. ${field(0)})`;
+            }
+        }
+
+        const decode = opts.decode;
+        const loadMember = async (index: number, destination: Float32Array | undefined) => {
+            if (decode !== undefined) {
+                return await decode(index);
+            }
+
+            const msg = await this.getMessage(index, {destination: destination, metrics: metrics});
+            return msg.data as Float32Array;
+        }
+
+        return await reduceEnsemble(this.n_messages, loadMember, {...opts, metrics: metrics});
+    }
+
+    /**
+     * Turn overlapping time-aggregated buckets (e.g., 0-1, 0-2, and 0-6 hour precipitation) into consecutive intervals (1-2, 2-6 hour). Messages are
+     *  grouped by parameter, level, reference time, ensemble member, and aggregation, ordered by forecast time, and differenced natively (weighting by the
+     *  window lengths for averages). Each message is decoded once, no matter how many intervals it's used for.
+     * @param opts - Use `min_value` to clamp differences (e.g., 0 for precipitation) and `metrics` to collect timings
+     * @returns The intervals for each field. Fields that aren't aggregated, or whose aggregation can't be differenced (e.g., max and min), are left out.
+     * @example
+     * // Hourly precipitation from HRRR's run-total buckets
+     * const [apcp] = await g2_file.search(':APCP:surface:').differenceAccumulations({min_value: 0});
+     * apcp.intervals.forEach(({start, end, data}) => console.log(start / 3600, end / 3600, data));
+     */
+    async differenceAccumulations(opts?: Grib2IntervalOptions) {
+        opts = opts === undefined ? {} : opts;
+        const metrics = opts.metrics === undefined && this.metrics !== null ? this.metrics : opts.metrics;
+
+        const decode = async (index: number) => (await this.getMessage(index, {metrics: metrics})).data as Float32Array;
+        return await differenceAccumulations(this.getHeaderTable(), decode, {...opts, metrics: metrics});
+    }
+
+    /**
+     * Decode some messages and combine them into a derived field (e.g., wind speed from u and v) with a native expression, evaluated in one pass. Inputs
+     *  named `u` and `v` are taken to be the components of a vector (like the wind). If section 3 says they're relative to the grid (as on the Lambert
+     *  conformal grids from HRRR and NAM), they're rotated to be relative to east and north before the expression is evaluated, so 'wind_direction' is
+     *  always the direction on the earth. Grid-relative vectors on rotated lat/lon grids aren't supported and throw.
+     * @param expression - An expression (see Grib2Expression), or the name of one of the built-in ones: 'wind_speed' and 'wind_direction' (from `u` and
+     *  `v`), 'dewpoint_depression' (from `t` and `td`), 'k_to_c' and 'k_to_f' (from `t`), 'pa_to_hpa' (from `p`), 'ms_to_kt' (from `ws`), and
+     *  'kgm2_to_in' (from `precip`)
+     * @param inputs - The message for each variable in the expression, as an index or a search string or regular expression that matches exactly one message
+     * @param opts - Use `destination` to write the output into an existing array and `metrics` to collect timings
+     * @returns The derived field
+     * @example
+     * const wspd = await g2_file.deriveField('wind_speed', {u: ':UGRD:10 m above ground:', v: ':VGRD:10 m above ground:'});
+     * const t2m_f = await g2_file.deriveField('k_to_f', {t: ':TMP:2 m above ground:'});
+     */
+    async deriveField(expression: string, inputs: Record<string, number | string | RegExp>, opts?: Grib2ExpressionOptions) {
+        opts = opts === undefined ? {} : opts;
+        const metrics = opts.metrics === undefined && this.metrics !== null ? this.metrics : opts.metrics;
+
+        const compiled = Grib2Expression.compile(expression in derived_expressions ? derived_expressions[expression as keyof typeof derived_expressions] : expression);
+        const fields: Record<string, Float32Array> = {};
+        const grids: Record<string, Grib2GridDefinitionSection> = {};
+
+        for (let ivar = 0; ivar < compiled.variables.length; ivar++) {
+            const name = compiled.variables[ivar];
+            const input = inputs[name];
+
+            let index: number;
+            if (input === undefined) {
+                throw `No message given for '${name}' in expression '${compiled.expression}'`;
+            }
+            else if (typeof input == 'number') {
+                index = input;
+            }
+            else {
+                const matching: number[] = [];
+                for (let i = 0; i < this.n_messages; i++) {
+                    if (this.getInventoryString(i).match(input) !== null) matching.push(i);
+                }
+
+                if (matching.length != 1) {
+                    throw `'${input}' matches ${matching.length} messages for '${name}'; it needs to match exactly one`;
+                }
+                index = matching[0];
+            }
+
+            const msg = await this.getMessage(index, {metrics: metrics});
+            fields[name] = msg.data as Float32Array;
+            grids[name] = msg.headers.sec3;
+        }
+
+        if ('u' in grids && 'v' in grids && (grids.u.hasGridRelativeComponents() || grids.v.hasGridRelativeComponents())) {
+            if (grids.u.getGridKey() != grids.v.getGridKey()) {
+                throw `The messages for 'u' and 'v' are on different grids`;
+            }
+
+            // Nothing to do on a lat/lon grid, since the grid's x and y are already east and north
+            if (grids.u.getGridParameters().projection != 'PlateCarree') {
+                const {sin, cos} = await getWindRotation(grids.u, metrics);
+                const rotation_inputs = {cos_a: cos, sin_a: sin, u: fields.u, v: fields.v};
+                fields.u = await Grib2Expression.compile('cos_a * u + sin_a * v').evaluate(rotation_inputs, {metrics: metrics});
+                fields.v = await Grib2Expression.compile('cos_a * v - sin_a * u').evaluate(rotation_inputs, {metrics: metrics});
+            }
+        }
+
+        return await compiled.evaluate(fields, {...opts, metrics: metrics});
+    }
+
+    /**
+     * Open a grib file that's read as it's needed instead of all at once, e.g., a multi-GB local file in Node. Only the headers are read up front;
+     *  each message is read from the source when it's decoded, and a bounded number of recently used messages (plus a bounded read-ahead) are kept in
+     *  memory, so memory use depends on the messages being decoded and not on the size of the file. The headers are read with a few small reads per
+     *  message (which include the bitmap, but not the packed data).
+     * @param source - Where to read the data from, e.g., a Grib2FileHandleSource for a local file in Node or a Grib2BlobSource for a File in the browser
+     * @param opts - Use `index` to skip reading the headers, `max_bytes` and `read_ahead_bytes`
+     *  to size the message cache, `header_read_size` for the size of the reads when scanning the headers, and `metrics` to collect timings
+     * @returns A Grib2File with all the messages
+     * @example
+     * // Node
+     * const fs = require('fs');
+     * const source = await grib.Grib2FileHandleSource.open(fs.promises, 'gefs.t00z.pgrb2a.0p50.f024');
+     * const g2_file = await grib.Grib2File.fromSource(source, {max_bytes: 256 * 1024 * 1024});
+     * const msg = await g2_file.search(':TMP:2 m above ground:').getMessage(0);
+     */
+    static async fromSource(source: Grib2ByteSource, opts?: Grib2MessageCacheOptions & {index?: ArrayBuffer | Grib2HeaderTable | Grib2IndexEntry[], header_read_size?: number, metrics?: Grib2Metrics}) {
+        opts = opts === undefined ? {} : opts;
+        const cache = new Grib2MessageCache(source, opts);
+
+        if (opts.index !== undefined) {
+            const table = opts.index instanceof ArrayBuffer ? unpackIndex(opts.index) : opts.index instanceof Grib2HeaderTable ? opts.index : Grib2HeaderTable.fromEntries(opts.index);
+            const last = table.n_messages - 1;
+            if (last >= 0 && table.columns.offset[last] + table.columns.length[last] > source.size) {
+                throw `The messages in the index go past the end of the data; does the index go with this file?`;
+            }
+
+            return new Grib2File(null, cache, opts.metrics, table);
+        }
+
+        const stop_scan = startStage(opts.metrics, 'scan');
+        const {table, n_bytes_read} = await scanSource(source, opts.header_read_size);
+        stop_scan({bytes: n_bytes_read});
+
+        return new Grib2File(null, cache, opts.metrics, table);
     }
 
     /**
      * Scan a data buffer for grib2 messages
-     * @param buffer - The buffer to scan
+     * @param data - The buffer to scan, or a block on the WASM heap
+     * @param opts - Use the `metrics` option to collect timings for the scan and for decoding messages from the file
      * @returns A Grib2File with all the messages
      */
-    static scan(buffer: DataView) {
+    static scan(data: DataView | Grib2HeapBuffer, opts?: {metrics?: Grib2Metrics}) {
+        opts = opts === undefined ? {} : opts;
+        const stop_scan = startStage(opts.metrics, 'scan');
+        const buffer = data instanceof Grib2HeapBuffer ? data.view : data;
+
         let offset = 0;
-        const message_headers: Grib2MessageHeaders[] = [];
+        const entries: Grib2IndexEntry[] = [];
 
+        // Only keep the key fields for each message; the full headers get unpacked again when they're needed
         while (offset < buffer.byteLength) {
             const header = Grib2MessageHeaders.unpack(buffer, offset);
-            message_headers.push(header);
+            entries.push(makeIndexEntry(header, buffer, entries.length));
             offset += header.message_length;
         }
 
-        return new Grib2File(message_headers, buffer);
+        stop_scan({bytes: buffer.byteLength});
+        return new Grib2File(null, data, opts.metrics, Grib2HeaderTable.fromEntries(entries));
+    }
+
+    /**
+     * Scan a stream of grib data for messages as it arrives. Compressed (gzip or zlib) data are inflated as they arrive, so the compressed data are never
+     *  all in memory at once.
+     * @param stream - The data, e.g., the body of a fetch response
+     * @param opts - Use `compression` to say how the data are compressed (by default, it's detected from the first few bytes), `on_message` to be
+     *  called with each message as soon as it's complete, `size_hint` for the expected decompressed size, and `metrics` to collect timings
+     * @returns A Grib2File with all the messages
+     */
+    static async fromStream(stream: ReadableStream<Uint8Array>, opts?: Grib2StreamOptions & {on_message?: Grib2MessageCallback, size_hint?: number}) {
+        opts = opts === undefined ? {} : opts;
+        const scanner = new Grib2StreamScanner(opts.size_hint, opts.on_message);
+
+        const stop_fetch = startStage(opts.metrics, 'fetch');
+        await readGribStream(stream, chunk => scanner.push(chunk), opts);
+        stop_fetch({bytes: scanner.length});
+
+        return scanner.finish(opts.metrics);
     }
 
     /**
      * Get a grib file directly from a remote source. This downloads the entire file, so if you don't need the entire file, and the file has an inventory, you may want to
      *  use a `Grib2Inventory` to search pare down the file first.
      * @param url - The URL from which to fetch the grib file
-     * @param opts - Options for downloading the data (use the `decompressor` option to decompress the raw data before constructing the `Grib2File` object)
+     * @param opts - Options for downloading the data. Gzip- or zlib-compressed files (e.g., MRMS .grib2.gz files) are detected and inflated as they download;
+     *  use `compression` to override the detection. Use the `decompressor` option instead to decompress the whole raw file with your own function,
+     *  `on_message` to be called with each message as soon as it's downloaded, and `metrics` to collect timings.
      * @returns a Grib2File containing the remote data
      */
-    static async fromRemote(url: string, opts?: {decompressor?: (ary: Uint8Array) => Uint8Array}) {
+    static async fromRemote(url: string, opts?: Grib2StreamOptions & {decompressor?: (ary: Uint8Array) => Uint8Array, on_message?: Grib2MessageCallback}) {
         opts = opts === undefined ? {} : opts;
-        const decompressor = opts.decompressor === undefined ? (ary: Uint8Array) => ary : opts.decompressor;
 
+        const stop_fetch = startStage(opts.metrics, 'fetch');
         const resp = await fetch(url);
+
+        if (opts.decompressor === undefined && resp.body !== null) {
+            // The decompressed size isn't known for compressed files, but the compressed size is a lower bound, and the scanner projects the
+            //  decompressed size from how much of it has been read
+            const content_length = parseInt(resp.headers.get('content-length'));
+            const size_hint = isNaN(content_length) ? undefined : content_length;
+            const scanner = new Grib2StreamScanner(size_hint, opts.on_message, size_hint);
+
+            await readGribStream(resp.body, (chunk, bytes_read) => scanner.push(chunk, bytes_read), opts);
+            stop_fetch({bytes: scanner.length});
+
+            return scanner.finish(opts.metrics);
+        }
+
+        const decompressor = opts.decompressor === undefined ? (ary: Uint8Array) => ary : opts.decompressor;
         const data = new Uint8Array(await (await resp.blob()).arrayBuffer());
+        stop_fetch({bytes: data.byteLength});
+
         const data_decompressed = decompressor(data);
-        return Grib2File.scan(new DataView(data_decompressed.buffer));
+        return Grib2File.scan(new DataView(data_decompressed.buffer, data_decompressed.byteOffset, data_decompressed.byteLength), {metrics: opts.metrics});
     }
 
     /**
      * @returns A string containing the header information for each message in this file
      */
     toString() {
-        return this.headers.map((header, ihdr) => header.getInventoryString(ihdr)).join("\n");
+        const inv_strings: string[] = [];
+        for (let i = 0; i < this.n_messages; i++) {
+            inv_strings.push(this.getInventoryString(i));
+        }
+        return inv_strings.join("\n");
     }
 
     /**
@@ -80,8 +693,249 @@ class Grib2File {
      * g2_file.search(':HGT:500 mb:')
      */
     search(matcher: string | RegExp) {
-        const matching_headers = this.headers.filter((hdr, ihdr) => hdr.matches(ihdr, matcher));
-        return new Grib2File(matching_headers, this.buffer);
+        const data = this.cache !== null ? this.cache : this.heap !== null ? this.heap : this.buffer_;
+
+        if (this.index_ === null) {
+            const matching_headers = this.headers_.filter((hdr, ihdr) => hdr.matches(ihdr, matcher));
+            const matching_file = new Grib2File(matching_headers, data, this.metrics);
+            this.shareWith(matching_file);
+            return matching_file;
+        }
+
+        // Search the index, so the headers don't have to be unpacked
+        const matching: number[] = [];
+        for (let i = 0; i < this.n_messages; i++) {
+            if (this.getInventoryString(i).match(matcher) !== null) matching.push(i);
+        }
+
+        const matching_file = new Grib2File(null, data, this.metrics, this.index_.subset(matching));
+        matching.forEach((i, imatch) => { matching_file.headers_[imatch] = this.headers_[i]; });
+        this.shareWith(matching_file);
+        return matching_file;
+    }
+
+    /**
+     * Give a file made from this one (e.g., by a search) the same scheduler and persistent cache
+     */
+    private shareWith(file: Grib2File) {
+        file.scheduler = this.scheduler;
+        file.persistent = this.persistent;
+        file.source_url = this.source_url;
+        file.source_version = this.source_version;
+        file.source_ranges = this.source_ranges;
+    }
+
+    /**
+     * Copy the file onto the WASM heap, so the decoders can read the packed data where it is instead of copying each message's data onto the heap
+     *  every time it's decoded. This is worth it for large JPEG2000- or complex-packed messages, or messages that are decoded more than once. The copy
+     *  isn't garbage-collected, so call free() when done with it. (Inventories can download straight onto the heap with `downloadData(url, {on_heap: true})`.)
+     * @returns A Grib2File with the same messages, on the heap
+     */
+    async toHeap() {
+        if (this.buffer === null) {
+            throw `A file opened with fromSource() can't be copied onto the heap`;
+        }
+
+        if (this.heap !== null) {
+            return this;
+        }
+
+        const compression = await getCompressionModule(this.metrics === null ? undefined : this.metrics);
+        const stop_input_copy = startStage(this.metrics, 'input_copy');
+        const heap = Grib2HeapBuffer.allocate(compression, this.buffer_.byteLength);
+        heap.set(new Uint8Array(this.buffer_.buffer, this.buffer_.byteOffset, this.buffer_.byteLength), 0);
+        stop_input_copy({bytes: heap.length});
+
+        // The offsets are the same, so the headers that have already been unpacked can be shared
+        const heap_file = new Grib2File(this.index_ === null ? this.headers_ : null, heap, this.metrics, this.index_);
+        if (this.index_ !== null) {
+            this.headers_.forEach((header, ihdr) => { heap_file.headers_[ihdr] = header; });
+        }
+        this.shareWith(heap_file);
+        return heap_file;
+    }
+
+    /**
+     * Free the file's memory on the WASM heap, if it's on the heap. Files from searches of this file share the same memory, so they can't be decoded
+     *  after this either.
+     */
+    free() {
+        if (this.heap !== null) {
+            this.heap.free();
+        }
+    }
+}
+
+/**
+ * Read the headers for all the messages from a source into a header table. Reads are done in blocks of `read_size` bytes, which for small messages
+ *  covers the headers for several messages at once. The headers for each message are parsed from the start of the message (through the start of section 7).
+ */
+async function scanSource(source: Grib2ByteSource, read_size?: number) {
+    read_size = read_size === undefined ? 64 * 1024 : read_size;
+
+    let block = new Uint8Array(0);
+    let block_offset = 0;
+    let n_bytes_read = 0;
+
+    const read = async (position: number, length: number) => {
+        if (position < block_offset || position + length > block_offset + block.length) {
+            block_offset = position;
+            block = await source.read(position, Math.min(Math.max(length, read_size), source.size - position));
+            n_bytes_read += block.length;
+        }
+
+        return block.subarray(position - block_offset, position - block_offset + length);
+    }
+
+    const indicator_length = 16;
+    const section_header_length = 5;
+
+    const entries: Grib2IndexEntry[] = [];
+    let offset = 0;
+
+    while (offset < source.size) {
+        if (offset + indicator_length > source.size) {
+            throw `Grib data ended partway through a message`;
+        }
+
+        const sec0_data = await read(offset, indicator_length);
+        const message_length = g2_section0_unpacker.unpack(new DataView(sec0_data.buffer, sec0_data.byteOffset, indicator_length), 0).contents.message_length;
+        if (message_length < indicator_length || offset + message_length > source.size) {
+            throw `Bad message length ${message_length} at byte ${offset}`;
+        }
+
+        // Walk the section lengths to find section 7
+        let sec_offset = indicator_length;
+        while (true) {
+            if (sec_offset + section_header_length > message_length) {
+                throw `Couldn't find the data section in the message at byte ${offset}`;
+            }
+
+            const sec_header = await read(offset + sec_offset, section_header_length);
+            const sec_view = new DataView(sec_header.buffer, sec_header.byteOffset, section_header_length);
+            if (sec_view.getUint8(4) == 7) break;
+
+            const sec_length = sec_view.getUint32(0);
+            if (sec_length < section_header_length) {
+                throw `Bad section length ${sec_length} in the message at byte ${offset}`;
+            }
+            sec_offset += sec_length;
+        }
+
+        const header_data = await read(offset, sec_offset + section_header_length);
+        const header_buffer = new DataView(header_data.buffer, header_data.byteOffset, header_data.byteLength);
+        const header = Grib2MessageHeaders.unpack(header_buffer, 0, {file_offset: offset, headers_only: true});
+
+        entries.push(makeIndexEntry(header, header_buffer, entries.length));
+        offset += message_length;
+    }
+
+    return {table: Grib2HeaderTable.fromEntries(entries), n_bytes_read: n_bytes_read};
+}
+
+/**
+ * Called with each message as a stream is scanned. `buffer` holds the data received so far, which includes the whole message, so the message can be
+ *  decoded right away with `header.getMessage(buffer)`. If the callback returns a promise, scanning waits for it (and reading the stream slows down
+ *  to match), and a rejection stops the scan.
+ */
+type Grib2MessageCallback = (header: Grib2MessageHeaders, buffer: DataView) => void | Promise<void>;
+
+/**
+ * Scans grib data for messages as it arrives in chunks. The data are copied into one buffer that grows as needed (so the final Grib2File has a
+ *  single buffer), and each message's headers are parsed as soon as the whole message has arrived.
+ */
+class Grib2StreamScanner {
+    private data: Uint8Array;
+    private scan_offset: number;
+    private on_message: Grib2MessageCallback | undefined;
+    private source_size: number | undefined;
+
+    /** The index entries for the messages scanned so far */
+    readonly entries: Grib2IndexEntry[];
+
+    /** The number of bytes received so far */
+    length: number;
+
+    /**
+     * @param size_hint - The expected total size, to avoid growing the buffer
+     * @param on_message - Called with each message as soon as it's complete
+     * @param source_size - The size of the data as they're read from the source, if that's different from the total (e.g., the compressed size of
+     *  compressed data). When the buffer has to grow, it grows to the total projected from how much of the source has been read.
+     */
+    constructor(size_hint?: number, on_message?: Grib2MessageCallback, source_size?: number) {
+        this.data = new Uint8Array(size_hint === undefined ? 1 << 20 : Math.max(size_hint, 16));
+        this.length = 0;
+        this.scan_offset = 0;
+        this.on_message = on_message;
+        this.source_size = source_size;
+        this.entries = [];
+    }
+
+    /**
+     * Add a chunk of data and scan any messages it completes. Wait for this to finish before pushing the next chunk.
+     * @param chunk - The data (which is copied, so the caller can reuse it)
+     * @param source_bytes_read - How many bytes of the source have been read so far, if a `source_size` was given
+     */
+    async push(chunk: Uint8Array, source_bytes_read?: number) {
+        const needed_size = this.length + chunk.length;
+
+        if (needed_size > this.data.length) {
+            let new_size: number;
+
+            if (this.source_size !== undefined && source_bytes_read !== undefined && source_bytes_read > 0 && source_bytes_read < this.source_size) {
+                // Assume the rest of the source expands as much as what's been read so far, with some room in case it expands more
+                new_size = Math.ceil(needed_size * this.source_size / source_bytes_read * 1.1);
+            }
+            else {
+                new_size = this.data.length * 2;
+            }
+
+            // Don't creep up a little at a time if the projection keeps coming up short
+            new_size = Math.max(new_size, needed_size, Math.ceil(this.data.length * 1.25));
+
+            const new_data = new Uint8Array(new_size);
+            new_data.set(this.data.subarray(0, this.length));
+            this.data = new_data;
+        }
+
+        this.data.set(chunk, this.length);
+        this.length += chunk.length;
+
+        const indicator_length = 16;
+        const buffer = new DataView(this.data.buffer, 0, this.length);
+
+        while (this.length - this.scan_offset >= indicator_length) {
+            const message_length = g2_section0_unpacker.unpack(buffer, this.scan_offset).contents.message_length;
+            if (message_length < indicator_length) {
+                throw `Bad message length ${message_length} at byte ${this.scan_offset}`;
+            }
+            if (this.scan_offset + message_length > this.length) break;
+
+            const header = Grib2MessageHeaders.unpack(buffer, this.scan_offset);
+            this.entries.push(makeIndexEntry(header, buffer, this.entries.length));
+            this.scan_offset += message_length;
+
+            if (this.on_message !== undefined) {
+                await this.on_message(header, buffer);
+            }
+        }
+    }
+
+    /**
+     * @param metrics - Metrics for the file to collect
+     * @returns A Grib2File with all the messages
+     */
+    finish(metrics?: Grib2Metrics) {
+        if (this.scan_offset != this.length) {
+            throw `Grib data ended partway through a message`;
+        }
+
+        // Drop the unused space at the end of the buffer, so the file doesn't hold onto it
+        if (this.length < this.data.length) {
+            this.data = this.data.slice(0, this.length);
+        }
+
+        return new Grib2File(null, new DataView(this.data.buffer, 0, this.length), metrics, Grib2HeaderTable.fromEntries(this.entries));
     }
 }
 
@@ -132,6 +986,13 @@ class Grib2Inventory {
     /**
      * Download a grib2 file containing the messages in this inventory. This function only downloads the sections of the full file that are referred to in this inventory object.
      * @param url - The url to download data from
+     * @param opts - Use the `metrics` option to collect timings for the download and for decoding messages from the file, and `signal` to abort the
+     *  download. With a `scheduler`, the range requests are queued with the given `priority` and `group` (use a negative priority to prefetch), and
+     *  requests for the same ranges share one download. The file keeps the scheduler for decoding its messages. Use `on_heap` to put the data straight
+     *  onto the WASM heap (see Grib2File.toHeap()). With a `persistent_cache`, the file keeps its decoded messages in the cache, and the next time the
+     *  same messages are downloaded from the same url (e.g., after a page reload), only a HEAD request is made up front, to check the file's ETag or
+     *  Last-Modified time. If the file hasn't changed, messages come from the cache, and any that have been evicted are fetched one at a time as
+     *  they're decoded (so `on_heap` doesn't apply then). A server that sends neither header can't be checked, so nothing is cached from it.
      * @returns A Grib2File containing all the messages
      * @example
      * // Subset the full inventory (500 mb height)
@@ -140,7 +1001,34 @@ class Grib2Inventory {
      * // Download only the 500 mb height message from the remote grib file
      * z500_inv.downloadData('https://example.com/path/to/data.grib2');
      */
-    async downloadData(url: string) {
+    async downloadData(url: string, opts?: Grib2TaskOptions & {metrics?: Grib2Metrics, scheduler?: Grib2Scheduler, on_heap?: boolean, persistent_cache?: Grib2PersistentCache}) {
+        opts = opts === undefined ? {} : opts;
+        const cache = opts.persistent_cache === undefined ? null : opts.persistent_cache;
+        const inventory = this.toString();
+
+        if (cache !== null) {
+            // The cache keys have the version of the file that's there now, so nothing cached from a file that's since been replaced matches
+            const version = await fetchSourceVersion(url, opts.signal);
+
+            let cached: {ranges: Grib2SourceRange[], table: Grib2HeaderTable} | null = null;
+            if (version !== null) {
+                try {
+                    cached = await cache.getIndex(cache.indexKey(url, version, inventory));
+                }
+                catch (err) {
+                    reportError(opts.metrics, 'cache_read', err);
+                }
+            }
+
+            if (cached !== null) {
+                const source = new Grib2RangeSource(url, cached.ranges, version);
+                const g2_file = new Grib2File(null, new Grib2MessageCache(source, {read_ahead_bytes: 0}), opts.metrics, cached.table);
+                g2_file.scheduler = opts.scheduler === undefined ? null : opts.scheduler;
+                g2_file.usePersistentCache(cache, url, version, cached.ranges);
+                return g2_file;
+            }
+        }
+
         const byte_ranges = this.entries.map(entr => entr.byte_range);
         const byte_ranges_merged: [number, number][] = [];
         let cur_range: [number, number] | null = null;
@@ -166,16 +1054,76 @@ class Grib2Inventory {
         }
 
         // Fetch the data
-        const promises = byte_ranges_merged.map(entr => {
-            const range_header = `${entr[0]}-${entr[1] === null ? '' : entr[1] - 1}`;
-            return fetch(url, {headers: {range: `bytes=${range_header}`}});
-        })
-
-        // Unpack and stick it all in a single array buffer
-        return Promise.all(promises).then(resps => {
-            const promises = resps.map(async resp => await resp.arrayBuffer());
-            return Promise.all(promises);
-        }).then(buffers => {
+        const stop_fetch = startStage(opts.metrics, 'fetch');
+        const fetchRange = (range_header: string, signal?: AbortSignal) => fetch(url, {headers: {range: `bytes=${range_header}`}, signal: signal})
+            .then(async resp => ({data: await resp.arrayBuffer(), version: responseVersion(resp)}));
+
+        let promises: Promise<{data: ArrayBuffer, version: string | null}>[];
+        if (opts.scheduler === undefined) {
+            promises = byte_ranges_merged.map(entr => fetchRange(`${entr[0]}-${entr[1] === null ? '' : entr[1] - 1}`, opts.signal));
+        }
+        else {
+            const tasks = byte_ranges_merged.map(entr => {
+                const range_header = `${entr[0]}-${entr[1] === null ? '' : entr[1] - 1}`;
+                return opts.scheduler.schedule('fetch', signal => fetchRange(range_header, signal), {priority: opts.priority, signal: opts.signal, group: opts.group, key: `${url}#bytes=${range_header}`});
+            });
+
+            // If one range fails, don't leave the rest of them downloading for nothing
+            promises = tasks.map(task => task.promise.catch(err => {
+                tasks.forEach(task => task.cancel());
+                throw err;
+            }));
+        }
+
+        // Give the file the scheduler, and for the persistent cache, where each range came from in the remote file and which version of the file it was
+        const setUp = (g2_file: Grib2File, buffers: ArrayBuffer[], version: string | null) => {
+            g2_file.scheduler = opts.scheduler === undefined ? null : opts.scheduler;
+
+            if (cache !== null && version === null) {
+                reportError(opts.metrics, 'cache_write', `${url} doesn't send an ETag or Last-Modified header, so it can't be cached`);
+            }
+            else if (cache !== null) {
+                const ranges: Grib2SourceRange[] = [];
+                let local_offset = 0;
+                buffers.forEach((buf, i) => {
+                    ranges.push({local_offset: local_offset, remote_offset: byte_ranges_merged[i][0], length: buf.byteLength});
+                    local_offset += buf.byteLength;
+                });
+
+                g2_file.usePersistentCache(cache, url, version, ranges);
+                cache.putIndex(cache.indexKey(url, version, inventory), ranges, g2_file.getHeaderTable()).catch(err => reportError(opts.metrics, 'cache_write', err));
+            }
+
+            return g2_file;
+        };
+
+        // Stick it all in a single array buffer
+        return Promise.all(promises).then(async responses => {
+            const buffers = responses.map(resp => resp.data);
+
+            // Ranges from different versions of the file don't go together
+            const versions = responses.map(resp => resp.version);
+            if (versions.some(version => version !== null && versions[0] !== null && version != versions[0])) {
+                throw `${url} was replaced while its byte ranges were being downloaded`;
+            }
+            const version = versions.some(version => version === null) ? null : versions[0];
+
+            if (opts.on_heap) {
+                const total_length = buffers.map(buf => buf.byteLength).reduce((a, b) => a + b, 0);
+                const compression = await getCompressionModule(opts.metrics);
+                const heap = Grib2HeapBuffer.allocate(compression, total_length);
+
+                let offset = 0;
+                buffers.forEach(buf => {
+                    heap.set(new Uint8Array(buf), offset);
+                    offset += buf.byteLength;
+                });
+
+                stop_fetch({bytes: total_length});
+
+                return setUp(Grib2File.scan(heap, {metrics: opts.metrics}), buffers, version);
+            }
+
             let concat_buf: ArrayBuffer;
             if (buffers.length > 1) {
                 const total_length = buffers.map(buf => buf.byteLength).reduce((a, b) => a + b);
@@ -192,8 +1140,10 @@ class Grib2Inventory {
                 concat_buf = buffers[0];
             }
 
+            stop_fetch({bytes: concat_buf.byteLength});
+
             const dv = new DataView(concat_buf);
-            return Grib2File.scan(dv);
+            return setUp(Grib2File.scan(dv, {metrics: opts.metrics}), buffers, version);
         });
     }
 
@@ -262,8 +1212,17 @@ class Grib2MessageHeaders {
         this.sec7 = sec7;
     }
 
-    static unpack(buffer: DataView, offset: number) {
-        const message_offset = offset;
+    /**
+     * Unpack the headers for a message
+     * @param buffer - The buffer containing the message
+     * @param offset - Where the message starts in the buffer
+     * @param opts - Use `file_offset` if the buffer isn't the whole file, to give where the message is in the file (it's `offset` by default), and
+     *  `headers_only` if the buffer only has the message through the start of section 7
+     * @returns The message headers
+     */
+    static unpack(buffer: DataView, offset: number, opts?: {file_offset?: number, headers_only?: boolean}) {
+        opts = opts === undefined ? {} : opts;
+        const message_offset = opts.file_offset === undefined ? offset : opts.file_offset;
 
         const sec0 = g2_section0_unpacker.unpack(buffer, offset);
         offset += sec0.section_length;
@@ -293,6 +1252,10 @@ class Grib2MessageHeaders {
         const sec7 = g2_section7_unpacker.unpack(buffer, offset);
         offset += sec7.contents.section_length;
 
+        if (opts.headers_only) {
+            return new Grib2MessageHeaders(message_offset, sec0, sec1, sec2, sec3, sec4, sec5, sec6, sec7);
+        }
+
         const end_marker = unpackUTF8String(buffer, offset, 4);
         if (end_marker != '7777') {
             throw `Missing end marker`;
@@ -301,9 +1264,32 @@ class Grib2MessageHeaders {
         return new Grib2MessageHeaders(message_offset, sec0, sec1, sec2, sec3, sec4, sec5, sec6, sec7);
     }
 
-    async getMessage(buffer: DataView) {
-        const data = await this.sec7.unpackData(buffer, this.sec3, this.sec5, this.sec6);
-        return new Grib2Message(this.offset, this, data);
+    async getMessage(buffer: DataView, opts?: Grib2DecodeOptions) {
+        opts = opts === undefined ? {} : opts;
+        const output_format = opts.output_format === undefined ? 'float32' : opts.output_format;
+
+        // Each message gets its own metrics, which are also added to any metrics passed in
+        const metrics = opts.metrics === undefined ? null : new Grib2Metrics();
+
+        const {data, packing, stats} = await this.sec7.unpackData(buffer, this.sec3, this.sec5, this.sec6, {...opts, metrics: metrics === null ? undefined : metrics});
+
+        if (metrics !== null) {
+            opts.metrics.merge(metrics);
+        }
+
+        return new Grib2Message(this.offset, this, data, output_format, packing, metrics, stats);
+    }
+
+    /**
+     * Get the values at a set of points without decoding the full field. See Grib2File.extractPoints().
+     * @param buffer - The buffer containing the message
+     * @param points - The points to extract
+     * @param opts - Use the `metrics` option to collect timings
+     * @returns The values at the points, with NaN for missing values and points off the grid
+     */
+    async extractPoints(buffer: DataView, points: Grib2Points, opts?: Grib2ExtractOptions) {
+        const {values} = await extractPoints(1, async () => ({header: this, buffer: buffer}), points, opts);
+        return values;
     }
 
     getInventoryString(index: number) {
@@ -375,17 +1361,40 @@ class Grib2MessageHeaders {
     getGridParameters() {
         return this.sec3.getGridParameters();
     }
+
+    getCoordinates(coordinate_type?: 'latlon', metrics?: Grib2Metrics) : Promise<Grib2LatLonCoordinates>;
+    getCoordinates(coordinate_type: 'projected', metrics?: Grib2Metrics) : Promise<Grib2ProjectedCoordinates>;
+    getCoordinates(coordinate_type?: Grib2CoordinateType, metrics?: Grib2Metrics) {
+        return coordinate_type == 'projected' ? getGridCoordinates(this.sec3, 'projected', metrics) : getGridCoordinates(this.sec3, 'latlon', metrics);
+    }
 }
 
 class Grib2Message {
     readonly offset: number;
     readonly headers: Grib2MessageHeaders;
-    readonly data: Float32Array;
 
-    constructor(offset: number, headers: Grib2MessageHeaders, data: Float32Array) {
+    /** The decoded data. This is a Float32Array for 'float32' output, a Uint16Array of half-precision floats for 'float16' output, and a Uint16Array or Uint32Array for 'packed' output. */
+    readonly data: Grib2OutputArray;
+    readonly output_format: Grib2OutputFormat;
+
+    /** For 'packed' output, the parameters needed to turn the packed integers into physical values; null otherwise. */
+    readonly packing: Grib2PackingParameters | null;
+
+    /** Timings and counters for decoding this message, or null if metrics weren't collected */
+    readonly metrics: Grib2Metrics | null;
+
+    /** Min, max, mean, etc. of the field, computed while decoding if the `stats` option was set; null otherwise */
+    readonly stats: Grib2FieldStats | null;
+
+    constructor(offset: number, headers: Grib2MessageHeaders, data: Grib2OutputArray, output_format?: Grib2OutputFormat, packing?: Grib2PackingParameters | null,
+                metrics?: Grib2Metrics | null, stats?: Grib2FieldStats | null) {
         this.offset = offset;
         this.headers = headers;
         this.data = data;
+        this.output_format = output_format === undefined ? 'float32' : output_format;
+        this.packing = packing === undefined ? null : packing;
+        this.metrics = metrics === undefined ? null : metrics;
+        this.stats = stats === undefined ? null : stats;
     }
 
     /**
@@ -411,6 +1420,73 @@ class Grib2Message {
     getGridParameters() {
         return this.headers.getGridParameters();
     }
+
+    /**
+     * Get the coordinates of every grid point, in the same order as the data. These are computed once for each unique grid and shared by all messages on
+     *  it, so don't modify the arrays.
+     * @param coordinate_type - 'latlon' (the default) for latitudes and longitudes in degrees, or 'projected' for x and y on the grid's map projection
+     * @param metrics - Collect timings into this object
+     * @returns The coordinates as `{lats, lons}` or `{x, y}`
+     * @example
+     * const {lats, lons} = await msg.getCoordinates();
+     */
+    getCoordinates(coordinate_type?: 'latlon', metrics?: Grib2Metrics) : Promise<Grib2LatLonCoordinates>;
+    getCoordinates(coordinate_type: 'projected', metrics?: Grib2Metrics) : Promise<Grib2ProjectedCoordinates>;
+    getCoordinates(coordinate_type?: Grib2CoordinateType, metrics?: Grib2Metrics) {
+        return coordinate_type == 'projected' ? this.headers.getCoordinates('projected', metrics) : this.headers.getCoordinates('latlon', metrics);
+    }
+
+    /**
+     * Interpolate the data to a set of target points. The interpolation weights are computed the first time a grid is regridded to a target and
+     *  reused for every message on the same grid after that.
+     * @param target - The points to interpolate to
+     * @param opts - Use `method` to pick 'bilinear' (the default) or 'nearest' interpolation, and `destination` to put the output in an existing array
+     * @returns The data at the target points, with NaN for points off this message's grid
+     * @example
+     * // Interpolate HRRR fields to a 0.1 degree lat/lon grid
+     * const target = new grib.Grib2RegridTarget(display_lats, display_lons);
+     * const t2m_regridded = await msg_t2m.regrid(target);
+     * const td2m_regridded = await msg_td2m.regrid(target);  // reuses the weights
+     */
+    async regrid(target: Grib2RegridTarget, opts?: Grib2RegridOptions) {
+        opts = opts === undefined ? {} : opts;
+        const method = opts.method === undefined ? 'bilinear' : opts.method;
+
+        if (!(this.data instanceof Float32Array) || this.output_format != 'float32') {
+            throw `Only messages decoded to 'float32' can be regridded`;
+        }
+
+        return await regridCached(this.data, this.headers.sec3, target, method, opts);
+    }
+
+    /**
+     * Build a multi-resolution pyramid (e.g., for map tiles) from the data. Each level is half the resolution of the one before it, made by reducing
+     *  2x2 blocks while skipping missing values. The reduction runs natively (and multithreaded in the native build).
+     * @param opts - Use `reducer` to pick 'mean' (the default), 'max', or 'nearest', `n_levels` to set the number of levels, and `tile_size` to cut
+     *  each level into square tiles
+     * @returns The levels, starting with the full-resolution data (level 0, which is this message's data)
+     * @example
+     * // Composite reflectivity as 256 x 256 tiles, keeping the max in each block so storms don't get smoothed out
+     * const levels = await msg.buildPyramid({reducer: 'max', tile_size: 256});
+     * const tile = levels[2].getTile(1, 0);
+     */
+    async buildPyramid(opts?: Grib2PyramidOptions) {
+        if (!(this.data instanceof Float32Array) || this.output_format != 'float32') {
+            throw `Only messages decoded to 'float32' can be made into pyramids`;
+        }
+
+        const {ngrid_i, ngrid_j} = this.getGridDimensions();
+        return await buildPyramid(this.data, ngrid_i, ngrid_j, opts);
+    }
 }
 
-export {Grib2Message, Grib2MessageHeaders, Grib2File, Grib2Inventory, addGrib2ParameterListing};
\ No newline at end of file
+export {Grib2Message, Grib2MessageHeaders, Grib2File, Grib2StreamScanner, Grib2Inventory, Grib2Metrics, Grib2RegridTarget, Grib2RegridWeights, Grib2PyramidLevel,
+        Grib2FileHandleSource, Grib2BlobSource, Grib2RangeSource, Grib2PersistentCache, Grib2IndexedDBStore, Grib2DirectoryStore, Grib2EnsembleReducer, Grib2Expression, Grib2HeaderTable, Grib2Scheduler, Grib2Task, Grib2HeapBuffer, addGrib2ParameterListing, complexPackingEncoder, getRegridWeights, clearRegridCache, getGridCoordinates,
+        clearCoordinateCache, buildPyramid, freeDecoderSession};
+export type {Grib2DecodeOptions, Grib2FieldStats, Grib2OutputArray, Grib2OutputFormat, Grib2PackingParameters, Grib2Stage, Grib2StageMetrics, Grib2NativeCounters, Grib2HandledError,
+             Grib2RegridMethod, Grib2RegridOptions, Grib2CoordinateType, Grib2LatLonCoordinates, Grib2ProjectedCoordinates, Grib2Points, Grib2ExtractOptions,
+             Grib2PointExtraction, Grib2PyramidReducer, Grib2PyramidOptions, Grib2Compression, Grib2StreamOptions,
+             Grib2MessageCallback, Grib2IndexEntry, Grib2ByteSource, Grib2ByteRange, Grib2FileHandle, Grib2MessageCacheOptions,
+             Grib2EnsembleOptions, Grib2EnsembleStats, Grib2IntervalOptions, Grib2Interval, Grib2IntervalSeries,
+             Grib2ExpressionOptions, Grib2IndexColumn, Grib2ColumnArray, Grib2SchedulerOptions, Grib2PrefetchOptions, Grib2TaskOptions, Grib2TaskKind, Grib2TaskState, Grib2SourceRange,
+             Grib2PersistentStore, Grib2StoredEntry, Grib2DirectoryFS, Grib2PersistentCacheOptions, Grib2CachedField};
\ No newline at end of file
@@ -0,0 +1,775 @@
+import { Grib2Metrics, reportError, startStage } from "./grib2metrics";
+import { Grib2HeaderTable, hashString, packIndex, unpackIndex } from "./grib2index";
+import type { Grib2SourceRange } from "./source";
+import { Grib2FieldStats, Grib2OutputArray, Grib2OutputFormat, Grib2PackingParameters, Grib2ScalingParameters, getCompressionModule, getDestination, runNative } from "./unpack";
+
+/**
+ * An entry in a persistent store. Entries are named by ids made from their keys (16 hex digits), which are safe to use as file names.
+ */
+interface Grib2StoredEntry {
+    id: string;
+    /** Size in bytes */
+    size: number;
+    /** When the entry was last read or written, in milliseconds since 1970-01-01 */
+    last_used: number;
+}
+
+/**
+ * Somewhere to keep cache entries between page loads or process restarts
+ */
+interface Grib2PersistentStore {
+    /** Read an entry, or null if there isn't one */
+    get(id: string): Promise<Uint8Array | null>;
+    /** Write an entry, replacing any that's there */
+    put(id: string, data: Uint8Array): Promise<void>;
+    delete(id: string): Promise<void>;
+    /** Update when an entry was last used */
+    touch(entry: Grib2StoredEntry): Promise<void>;
+    /** List all the entries */
+    list(): Promise<Grib2StoredEntry[]>;
+}
+
+function idbRequest<T>(request: IDBRequest<T>) {
+    return new Promise<T>((resolve, reject) => {
+        request.onsuccess = () => resolve(request.result);
+        request.onerror = () => reject(request.error);
+    });
+}
+
+function idbTransaction(transaction: IDBTransaction) {
+    return new Promise<void>((resolve, reject) => {
+        transaction.oncomplete = () => resolve();
+        transaction.onerror = () => reject(transaction.error);
+        transaction.onabort = () => reject(transaction.error);
+    });
+}
+
+/**
+ * A store in an IndexedDB database in the browser. The data and the entry sizes and times are in separate object stores, so listing the entries
+ *  doesn't read the data.
+ */
+class Grib2IndexedDBStore implements Grib2PersistentStore {
+    private db: IDBDatabase;
+
+    constructor(db: IDBDatabase) {
+        this.db = db;
+    }
+
+    /**
+     * Open (or create) the database
+     * @param name - The database name ('gribjs-cache' by default)
+     * @param factory - The IndexedDB factory (`indexedDB` by default)
+     * @returns The store
+     */
+    static async open(name?: string, factory?: IDBFactory) {
+        name = name === undefined ? 'gribjs-cache' : name;
+        factory = factory === undefined ? indexedDB : factory;
+
+        const request = factory.open(name, 1);
+        request.onupgradeneeded = () => {
+            request.result.createObjectStore('data');
+            request.result.createObjectStore('entries', {keyPath: 'id'});
+        };
+
+        return new Grib2IndexedDBStore(await idbRequest(request));
+    }
+
+    async get(id: string) {
+        const transaction = this.db.transaction('data', 'readonly');
+        const data = await idbRequest(transaction.objectStore('data').get(id)) as Uint8Array | undefined;
+        return data === undefined ? null : data;
+    }
+
+    async put(id: string, data: Uint8Array) {
+        const transaction = this.db.transaction(['data', 'entries'], 'readwrite');
+        transaction.objectStore('data').put(data, id);
+        transaction.objectStore('entries').put({id: id, size: data.byteLength, last_used: Date.now()});
+        await idbTransaction(transaction);
+    }
+
+    async delete(id: string) {
+        const transaction = this.db.transaction(['data', 'entries'], 'readwrite');
+        transaction.objectStore('data').delete(id);
+        transaction.objectStore('entries').delete(id);
+        await idbTransaction(transaction);
+    }
+
+    async touch(entry: Grib2StoredEntry) {
+        const transaction = this.db.transaction('entries', 'readwrite');
+        transaction.objectStore('entries').put({id: entry.id, size: entry.size, last_used: entry.last_used});
+        await idbTransaction(transaction);
+    }
+
+    async list() {
+        const transaction = this.db.transaction('entries', 'readonly');
+        return await idbRequest(transaction.objectStore('entries').getAll()) as Grib2StoredEntry[];
+    }
+}
+
+/**
+ * The parts of Node's `fs.promises` that a Grib2DirectoryStore uses
+ */
+interface Grib2DirectoryFS {
+    mkdir(path: string, opts: {recursive: boolean}): Promise<unknown>;
+    readFile(path: string): Promise<Uint8Array>;
+    writeFile(path: string, data: Uint8Array): Promise<void>;
+    rename(old_path: string, new_path: string): Promise<void>;
+    unlink(path: string): Promise<void>;
+    readdir(path: string): Promise<string[]>;
+    stat(path: string): Promise<{size: number, mtimeMs: number}>;
+    utimes(path: string, atime: number, mtime: number): Promise<void>;
+}
+
+const entry_extension = '.g2c';
+
+function isMissingFile(err: unknown) {
+    return err !== null && typeof err == 'object' && (err as {code?: string}).code == 'ENOENT';
+}
+
+/**
+ * A store in a directory in Node, with one file per entry. Files are written to a temporary name and renamed, so a crash partway through a write
+ *  doesn't leave a truncated entry, and the last-used time is the file's modification time. Like Grib2FileHandleSource, this takes `fs.promises` instead
+ *  of depending on Node.
+ * @example
+ * const fs = require('fs');
+ * const store = await grib.Grib2DirectoryStore.open(fs.promises, '/var/cache/gribjs');
+ */
+class Grib2DirectoryStore implements Grib2PersistentStore {
+    private fs: Grib2DirectoryFS;
+    private path: string;
+
+    constructor(fs_promises: Grib2DirectoryFS, path: string) {
+        this.fs = fs_promises;
+        this.path = path;
+    }
+
+    /**
+     * Open a directory, creating it if it doesn't exist
+     * @param fs_promises - Node's `fs.promises`
+     * @param path - The directory
+     * @returns The store
+     */
+    static async open(fs_promises: Grib2DirectoryFS, path: string) {
+        await fs_promises.mkdir(path, {recursive: true});
+        return new Grib2DirectoryStore(fs_promises, path);
+    }
+
+    private file(id: string) {
+        return `${this.path}/${id}${entry_extension}`;
+    }
+
+    async get(id: string) {
+        try {
+            // Node gives back a Buffer, whose slice() doesn't copy like a Uint8Array's does
+            const data = await this.fs.readFile(this.file(id));
+            return new Uint8Array(data.buffer, data.byteOffset, data.byteLength);
+        }
+        catch (err) {
+            if (isMissingFile(err)) return null;
+            throw err;
+        }
+    }
+
+    async put(id: string, data: Uint8Array) {
+        const tmp_file = `${this.file(id)}.${Date.now()}-${Math.floor(Math.random() * 0x100000000).toString(16)}.tmp`;
+        await this.fs.writeFile(tmp_file, data);
+        await this.fs.rename(tmp_file, this.file(id));
+    }
+
+    async delete(id: string) {
+        try {
+            await this.fs.unlink(this.file(id));
+        }
+        catch (err) {
+            if (!isMissingFile(err)) throw err;
+        }
+    }
+
+    async touch(entry: Grib2StoredEntry) {
+        try {
+            await this.fs.utimes(this.file(entry.id), entry.last_used / 1000, entry.last_used / 1000);
+        }
+        catch (err) {
+            if (!isMissingFile(err)) throw err;
+        }
+    }
+
+    async list() {
+        const names = (await this.fs.readdir(this.path)).filter(name => /^[0-9a-f]{16}\.g2c$/.test(name));
+        const entries: Grib2StoredEntry[] = [];
+
+        for (let i = 0; i < names.length; i++) {
+            const id = names[i].slice(0, -entry_extension.length);
+            try {
+                const {size, mtimeMs} = await this.fs.stat(this.file(id));
+                entries.push({id: id, size: size, last_used: mtimeMs});
+            }
+            catch (err) {
+                // Another process removed it
+                if (!isMissingFile(err)) throw err;
+            }
+        }
+
+        return entries;
+    }
+}
+
+/**
+ * A decoded message as it's kept in the cache
+ */
+interface Grib2CachedField {
+    /** The message from the start of section 0 through the header of section 7, to unpack the headers from */
+    headers: Uint8Array;
+    data: Grib2OutputArray;
+    output_format: Grib2OutputFormat;
+    packing: Grib2PackingParameters | null;
+    stats: Grib2FieldStats | null;
+    /** The scaling from section 5, which `quantize` uses to store 'float32' data as the message's packed integers */
+    scaling: Grib2ScalingParameters | null;
+}
+
+interface Grib2PersistentCacheOptions {
+    /** Keep at most this many bytes in the store (512 MB by default). The least recently used entries are removed to make room for new ones. */
+    max_bytes?: number;
+    /**
+     * Store 'float32' fields as the message's own packed integers (16 bits per point) instead of floats, which halves their size without changing any
+     *  values. Fields that can't be stored that way (e.g., the packing uses more than 16 bits) are stored as floats. Off by default.
+     */
+    quantize?: boolean;
+}
+
+const default_persistent_max_bytes = 512 * 1024 * 1024;
+
+// Entries are the magic, the version, the key (checked on read, in case two keys hash to the same id), and then the contents
+const entry_magic = 'G2PC';
+const entry_version = 2;
+const entry_header_length = 12;
+
+// The field contents are a fixed header, the message headers, and then the data, which is in the platform's byte order (the store is only read on the
+//  machine that wrote it)
+const field_types = {
+    float32: 0,
+    float16: 1,
+    // float32 stored as the message's packed integers in 16 bits, with the scaling where the packing parameters go
+    quantized: 2,
+    packed16: 3,
+    packed32: 4,
+};
+
+const quantized_missing_value = 0xffff;
+
+const field_has_packing = 1;
+const field_has_stats = 2;
+const field_packing_offset = 12;
+const field_stats_offset = field_packing_offset + 4 * 8;
+const field_header_length = field_stats_offset + 8 * 8;
+
+function align4(n: number) {
+    return (n + 3) & ~3;
+}
+
+function encodeKey(key: string) {
+    return new TextEncoder().encode(key);
+}
+
+/**
+ * Copy an array into a byte buffer
+ */
+function setBytes(bytes: Uint8Array, offset: number, data: Grib2OutputArray | Uint8Array) {
+    bytes.set(new Uint8Array(data.buffer, data.byteOffset, data.byteLength), offset);
+}
+
+/**
+ * Get an array from a byte buffer, without a copy if it's aligned
+ */
+function getArray<T extends Grib2OutputArray>(array_type: {new(buffer: ArrayBuffer, offset: number, length: number): T, BYTES_PER_ELEMENT: number},
+                                              bytes: Uint8Array, offset: number, length: number) {
+    const start = bytes.byteOffset + offset;
+    if (start % array_type.BYTES_PER_ELEMENT == 0) {
+        return new array_type(bytes.buffer as ArrayBuffer, start, length);
+    }
+
+    return new array_type(bytes.slice(offset, offset + length * array_type.BYTES_PER_ELEMENT).buffer, 0, length);
+}
+
+/**
+ * Turn a 'float32' field back into the message's packed integers, as 16-bit ints
+ * @returns The packed integers, or null if some value isn't exactly one of the packed values or the packed integers don't fit in 16 bits
+ */
+async function quantizeField(data: Float32Array, scaling: Grib2ScalingParameters, metrics?: Grib2Metrics) {
+    const n_points = data.length;
+    const compression = await getCompressionModule(metrics);
+    const input_ = compression._malloc(Math.max(n_points, 1) * 4);
+    const output_ = compression._malloc(Math.max(n_points, 1) * 2);
+    new Float32Array(compression.HEAPU8.buffer, input_, n_points).set(data);
+
+    const status = runNative(compression, 'quantize', n_points, () => compression.ccall('field_to_packed16', 'number', ['number', 'number', 'number', 'number', 'number', 'number'],
+                             [input_, n_points, scaling.reference_value, scaling.binary_scale_factor, scaling.decimal_scale_factor, output_]) as number, metrics);
+    const packed = status == 0 ? new Uint8Array(compression.HEAPU8.buffer, output_, n_points * 2).slice() : null;
+
+    compression._free(input_);
+    compression._free(output_);
+
+    if (status != 0 && status != 1) {
+        throw `Quantizing a field encountered an error: ${status}`;
+    }
+
+    return packed;
+}
+
+async function packField(field: Grib2CachedField, quantize: boolean, metrics?: Grib2Metrics) {
+    const n_points = field.data.length;
+
+    // Quantizing is lossless, so fields it doesn't work for are stored as floats
+    let quantized: Uint8Array | null = null;
+    if (quantize && field.output_format == 'float32' && field.scaling !== null) {
+        quantized = await quantizeField(field.data as Float32Array, field.scaling, metrics);
+    }
+
+    let field_type: number;
+    if (field.output_format == 'float32') {
+        field_type = quantized !== null ? field_types.quantized : field_types.float32;
+    }
+    else if (field.output_format == 'float16') {
+        field_type = field_types.float16;
+    }
+    else {
+        field_type = field.data instanceof Uint16Array ? field_types.packed16 : field_types.packed32;
+    }
+
+    const data_offset = align4(field_header_length + field.headers.length);
+    const data_length = quantized !== null ? quantized.length : field.data.byteLength;
+    const bytes = new Uint8Array(data_offset + data_length);
+    const view = new DataView(bytes.buffer);
+
+    view.setUint8(0, field_type);
+    view.setUint8(1, (field.packing === null ? 0 : field_has_packing) | (field.stats === null ? 0 : field_has_stats));
+    view.setUint32(4, field.headers.length, true);
+    view.setUint32(8, n_points, true);
+
+    if (quantized !== null) {
+        const {reference_value, binary_scale_factor, decimal_scale_factor} = field.scaling;
+        [reference_value, binary_scale_factor, decimal_scale_factor, quantized_missing_value].forEach((value, i) => view.setFloat64(field_packing_offset + i * 8, value, true));
+    }
+    else if (field.packing !== null) {
+        const {reference_value, binary_scale_factor, decimal_scale_factor, missing_value} = field.packing;
+        [reference_value, binary_scale_factor, decimal_scale_factor, missing_value].forEach((value, i) => view.setFloat64(field_packing_offset + i * 8, value, true));
+    }
+
+    if (field.stats !== null) {
+        const {min, max, mean, std, sum, sum_of_squares, count, missing_count} = field.stats;
+        [min, max, mean, std, sum, sum_of_squares, count, missing_count].forEach((value, i) => view.setFloat64(field_stats_offset + i * 8, value, true));
+    }
+
+    bytes.set(field.headers, field_header_length);
+
+    if (quantized !== null) {
+        bytes.set(quantized, data_offset);
+    }
+    else {
+        setBytes(bytes, data_offset, field.data);
+    }
+
+    return bytes;
+}
+
+async function unpackField(bytes: Uint8Array, metrics?: Grib2Metrics) : Promise<Grib2CachedField> {
+    const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+    if (bytes.length < field_header_length) {
+        throw `Cached field is truncated`;
+    }
+
+    const field_type = view.getUint8(0);
+    const flags = view.getUint8(1);
+    const headers_length = view.getUint32(4, true);
+    const n_points = view.getUint32(8, true);
+    const data_offset = align4(field_header_length + headers_length);
+    const data_length = n_points * (field_type == field_types.float32 || field_type == field_types.packed32 ? 4 : 2);
+
+    if (data_offset + data_length != bytes.length) {
+        throw `Cached field has the wrong size`;
+    }
+
+    const read = (offset: number, i: number) => view.getFloat64(offset + i * 8, true);
+
+    let packing: Grib2PackingParameters | null = null;
+    let scaling: Grib2ScalingParameters | null = null;
+    if (field_type == field_types.quantized) {
+        scaling = {reference_value: read(field_packing_offset, 0), binary_scale_factor: read(field_packing_offset, 1),
+                   decimal_scale_factor: read(field_packing_offset, 2)};
+    }
+    else if (flags & field_has_packing) {
+        packing = {reference_value: read(field_packing_offset, 0), binary_scale_factor: read(field_packing_offset, 1),
+                   decimal_scale_factor: read(field_packing_offset, 2), missing_value: read(field_packing_offset, 3)};
+    }
+
+    let stats: Grib2FieldStats | null = null;
+    if (flags & field_has_stats) {
+        stats = {min: read(field_stats_offset, 0), max: read(field_stats_offset, 1), mean: read(field_stats_offset, 2), std: read(field_stats_offset, 3),
+                 sum: read(field_stats_offset, 4), sum_of_squares: read(field_stats_offset, 5), count: read(field_stats_offset, 6),
+                 missing_count: read(field_stats_offset, 7)};
+    }
+
+    const headers = bytes.slice(field_header_length, field_header_length + headers_length);
+
+    let data: Grib2OutputArray;
+    let output_format: Grib2OutputFormat;
+
+    if (field_type == field_types.quantized) {
+        output_format = 'float32';
+        data = new Float32Array(n_points);
+
+        const compression = await getCompressionModule(metrics);
+        const input_ = compression._malloc(Math.max(n_points, 1) * 2);
+        const output_ = compression._malloc(Math.max(n_points, 1) * 4);
+        compression.HEAPU8.set(bytes.subarray(data_offset, data_offset + data_length), input_);
+
+        const status = runNative(compression, 'quantize', n_points, () => compression.ccall('field_from_packed16', 'number', ['number', 'number', 'number', 'number', 'number', 'number'],
+                                 [input_, n_points, scaling.reference_value, scaling.binary_scale_factor, scaling.decimal_scale_factor, output_]) as number, metrics);
+        if (status == 0) {
+            data.set(new Float32Array(compression.HEAPU8.buffer, output_, n_points));
+        }
+
+        compression._free(input_);
+        compression._free(output_);
+
+        if (status != 0) {
+            throw `Expanding a quantized field encountered an error: ${status}`;
+        }
+    }
+    else if (field_type == field_types.float32) {
+        output_format = 'float32';
+        data = new Float32Array(n_points);
+        data.set(getArray(Float32Array, bytes, data_offset, n_points));
+    }
+    else if (field_type == field_types.float16) {
+        output_format = 'float16';
+        data = new Uint16Array(n_points);
+        data.set(getArray(Uint16Array, bytes, data_offset, n_points));
+    }
+    else if (field_type == field_types.packed16) {
+        output_format = 'packed';
+        data = new Uint16Array(n_points);
+        data.set(getArray(Uint16Array, bytes, data_offset, n_points));
+    }
+    else if (field_type == field_types.packed32) {
+        output_format = 'packed';
+        data = new Uint32Array(n_points);
+        data.set(getArray(Uint32Array, bytes, data_offset, n_points));
+    }
+    else {
+        throw `Unknown cached field type ${field_type}`;
+    }
+
+    return {headers: headers, data: data, output_format: output_format, packing: packing, stats: stats, scaling: scaling};
+}
+
+/**
+ * Copy a cached field's data into a destination array
+ * @param data - The field's data
+ * @param destination - The destination, which has to be the same type of array as the data and at least as long
+ * @returns The part of the destination the data went into
+ */
+function copyFieldData(data: Grib2OutputArray, destination: Grib2OutputArray) : Grib2OutputArray {
+    if (data instanceof Float32Array) {
+        const output = getDestination(destination, Float32Array, 'Float32Array', data.length);
+        output.set(data);
+        return output;
+    }
+    else if (data instanceof Uint16Array) {
+        const output = getDestination(destination, Uint16Array, 'Uint16Array', data.length);
+        output.set(data);
+        return output;
+    }
+    else {
+        const output = getDestination(destination, Uint32Array, 'Uint32Array', data.length);
+        output.set(data);
+        return output;
+    }
+}
+
+/**
+ * A cache of decoded messages that lasts between page loads or process restarts, on top of a Grib2IndexedDBStore in the browser or a Grib2DirectoryStore
+ *  in Node. Entries are keyed on where the message came from (a URL or path, the version of the file there, and the byte range) and a checksum of its
+ *  index entry, so a file that's been replaced at the same URL isn't served from stale entries.
+ *  The store is kept under a size limit by removing the least recently used entries. Files use it through Grib2File.usePersistentCache() or the
+ *  `persistent_cache` option to Grib2Inventory.downloadData().
+ * @example
+ * // Browser
+ * const cache = new grib.Grib2PersistentCache(await grib.Grib2IndexedDBStore.open(), {max_bytes: 1024 * 1024 * 1024});
+ * // Node
+ * const cache = new grib.Grib2PersistentCache(await grib.Grib2DirectoryStore.open(fs.promises, '/var/cache/gribjs'));
+ */
+class Grib2PersistentCache {
+    readonly store: Grib2PersistentStore;
+    readonly quantize: boolean;
+    private max_bytes: number;
+
+    // The store's entries, which are listed the first time the cache is used
+    private entries: Record<string, Grib2StoredEntry> | null;
+    private loading: Promise<void> | null;
+    private n_bytes: number;
+
+    constructor(store: Grib2PersistentStore, opts?: Grib2PersistentCacheOptions) {
+        opts = opts === undefined ? {} : opts;
+        this.store = store;
+        this.quantize = opts.quantize === undefined ? false : opts.quantize;
+        this.max_bytes = opts.max_bytes === undefined ? default_persistent_max_bytes : opts.max_bytes;
+        this.entries = null;
+        this.loading = null;
+        this.n_bytes = 0;
+    }
+
+    private load() {
+        if (this.loading === null) {
+            this.loading = this.store.list().then(entries => {
+                this.entries = {};
+                this.n_bytes = 0;
+                entries.forEach(entry => {
+                    this.entries[entry.id] = entry;
+                    this.n_bytes += entry.size;
+                });
+            });
+
+            // Try again next time if listing failed
+            this.loading.catch(() => { this.loading = null; });
+        }
+
+        return this.loading;
+    }
+
+    private static entryId(key: string) {
+        // Two 32-bit hashes, so ids for different keys practically never collide (and if they do, the key check on read catches it)
+        const reversed = key.split('').reverse().join('');
+        return [hashString(key), hashString(reversed)].map(hash => `0000000${hash.toString(16)}`.slice(-8)).join('');
+    }
+
+    private forget(id: string) {
+        if (id in this.entries) {
+            this.n_bytes -= this.entries[id].size;
+            delete this.entries[id];
+        }
+    }
+
+    /**
+     * Read an entry
+     * @param key - The key
+     * @param metrics - Collect timings into this object
+     * @returns The entry's contents, or null if it isn't in the cache
+     */
+    async get(key: string, metrics?: Grib2Metrics) {
+        await this.load();
+
+        const id = Grib2PersistentCache.entryId(key);
+        if (!(id in this.entries)) return null;
+
+        const stop = startStage(metrics, 'cache_read');
+        const data = await this.store.get(id);
+        stop({bytes: data === null ? 0 : data.byteLength});
+
+        if (data === null) {
+            // Another page or process removed it
+            this.forget(id);
+            return null;
+        }
+
+        const key_bytes = encodeKey(key);
+        const view = new DataView(data.buffer, data.byteOffset, data.byteLength);
+        const contents_offset = align4(entry_header_length + key_bytes.length);
+        if (data.length < contents_offset || String.fromCharCode(data[0], data[1], data[2], data[3]) != entry_magic || view.getUint32(4, true) != entry_version
+            || view.getUint32(8, true) != key_bytes.length || key_bytes.some((byte, i) => data[entry_header_length + i] != byte)) {
+            // Corrupt, from an older version of the format, or another key with the same id; either way, it's no use
+            await this.store.delete(id);
+            this.forget(id);
+            return null;
+        }
+
+        const entry = this.entries[id];
+        if (entry !== undefined) {
+            entry.last_used = Date.now();
+            this.store.touch(entry).catch(err => reportError(metrics, 'cache_write', err));
+        }
+
+        return data.subarray(contents_offset);
+    }
+
+    /**
+     * Write an entry, removing the least recently used ones if the cache is over its size limit. Entries bigger than the limit aren't written.
+     * @param key - The key
+     * @param contents - The contents
+     * @param metrics - Collect timings into this object
+     */
+    async put(key: string, contents: Uint8Array, metrics?: Grib2Metrics) {
+        await this.load();
+
+        const key_bytes = encodeKey(key);
+        const contents_offset = align4(entry_header_length + key_bytes.length);
+        const data = new Uint8Array(contents_offset + contents.length);
+        const view = new DataView(data.buffer);
+
+        for (let i = 0; i < entry_magic.length; i++) {
+            data[i] = entry_magic.charCodeAt(i);
+        }
+        view.setUint32(4, entry_version, true);
+        view.setUint32(8, key_bytes.length, true);
+        data.set(key_bytes, entry_header_length);
+        data.set(contents, contents_offset);
+
+        if (data.length > this.max_bytes) return;
+
+        const id = Grib2PersistentCache.entryId(key);
+
+        const stop = startStage(metrics, 'cache_write');
+        await this.store.put(id, data);
+        stop({bytes: data.byteLength});
+
+        this.forget(id);
+        this.entries[id] = {id: id, size: data.length, last_used: Date.now()};
+        this.n_bytes += data.length;
+
+        if (this.n_bytes > this.max_bytes) {
+            const oldest = Object.keys(this.entries).filter(other => other != id).sort((a, b) => this.entries[a].last_used - this.entries[b].last_used);
+            for (let i = 0; i < oldest.length && this.n_bytes > this.max_bytes; i++) {
+                await this.store.delete(oldest[i]);
+                this.forget(oldest[i]);
+            }
+        }
+    }
+
+    /**
+     * Remove an entry
+     * @param key - The key
+     */
+    async delete(key: string) {
+        await this.load();
+
+        const id = Grib2PersistentCache.entryId(key);
+        await this.store.delete(id);
+        this.forget(id);
+    }
+
+    /**
+     * Remove every entry
+     */
+    async clear() {
+        await this.load();
+
+        const ids = Object.keys(this.entries);
+        for (let i = 0; i < ids.length; i++) {
+            await this.store.delete(ids[i]);
+            this.forget(ids[i]);
+        }
+    }
+
+    /**
+     * The number of bytes in the store (as of the last time this cache read or wrote it)
+     */
+    get size() {
+        return this.n_bytes;
+    }
+
+    /**
+     * The key for a decoded message
+     * @param url - Where the file is
+     * @param version - Which version of the file it is (e.g., an ETag, or a modification time and size)
+     * @param offset - Where the message is in the file
+     * @param length - The length of the message
+     * @param checksum - The checksum of the message's index entry
+     * @param output_format - The output format it was decoded to
+     */
+    messageKey(url: string, version: string, offset: number, length: number, checksum: number, output_format: Grib2OutputFormat) {
+        const format = output_format == 'float32' && this.quantize ? 'float32-quantized' : output_format;
+        return `${url}#${version}#bytes=${offset}-${offset + length - 1}#${checksum}#${format}`;
+    }
+
+    /**
+     * The key for the index of a set of byte ranges from a file
+     * @param url - Where the file is
+     * @param version - Which version of the file it is
+     * @param inventory - The inventory of the messages in the ranges
+     */
+    indexKey(url: string, version: string, inventory: string) {
+        return `${url}#${version}#index#${inventory.length}:${hashString(inventory)}`;
+    }
+
+    /**
+     * Read a decoded message. The data always go in a new array, so a destination array isn't written until the message has been checked against
+     *  the file (see copyFieldData()).
+     * @param key - The key from messageKey()
+     * @param metrics - Collect timings into this object
+     * @returns The message, or null if it isn't in the cache (or the entry can't be unpacked, in which case it's removed)
+     */
+    async getField(key: string, metrics?: Grib2Metrics) {
+        const contents = await this.get(key, metrics);
+        if (contents === null) return null;
+
+        try {
+            return await unpackField(contents, metrics);
+        }
+        catch (err) {
+            await this.delete(key);
+            return null;
+        }
+    }
+
+    /**
+     * Write a decoded message
+     * @param key - The key from messageKey()
+     * @param field - The message
+     * @param metrics - Collect timings into this object
+     */
+    async putField(key: string, field: Grib2CachedField, metrics?: Grib2Metrics) {
+        await this.put(key, await packField(field, this.quantize, metrics), metrics);
+    }
+
+    /**
+     * Read the index for a set of byte ranges from a file
+     * @param key - The key from indexKey()
+     * @returns The ranges and the header table for the messages in them, or null if they aren't in the cache
+     */
+    async getIndex(key: string) {
+        const contents = await this.get(key);
+        if (contents === null) return null;
+
+        try {
+            const view = new DataView(contents.buffer, contents.byteOffset, contents.byteLength);
+            const n_ranges = view.getUint32(0, true);
+            const ranges: Grib2SourceRange[] = [];
+            for (let i = 0; i < n_ranges; i++) {
+                const offset = 4 + i * 24;
+                ranges.push({local_offset: view.getFloat64(offset, true), remote_offset: view.getFloat64(offset + 8, true), length: view.getFloat64(offset + 16, true)});
+            }
+
+            return {ranges: ranges, table: unpackIndex(contents.slice(4 + n_ranges * 24).buffer)};
+        }
+        catch (err) {
+            await this.delete(key);
+            return null;
+        }
+    }
+
+    /**
+     * Write the index for a set of byte ranges from a file
+     * @param key - The key from indexKey()
+     * @param ranges - The ranges
+     * @param table - The header table for the messages in the ranges
+     */
+    async putIndex(key: string, ranges: Grib2SourceRange[], table: Grib2HeaderTable) {
+        const index = new Uint8Array(packIndex(table));
+        const contents = new Uint8Array(4 + ranges.length * 24 + index.length);
+        const view = new DataView(contents.buffer);
+
+        view.setUint32(0, ranges.length, true);
+        ranges.forEach((range, i) => {
+            view.setFloat64(4 + i * 24, range.local_offset, true);
+            view.setFloat64(4 + i * 24 + 8, range.remote_offset, true);
+            view.setFloat64(4 + i * 24 + 16, range.length, true);
+        });
+        contents.set(index, 4 + ranges.length * 24);
+
+        await this.put(key, contents);
+    }
+}
+
+export {Grib2PersistentCache, Grib2IndexedDBStore, Grib2DirectoryStore, copyFieldData};
+export type {Grib2PersistentStore, Grib2StoredEntry, Grib2DirectoryFS, Grib2PersistentCacheOptions, Grib2CachedField};
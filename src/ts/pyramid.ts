@@ -0,0 +1,190 @@
+import { Grib2Metrics, startStage } from "./grib2metrics";
+import { getCompressionModule, runNative } from "./unpack";
+
+type Grib2PyramidReducer = 'mean' | 'max' | 'nearest';
+
+interface Grib2PyramidOptions {
+    /** How to combine each 2x2 block: 'mean' (the default), 'max', or 'nearest' (the first point in the block that isn't missing, for categorical data) */
+    reducer?: Grib2PyramidReducer;
+    /** Number of levels, including the full-resolution level. By default, levels are added until the coarsest one fits in one tile. */
+    n_levels?: number;
+    /** If given, cut every level into tiles of this many points on a side */
+    tile_size?: number;
+    /** Collect timings into this object */
+    metrics?: Grib2Metrics;
+}
+
+const pyramid_reducer_codes = {
+    mean: 0,
+    max: 1,
+    nearest: 2,
+}
+
+// How small the coarsest level gets by default when not cutting tiles
+const default_min_size = 256;
+
+/**
+ * One level of a pyramid
+ */
+class Grib2PyramidLevel {
+    /** The level number; 0 is full resolution, and each level after that is half the resolution of the one before */
+    readonly level: number;
+    readonly data: Float32Array;
+    readonly ni: number;
+    readonly nj: number;
+
+    /** The tiles, one after the other in row-major order, or null if the level wasn't cut into tiles */
+    readonly tiles: Float32Array | null;
+    readonly tile_size: number | null;
+    readonly n_tiles_i: number;
+    readonly n_tiles_j: number;
+
+    constructor(level: number, data: Float32Array, ni: number, nj: number, tiles?: Float32Array | null, tile_size?: number | null) {
+        this.level = level;
+        this.data = data;
+        this.ni = ni;
+        this.nj = nj;
+        this.tiles = tiles === undefined ? null : tiles;
+        this.tile_size = tile_size === undefined ? null : tile_size;
+        this.n_tiles_i = this.tile_size === null ? 0 : Math.ceil(ni / this.tile_size);
+        this.n_tiles_j = this.tile_size === null ? 0 : Math.ceil(nj / this.tile_size);
+    }
+
+    /**
+     * Get a tile from this level. Tiles that hang off the edge of the grid are padded with NaN.
+     * @param tile_i - The tile's column
+     * @param tile_j - The tile's row
+     * @returns The tile_size x tile_size points in the tile, with i varying fastest
+     */
+    getTile(tile_i: number, tile_j: number) {
+        if (this.tiles === null) {
+            throw `This pyramid level wasn't cut into tiles`;
+        }
+
+        if (tile_i < 0 || tile_i >= this.n_tiles_i || tile_j < 0 || tile_j >= this.n_tiles_j) {
+            throw `Tile (${tile_i}, ${tile_j}) is out of range for a level with ${this.n_tiles_i} x ${this.n_tiles_j} tiles`;
+        }
+
+        const tile_points = this.tile_size * this.tile_size;
+        const offset = (tile_j * this.n_tiles_i + tile_i) * tile_points;
+        return this.tiles.subarray(offset, offset + tile_points);
+    }
+}
+
+function levelDim(n: number, level: number) {
+    return Math.ceil(n / Math.pow(2, level));
+}
+
+function defaultLevels(ni: number, nj: number, min_size: number) {
+    let n_levels = 1;
+    while (Math.max(levelDim(ni, n_levels - 1), levelDim(nj, n_levels - 1)) > min_size) {
+        n_levels++;
+    }
+    return n_levels;
+}
+
+/**
+ * Build a multi-resolution pyramid from a field. Each level is the level before it reduced in 2x2 blocks, skipping missing (NaN) points, so a point is
+ *  only missing if every full-resolution point under it is. For the 'mean' reducer, each point is the mean of all the full-resolution points under it.
+ * @param data - The full-resolution field, with i varying fastest (as decoded)
+ * @param ni - The number of points in the i direction
+ * @param nj - The number of points in the j direction
+ * @param opts - The reducer, number of levels, and tile size
+ * @returns The levels, starting with the full-resolution one (which uses `data` without copying it)
+ */
+async function buildPyramid(data: Float32Array, ni: number, nj: number, opts?: Grib2PyramidOptions) {
+    opts = opts === undefined ? {} : opts;
+    const reducer = opts.reducer === undefined ? 'mean' : opts.reducer;
+    const tile_size = opts.tile_size === undefined ? null : opts.tile_size;
+    const n_levels = opts.n_levels === undefined ? defaultLevels(ni, nj, tile_size === null ? default_min_size : tile_size) : opts.n_levels;
+
+    if (!(reducer in pyramid_reducer_codes)) {
+        throw `Unknown pyramid reducer '${reducer}'`;
+    }
+
+    if (data.length != ni * nj) {
+        throw `Field has ${data.length} points, but the grid is ${ni} x ${nj}`;
+    }
+
+    if (n_levels < 1 || n_levels > 32) {
+        throw `Number of pyramid levels must be between 1 and 32 (got ${n_levels})`;
+    }
+
+    if (tile_size !== null && tile_size < 1) {
+        throw `Tile size must be positive (got ${tile_size})`;
+    }
+
+    const metrics = opts.metrics;
+    const compression = await getCompressionModule(metrics);
+    const build_pyramid = compression.cwrap('build_pyramid', 'number', ['number', 'number', 'number', 'number', 'number', 'number']);
+    const cut_tiles = compression.cwrap('cut_tiles', 'number', ['number', 'number', 'number', 'number', 'number']);
+
+    const level_dims: [number, number][] = [];
+    for (let level = 0; level < n_levels; level++) {
+        level_dims.push([levelDim(ni, level), levelDim(nj, level)]);
+    }
+
+    const level_sizes = level_dims.map(([level_ni, level_nj]) => level_ni * level_nj);
+    const pyramid_size = level_sizes.slice(1).reduce((a, b) => a + b, 0);
+
+    const data_ = compression._malloc(data.byteLength);
+    const pyramid_ = compression._malloc(Math.max(pyramid_size, 1) * 4);
+
+    const stop_input_copy = startStage(metrics, 'input_copy');
+    new Float32Array(compression.HEAPU8.buffer, data_, data.length).set(data);
+    stop_input_copy({bytes: data.byteLength});
+
+    const status = runNative(compression, 'pyramid', pyramid_size, () => build_pyramid(data_, ni, nj, n_levels, pyramid_reducer_codes[reducer], pyramid_), metrics);
+
+    const levels: Grib2PyramidLevel[] = [];
+    let tile_status = 0;
+
+    if (status == 0) {
+        let level_offset_ = pyramid_;
+
+        for (let level = 0; level < n_levels; level++) {
+            const [level_ni, level_nj] = level_dims[level];
+            const level_data_ = level == 0 ? data_ : level_offset_;
+            let tiles: Float32Array | null = null;
+
+            if (tile_size !== null) {
+                const n_tile_points = Math.ceil(level_ni / tile_size) * Math.ceil(level_nj / tile_size) * tile_size * tile_size;
+                const tiles_ = compression._malloc(n_tile_points * 4);
+
+                tile_status = runNative(compression, 'pyramid', n_tile_points, () => cut_tiles(level_data_, level_ni, level_nj, tile_size, tiles_), metrics);
+                if (tile_status == 0) {
+                    tiles = new Float32Array(compression.HEAPU8.buffer, tiles_, n_tile_points).slice();
+                }
+
+                compression._free(tiles_);
+                if (tile_status != 0) break;
+            }
+
+            let level_data = data;
+            if (level > 0) {
+                const stop_output_copy = startStage(metrics, 'output_copy');
+                level_data = new Float32Array(compression.HEAPU8.buffer, level_offset_, level_sizes[level]).slice();
+                stop_output_copy({bytes: level_data.byteLength, points: level_sizes[level]});
+                level_offset_ += level_sizes[level] * 4;
+            }
+
+            levels.push(new Grib2PyramidLevel(level, level_data, level_ni, level_nj, tiles, tile_size));
+        }
+    }
+
+    compression._free(data_);
+    compression._free(pyramid_);
+
+    if (status != 0) {
+        throw `Building the pyramid encountered an error: ${status}`;
+    }
+
+    if (tile_status != 0) {
+        throw `Cutting tiles encountered an error: ${tile_status}`;
+    }
+
+    return levels;
+}
+
+export {Grib2PyramidLevel, buildPyramid};
+export type {Grib2PyramidReducer, Grib2PyramidOptions};
@@ -0,0 +1,306 @@
+import { Grib2Metrics, startStage } from "./grib2metrics";
+import type { Grib2GridDefinitionSection } from "./grib2section";
+import { n_native_grid_params } from "./grib2griddefs";
+import { getCompressionModule, runNative } from "./unpack";
+
+type Grib2RegridMethod = 'nearest' | 'bilinear';
+
+interface Grib2RegridOptions {
+    /** 'bilinear' (the default) or 'nearest' */
+    method?: Grib2RegridMethod;
+    /** An array to put the regridded data in instead of allocating a new one */
+    destination?: Float32Array;
+    /** Collect timings into this object */
+    metrics?: Grib2Metrics;
+}
+
+const regrid_method_codes = {
+    nearest: 0,
+    bilinear: 1,
+}
+
+const regrid_n_weights = {
+    nearest: 1,
+    bilinear: 4,
+}
+
+let n_regrid_targets = 0;
+
+/**
+ * A set of points to regrid to. The interpolation weights are cached for each target, so make one of these per target grid and reuse it.
+ */
+class Grib2RegridTarget {
+    readonly lats: Float32Array;
+    readonly lons: Float32Array;
+    readonly key: string;
+
+    /**
+     * @param lats - Latitudes of the target points in degrees
+     * @param lons - Longitudes of the target points in degrees
+     * @param key - A string identifying this target for the weights cache. Targets with the same key are assumed to have the same points. If not given,
+     *  each target gets its own key.
+     */
+    constructor(lats: Float32Array, lons: Float32Array, key?: string) {
+        if (lats.length != lons.length) {
+            throw `Target latitudes and longitudes have different lengths (${lats.length} and ${lons.length})`;
+        }
+
+        this.lats = lats;
+        this.lons = lons;
+        this.key = key === undefined ? `target${n_regrid_targets++}` : key;
+    }
+
+    get size() {
+        return this.lats.length;
+    }
+}
+
+/**
+ * Interpolation weights from a source grid to a target. The weights stay on the WASM heap so they can be applied to each field without copying them.
+ */
+class Grib2RegridWeights {
+    readonly method: Grib2RegridMethod;
+    readonly source_size: number;
+    readonly target_size: number;
+    readonly n_weights: number;
+
+    private indices_: number;
+    private weights_: number;
+
+    constructor(method: Grib2RegridMethod, source_size: number, target_size: number, indices_: number, weights_: number) {
+        this.method = method;
+        this.source_size = source_size;
+        this.target_size = target_size;
+        this.n_weights = regrid_n_weights[method];
+        this.indices_ = indices_;
+        this.weights_ = weights_;
+    }
+
+    /**
+     * Interpolate a field on the source grid to the target
+     * @param data - The field on the source grid
+     * @param opts - Use `destination` to put the output in an existing array
+     * @returns The field at the target points. Points off the source grid are NaN.
+     */
+    async apply(data: Float32Array, opts?: Grib2RegridOptions) {
+        opts = opts === undefined ? {} : opts;
+
+        if (this.indices_ === 0) {
+            throw `These regridding weights have been freed`;
+        }
+
+        if (data.length != this.source_size) {
+            throw `Field has ${data.length} points, but the source grid has ${this.source_size}`;
+        }
+
+        let output = opts.destination === undefined ? new Float32Array(this.target_size) : opts.destination;
+        if (output.length < this.target_size) {
+            throw `Destination array has ${output.length} elements, but the target has ${this.target_size} points`;
+        }
+        output = output.length == this.target_size ? output : output.subarray(0, this.target_size);
+
+        const compression = await getCompressionModule(opts.metrics);
+        const regrid_apply = compression.cwrap('regrid_apply', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number']);
+
+        const src_ = compression._malloc(data.byteLength);
+        const output_ = compression._malloc(output.byteLength);
+
+        const stop_input_copy = startStage(opts.metrics, 'input_copy');
+        new Float32Array(compression.HEAPU8.buffer, src_, data.length).set(data);
+        stop_input_copy({bytes: data.byteLength});
+
+        const status = runNative(compression, 'regrid', this.target_size,
+                                 () => regrid_apply(src_, this.source_size, this.indices_, this.weights_, this.target_size, this.n_weights, output_), opts.metrics);
+
+        if (status == 0) {
+            const stop_output_copy = startStage(opts.metrics, 'output_copy');
+            output.set(new Float32Array(compression.HEAPU8.buffer, output_, this.target_size));
+            stop_output_copy({bytes: output.byteLength, points: this.target_size});
+        }
+
+        compression._free(src_);
+        compression._free(output_);
+
+        if (status != 0) {
+            throw `Regridding encountered an error: ${status}`;
+        }
+
+        return output;
+    }
+
+    /**
+     * Copy the indices and weights off of the WASM heap. There are `n_weights` of each per target point, and an index of -1 means there's no source point.
+     * @returns The source grid indices and the weights
+     */
+    async getIndicesAndWeights() {
+        if (this.indices_ === 0) {
+            throw `These regridding weights have been freed`;
+        }
+
+        const compression = await getCompressionModule();
+        const indices = new Int32Array(compression.HEAPU8.buffer, this.indices_, this.target_size * this.n_weights).slice();
+        const weights = new Float32Array(compression.HEAPU8.buffer, this.weights_, this.target_size * this.n_weights).slice();
+        return {indices: indices, weights: weights};
+    }
+
+    /**
+     * Free the weights on the WASM heap. The weights can't be used after this.
+     */
+    async free() {
+        if (this.indices_ === 0) return;
+
+        const compression = await getCompressionModule();
+        compression._free(this.indices_);
+        compression._free(this.weights_);
+        this.indices_ = 0;
+        this.weights_ = 0;
+    }
+}
+
+/**
+ * Compute the weights to regrid from a grid to a target without caching them. The caller should free() them when done.
+ */
+async function computeRegridWeights(grid_params: Float64Array, source_size: number, target: Grib2RegridTarget, method: Grib2RegridMethod, metrics?: Grib2Metrics) {
+    const compression = await getCompressionModule(metrics);
+    const regrid_weights = compression.cwrap('regrid_weights', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number']);
+
+    const n_weights = regrid_n_weights[method];
+    const params_ = compression._malloc(n_native_grid_params * 8);
+    const lats_ = compression._malloc(target.size * 4);
+    const lons_ = compression._malloc(target.size * 4);
+    const indices_ = compression._malloc(target.size * n_weights * 4);
+    const weights_ = compression._malloc(target.size * n_weights * 4);
+
+    new Float64Array(compression.HEAPU8.buffer, params_, n_native_grid_params).set(grid_params);
+    new Float32Array(compression.HEAPU8.buffer, lats_, target.size).set(target.lats);
+    new Float32Array(compression.HEAPU8.buffer, lons_, target.size).set(target.lons);
+
+    const status = runNative(compression, 'regrid_weights', target.size,
+                             () => regrid_weights(params_, lats_, lons_, target.size, regrid_method_codes[method], indices_, weights_), metrics);
+
+    compression._free(params_);
+    compression._free(lats_);
+    compression._free(lons_);
+
+    if (status != 0) {
+        compression._free(indices_);
+        compression._free(weights_);
+        throw `Computing regridding weights encountered an error: ${status}`;
+    }
+
+    return new Grib2RegridWeights(method, source_size, target.size, indices_, weights_);
+}
+
+interface Grib2RegridCacheEntry {
+    weights: Promise<Grib2RegridWeights>;
+    // Regrids using these weights right now. Weights that fall out of the cache aren't freed until these finish.
+    n_users: number;
+    evicted: boolean;
+}
+
+// The weights can be big (up to 32 bytes per target point), so only keep a few sets on the heap
+const max_cached_regrid_weights = 8;
+
+const regrid_weights_cache: Record<string, Grib2RegridCacheEntry> = {};
+// Keys in the cache, least recently used first
+let regrid_weights_lru: string[] = [];
+
+function freeEvictedWeights(entry: Grib2RegridCacheEntry) {
+    if (entry.evicted && entry.n_users == 0) {
+        entry.weights.then(weights => weights.free(), () => {});
+    }
+}
+
+function evictRegridWeights(key: string) {
+    const entry = regrid_weights_cache[key];
+    delete regrid_weights_cache[key];
+    regrid_weights_lru.splice(regrid_weights_lru.indexOf(key), 1);
+
+    entry.evicted = true;
+    freeEvictedWeights(entry);
+}
+
+function getRegridCacheEntry(sec3: Grib2GridDefinitionSection, target: Grib2RegridTarget, method: Grib2RegridMethod, metrics?: Grib2Metrics) {
+    const key = `${sec3.getGridKey()}|${target.key}|${method}`;
+
+    let entry = regrid_weights_cache[key];
+    if (entry === undefined) {
+        const weights = computeRegridWeights(sec3.contents.grid_definition_template.getNativeGridParameters(), sec3.contents.grid_size, target, method, metrics);
+        const new_entry = {weights: weights, n_users: 0, evicted: false};
+        regrid_weights_cache[key] = new_entry;
+        entry = new_entry;
+
+        // Don't keep failures around
+        weights.catch(() => {
+            if (regrid_weights_cache[key] === new_entry) {
+                delete regrid_weights_cache[key];
+                regrid_weights_lru.splice(regrid_weights_lru.indexOf(key), 1);
+            }
+        });
+    }
+    else {
+        regrid_weights_lru.splice(regrid_weights_lru.indexOf(key), 1);
+    }
+
+    regrid_weights_lru.push(key);
+
+    while (regrid_weights_lru.length > max_cached_regrid_weights) {
+        evictRegridWeights(regrid_weights_lru[0]);
+    }
+
+    return entry;
+}
+
+/**
+ * Get the weights to regrid from a grid to a target, computing them if they're not already cached. Weights are cached by the contents of section 3, so
+ *  all messages on the same grid share them. Only the most recently used sets of weights are kept, and the rest are freed, so don't hold onto these;
+ *  use computeRegridWeights() for weights that need to stay around.
+ * @param sec3 - The grid definition section for the source grid
+ * @param target - The points to regrid to
+ * @param method - The interpolation method
+ * @param metrics - Collect timings into this object
+ * @returns The regridding weights
+ */
+async function getRegridWeights(sec3: Grib2GridDefinitionSection, target: Grib2RegridTarget, method: Grib2RegridMethod, metrics?: Grib2Metrics) {
+    return await getRegridCacheEntry(sec3, target, method, metrics).weights;
+}
+
+/**
+ * Regrid data with the cached weights. The weights aren't freed while they're being used, even if they fall out of the cache in the meantime.
+ * @param data - The data on the source grid
+ * @param sec3 - The grid definition section for the source grid
+ * @param target - The points to regrid to
+ * @param method - The interpolation method
+ * @param opts - The destination array and metrics, as for Grib2RegridWeights.apply()
+ * @returns The data at the target points
+ */
+async function regridCached(data: Float32Array, sec3: Grib2GridDefinitionSection, target: Grib2RegridTarget, method: Grib2RegridMethod, opts?: Grib2RegridOptions) {
+    const entry = getRegridCacheEntry(sec3, target, method, opts === undefined ? undefined : opts.metrics);
+    entry.n_users++;
+
+    try {
+        const weights = await entry.weights;
+        return await weights.apply(data, opts);
+    }
+    finally {
+        entry.n_users--;
+        freeEvictedWeights(entry);
+    }
+}
+
+/**
+ * Free all the cached regridding weights
+ */
+async function clearRegridCache() {
+    const entries = Object.keys(regrid_weights_cache).map(key => regrid_weights_cache[key]);
+    Object.keys(regrid_weights_cache).forEach(key => { delete regrid_weights_cache[key]; });
+    regrid_weights_lru = [];
+
+    // Weights that are in use are freed when the regrids using them finish
+    entries.forEach(entry => { entry.evicted = true; });
+    const all_weights = await Promise.all(entries.filter(entry => entry.n_users == 0).map(entry => entry.weights.catch((): Grib2RegridWeights => null)));
+    await Promise.all(all_weights.filter(weights => weights !== null).map(weights => weights.free()));
+}
+
+export {Grib2RegridTarget, Grib2RegridWeights, getRegridWeights, regridCached, computeRegridWeights, clearRegridCache};
+export type {Grib2RegridMethod, Grib2RegridOptions};
@@ -0,0 +1,437 @@
+type Grib2TaskKind = 'fetch' | 'decode';
+type Grib2TaskState = 'queued' | 'running' | 'done' | 'cancelled';
+
+interface Grib2SchedulerOptions {
+    /** Run at most this many fetches at once (6 by default, which is how many connections browsers allow to one host over HTTP/1.1) */
+    max_fetches?: number;
+    /** Run at most this many decodes at once (1 by default, since decodes without a worker pool run on this thread) */
+    max_decodes?: number;
+    /** Speculative fetches (ones with a negative priority) can use at most this many of the fetch slots (2 by default) */
+    max_speculative_fetches?: number;
+    /** Keep the results of this many finished tasks that were given a key, so a prefetched result can be picked up later (16 by default) */
+    max_retained?: number;
+}
+
+interface Grib2TaskOptions {
+    /** Higher priorities run first, and tasks with the same priority run in the order they were submitted. The default is 0; negative priorities are
+     *  speculative (e.g., prefetching). */
+    priority?: number;
+    /** Cancel the task when this is aborted */
+    signal?: AbortSignal;
+    /** A name for a set of tasks (e.g., a forecast hour), so their priorities can be changed or they can be cancelled all at once */
+    group?: string;
+}
+
+interface Grib2PrefetchOptions {
+    /** Prefetch this many later forecast hours (2 by default) */
+    n_ahead?: number;
+    /** Prefetch this many earlier forecast hours (1 by default) */
+    n_behind?: number;
+}
+
+interface Grib2Job {
+    kind: Grib2TaskKind;
+    run: (signal: AbortSignal) => Promise<unknown>;
+    priority: number;
+    group: string | null;
+    key: string | null;
+    seq: number;
+    state: Grib2TaskState;
+    controller: AbortController | null;
+    attempt: number;
+    n_holders: number;
+    result: Promise<unknown>;
+    resolve: (value: unknown) => void;
+    reject: (reason: unknown) => void;
+}
+
+/** What cancelled tasks reject with */
+const cancelled_message = 'Cancelled';
+
+/**
+ * One caller's handle on a scheduled task. Tasks submitted with the same key share the work, but each caller can cancel its own handle; the work is only
+ *  stopped once every handle on it has been cancelled.
+ */
+class Grib2Task<T> {
+    /** Resolves with the task's result, or rejects with 'Cancelled' if the task is cancelled */
+    readonly promise: Promise<T>;
+
+    private scheduler: Grib2Scheduler;
+    private job: Grib2Job;
+    private released: boolean;
+    private reject_: (reason: unknown) => void;
+
+    constructor(scheduler: Grib2Scheduler, job: Grib2Job, signal?: AbortSignal) {
+        this.scheduler = scheduler;
+        this.job = job;
+        this.released = false;
+
+        this.promise = new Promise<T>((resolve, reject) => {
+            this.reject_ = reject;
+            job.result.then(value => resolve(value as T), reject);
+        });
+
+        if (signal !== undefined) {
+            if (signal.aborted) {
+                this.cancel();
+            }
+            else {
+                const onabort = () => this.cancel();
+                signal.addEventListener('abort', onabort);
+                this.promise.then(() => signal.removeEventListener('abort', onabort), () => signal.removeEventListener('abort', onabort));
+            }
+        }
+    }
+
+    /**
+     * The task's priority. Changing it reorders the task if it's still queued (and for a shared task, changes it for every caller).
+     */
+    get priority() {
+        return this.job.priority;
+    }
+
+    set priority(priority: number) {
+        this.scheduler.setPriority(this.job, priority);
+    }
+
+    get state() {
+        return this.job.state;
+    }
+
+    /**
+     * Stop waiting on the task. It's taken out of the queue (or aborted if it's running) unless another caller is still waiting on it.
+     */
+    cancel() {
+        if (this.released) return;
+
+        this.released = true;
+        this.reject_(cancelled_message);
+        this.scheduler.release(this.job);
+    }
+}
+
+/**
+ * Runs fetches and decodes in order of priority, with a limit on how many of each run at once. Priorities can be changed after the tasks are submitted,
+ *  and tasks can be cancelled with an AbortSignal: queued tasks are dropped, and running fetches are aborted. Speculative tasks (negative priority, e.g.,
+ *  prefetching the next forecast hour) only get a few of the fetch slots, and are stopped and put back in the queue if a fetch that's needed now is
+ *  waiting for a slot. Tasks with the same key share one result, so a request for something that's already being prefetched picks up the prefetch (and
+ *  raises its priority) instead of starting over.
+ */
+class Grib2Scheduler {
+    private max_fetches: number;
+    private max_decodes: number;
+    private max_speculative_fetches: number;
+    private max_retained: number;
+
+    private queue: Grib2Job[];
+    private running: Grib2Job[];
+    // Decodes that were cancelled while running. They can't be stopped partway through, so they keep their slot until they finish.
+    private draining: Grib2Job[];
+    private jobs_by_key: Record<string, Grib2Job>;
+    // Keys of finished jobs, most recently used last
+    private retained: string[];
+    private n_submitted: number;
+    // Groups for the forecast hours being prefetched by prefetchNeighbors()
+    private prefetch_groups: string[];
+
+    constructor(opts?: Grib2SchedulerOptions) {
+        opts = opts === undefined ? {} : opts;
+        this.max_fetches = opts.max_fetches === undefined ? 6 : opts.max_fetches;
+        this.max_decodes = opts.max_decodes === undefined ? 1 : opts.max_decodes;
+        this.max_speculative_fetches = opts.max_speculative_fetches === undefined ? 2 : opts.max_speculative_fetches;
+        this.max_retained = opts.max_retained === undefined ? 16 : opts.max_retained;
+
+        this.queue = [];
+        this.running = [];
+        this.draining = [];
+        this.jobs_by_key = {};
+        this.retained = [];
+        this.n_submitted = 0;
+        this.prefetch_groups = [];
+    }
+
+    /**
+     * Submit a task
+     * @param kind - 'fetch' or 'decode', which have separate limits on how many run at once
+     * @param run - Does the work. This is passed a signal that's aborted if the task is cancelled or preempted while it's running, which should be passed
+     *  on to fetch(). A preempted task is run again from the start later, so this may be called more than once.
+     * @param opts - The `priority`, a `signal` to cancel the task, a `group` name, and a `key` to share the task (and its result) with other tasks
+     *  submitted with the same key
+     * @returns A handle on the task
+     * @example
+     * const task = scheduler.schedule('fetch', signal => fetch(url, {signal: signal}).then(resp => resp.arrayBuffer()), {priority: -1, key: url});
+     * task.priority = 1;  // It's needed now
+     * const buffer = await task.promise;
+     */
+    schedule<T>(kind: Grib2TaskKind, run: (signal: AbortSignal) => Promise<T>, opts?: Grib2TaskOptions & {key?: string}) {
+        opts = opts === undefined ? {} : opts;
+        const priority = opts.priority === undefined ? 0 : opts.priority;
+        const key = opts.key === undefined ? null : opts.key;
+
+        if (key !== null && key in this.jobs_by_key) {
+            const job = this.jobs_by_key[key];
+            job.n_holders++;
+
+            if (job.state == 'done') {
+                this.retained.splice(this.retained.indexOf(key), 1);
+                this.retained.push(key);
+            }
+            else if (priority > job.priority) {
+                this.setPriority(job, priority);
+            }
+
+            return new Grib2Task<T>(this, job, opts.signal);
+        }
+
+        let resolve: (value: unknown) => void, reject: (reason: unknown) => void;
+        const result = new Promise<unknown>((res, rej) => { resolve = res; reject = rej; });
+
+        // The callers each get their own promise, so nobody needs to handle this one
+        result.catch(() => {});
+
+        const job: Grib2Job = {
+            kind: kind, run: run, priority: priority, group: opts.group === undefined ? null : opts.group, key: key, seq: this.n_submitted++,
+            state: 'queued', controller: null, attempt: 0, n_holders: 1, result: result, resolve: resolve, reject: reject,
+        };
+
+        if (key !== null) {
+            this.jobs_by_key[key] = job;
+        }
+
+        this.queue.push(job);
+        const task = new Grib2Task<T>(this, job, opts.signal);
+        this.pump();
+        return task;
+    }
+
+    /**
+     * Change the priority of every unfinished task in a group
+     * @param group - The group name
+     * @param priority - The new priority
+     */
+    setGroupPriority(group: string, priority: number) {
+        this.queue.concat(this.running).filter(job => job.group === group).forEach(job => { job.priority = priority; });
+        this.pump();
+    }
+
+    /**
+     * Cancel every unfinished task in a group, whether or not anyone's still waiting on them
+     * @param group - The group name
+     */
+    cancelGroup(group: string) {
+        this.queue.concat(this.running).filter(job => job.group === group).forEach(job => this.cancelJob(job));
+        this.pump();
+    }
+
+    /**
+     * Prefetch the forecast hours around the one being looked at, at speculative priorities (-1 for the nearest hours, and lower further out). Prefetches
+     *  from an earlier call for hours that aren't neighbors anymore are cancelled, and a prefetch of the current hour is bumped to priority 0. Requests for
+     *  the same data later on (e.g., Grib2Inventory.downloadData() with this scheduler) pick up the prefetched results.
+     * @param current - The forecast hour being looked at
+     * @param hours - All the forecast hours, in order
+     * @param load - Starts loading a forecast hour. Pass the task options it's given on to the requests (e.g., to Grib2Inventory.downloadData()).
+     * @param opts - How many hours to prefetch `n_ahead` of and `n_behind` the current one
+     * @example
+     * scheduler.prefetchNeighbors(fhour, fhours, (fh, task_opts) => getInventory(fh).then(inv => inv.search(':REFC:').downloadData(dataUrl(fh), {...task_opts, scheduler: scheduler})));
+     */
+    prefetchNeighbors(current: number, hours: number[], load: (hour: number, task_opts: Grib2TaskOptions) => Promise<unknown>, opts?: Grib2PrefetchOptions) {
+        opts = opts === undefined ? {} : opts;
+        const n_ahead = opts.n_ahead === undefined ? 2 : opts.n_ahead;
+        const n_behind = opts.n_behind === undefined ? 1 : opts.n_behind;
+
+        const i_current = hours.indexOf(current);
+        if (i_current < 0) {
+            throw `Forecast hour ${current} isn't one of the hours`;
+        }
+
+        const prefetchGroup = (hour: number) => `prefetch:${hour}`;
+
+        const neighbors: number[] = [];
+        for (let i = Math.max(i_current - n_behind, 0); i <= Math.min(i_current + n_ahead, hours.length - 1); i++) {
+            if (i != i_current) neighbors.push(i);
+        }
+        const groups = neighbors.map(i => prefetchGroup(hours[i]));
+
+        // The current hour is needed now, and the hours that aren't neighbors anymore aren't needed at all
+        this.setGroupPriority(prefetchGroup(current), 0);
+        this.prefetch_groups.filter(group => group != prefetchGroup(current) && groups.indexOf(group) < 0).forEach(group => this.cancelGroup(group));
+
+        neighbors.forEach((i, ineighbor) => {
+            const priority = -Math.abs(i - i_current);
+            const group = groups[ineighbor];
+
+            if (this.prefetch_groups.indexOf(group) >= 0) {
+                this.setGroupPriority(group, priority);
+            }
+            else {
+                // Cancelled prefetches reject, which nobody needs to hear about
+                load(hours[i], {priority: priority, group: group}).catch(() => {});
+            }
+        });
+
+        this.prefetch_groups = groups;
+    }
+
+    /**
+     * Cancel every unfinished task and drop the retained results
+     */
+    cancelAll() {
+        this.queue.concat(this.running).forEach(job => this.cancelJob(job));
+        this.retained.forEach(key => { delete this.jobs_by_key[key]; });
+        this.retained = [];
+    }
+
+    /**
+     * The number of tasks waiting to run
+     */
+    get n_queued() {
+        return this.queue.length;
+    }
+
+    /**
+     * The number of tasks running
+     */
+    get n_running() {
+        return this.running.length;
+    }
+
+    // Used by Grib2Task
+    setPriority(job: Grib2Job, priority: number) {
+        job.priority = priority;
+        this.pump();
+    }
+
+    release(job: Grib2Job) {
+        job.n_holders--;
+        if (job.n_holders <= 0 && (job.state == 'queued' || job.state == 'running')) {
+            this.cancelJob(job);
+            this.pump();
+        }
+    }
+
+    private cancelJob(job: Grib2Job) {
+        if (job.state == 'queued') {
+            this.queue.splice(this.queue.indexOf(job), 1);
+        }
+        else if (job.state == 'running') {
+            this.running.splice(this.running.indexOf(job), 1);
+            job.controller.abort();
+
+            if (job.kind == 'decode') {
+                this.draining.push(job);
+            }
+        }
+        else {
+            return;
+        }
+
+        job.state = 'cancelled';
+        job.reject(cancelled_message);
+        this.forget(job);
+    }
+
+    private forget(job: Grib2Job) {
+        if (job.key !== null && this.jobs_by_key[job.key] === job) {
+            delete this.jobs_by_key[job.key];
+        }
+    }
+
+    private start(job: Grib2Job) {
+        this.queue.splice(this.queue.indexOf(job), 1);
+        this.running.push(job);
+        job.state = 'running';
+        job.controller = new AbortController();
+        const attempt = ++job.attempt;
+
+        let result: Promise<unknown>;
+        try {
+            result = job.run(job.controller.signal);
+        }
+        catch (err) {
+            result = Promise.reject(err);
+        }
+
+        Promise.resolve(result).then(value => this.finish(job, attempt, value, null), err => this.finish(job, attempt, undefined, err === undefined ? 'Task failed' : err));
+    }
+
+    private finish(job: Grib2Job, attempt: number, value: unknown, err: unknown) {
+        const i_draining = this.draining.indexOf(job);
+        if (i_draining >= 0) {
+            // A cancelled decode finally finished, so its slot is free
+            this.draining.splice(i_draining, 1);
+            this.pump();
+            return;
+        }
+
+        // The job was cancelled or preempted while this attempt was running
+        if (job.attempt != attempt || job.state != 'running') return;
+
+        this.running.splice(this.running.indexOf(job), 1);
+        job.state = 'done';
+        job.controller = null;
+
+        if (err === null) {
+            job.resolve(value);
+
+            if (job.key !== null) {
+                this.retained.push(job.key);
+                while (this.retained.length > this.max_retained) {
+                    delete this.jobs_by_key[this.retained.shift()];
+                }
+            }
+        }
+        else {
+            job.reject(err);
+            this.forget(job);
+        }
+
+        this.pump();
+    }
+
+    private preempt(job: Grib2Job) {
+        this.running.splice(this.running.indexOf(job), 1);
+        job.controller.abort();
+        job.controller = null;
+        job.state = 'queued';
+        this.queue.push(job);
+    }
+
+    private pump() {
+        (['fetch', 'decode'] as Grib2TaskKind[]).forEach(kind => {
+            const limit = kind == 'fetch' ? this.max_fetches : this.max_decodes;
+            const speculative_limit = kind == 'fetch' ? this.max_speculative_fetches : limit;
+
+            while (true) {
+                let next: Grib2Job | null = null;
+                for (let i = 0; i < this.queue.length; i++) {
+                    const job = this.queue[i];
+                    if (job.kind == kind && (next === null || job.priority > next.priority || (job.priority == next.priority && job.seq < next.seq))) next = job;
+                }
+
+                if (next === null) break;
+
+                const running = this.running.filter(job => job.kind == kind);
+                const n_occupied = running.length + this.draining.filter(job => job.kind == kind).length;
+
+                if (next.priority < 0) {
+                    if (n_occupied >= limit || running.filter(job => job.priority < 0).length >= speculative_limit) break;
+                }
+                else if (n_occupied >= limit) {
+                    // Make room by stopping the least important speculative fetch (decodes can't be stopped partway through)
+                    let victim: Grib2Job | null = null;
+                    for (let i = 0; i < running.length; i++) {
+                        if (running[i].priority < 0 && (victim === null || running[i].priority < victim.priority)) victim = running[i];
+                    }
+
+                    if (kind != 'fetch' || victim === null) break;
+                    this.preempt(victim);
+                }
+
+                this.start(next);
+            }
+        });
+    }
+}
+
+export {Grib2Scheduler, Grib2Task, cancelled_message};
+export type {Grib2TaskKind, Grib2TaskState, Grib2TaskOptions, Grib2SchedulerOptions, Grib2PrefetchOptions};
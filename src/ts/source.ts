@@ -0,0 +1,316 @@
+/**
+ * Somewhere to read grib data from at arbitrary offsets, so a file doesn't have to be in memory all at once.
+ */
+interface Grib2ByteSource {
+    /** The total size of the data in bytes */
+    readonly size: number;
+
+    /**
+     * Read some of the data
+     * @param position - Where to start reading
+     * @param length - How many bytes to read
+     * @returns The bytes
+     */
+    read(position: number, length: number): Promise<Uint8Array>;
+
+    /** Release whatever the source is holding on to (e.g., a file descriptor) */
+    close?(): Promise<void>;
+}
+
+/**
+ * The parts of a Node `fs.promises` FileHandle that a Grib2FileHandleSource uses
+ */
+interface Grib2FileHandle {
+    read(buffer: Uint8Array, offset: number, length: number, position: number): Promise<{bytesRead: number}>;
+    stat(): Promise<{size: number}>;
+    close(): Promise<void>;
+}
+
+/**
+ * A local file in Node, read with positioned reads. This library doesn't depend on Node, so pass in `fs.promises` (or anything with a compatible
+ *  `open()`), or a FileHandle that's already open.
+ * @example
+ * const fs = require('fs');
+ * const source = await grib.Grib2FileHandleSource.open(fs.promises, '/data/gefs.grib2');
+ * const g2_file = await grib.Grib2File.fromSource(source);
+ */
+class Grib2FileHandleSource implements Grib2ByteSource {
+    readonly size: number;
+    private handle: Grib2FileHandle;
+
+    constructor(handle: Grib2FileHandle, size: number) {
+        this.handle = handle;
+        this.size = size;
+    }
+
+    /**
+     * Open a file
+     * @param fs_promises - Node's `fs.promises`
+     * @param path - The path to the file
+     * @returns A source for the file
+     */
+    static async open(fs_promises: {open(path: string, flags: string): Promise<Grib2FileHandle>}, path: string) {
+        const handle = await fs_promises.open(path, 'r');
+        const {size} = await handle.stat();
+        return new Grib2FileHandleSource(handle, size);
+    }
+
+    async read(position: number, length: number) {
+        if (position < 0 || position + length > this.size) {
+            throw `Read of ${length} bytes at ${position} is past the end of the file (${this.size} bytes)`;
+        }
+
+        const data = new Uint8Array(length);
+        let n_read = 0;
+
+        // Reads can come back short, so keep going until they're all done
+        while (n_read < length) {
+            const {bytesRead} = await this.handle.read(data, n_read, length - n_read, position + n_read);
+            if (bytesRead == 0) {
+                throw `Unexpected end of file at ${position + n_read}`;
+            }
+            n_read += bytesRead;
+        }
+
+        return data;
+    }
+
+    async close() {
+        await this.handle.close();
+    }
+}
+
+/**
+ * A Blob (e.g., a File from a file input) in the browser, read one slice at a time
+ */
+class Grib2BlobSource implements Grib2ByteSource {
+    readonly size: number;
+    private blob: Blob;
+
+    constructor(blob: Blob) {
+        this.blob = blob;
+        this.size = blob.size;
+    }
+
+    async read(position: number, length: number) {
+        if (position < 0 || position + length > this.size) {
+            throw `Read of ${length} bytes at ${position} is past the end of the blob (${this.size} bytes)`;
+        }
+
+        return new Uint8Array(await this.blob.slice(position, position + length).arrayBuffer());
+    }
+}
+
+interface Grib2ByteRange {
+    offset: number;
+    length: number;
+}
+
+/**
+ * A byte range of a remote file and where it is in a local copy made of several ranges laid end to end (the way Grib2Inventory.downloadData() lays
+ *  them out)
+ */
+interface Grib2SourceRange {
+    local_offset: number;
+    remote_offset: number;
+    length: number;
+}
+
+/**
+ * @param ranges - The ranges in the local copy
+ * @param offset - An offset in the local copy
+ * @returns The same offset in the remote file
+ */
+function remoteOffset(ranges: Grib2SourceRange[], offset: number) {
+    for (let i = 0; i < ranges.length; i++) {
+        if (offset >= ranges[i].local_offset && offset < ranges[i].local_offset + ranges[i].length) {
+            return ranges[i].remote_offset + offset - ranges[i].local_offset;
+        }
+    }
+
+    throw `Offset ${offset} isn't in any of the downloaded ranges`;
+}
+
+/**
+ * Identify which version of a remote file a response came from, using its ETag, or its Last-Modified time if it doesn't have one. (Cross-origin, the
+ *  server has to list ETag in Access-Control-Expose-Headers for it to be visible; Last-Modified always is.)
+ * @param resp - A response for the file, to a HEAD or range request
+ * @returns The version, or null if the response doesn't say, in which case there's no telling whether the file has been replaced
+ */
+function responseVersion(resp: Response) {
+    const etag = resp.headers.get('etag');
+    if (etag !== null) return `etag:${etag}`;
+
+    const last_modified = resp.headers.get('last-modified');
+    return last_modified === null ? null : `modified:${last_modified}`;
+}
+
+/**
+ * Find out which version of a remote file is there now, with a HEAD request
+ * @param url - Where the file is
+ * @param signal - Aborts the request
+ * @returns The version (see responseVersion()), or null if the server doesn't say
+ */
+async function fetchSourceVersion(url: string, signal?: AbortSignal) {
+    const resp = await fetch(url, {method: 'HEAD', signal: signal});
+    return resp.ok ? responseVersion(resp) : null;
+}
+
+/**
+ * Byte ranges of a remote file, read with HTTP range requests as they're needed. Positions are in the local layout, with the ranges laid end to end.
+ *  Given the version of the file the ranges came from (see responseVersion()), reads fail if the file has been replaced since.
+ */
+class Grib2RangeSource implements Grib2ByteSource {
+    readonly size: number;
+    private url: string;
+    private ranges: Grib2SourceRange[];
+    private version: string | null;
+
+    constructor(url: string, ranges: Grib2SourceRange[], version?: string) {
+        this.url = url;
+        this.ranges = ranges;
+        this.version = version === undefined ? null : version;
+        this.size = ranges.map(range => range.local_offset + range.length).reduce((a, b) => Math.max(a, b), 0);
+    }
+
+    async read(position: number, length: number) {
+        const range = this.ranges.filter(range => position >= range.local_offset && position + length <= range.local_offset + range.length)[0];
+        if (range === undefined) {
+            throw `Read of ${length} bytes at ${position} isn't within one of the ranges of ${this.url}`;
+        }
+
+        const start = range.remote_offset + position - range.local_offset;
+        const resp = await fetch(this.url, {headers: {range: `bytes=${start}-${start + length - 1}`}});
+        if (!resp.ok) {
+            throw `Reading bytes ${start}-${start + length - 1} of ${this.url} failed: ${resp.status} ${resp.statusText}`;
+        }
+
+        if (this.version !== null && responseVersion(resp) != this.version) {
+            throw `${this.url} has been replaced since its byte ranges were indexed`;
+        }
+
+        const data = new Uint8Array(await resp.arrayBuffer());
+        if (data.length != length) {
+            throw `Expected ${length} bytes from ${this.url}, but got ${data.length}; does the server support range requests?`;
+        }
+
+        return data;
+    }
+}
+
+interface Grib2MessageCacheOptions {
+    /** Keep at most this many bytes of messages in memory (128 MB by default). Messages being decoded are kept even if this is exceeded. */
+    max_bytes?: number;
+    /** When a message is read, also start reading the messages after it, up to this many bytes (16 MB by default; 0 to turn it off) */
+    read_ahead_bytes?: number;
+}
+
+const default_cache_max_bytes = 128 * 1024 * 1024;
+const default_read_ahead_bytes = 16 * 1024 * 1024;
+
+/**
+ * Reads whole messages from a source on demand, keeping the most recently used ones (up to a size limit) and reading ahead to the next messages.
+ */
+class Grib2MessageCache {
+    private source: Grib2ByteSource;
+    private max_bytes: number;
+    private read_ahead_bytes: number;
+
+    // Most recently used last
+    private keys: string[];
+    private messages: Record<string, {range: Grib2ByteRange, data: Promise<Uint8Array>}>;
+    private n_bytes: number;
+
+    constructor(source: Grib2ByteSource, opts?: Grib2MessageCacheOptions) {
+        opts = opts === undefined ? {} : opts;
+        this.source = source;
+        this.max_bytes = opts.max_bytes === undefined ? default_cache_max_bytes : opts.max_bytes;
+        this.read_ahead_bytes = opts.read_ahead_bytes === undefined ? default_read_ahead_bytes : opts.read_ahead_bytes;
+        this.keys = [];
+        this.messages = {};
+        this.n_bytes = 0;
+    }
+
+    private fetch(range: Grib2ByteRange) {
+        const key = `${range.offset}:${range.length}`;
+
+        if (key in this.messages) {
+            // Move it to the most-recently-used end
+            this.keys.splice(this.keys.indexOf(key), 1);
+            this.keys.push(key);
+            return this.messages[key].data;
+        }
+
+        const data = this.source.read(range.offset, range.length);
+        this.messages[key] = {range: range, data: data};
+        this.keys.push(key);
+        this.n_bytes += range.length;
+
+        // Don't keep failures around
+        data.catch(() => { this.remove(key); });
+
+        this.evict();
+        return data;
+    }
+
+    private remove(key: string) {
+        if (!(key in this.messages)) return;
+
+        this.n_bytes -= this.messages[key].range.length;
+        delete this.messages[key];
+        this.keys.splice(this.keys.indexOf(key), 1);
+    }
+
+    private evict() {
+        // Always keep the newest one, since that's the one that was just asked for
+        while (this.n_bytes > this.max_bytes && this.keys.length > 1) {
+            this.remove(this.keys[0]);
+        }
+    }
+
+    /**
+     * Get a message's bytes
+     * @param range - Where the message is
+     * @param next - The messages that come after it, to read ahead
+     * @returns The message's bytes
+     */
+    async get(range: Grib2ByteRange, next?: Grib2ByteRange[]) {
+        const data = this.fetch(range);
+
+        if (next !== undefined) {
+            let n_ahead = 0;
+            for (let i = 0; i < next.length; i++) {
+                n_ahead += next[i].length;
+                if (n_ahead > this.read_ahead_bytes || n_ahead + range.length > this.max_bytes) break;
+
+                // Nobody's waiting on these yet, so ignore failures (they'll be retried when the message is actually needed)
+                this.fetch(next[i]).catch(() => {});
+            }
+
+            // Read-ahead shouldn't push out the message that was asked for
+            this.keys.splice(this.keys.indexOf(`${range.offset}:${range.length}`), 1);
+            this.keys.push(`${range.offset}:${range.length}`);
+        }
+
+        return await data;
+    }
+
+    /**
+     * The number of bytes of messages currently held
+     */
+    get size() {
+        return this.n_bytes;
+    }
+
+    /**
+     * Drop all the cached messages
+     */
+    clear() {
+        this.keys = [];
+        this.messages = {};
+        this.n_bytes = 0;
+    }
+}
+
+export {Grib2FileHandleSource, Grib2BlobSource, Grib2RangeSource, Grib2MessageCache, remoteOffset, responseVersion, fetchSourceVersion};
+export type {Grib2ByteSource, Grib2FileHandle, Grib2ByteRange, Grib2SourceRange, Grib2MessageCacheOptions};
@@ -0,0 +1,233 @@
+import { Grib2Metrics } from "./grib2metrics";
+import { getCompressionModule, runNative } from "./unpack";
+import { Grib2CompressionModule } from "../compiled/grib_compression";
+
+// Not in every version of the DOM typings
+declare const DecompressionStream: {new(format: string): {readable: ReadableStream<Uint8Array>, writable: WritableStream<Uint8Array>}} | undefined;
+
+/**
+ * How a grib file is compressed. 'auto' looks at the first few bytes to tell gzip and zlib from uncompressed grib.
+ */
+type Grib2Compression = 'gzip' | 'deflate' | 'none' | 'auto';
+
+interface Grib2StreamOptions {
+    /** How the data are compressed ('auto' by default) */
+    compression?: Grib2Compression;
+    /** Always use the native zlib instead of the browser's DecompressionStream */
+    native_inflate?: boolean;
+    /** Collect timings into this object */
+    metrics?: Grib2Metrics;
+}
+
+// inflate_stream_feed() return values
+const inflate_stream_end = 1;
+
+// Size of the buffer the native inflater drains into
+const inflate_output_size = 1 << 20;
+
+/**
+ * Guess the compression from the first bytes of the data
+ */
+function detectCompression(data: Uint8Array) : 'gzip' | 'deflate' | 'none' {
+    if (data.length >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+        return 'gzip';
+    }
+
+    // A zlib header has deflate as the method in the low nibble, and the first two bytes are a multiple of 31
+    if (data.length >= 2 && (data[0] & 0x0f) == 8 && ((data[0] << 8) | data[1]) % 31 == 0) {
+        return 'deflate';
+    }
+
+    return 'none';
+}
+
+/**
+ * Incremental gzip/zlib decompression with the native zlib. The inflater state lives on the WASM heap, so call free() when done.
+ */
+class Grib2Inflater {
+    private compression: Grib2CompressionModule;
+    private stream_: number;
+    private output_: number;
+    private sizes_: number;
+    private finished: boolean;
+    private metrics: Grib2Metrics | undefined;
+
+    private constructor(compression: Grib2CompressionModule, stream_: number, metrics?: Grib2Metrics) {
+        this.compression = compression;
+        this.stream_ = stream_;
+        this.output_ = compression._malloc(inflate_output_size);
+        this.sizes_ = compression._malloc(8);
+        this.finished = false;
+        this.metrics = metrics;
+    }
+
+    static async create(metrics?: Grib2Metrics) {
+        const compression = await getCompressionModule(metrics);
+        const stream_ = compression.ccall('inflate_stream_new', 'number', [], []) as number;
+        if (stream_ === 0) {
+            throw `Couldn't initialize the native inflater`;
+        }
+
+        return new Grib2Inflater(compression, stream_, metrics);
+    }
+
+    /**
+     * Inflate a chunk of compressed data
+     * @param chunk - The compressed data
+     * @param on_output - Called with each piece of decompressed data. The piece is a view on the WASM heap, so copy it before the next call. If this
+     *  returns a promise, it's waited on before inflating more.
+     */
+    async push(chunk: Uint8Array, on_output: (data: Uint8Array) => void | Promise<void>) {
+        if (this.stream_ === 0) {
+            throw `This inflater has been freed`;
+        }
+
+        const compression = this.compression;
+        const input_ = compression._malloc(Math.max(chunk.length, 1));
+        compression.HEAPU8.set(chunk, input_);
+
+        let input_offset = 0;
+        let status: number;
+
+        try {
+            while (true) {
+                const input_size = chunk.length - input_offset;
+                status = runNative(compression, 'inflate', 0, () => compression.ccall('inflate_stream_feed', 'number',
+                                   ['number', 'number', 'number', 'number', 'number', 'number', 'number'],
+                                   [this.stream_, input_ + input_offset, input_size, this.output_, inflate_output_size, this.sizes_, this.sizes_ + 4]) as number, this.metrics);
+
+                if (status < 0) {
+                    throw `Inflating compressed data encountered an error: ${status}`;
+                }
+
+                const input_used = compression.getValue(this.sizes_, 'i32');
+                const output_used = compression.getValue(this.sizes_ + 4, 'i32');
+                input_offset += input_used;
+
+                if (output_used > 0) {
+                    await on_output(new Uint8Array(compression.HEAPU8.buffer, this.output_, output_used));
+                }
+
+                // Keep going until all the input is used and zlib has nothing more to give
+                if (input_offset >= chunk.length && output_used < inflate_output_size) break;
+            }
+        }
+        finally {
+            compression._free(input_);
+        }
+
+        this.finished = status == inflate_stream_end;
+    }
+
+    /**
+     * Free the inflater
+     * @param check_complete - Throw if the compressed data stopped partway through
+     */
+    free(check_complete?: boolean) {
+        if (this.stream_ === 0) return;
+
+        this.compression.ccall('inflate_stream_free', null, ['number'], [this.stream_]);
+        this.compression._free(this.output_);
+        this.compression._free(this.sizes_);
+        this.stream_ = 0;
+
+        if (check_complete && !this.finished) {
+            throw `Compressed data ended unexpectedly`;
+        }
+    }
+}
+
+async function readChunks(reader: ReadableStreamDefaultReader<Uint8Array>, on_chunk: (chunk: Uint8Array) => void | Promise<void>) {
+    while (true) {
+        const {done, value} = await reader.read();
+        if (done) break;
+        await on_chunk(value);
+    }
+}
+
+/**
+ * Read a stream of (possibly compressed) grib data, decompressing it as it arrives
+ * @param stream - The data
+ * @param on_data - Called with each chunk of decompressed data, in order, and the number of bytes read from the stream so far. The chunk may be reused
+ *  after this returns (or after the promise it returns resolves), so copy it. Reading waits on the promise, so a slow consumer slows the reading down.
+ * @param opts - The compression, whether to use the native inflater, and metrics
+ */
+async function readGribStream(stream: ReadableStream<Uint8Array>, on_data: (data: Uint8Array, bytes_read: number) => void | Promise<void>, opts?: Grib2StreamOptions) {
+    opts = opts === undefined ? {} : opts;
+    const reader = stream.getReader();
+
+    try {
+        await readGribChunks(reader, on_data, opts);
+    }
+    catch (err) {
+        // Don't leave the source locked (and still downloading) when something fails partway through
+        reader.cancel(err).catch(() => {});
+        throw err;
+    }
+}
+
+async function readGribChunks(reader: ReadableStreamDefaultReader<Uint8Array>, on_data: (data: Uint8Array, bytes_read: number) => void | Promise<void>, opts: Grib2StreamOptions) {
+    // Peek at the first chunk to figure out the compression
+    const first = await reader.read();
+    if (first.done) return;
+
+    let bytes_read = first.value.length;
+    const readSource = (on_chunk: (chunk: Uint8Array) => void | Promise<void>) => readChunks(reader, chunk => {
+        bytes_read += chunk.length;
+        return on_chunk(chunk);
+    });
+
+    const compression = opts.compression === undefined || opts.compression == 'auto' ? detectCompression(first.value) : opts.compression;
+
+    if (compression == 'none') {
+        await on_data(first.value, bytes_read);
+        await readSource(chunk => on_data(chunk, bytes_read));
+        return;
+    }
+
+    if (typeof DecompressionStream !== 'undefined' && !opts.native_inflate) {
+        // Feed the compressed chunks in one end and read the decompressed data out the other at the same time, so the compressed data never piles up
+        const decompressor = new DecompressionStream(compression);
+        const writer = decompressor.writable.getWriter();
+        const output = decompressor.readable.getReader();
+        const reading = readChunks(output, data => on_data(data, bytes_read));
+
+        const writing = (async () => {
+            await writer.write(first.value);
+            await readSource(chunk => writer.write(chunk));
+            await writer.close();
+        })();
+
+        try {
+            // This rejects as soon as either side fails
+            await Promise.all([reading, writing]);
+        }
+        catch (err) {
+            // Each side could be waiting on the other (or on the network), so stop everything: cancel the source, and abort the decompressor from both
+            //  ends (a write blocked on the decompressor's output only gives up once the output is cancelled). Then wait for both sides to finish, so
+            //  nothing is left running (or rejects unhandled) after this returns.
+            reader.cancel(err).catch(() => {});
+            output.cancel(err).catch(() => {});
+            writer.abort(err).catch(() => {});
+            await Promise.all([reading.catch(() => {}), writing.catch(() => {})]);
+            throw err;
+        }
+
+        return;
+    }
+
+    const inflater = await Grib2Inflater.create(opts.metrics);
+    let complete = false;
+
+    try {
+        await inflater.push(first.value, data => on_data(data, bytes_read));
+        await readSource(chunk => inflater.push(chunk, data => on_data(data, bytes_read)));
+        complete = true;
+    }
+    finally {
+        inflater.free(complete);
+    }
+}
+
+export {Grib2Inflater, readGribStream, detectCompression};
+export type {Grib2Compression, Grib2StreamOptions};
@@ -0,0 +1,101 @@
+// Stands in for the emscripten module in the TypeScript tests, since that's built for the browser and needs emscripten to build. npm test copies it to
+//   where the compiled tests look for the module. It only has the functions the tests call, which do the same thing as the C functions (those are
+//   tested on their own in src/compiled/test).
+
+const PACKED16_MISSING = 0xffff;
+
+function fakeModule() {
+    let heap = new ArrayBuffer(1 << 16);
+    let top = 8;
+
+    const module = {
+        HEAPU8: new Uint8Array(heap),
+
+        _malloc(n_bytes) {
+            const ptr = top;
+            top += (n_bytes + 7) & ~7;
+            if (top > heap.byteLength) {
+                const grown = new ArrayBuffer(Math.max(top, heap.byteLength * 2));
+                new Uint8Array(grown).set(module.HEAPU8);
+                heap = grown;
+                module.HEAPU8 = new Uint8Array(heap);
+            }
+            return ptr;
+        },
+
+        _free(ptr) {},
+
+        ccall(name, return_type, arg_types, args) {
+            const func = functions[name];
+            if (func === undefined) {
+                throw `The fake compression module doesn't have ${name}()`;
+            }
+            return func(heap, ...args);
+        },
+    };
+
+    return module;
+}
+
+function scalePacked(ref, val, bin_exp, dec_exp) {
+    return Math.fround((ref + val * bin_exp) * dec_exp);
+}
+
+const functions = {
+    enable_decode_counters(heap, enable) {},
+
+    read_decode_counters(heap, counts_) {
+        new Float64Array(heap, counts_, 4).fill(0);
+    },
+
+    field_to_packed16(heap, input_, n_points, reference_value, binary_scale_factor, decimal_scale_factor, output_) {
+        const input = new Float32Array(heap, input_, n_points);
+        const output = new Uint16Array(heap, output_, n_points);
+        const ref = Math.fround(reference_value), bin_exp = Math.pow(2, binary_scale_factor), dec_exp = Math.pow(10, -decimal_scale_factor);
+        let n_bad = 0;
+
+        for (let i = 0; i < n_points; i++) {
+            if (isNaN(input[i])) {
+                output[i] = PACKED16_MISSING;
+                continue;
+            }
+
+            const guess = Math.round((input[i] / dec_exp - ref) / bin_exp);
+            if (!(guess >= -1 && guess <= PACKED16_MISSING)) {
+                n_bad++;
+                continue;
+            }
+
+            let val = -1;
+            for (let ival = guess - 1; ival <= guess + 1; ival++) {
+                if (ival >= 0 && ival < PACKED16_MISSING && scalePacked(ref, ival, bin_exp, dec_exp) == input[i]) {
+                    val = ival;
+                    break;
+                }
+            }
+
+            if (val < 0) {
+                n_bad++;
+                continue;
+            }
+
+            output[i] = val;
+        }
+
+        return n_bad > 0 ? 1 : 0;
+    },
+
+    field_from_packed16(heap, input_, n_points, reference_value, binary_scale_factor, decimal_scale_factor, output_) {
+        const input = new Uint16Array(heap, input_, n_points);
+        const output = new Float32Array(heap, output_, n_points);
+        const ref = Math.fround(reference_value), bin_exp = Math.pow(2, binary_scale_factor), dec_exp = Math.pow(10, -decimal_scale_factor);
+
+        for (let i = 0; i < n_points; i++) {
+            output[i] = input[i] == PACKED16_MISSING ? NaN : scalePacked(ref, input[i], bin_exp, dec_exp);
+        }
+
+        return 0;
+    },
+};
+
+exports.default = () => Promise.resolve(fakeModule());
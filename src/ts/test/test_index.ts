@@ -0,0 +1,111 @@
+import { test } from "node:test";
+import { strict as assert } from "node:assert";
+
+import { Grib2HeaderTable, packIndex, unpackIndex } from "../grib2index";
+import type { Grib2IndexEntry } from "../grib2index";
+
+// Tests for packIndex() and unpackIndex(): a header table should come back from its binary index with every column and inventory string the same,
+//   and buffers that aren't an index this version can read should be rejected.
+
+function makeEntry(i: number, overrides?: Partial<Grib2IndexEntry>) : Grib2IndexEntry {
+    const entry: Grib2IndexEntry = {
+        offset: i * 1234567,
+        length: 1000 + i,
+        discipline: 0,
+        parameter_category: 2,
+        parameter_number: 2 + i % 2,
+        product_template: 0,
+        surface1_type: 103,
+        surface1_value: 10,
+        surface2_type: 255,
+        surface2_value: NaN,
+        reference_time: Date.UTC(2023, 8, 14, 12),
+        forecast_time: i * 3600,
+        agg_duration: 0,
+        ensemble_type: 255,
+        ensemble_perturbation: 0,
+        grid_template: 30,
+        grid_id: 0xdeadbeef,
+        data_representation_template: 3,
+        inventory: `d=2023091412:${i % 2 == 0 ? 'UGRD' : 'VGRD'}:10 m above ground:${i} hour fcst:`,
+    };
+
+    return {...entry, ...overrides};
+}
+
+function roundTrip(table: Grib2HeaderTable) {
+    return unpackIndex(packIndex(table));
+}
+
+test('index round-trips every column', () => {
+    const entries = [
+        makeEntry(0),
+        makeEntry(1),
+        // Past 4 GB in the file, a layer between two surfaces, and an ensemble member
+        makeEntry(2, {offset: 5 * 1024 * 1024 * 1024 + 17, surface1_type: 100, surface1_value: 85000, surface2_type: 100, surface2_value: 50000}),
+        makeEntry(3, {product_template: 1, ensemble_type: 3, ensemble_perturbation: 21}),
+        // An accumulation, and a message without a forecast time
+        makeEntry(4, {product_template: 8, forecast_time: 6 * 3600, agg_duration: 3 * 3600, inventory: 'd=2023091412:APCP:surface:3-6 hour acc fcst:'}),
+        makeEntry(5, {forecast_time: NaN, surface1_type: 1, surface1_value: NaN, grid_template: 0, grid_id: 1, data_representation_template: 40}),
+    ];
+
+    const table = roundTrip(Grib2HeaderTable.fromEntries(entries));
+
+    assert.equal(table.n_messages, entries.length);
+    assert.deepEqual(table.getEntries(), entries);
+
+    const original = Grib2HeaderTable.fromEntries(entries);
+    entries.forEach((entry, i) => assert.equal(table.getChecksum(i), original.getChecksum(i)));
+});
+
+test('index round-trips empty inventory strings and an empty table', () => {
+    const entries = [makeEntry(0, {inventory: ''}), makeEntry(1), makeEntry(2, {inventory: ''})];
+    assert.deepEqual(roundTrip(Grib2HeaderTable.fromEntries(entries)).getEntries(), entries);
+
+    const empty = roundTrip(new Grib2HeaderTable(0, []));
+    assert.equal(empty.n_messages, 0);
+    assert.deepEqual(empty.getEntries(), []);
+});
+
+test('index subsets round-trip', () => {
+    const table = Grib2HeaderTable.fromEntries([0, 1, 2, 3].map(i => makeEntry(i)));
+    const subset = roundTrip(table.subset([3, 1]));
+
+    assert.deepEqual(subset.getEntries(), [makeEntry(3), makeEntry(1)]);
+});
+
+test('index layout is big-endian with a fixed header', () => {
+    const buffer = packIndex(Grib2HeaderTable.fromEntries([makeEntry(1), makeEntry(2)]));
+    const view = new DataView(buffer);
+    const inventory_length = makeEntry(1).inventory.length + makeEntry(2).inventory.length;
+
+    assert.equal(String.fromCharCode(...new Uint8Array(buffer, 0, 4)), 'G2IX');
+    assert.equal(view.getUint16(4), 1);
+    assert.equal(view.getUint32(8), 2);
+    assert.equal(view.getUint32(12), inventory_length);
+    assert.equal(buffer.byteLength, 16 + 2 * 80 + inventory_length);
+
+    // The second record's offset and the start of its inventory string
+    assert.equal(view.getFloat64(16 + 80), makeEntry(2).offset);
+    assert.equal(view.getUint32(16 + 80 + 60), makeEntry(1).inventory.length);
+});
+
+test('index rejects buffers it can\'t read', () => {
+    const buffer = packIndex(Grib2HeaderTable.fromEntries([makeEntry(0), makeEntry(1)]));
+
+    const bad_magic = buffer.slice(0);
+    new Uint8Array(bad_magic)[0] = 'X'.charCodeAt(0);
+    assert.throws(() => unpackIndex(bad_magic), /Not a grib2 message index/);
+
+    const bad_version = buffer.slice(0);
+    new DataView(bad_version).setUint16(4, 2);
+    assert.throws(() => unpackIndex(bad_version), /Unsupported grib2 message index version 2/);
+
+    assert.throws(() => unpackIndex(buffer.slice(0, buffer.byteLength - 1)), /truncated/);
+    assert.throws(() => unpackIndex(buffer.slice(0, 10)), /Not a grib2 message index/);
+});
+
+test('index rejects inventory strings that are too long', () => {
+    const table = Grib2HeaderTable.fromEntries([makeEntry(0, {inventory: 'x'.repeat(0x10000)})]);
+    assert.throws(() => packIndex(table), /too long/);
+});
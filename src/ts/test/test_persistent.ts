@@ -0,0 +1,216 @@
+import { test } from "node:test";
+import { strict as assert } from "node:assert";
+
+import { Grib2PersistentCache } from "../persistent";
+import type { Grib2CachedField, Grib2PersistentStore, Grib2StoredEntry } from "../persistent";
+import { Grib2HeaderTable } from "../grib2index";
+import type { Grib2FieldStats } from "../unpack";
+
+// Tests for the persistent cache's entry format: decoded messages in every output format should come back from the store the same as they went in
+//   (including quantized fields, which have to come back exactly), and entries that can't be read back (from another version of the format, another
+//   key, or cut short) should be dropped instead of returned.
+
+class MemoryStore implements Grib2PersistentStore {
+    readonly entries: Map<string, {data: Uint8Array, last_used: number}>;
+
+    constructor() {
+        this.entries = new Map();
+    }
+
+    async get(id: string) {
+        const entry = this.entries.get(id);
+        return entry === undefined ? null : entry.data.slice();
+    }
+
+    async put(id: string, data: Uint8Array) {
+        this.entries.set(id, {data: data.slice(), last_used: Date.now()});
+    }
+
+    async delete(id: string) {
+        this.entries.delete(id);
+    }
+
+    async touch(entry: Grib2StoredEntry) {
+        const stored = this.entries.get(entry.id);
+        if (stored !== undefined) stored.last_used = entry.last_used;
+    }
+
+    async list() {
+        return Array.from(this.entries.entries()).map(([id, entry]) => ({id: id, size: entry.data.length, last_used: entry.last_used}));
+    }
+
+    // The id the last entry was written under
+    lastId() {
+        return Array.from(this.entries.keys()).pop();
+    }
+}
+
+const headers = new Uint8Array([0x47, 0x52, 0x49, 0x42, 0, 0, 0, 2, 1, 2, 3]);
+
+const stats: Grib2FieldStats = {min: 85000, max: 93000, mean: 89000.5, std: 1234.25, sum: 267001.5, sum_of_squares: 2.4e10, count: 3, missing_count: 1};
+
+function makeField(data: Float32Array | Uint16Array | Uint32Array, overrides?: Partial<Grib2CachedField>) : Grib2CachedField {
+    const field: Grib2CachedField = {headers: headers, data: data, output_format: data instanceof Float32Array ? 'float32' : 'packed', packing: null,
+                                     stats: null, scaling: null};
+    return {...field, ...overrides};
+}
+
+async function roundTrip(field: Grib2CachedField, quantize?: boolean) {
+    const store = new MemoryStore();
+    const cache = new Grib2PersistentCache(store, {quantize: quantize === undefined ? false : quantize});
+    const key = cache.messageKey('https://example.com/hrrr.grib2', '"etag"', 1000, 500, 12345, field.output_format);
+
+    await cache.putField(key, field);
+
+    // The size of the field, without the entry header and the key (which has the format in it, so it's longer for quantized fields)
+    const size = store.entries.get(store.lastId()).data.length - ((12 + new TextEncoder().encode(key).length + 3) & ~3);
+
+    return {field: await cache.getField(key), size: size};
+}
+
+test('float32 fields round-trip with their stats', async () => {
+    const data = new Float32Array([85000, 90000, NaN, 93000.5, -1e-30, 3.4e38]);
+    const {field} = await roundTrip(makeField(data, {stats: stats}));
+
+    assert.equal(field.output_format, 'float32');
+    assert.ok(field.data instanceof Float32Array);
+    assert.deepEqual(Array.from(field.data), Array.from(data));
+    assert.deepEqual(field.stats, stats);
+    assert.equal(field.packing, null);
+    assert.deepEqual(Array.from(field.headers), Array.from(headers));
+});
+
+test('float16 and packed fields round-trip with their packing', async () => {
+    const half = new Uint16Array([0x3c00, 0x7c00, 0x7e00, 0x0001]);
+    const {field: half_field} = await roundTrip(makeField(half, {output_format: 'float16'}));
+    assert.equal(half_field.output_format, 'float16');
+    assert.ok(half_field.data instanceof Uint16Array);
+    assert.deepEqual(Array.from(half_field.data), Array.from(half));
+
+    const packing = {reference_value: 21215, binary_scale_factor: -1, decimal_scale_factor: 2, missing_value: 0xffff};
+
+    // Headers that aren't a multiple of 4 bytes long, so the data have to be padded to be read without a copy
+    const packed16 = new Uint16Array([0, 1, 4095, 0xffff]);
+    const {field: field16} = await roundTrip(makeField(packed16, {packing: packing, headers: headers.subarray(0, 9)}));
+    assert.equal(field16.output_format, 'packed');
+    assert.ok(field16.data instanceof Uint16Array);
+    assert.deepEqual(Array.from(field16.data), Array.from(packed16));
+    assert.deepEqual(field16.packing, packing);
+    assert.deepEqual(Array.from(field16.headers), Array.from(headers.subarray(0, 9)));
+
+    const packed32 = new Uint32Array([0, 1, 0x1ffffff, 0xffffffff]);
+    const {field: field32} = await roundTrip(makeField(packed32, {packing: {...packing, missing_value: 0xffffffff}, stats: stats}));
+    assert.ok(field32.data instanceof Uint32Array);
+    assert.deepEqual(Array.from(field32.data), Array.from(packed32));
+    assert.deepEqual(field32.packing, {...packing, missing_value: 0xffffffff});
+    assert.deepEqual(field32.stats, stats);
+});
+
+test('quantized fields come back exactly, at half the size', async () => {
+    // Surface pressure in Pa (well above the largest half-precision float), scaled the way the decoders scale it
+    const scaling = {reference_value: 85000, binary_scale_factor: 0, decimal_scale_factor: 1};
+    const data = new Float32Array(1000).map((_, i) => i % 97 == 0 ? NaN : (85000 + i * 17) * Math.pow(10, -1));
+
+    const {field: unquantized, size: float_size} = await roundTrip(makeField(data, {scaling: scaling}), false);
+    const {field, size} = await roundTrip(makeField(data, {scaling: scaling, stats: stats}), true);
+
+    assert.equal(field.output_format, 'float32');
+    assert.deepEqual(Array.from(field.data), Array.from(data));
+    assert.deepEqual(field.scaling, scaling);
+    assert.deepEqual(field.stats, stats);
+    assert.equal(field.packing, null);
+    assert.equal(float_size - size, 2 * data.length);
+
+    assert.equal(unquantized.scaling, null);
+    assert.deepEqual(Array.from(unquantized.data), Array.from(data));
+});
+
+test('fields that can\'t be quantized are stored as floats', async () => {
+    const scaling = {reference_value: 85000, binary_scale_factor: 0, decimal_scale_factor: 0};
+    const fields = {
+        'out of range': new Float32Array([85000, 1e10, 93000]),
+        'more than 16 bits': new Float32Array([85000, 85000 + 70000, 93000]),
+        'between packed values': new Float32Array([85000, 85000.5, 93000]),
+        'below the reference value': new Float32Array([85000, 84000, 93000]),
+        'infinite': new Float32Array([85000, Infinity, 93000]),
+    };
+
+    for (const [name, data] of Object.entries(fields)) {
+        const {field, size} = await roundTrip(makeField(data, {scaling: scaling}), true);
+        const {size: float_size} = await roundTrip(makeField(data, {scaling: scaling}), false);
+
+        assert.deepEqual(Array.from(field.data), Array.from(data), name);
+        assert.equal(field.scaling, null, name);
+        assert.equal(size, float_size, name);
+    }
+
+    // No scaling to quantize with
+    const {field} = await roundTrip(makeField(new Float32Array([1.5, 2.5])), true);
+    assert.deepEqual(Array.from(field.data), [1.5, 2.5]);
+});
+
+test('entries that can\'t be read back are dropped', async () => {
+    const store = new MemoryStore();
+    const cache = new Grib2PersistentCache(store);
+    const field = makeField(new Float32Array([1, 2, 3]), {stats: stats});
+
+    const key = cache.messageKey('https://example.com/hrrr.grib2', '"etag"', 0, 500, 1, 'float32');
+    const other_key = cache.messageKey('https://example.com/hrrr.grib2', '"etag"', 500, 500, 2, 'float32');
+
+    // From another version of the format
+    await cache.putField(key, field);
+    const id = store.lastId();
+    const good = store.entries.get(id).data;
+    const old_version = good.slice();
+    new DataView(old_version.buffer).setUint32(4, 1, true);
+    await store.put(id, old_version);
+    assert.equal(await cache.getField(key), null);
+    assert.ok(!store.entries.has(id));
+
+    // Not an entry at all
+    await cache.putField(key, field);
+    const bad_magic = good.slice();
+    bad_magic[0] = 0;
+    await store.put(id, bad_magic);
+    assert.equal(await cache.getField(key), null);
+    assert.ok(!store.entries.has(id));
+
+    // Written for another key
+    await cache.putField(other_key, field);
+    const other_id = store.lastId();
+    await store.put(other_id, good);
+    assert.equal(await cache.getField(other_key), null);
+    assert.ok(!store.entries.has(other_id));
+
+    // Cut short, in the header and in the data
+    for (const length of [good.length - 1, 20, 3]) {
+        await cache.putField(key, field);
+        await store.put(id, good.slice(0, length));
+        assert.equal(await cache.getField(key), null, `${length} bytes`);
+        assert.ok(!store.entries.has(id), `${length} bytes`);
+    }
+
+    // And an intact one is still there
+    await cache.putField(key, field);
+    assert.deepEqual(Array.from((await cache.getField(key)).data), [1, 2, 3]);
+    assert.equal(cache.size, good.length);
+});
+
+test('indexes round-trip with their byte ranges', async () => {
+    const cache = new Grib2PersistentCache(new MemoryStore());
+    const table = new Grib2HeaderTable(2, ['d=2023091412:UGRD:10 m above ground:1 hour fcst:', 'd=2023091412:VGRD:10 m above ground:1 hour fcst:']);
+    table.columns.offset[1] = 500;
+    table.columns.length[0] = 500;
+    table.columns.length[1] = 600;
+    table.columns.forecast_time[0] = table.columns.forecast_time[1] = 3600;
+
+    const ranges = [{local_offset: 0, remote_offset: 5 * 1024 * 1024 * 1024, length: 500}, {local_offset: 500, remote_offset: 1e6, length: 600}];
+    const key = cache.indexKey('https://example.com/hrrr.grib2', '"etag"', 'UGRD:10 m above ground|VGRD:10 m above ground');
+
+    await cache.putIndex(key, ranges, table);
+    const index = await cache.getIndex(key);
+
+    assert.deepEqual(index.ranges, ranges);
+    assert.deepEqual(index.table.getEntries(), table.getEntries());
+    assert.equal(await cache.getIndex(cache.indexKey('https://example.com/hrrr.grib2', '"etag2"', 'UGRD:10 m above ground')), null);
+});
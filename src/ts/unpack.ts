@@ -1,125 +1,373 @@
 
 import compression_module from "../compiled/grib_compression";
 import {Grib2CompressionModule} from "../compiled/grib_compression";
+import { Grib2Metrics, Grib2Stage, native_counter_names, startStage } from "./grib2metrics";
+import { heapPointer } from "./heap";
 let compression: Grib2CompressionModule | null = null;
 
-const return_types = {
-    8: Uint8Array,
-    16: Uint16Array,
-    32: Uint32Array
+type Grib2OutputArray = Float32Array | Uint16Array | Uint32Array;
+type Grib2OutputFormat = 'float32' | 'float16' | 'packed';
+
+interface Grib2DecodeOptions {
+    /** 'float32' (the default), 'float16' (IEEE half-precision floats stored in a Uint16Array), or 'packed' (the raw packed integers) */
+    output_format?: Grib2OutputFormat;
+    /** An array to decode into instead of allocating a new one (this can be a view on a SharedArrayBuffer, or on the WASM heap, which gets decoded into
+     *  without a copy) */
+    destination?: Grib2OutputArray;
+    /** Collect timings and counters for the decode into this object (the decoded message also gets its own metrics) */
+    metrics?: Grib2Metrics;
+    /** Compute the min, max, mean, etc. of the field while decoding it */
+    stats?: boolean;
 }
 
-async function pngDecoder(compressed: Uint8Array, bit_depth: 8, expected_size: number) : Promise<Uint8Array>;
-async function pngDecoder(compressed: Uint8Array, bit_depth: 16, expected_size: number) : Promise<Uint16Array>;
-async function pngDecoder(compressed: Uint8Array, bit_depth: 32, expected_size: number) : Promise<Uint32Array>;
-async function pngDecoder(compressed: Uint8Array, bit_depth: 8 | 16 | 32, expected_size: number) : Promise<Uint8Array | Uint16Array | Uint32Array> {
+/**
+ * Packed integers from a decoder, along with the parameters to turn them into physical values. The integers stay on the WASM heap (as 32-bit ints), so
+ *  unpackScaling() can use them where they are; whatever uses them last (usually unpackScaling()) frees them.
+ */
+interface Grib2PackedData {
+    packed_: number;
+    n_packed: number;
+    reference_value: number;
+    binary_scale_factor: number;
+    decimal_scale_factor: number;
+}
+
+/**
+ * The scaling from section 5. The physical values are (reference_value + packed * 2^binary_scale_factor) * 10^-decimal_scale_factor.
+ */
+interface Grib2ScalingParameters {
+    reference_value: number;
+    binary_scale_factor: number;
+    decimal_scale_factor: number;
+}
+
+/**
+ * Scaling parameters for 'packed' output, where missing values are set to missing_value
+ */
+interface Grib2PackingParameters extends Grib2ScalingParameters {
+    missing_value: number;
+}
+
+/**
+ * Statistics for a decoded field, in physical units. These are computed from the unrounded values, even for 'float16' and 'packed' output.
+ */
+interface Grib2FieldStats {
+    /** Minimum value (NaN if every point is missing) */
+    min: number;
+    /** Maximum value (NaN if every point is missing) */
+    max: number;
+    /** Mean of the non-missing values */
+    mean: number;
+    /** Standard deviation of the non-missing values */
+    std: number;
+    sum: number;
+    sum_of_squares: number;
+    /** Number of non-missing points */
+    count: number;
+    /** Number of missing points */
+    missing_count: number;
+}
+
+const n_field_stats = 5;
+
+function fieldStats(raw_stats: ArrayLike<number>, expected_size: number) : Grib2FieldStats {
+    // raw_stats is min, max, sum, sum of squares, and the number of missing points, from unpack_scaling()
+    const [min, max, sum, sum_of_squares, missing_count] = Array.prototype.slice.call(raw_stats) as number[];
+    const count = expected_size - missing_count;
+    const mean = count > 0 ? sum / count : NaN;
+    const variance = count > 0 ? Math.max(sum_of_squares / count - mean * mean, 0) : NaN;
+
+    return {min: min, max: max, mean: mean, std: Math.sqrt(variance), sum: sum, sum_of_squares: sum_of_squares, count: count, missing_count: missing_count};
+}
+
+const output_format_codes = {
+    float32: 0,
+    float16: 1,
+    packed16: 2,
+    packed32: 3,
+}
+
+// unpk_complex() marks missing values with INT_MAX
+const packed_missing_value = 2147483647;
+
+async function getCompressionModule(metrics?: Grib2Metrics) {
     if (compression === null) {
+        const stop = startStage(metrics, 'module_init');
         compression = await compression_module();
+        stop();
     }
 
-    if (!(bit_depth in return_types)) {
-        throw `bit_depth ${bit_depth} is not supported`;
+    return compression;
+}
+
+/**
+ * Copy data into a newly-allocated buffer on the WASM heap. Data that are already on the heap (from a file on a Grib2HeapBuffer) are used where they
+ *  are instead. The caller is responsible for calling freeHeapCopy() on it.
+ */
+function copyToHeap(module: Grib2CompressionModule, data: Uint8Array, metrics?: Grib2Metrics) {
+    const heap_ptr = heapPointer(data);
+    if (heap_ptr !== null) {
+        return heap_ptr;
     }
 
-    const png_decoder = compression.cwrap('decode_png', 'number', ['number', 'number', 'number', 'number', 'number', 'number']);
+    const stop = startStage(metrics, 'input_copy');
+    const data_ = module._malloc(data.length);
+    module.HEAPU8.set(data, data_);
+    stop({bytes: data.length});
+    return data_;
+}
 
-    const width_ = compression._malloc(4);
-    const height_ = compression._malloc(4);
-    const bit_depth_ = compression._malloc(4);
-    const compressed_ = compression._malloc(compressed.length);
-    const decompressed_ = compression._malloc(expected_size * bit_depth / 8);
+/**
+ * Free a buffer from copyToHeap(), if it was a copy
+ */
+function freeHeapCopy(module: Grib2CompressionModule, data: Uint8Array, data_: number) {
+    if (heapPointer(data) === null) {
+        module._free(data_);
+    }
+}
 
-    compression.setValue(bit_depth_, bit_depth, 'i32');
-    compressed.forEach((v, i) => compression.setValue(compressed_ + i, v, 'i8'));
+/**
+ * Run a native function, timing it and collecting the native decoder counters if metrics are being collected
+ */
+function runNative(module: Grib2CompressionModule, stage: Grib2Stage, points: number, native_func: () => number, metrics?: Grib2Metrics) {
+    if (metrics === undefined) {
+        return native_func();
+    }
+
+    module.ccall('enable_decode_counters', null, ['number'], [1]);
+    const stop = metrics.start(stage);
+    const status = native_func();
+    stop({points: points});
+
+    const counts_ = module._malloc(native_counter_names.length * 8);
+    module.ccall('read_decode_counters', null, ['number'], [counts_]);
+    metrics.addNativeCounters(new Float64Array(module.HEAPU8.buffer, counts_, native_counter_names.length));
+    module._free(counts_);
+    module.ccall('enable_decode_counters', null, ['number'], [0]);
+
+    return status;
+}
+
+/**
+ * Native decoder state that's kept from one message to the next: the PNG codec session (which holds onto row pointers and scratch space), the output
+ *  buffer, and the output arguments. Files with lots of small messages (e.g., MRMS) otherwise spend a good part of their decode time setting
+ *  these up and tearing them down. Decodes on this thread run one at a time, so one session is shared by all of them. The output buffer is only used
+ *  between awaits (the PNG decoder decodes into it and widens out of it, and unpackScaling() scales into it and copies out of it), so they can't
+ *  overlap.
+ */
+interface Grib2DecoderSession {
+    png_: number;
+    output_: number;
+    output_size: number;
+    // width, height, and bit depth for decode_png
+    args_: number;
+}
+
+let decoder_session: Grib2DecoderSession | null = null;
+
+/**
+ * Get the decoder session, making it if needed, with an output buffer of at least `output_size` bytes
+ */
+function getDecoderSession(module: Grib2CompressionModule, output_size: number) {
+    if (decoder_session === null) {
+        const png_ = module.ccall('png_session_new', 'number', [], []) as number;
+        const args_ = module._malloc(3 * 4);
+        if (png_ == 0 || args_ == 0) {
+            module.ccall('png_session_free', null, ['number'], [png_]);
+            module._free(args_);
+            throw `Couldn't allocate the decoder session`;
+        }
+
+        decoder_session = {png_: png_, output_: 0, output_size: 0, args_: args_};
+    }
+
+    if (output_size > decoder_session.output_size) {
+        module._free(decoder_session.output_);
+        decoder_session.output_ = module._malloc(output_size);
+        decoder_session.output_size = decoder_session.output_ == 0 ? 0 : output_size;
+        if (decoder_session.output_ == 0) {
+            throw `Couldn't allocate ${output_size} bytes for the decoder output`;
+        }
+    }
 
-    const png_status = png_decoder(compressed_, width_, height_, decompressed_, bit_depth_, expected_size);
+    return decoder_session;
+}
 
-    let decompressed;
+/**
+ * Free the native state kept between decodes (most of which is the output buffer, which is as big as the biggest message decoded so far). It's made
+ *  again for the next decode.
+ */
+function freeDecoderSession() {
+    if (decoder_session === null || compression === null) return;
+
+    compression.ccall('png_session_free', null, ['number'], [decoder_session.png_]);
+    compression._free(decoder_session.output_);
+    compression._free(decoder_session.args_);
+    decoder_session = null;
+}
+
+/**
+ * Copy indices into a newly-allocated buffer on the WASM heap. The caller is responsible for freeing it.
+ */
+function copyIndicesToHeap(module: Grib2CompressionModule, indices: Int32Array, metrics?: Grib2Metrics) {
+    const stop = startStage(metrics, 'input_copy');
+    const indices_ = module._malloc(indices.byteLength);
+    new Int32Array(module.HEAPU8.buffer, indices_, indices.length).set(indices);
+    stop({bytes: indices.byteLength});
+    return indices_;
+}
+
+async function pngDecoder(compressed: Uint8Array, bit_depth: number, expected_size: number, metrics?: Grib2Metrics) {
+    // Get the length first, since a view on the heap reads as empty if the heap grows
+    const compressed_length = compressed.length;
+    const compression = await getCompressionModule(metrics);
+
+    if (bit_depth != 8 && bit_depth != 16 && bit_depth != 32) {
+        throw `bit_depth ${bit_depth} is not supported`;
+    }
+
+    // 32-bit images are decoded straight into the packed output. Narrower ones are decoded into the session's output buffer and then widened.
+    const decompressed_size = expected_size * bit_depth / 8;
+    const session = getDecoderSession(compression, bit_depth == 32 ? 0 : decompressed_size);
+    const packed_ = compression._malloc(expected_size * 4);
+    const decompressed_ = bit_depth == 32 ? packed_ : session.output_;
+    const width_ = session.args_, height_ = session.args_ + 4, bit_depth_ = session.args_ + 8;
+    const compressed_ = copyToHeap(compression, compressed, metrics);
+
+    compression.setValue(bit_depth_, bit_depth, 'i32');
+
+    const png_status = runNative(compression, 'decompress', expected_size, 
+                                 () => compression.ccall('png_session_decode', 'number', 
+                                                         ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number'],
+                                                         [session.png_, compressed_, compressed_length, width_, height_, decompressed_, decompressed_size, 
+                                                          bit_depth_, expected_size]) as number, metrics);
 
     if (png_status == 0) {
-        decompressed = new return_types[bit_depth](expected_size);
-
-        for (let i = 0; i < expected_size; i++) {
-            let raw_grid_val = compression.getValue(decompressed_ + i * bit_depth / 8, `i${bit_depth}`);
-
-            // Swap byte order. Maybe have the C code do this.
-            if (bit_depth == 16)
-                raw_grid_val = ((raw_grid_val & 0xff) << 8) | ((raw_grid_val >> 8) & 0xff); 
-            else if (bit_depth == 32)
-                raw_grid_val = ((raw_grid_val & 0xff) << 24) | ((raw_grid_val & 0xff00) << 8) | ((raw_grid_val >> 8) & 0xff00) | ((raw_grid_val >> 24) & 0xff);
-            
-            decompressed[i] = raw_grid_val;
+        // Get the heap after allocating, as allocating can grow (and replace) it
+        const buffer = compression.HEAPU8.buffer;
+        const packed = new Uint32Array(buffer, packed_, expected_size);
+
+        // Widen and swap byte order. Maybe have the C code do this.
+        if (bit_depth == 8) {
+            packed.set(new Uint8Array(buffer, decompressed_, expected_size));
+        }
+        else if (bit_depth == 16) {
+            const decompressed = new Uint16Array(buffer, decompressed_, expected_size);
+            for (let i = 0; i < expected_size; i++) {
+                const raw_grid_val = decompressed[i];
+                packed[i] = ((raw_grid_val & 0xff) << 8) | ((raw_grid_val >> 8) & 0xff);
+            }
+        }
+        else {
+            for (let i = 0; i < expected_size; i++) {
+                const raw_grid_val = packed[i];
+                packed[i] = ((raw_grid_val & 0xff) << 24) | ((raw_grid_val & 0xff00) << 8) | ((raw_grid_val >> 8) & 0xff00) | ((raw_grid_val >>> 24) & 0xff);
+            }
         }
     }
 
-    compression._free(compressed_);
-    compression._free(decompressed_);
-    compression._free(width_);
-    compression._free(height_);
-    compression._free(bit_depth_);
+    freeHeapCopy(compression, compressed, compressed_);
 
     if (png_status != 0) {
+        compression._free(packed_);
         throw `png decoder encountered an error: ${png_status}`;
     }
 
-    return decompressed;
+    return packed_;
 }
 
-async function jpegDecoder(compressed: Uint8Array, expected_size: number) : Promise<Uint32Array> {
-    if (compression === null) {
-        compression = await compression_module();
-    }
+async function jpegDecoder(compressed: Uint8Array, expected_size: number, metrics?: Grib2Metrics) {
+    // Get the length first, since a view on the heap reads as empty if the heap grows
+    const compressed_length = compressed.length;
+    const compression = await getCompressionModule(metrics);
 
     const bit_depth = 32;
 
-    const jpeg_decoder = compression.cwrap('decode_jpeg2000', 'number', ['number', 'number', 'number']);
-
-    const compressed_ = compression._malloc(compressed.length);
+    // OpenJPEG can't reuse a codec from one message to the next, so nothing is kept for it between messages
     const decompressed_ = compression._malloc(expected_size * bit_depth / 8);
+    const compressed_ = copyToHeap(compression, compressed, metrics);
 
-    compressed.forEach((v, i) => compression.setValue(compressed_ + i, v, 'i8'));
+    const jpeg_status = runNative(compression, 'decompress', expected_size, 
+                                  () => compression.ccall('decode_jpeg2000_sized', 'number', ['number', 'number', 'number', 'number'], 
+                                                          [compressed_, compressed_length, decompressed_, expected_size]) as number, metrics);
 
-    const jpeg_status = jpeg_decoder(compressed_, compressed.length, decompressed_);
+    freeHeapCopy(compression, compressed, compressed_);
 
-    let decompressed;
+    if (jpeg_status != 0) {
+        compression._free(decompressed_);
+        throw `jpeg decoder encountered an error: ${jpeg_status}`;
+    }
 
-    if (jpeg_status == 0) {
-        decompressed = new return_types[bit_depth](expected_size);
+    return decompressed_;
+}
 
-        for (let i = 0; i < expected_size; i++) {
-            decompressed[i] = compression.getValue(decompressed_ + i * bit_depth / 8, `i${bit_depth}`);
-        }
+async function simplePackingDecoder(compressed: Uint8Array, expected_size: number, nbits: number, packed_size: number, metrics?: Grib2Metrics) {
+    const compression = await getCompressionModule(metrics);
+
+    const simple_decoder = compression.cwrap('unpk_simple', 'number', ['number', 'number', 'number', 'number', 'number']);
+    const bit_depth = 32;
+
+    const decompressed_ = compression._malloc(expected_size * bit_depth / 8);
+    const compressed_ = copyToHeap(compression, compressed, metrics);
+
+    const decode_status = runNative(compression, 'decompress', expected_size, () => simple_decoder(expected_size, nbits, packed_size, compressed_, decompressed_), metrics);
+
+    freeHeapCopy(compression, compressed, compressed_);
+
+    if (decode_status != 0) {
+        compression._free(decompressed_);
+        throw `Simple packing decoder encountered an error: ${decode_status}`;
     }
 
-    compression._free(compressed_);
-    compression._free(decompressed_);
+    return decompressed_;
+}
 
-    if (jpeg_status != 0) {
-        throw `jpeg decoder encountered an error: ${jpeg_status}`;
+/**
+ * Unpack only some of the values from simple-packed data.
+ * @param packed_indices - Indices into the packed data (i.e., after removing points the bitmap marks as missing), with -1 for a missing value
+ * @returns A pointer to the packed values at the indices on the WASM heap, with missing values set to INT_MAX. The caller is responsible for freeing it.
+ */
+async function simplePackingExtractor(compressed: Uint8Array, expected_size: number, nbits: number, packed_size: number, packed_indices: Int32Array,
+    metrics?: Grib2Metrics) {
+
+    const compression = await getCompressionModule(metrics);
+
+    const simple_extractor = compression.cwrap('extract_simple', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number']);
+
+    const n_indices = packed_indices.length;
+    const extracted_ = compression._malloc(n_indices * 4);
+    const compressed_ = copyToHeap(compression, compressed, metrics);
+    const indices_ = copyIndicesToHeap(compression, packed_indices, metrics);
+
+    const extract_status = runNative(compression, 'decompress', n_indices,
+                                     () => simple_extractor(expected_size, nbits, packed_size, compressed_, indices_, n_indices, extracted_), metrics);
+
+    freeHeapCopy(compression, compressed, compressed_);
+    compression._free(indices_);
+
+    if (extract_status != 0) {
+        compression._free(extracted_);
+        throw `Simple packing extractor encountered an error: ${extract_status}`;
     }
 
-    return decompressed;
+    return extracted_;
 }
 
 async function complexPackingDecoder(compressed: Uint8Array, expected_size: number, nbits: number, n_groups: number,
     group_split_method: number, missing_val_method: number, ref_group_width: number, nbit_group_width: number,
     ref_group_length: number, group_length_factor: number, len_last: number,
-    nbits_group_len: number, packed_size: number) {
+    nbits_group_len: number, packed_size: number, metrics?: Grib2Metrics) {
 
-    if (compression === null) {
-        compression = await compression_module();
-    }
+    const compression = await getCompressionModule(metrics);
 
     const csd_decoder = compression.cwrap('unpk_complex', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 
         'number', 'number', 'number', 'number', 'number', 'number', 'number']);
     const bit_depth = 32;
 
-    const compressed_ = compression._malloc(compressed.length);
     const decompressed_ = compression._malloc(expected_size * bit_depth / 8);
+    const compressed_ = copyToHeap(compression, compressed, metrics);
 
-    compressed.forEach((v, i) => compression.setValue(compressed_ + i, v, 'i8'));
-
-    const decode_status = csd_decoder(
+    const decode_status = runNative(compression, 'decompress', expected_size, () => csd_decoder(
         expected_size,
         nbits,
         n_groups,
@@ -131,47 +379,78 @@ async function complexPackingDecoder(compressed: Uint8Array, expected_size: numb
         group_length_factor,
         len_last,
         nbits_group_len,
-        packed_size, compressed_, decompressed_);
+        packed_size, compressed_, decompressed_), metrics);
 
-    let decompressed;
+    freeHeapCopy(compression, compressed, compressed_);
 
-    if (decode_status == 0) {
-        decompressed = new Uint32Array(expected_size);
-
-        for (let i = 0; i < expected_size; i++) {
-            decompressed[i] = compression.getValue(decompressed_ + i * bit_depth / 8, `i${bit_depth}`);
-        }
+    if (decode_status != 0) {
+        compression._free(decompressed_);
+        throw `Complex packing decoder encountered an error: ${decode_status}`;
     }
 
-    compression._free(compressed_);
-    compression._free(decompressed_);
+    return decompressed_;
+}
+
+/**
+ * Unpack only some of the values from complex-packed data. The group descriptors are all read, but only the groups with requested points are unpacked.
+ * @param packed_indices - Indices into the packed data (i.e., after removing points the bitmap marks as missing), with -1 for a missing value
+ * @returns A pointer to the packed values at the indices on the WASM heap, with missing values set to INT_MAX. The caller is responsible for freeing it.
+ */
+async function complexPackingExtractor(compressed: Uint8Array, expected_size: number, nbits: number, n_groups: number,
+    group_split_method: number, missing_val_method: number, ref_group_width: number, nbit_group_width: number,
+    ref_group_length: number, group_length_factor: number, len_last: number,
+    nbits_group_len: number, packed_size: number, packed_indices: Int32Array, metrics?: Grib2Metrics) {
+
+    const compression = await getCompressionModule(metrics);
 
-    if (decode_status != 0) {
-        throw `Complex packing decoder encountered an error: ${decode_status}`;
+    const complex_extractor = compression.cwrap('extract_complex', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number',
+        'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']);
+
+    const n_indices = packed_indices.length;
+    const extracted_ = compression._malloc(n_indices * 4);
+    const compressed_ = copyToHeap(compression, compressed, metrics);
+    const indices_ = copyIndicesToHeap(compression, packed_indices, metrics);
+
+    const extract_status = runNative(compression, 'decompress', n_indices, () => complex_extractor(
+        expected_size,
+        nbits,
+        n_groups,
+        group_split_method,
+        missing_val_method,
+        ref_group_width,
+        nbit_group_width,
+        ref_group_length,
+        group_length_factor,
+        len_last,
+        nbits_group_len,
+        packed_size, compressed_, indices_, n_indices, extracted_), metrics);
+
+    freeHeapCopy(compression, compressed, compressed_);
+    compression._free(indices_);
+
+    if (extract_status != 0) {
+        compression._free(extracted_);
+        throw `Complex packing extractor encountered an error: ${extract_status}`;
     }
 
-    return decompressed;
+    return extracted_;
 }
 
 async function complexSDPackingDecoder(compressed: Uint8Array, expected_size: number, nbits: number, n_groups: number,
     group_split_method: number, missing_val_method: number, ref_group_width: number, nbit_group_width: number,
     ref_group_length: number, group_length_factor: number, len_last: number,
-    nbits_group_len: number, packed_size: number, sd_order: number, extra_octets: number) {
+    nbits_group_len: number, packed_size: number, sd_order: number, extra_octets: number, metrics?: Grib2Metrics) {
 
-    if (compression === null) {
-        compression = await compression_module();
-    }
+    const compression = await getCompressionModule(metrics);
 
     const csd_decoder = compression.cwrap('unpk_sd_complex', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 
         'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']);
     const bit_depth = 32;
 
-    const compressed_ = compression._malloc(compressed.length);
     const decompressed_ = compression._malloc(expected_size * bit_depth / 8);
+    const compressed_ = copyToHeap(compression, compressed, metrics);
 
-    compressed.forEach((v, i) => compression.setValue(compressed_ + i, v, 'i8'));
-
-    const decode_status = csd_decoder(
+    const decode_status = runNative(compression, 'decompress', expected_size, () => csd_decoder(
         expected_size,
         nbits,
         n_groups,
@@ -183,56 +462,292 @@ async function complexSDPackingDecoder(compressed: Uint8Array, expected_size: nu
         group_length_factor,
         len_last,
         nbits_group_len,
-        packed_size, sd_order, extra_octets, compressed_, decompressed_);
+        packed_size, sd_order, extra_octets, compressed_, decompressed_), metrics);
 
-    let decompressed;
+    freeHeapCopy(compression, compressed, compressed_);
 
-    if (decode_status == 0) {
-        decompressed = new Uint32Array(expected_size);
+    if (decode_status != 0) {
+        compression._free(decompressed_);
+        throw `Complex/spatial differencing packing decoder encountered an error: ${decode_status}`;
+    }
 
-        for (let i = 0; i < expected_size; i++) {
-            decompressed[i] = compression.getValue(decompressed_ + i * bit_depth / 8, `i${bit_depth}`);
-        }
+    return decompressed_;
+}
+
+/**
+ * Find where grid points are in the packed data, given the bitmap from section 6
+ * @param bitmap - The bitmap
+ * @param grid_size - The number of points in the full grid
+ * @param grid_indices - Indices of points in the full grid (in the order they're stored in the message)
+ * @returns Indices into the packed data, with -1 for points the bitmap marks as missing
+ */
+async function bitmapPackedIndices(bitmap: Uint8Array, grid_size: number, grid_indices: Int32Array, metrics?: Grib2Metrics) {
+    const compression = await getCompressionModule(metrics);
+
+    const packed_indices = compression.cwrap('bitmap_packed_indices', 'number', ['number', 'number', 'number', 'number', 'number']);
+
+    const n_indices = grid_indices.length;
+    const output_ = compression._malloc(n_indices * 4);
+    const bitmap_ = copyToHeap(compression, bitmap, metrics);
+    const indices_ = copyIndicesToHeap(compression, grid_indices, metrics);
+
+    const status = packed_indices(bitmap_, grid_size, indices_, n_indices, output_);
+
+    let output: Int32Array;
+
+    if (status == 0) {
+        output = new Int32Array(compression.HEAPU8.buffer, output_, n_indices).slice();
     }
 
-    compression._free(compressed_);
-    compression._free(decompressed_);
+    freeHeapCopy(compression, bitmap, bitmap_);
+    compression._free(indices_);
+    compression._free(output_);
 
-    if (decode_status != 0) {
-        throw `Complex/spatial differencing packing decoder encountered an error: ${decode_status}`;
+    if (status != 0) {
+        throw `Applying the bitmap to point indices encountered an error: ${status}`;
     }
 
-    return decompressed;
+    return output;
 }
 
-async function applyBitmap(bitmap: Uint8Array, data: Float32Array, expected_size: number) {
-    if (compression === null) {
-        compression = await compression_module();
+type SpatialDifferenceOrder = 0 | 1 | 2 | 'auto';
+
+interface ComplexPackingEncoderOptions {
+    binary_scale_factor?: number;
+    spatial_difference_order?: SpatialDifferenceOrder;
+}
+
+/**
+ * Pack a field using complex packing (data representation template 5.2) or complex packing with spatial differencing (template 5.3). NaNs in the
+ *  input are packed as missing values.
+ * @param data - The field to pack
+ * @param decimal_scale_factor - The data are rounded to this many decimal places before packing
+ * @param opts - Options for packing. `spatial_difference_order` can be 0 (template 5.2), 1 or 2 (template 5.3), or 'auto' (the default) to pick whichever
+ *  packs smallest.
+ * @returns The complete data representation (section 5) and data (section 7) sections
+ */
+async function complexPackingEncoder(data: Float32Array, decimal_scale_factor: number, opts?: ComplexPackingEncoderOptions) {
+    opts = opts === undefined ? {} : opts;
+    const binary_scale_factor = opts.binary_scale_factor === undefined ? 0 : opts.binary_scale_factor;
+    const sd_order = opts.spatial_difference_order === undefined || opts.spatial_difference_order == 'auto' ? -1 : opts.spatial_difference_order;
+
+    const compression = await getCompressionModule();
+
+    const csd_encoder = compression.cwrap('pk_complex', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']);
+
+    const max_sec5_size = 49;
+
+    const data_ = compression._malloc(data.byteLength);
+    const sec5_ = compression._malloc(max_sec5_size);
+    const sec5_size_ = compression._malloc(4);
+    const sec7_ptr_ = compression._malloc(4);
+    const sec7_size_ = compression._malloc(4);
+
+    new Float32Array(compression.HEAPU8.buffer, data_, data.length).set(data);
+
+    const encode_status = csd_encoder(data_, data.length, decimal_scale_factor, binary_scale_factor, sd_order, sec5_, sec5_size_, sec7_ptr_, sec7_size_);
+
+    let sec5: Uint8Array;
+    let sec7: Uint8Array;
+
+    if (encode_status == 0) {
+        const sec5_size = compression.getValue(sec5_size_, 'i32');
+        const sec7_ = compression.getValue(sec7_ptr_, '*');
+        const sec7_size = compression.getValue(sec7_size_, 'i32');
+
+        sec5 = compression.HEAPU8.slice(sec5_, sec5_ + sec5_size);
+        sec7 = compression.HEAPU8.slice(sec7_, sec7_ + sec7_size);
+
+        compression._free(sec7_);
     }
 
-    const bitmap_decoder = compression.cwrap('apply_bitmap', 'number', ['number', 'number', 'number', 'number']);
+    compression._free(data_);
+    compression._free(sec5_);
+    compression._free(sec5_size_);
+    compression._free(sec7_ptr_);
+    compression._free(sec7_size_);
+
+    if (encode_status != 0) {
+        throw `Complex packing encoder encountered an error: ${encode_status}`;
+    }
 
-    const bitmap_ = compression._malloc(bitmap.byteLength);
-    bitmap.forEach((v, i) => compression.setValue(bitmap_ + i, v, 'i8'));
+    return {sec5: sec5, sec7: sec7};
+}
 
-    const data_input_ = compression._malloc(data.byteLength);
-    data.forEach((v, i) => compression.setValue(data_input_ + i * 4, v, 'float'));
+function getDestination<T extends Grib2OutputArray>(destination: Grib2OutputArray | undefined, array_type: new(length: number) => T, type_name: string, expected_size: number) {
+    if (destination === undefined) {
+        return new array_type(expected_size);
+    }
 
-    const data_output_ = compression._malloc(expected_size * 4);
+    if (!(destination instanceof array_type)) {
+        throw `Destination array should be a ${type_name}`;
+    }
 
-    bitmap_decoder(bitmap_, data_input_, data_output_, expected_size);
+    if (destination.length < expected_size) {
+        throw `Destination array has ${destination.length} elements, but the grid has ${expected_size} points`;
+    }
 
-    const data_output = new Float32Array(expected_size);
+    return destination.length == expected_size ? destination : destination.subarray(0, expected_size) as T;
+}
 
-    for (let i = 0; i < expected_size; i++) {
-        data_output[i] = compression.getValue(data_output_ + i * 4, 'float');
+function maxPackedValue(packed: Uint32Array) {
+    let max_val = 0;
+    for (let i = 0; i < packed.length; i++) {
+        if (packed[i] != packed_missing_value && packed[i] > max_val) max_val = packed[i];
     }
+    return max_val;
+}
+
+/**
+ * Pick some of the values out of fully-unpacked data, for templates that can't unpack individual values. This frees the full packed data.
+ * @param packed_indices - Indices into the packed data, with -1 for a missing value
+ * @returns The packed data at the indices, with missing values set to INT_MAX
+ */
+async function pickPackedValues(packed_data: Grib2PackedData, packed_indices: Int32Array, metrics?: Grib2Metrics) : Promise<Grib2PackedData> {
+    const compression = await getCompressionModule(metrics);
+
+    const n_indices = packed_indices.length;
+    const extracted_ = compression._malloc(n_indices * 4);
+
+    // Get the heap after allocating, as allocating can grow (and replace) it
+    const packed = new Uint32Array(compression.HEAPU8.buffer, packed_data.packed_, packed_data.n_packed);
+    const extracted = new Uint32Array(compression.HEAPU8.buffer, extracted_, n_indices);
+    packed_indices.forEach((idx, i) => {
+        extracted[i] = idx < 0 ? packed_missing_value : packed[idx];
+    });
+
+    compression._free(packed_data.packed_);
+    return {...packed_data, packed_: extracted_, n_packed: n_indices};
+}
 
-    compression._free(bitmap_);
-    compression._free(data_input_);
-    compression._free(data_output_);
+/**
+ * Apply the bitmap (if any) and the scaling to packed data, and convert it to the requested output format in one pass. The packed integers are used
+ *  where they are on the WASM heap and freed afterward.
+ * @param packed_data - The packed integers and scaling parameters from the decoder
+ * @param bitmap - The bitmap from section 6, or null if there isn't one
+ * @param expected_size - The number of points in the full grid
+ * @param opts - The output format, (optionally) the array to put the output in, and whether to compute statistics
+ * @returns The output data, for 'packed' output, the parameters needed to scale it, and the statistics if requested
+ */
+async function unpackScaling(packed_data: Grib2PackedData, bitmap: Uint8Array | null, expected_size: number, opts?: Grib2DecodeOptions) {
+    opts = opts === undefined ? {} : opts;
+    const output_format = opts.output_format === undefined ? 'float32' : opts.output_format;
+
+    const metrics = opts.metrics;
+    const compression = await getCompressionModule(metrics);
+
+    const packed_ = packed_data.packed_;
+    const n_packed = packed_data.n_packed;
+
+    let output: Grib2OutputArray;
+    let format_code: number;
+    let packing: Grib2PackingParameters | null = null;
+    let on_heap: boolean, output_: number;
+
+    try {
+        if (output_format == 'float32') {
+            output = getDestination(opts.destination, Float32Array, 'Float32Array', expected_size);
+            format_code = output_format_codes.float32;
+        }
+        else if (output_format == 'float16') {
+            output = getDestination(opts.destination, Uint16Array, 'Uint16Array', expected_size);
+            format_code = output_format_codes.float16;
+        }
+        else if (output_format == 'packed') {
+            // Use 16-bit integers if the packed values fit, keeping the largest value free to mark missing data
+            const missing_16bit = 0xffff;
+            const fits_16bit = maxPackedValue(new Uint32Array(compression.HEAPU8.buffer, packed_, n_packed)) < missing_16bit;
+
+            if (opts.destination instanceof Uint16Array || (opts.destination === undefined && fits_16bit)) {
+                if (!fits_16bit) {
+                    throw `Packed values don't fit in a Uint16Array destination`;
+                }
+
+                output = getDestination(opts.destination, Uint16Array, 'Uint16Array', expected_size);
+                format_code = output_format_codes.packed16;
+            }
+            else {
+                output = getDestination(opts.destination, Uint32Array, 'Uint16Array or Uint32Array', expected_size);
+                format_code = output_format_codes.packed32;
+            }
+
+            packing = {reference_value: packed_data.reference_value, binary_scale_factor: packed_data.binary_scale_factor,
+                       decimal_scale_factor: packed_data.decimal_scale_factor, missing_value: format_code == output_format_codes.packed16 ? missing_16bit : 0xffffffff};
+        }
+        else {
+            throw `Unknown output format '${output_format}'`;
+        }
+
+        // A destination on the WASM heap (e.g., a view on a Grib2HeapBuffer) is scaled into where it is. Otherwise, the scaling goes into the decoder
+        //  session's output buffer, which is kept from one message to the next, and gets copied out.
+        on_heap = output.buffer === compression.HEAPU8.buffer;
+        output_ = on_heap ? output.byteOffset : getDecoderSession(compression, expected_size * output.BYTES_PER_ELEMENT).output_;
+    }
+    catch (err) {
+        compression._free(packed_);
+        throw err;
+    }
+
+    const scaling = compression.cwrap('unpack_scaling', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number', 'number']);
+
+    const bitmap_ = bitmap === null ? 0 : copyToHeap(compression, bitmap, metrics);
+    const stats_ = opts.stats ? compression._malloc(n_field_stats * 8) : 0;
+
+    const scaling_status = runNative(compression, 'scaling', expected_size, () => scaling(packed_, n_packed, bitmap_, expected_size, packed_data.reference_value,
+                                     packed_data.binary_scale_factor, packed_data.decimal_scale_factor, format_code, output_, stats_), metrics);
+
+    let stats: Grib2FieldStats | null = null;
+
+    if (scaling_status == 0) {
+        // Get the heap after allocating, as allocating can grow (and replace) it, which also detaches a destination that's on it
+        const heap = compression.HEAPU8.buffer;
+
+        if (on_heap) {
+            if (output instanceof Float32Array) {
+                output = new Float32Array(heap, output_, expected_size);
+            }
+            else if (output instanceof Uint16Array) {
+                output = new Uint16Array(heap, output_, expected_size);
+            }
+            else {
+                output = new Uint32Array(heap, output_, expected_size);
+            }
+        }
+        else {
+            const stop_output_copy = startStage(metrics, 'output_copy');
+            if (output instanceof Float32Array) {
+                output.set(new Float32Array(heap, output_, expected_size));
+            }
+            else if (output instanceof Uint16Array) {
+                output.set(new Uint16Array(heap, output_, expected_size));
+            }
+            else {
+                output.set(new Uint32Array(heap, output_, expected_size));
+            }
+            stop_output_copy({bytes: expected_size * output.BYTES_PER_ELEMENT, points: expected_size});
+        }
+
+        if (opts.stats) {
+            stats = fieldStats(new Float64Array(heap, stats_, n_field_stats), expected_size);
+        }
+    }
+
+    compression._free(packed_);
+    if (bitmap !== null) {
+        freeHeapCopy(compression, bitmap, bitmap_);
+    }
+    if (opts.stats) {
+        compression._free(stats_);
+    }
+
+    if (scaling_status != 0) {
+        throw `Unpacking encountered an error: ${scaling_status}`;
+    }
 
-    return data_output;
+    return {data: output, packing: packing, stats: stats};
 }
 
-export {pngDecoder, jpegDecoder, complexPackingDecoder, complexSDPackingDecoder, applyBitmap};
\ No newline at end of file
+export {pngDecoder, jpegDecoder, simplePackingDecoder, simplePackingExtractor, complexPackingDecoder, complexPackingExtractor, complexSDPackingDecoder, complexPackingEncoder,
+        bitmapPackedIndices, pickPackedValues, unpackScaling, getCompressionModule, getDestination, runNative, freeDecoderSession, packed_missing_value};
+export type {ComplexPackingEncoderOptions, SpatialDifferenceOrder, Grib2OutputArray, Grib2OutputFormat, Grib2DecodeOptions, Grib2PackedData,
+             Grib2PackingParameters, Grib2ScalingParameters, Grib2FieldStats};
\ No newline at end of file